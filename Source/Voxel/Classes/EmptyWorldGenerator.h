@@ -17,4 +17,5 @@ class VOXEL_API UEmptyWorldGenerator : public UVoxelWorldGenerator
 
 public:
 	virtual void GetValuesAndMaterials(float Values[], FVoxelMaterial Materials[], const FIntVector& Start, const FIntVector& StartIndex, const int Step, const FIntVector& Size, const FIntVector& ArraySize) const override;
+	virtual bool GetValueRange(const FVoxelBox& Box, const int Step, float& OutMin, float& OutMax) const override;
 };
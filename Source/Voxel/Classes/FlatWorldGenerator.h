@@ -34,6 +34,7 @@ public:
 	UFlatWorldGenerator();
 
 	virtual void GetValuesAndMaterials(float Values[], FVoxelMaterial Materials[], const FIntVector& Start, const FIntVector& StartIndex, const int Step, const FIntVector& Size, const FIntVector& ArraySize) const override;
+	virtual bool GetValueRange(const FVoxelBox& Box, const int Step, float& OutMin, float& OutMax) const override;
 	virtual void SetVoxelWorld(AVoxelWorld* VoxelWorld) override;
 
 	// Height of the difference between full and empty
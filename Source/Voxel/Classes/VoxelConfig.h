@@ -0,0 +1,23 @@
+// Copyright 2017 Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+// Width of the data leafs (Depth 0 nodes of the value octree, the unit of edits, saves, paging and compression): 8, 16 or 32
+// Independent of the render chunks: small leafs waste less memory on scattered edits, big leafs have less overhead per voxel
+#ifndef VOXEL_LEAF_SIZE
+#define VOXEL_LEAF_SIZE 16
+#endif
+
+#define VOXEL_LEAF_SIZE_LOG2 (VOXEL_LEAF_SIZE == 8 ? 3 : VOXEL_LEAF_SIZE == 16 ? 4 : 5)
+#define VOXEL_LEAF_VOXELS (VOXEL_LEAF_SIZE * VOXEL_LEAF_SIZE * VOXEL_LEAF_SIZE)
+
+static_assert(VOXEL_LEAF_SIZE == 8 || VOXEL_LEAF_SIZE == 16 || VOXEL_LEAF_SIZE == 32, "VOXEL_LEAF_SIZE must be 8, 16 or 32");
+
+// Layout of the voxels in the dirty leafs and in the polygonizers caches, see TVoxelLayout
+// 0: linear, X + Size * Y + Size * Size * Z
+// 1: bricks of 4^3 voxels in Morton order, bricks in linear order: neighbors on the 3 axis are closer in memory
+#ifndef VOXEL_BRICK_LAYOUT
+#define VOXEL_BRICK_LAYOUT 0
+#endif
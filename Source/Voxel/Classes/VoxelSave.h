@@ -4,32 +4,131 @@
 
 #include "CoreMinimal.h"
 #include "VoxelMaterial.h"
+#include "VoxelValue.h"
+#include "VoxelConfig.h"
 #include <deque>
+#include <atomic>
 #include "VoxelSave.generated.h"
 
+class FArchiveLoadCompressedProxy;
+class FVoxelTaskGroup;
 
+// Number of chunks in each compressed block of a save. Blocks are compressed, decompressed and loaded in parallel
+#ifndef VOXEL_SAVE_BLOCK_CHUNKS
+#define VOXEL_SAVE_BLOCK_CHUNKS 32
+#endif
+
+/**
+ * Values & materials of a Depth 0 node. Chunks of saves made with another VOXEL_LEAF_SIZE don't fit inline
+ * A chunk can only store the voxels that differ from the generator, see EncodeDiff
+ */
 struct FVoxelChunkSave
 {
 	uint64 Id;
 
-	TArray<float, TFixedAllocator<16 * 16 * 16>> Values;
+	// Voxels stored in Values & Materials, one bit per voxel in their order. Empty if all the voxels are stored
+	TArray<uint32, TInlineAllocator<(VOXEL_LEAF_VOXELS + 31) / 32>> Mask;
+
+	TArray<FVoxelValue, TInlineAllocator<VOXEL_LEAF_VOXELS>> Values;
 
-	TArray<FVoxelMaterial, TFixedAllocator<16 * 16 * 16>> Materials;
+	TArray<FVoxelMaterial, TInlineAllocator<VOXEL_LEAF_VOXELS>> Materials;
 
 	FVoxelChunkSave();
 
-	FVoxelChunkSave(uint64 Id, FIntVector Position, float Values[16 * 16 * 16], FVoxelMaterial Materials[16 * 16 * 16]);
+	/**
+	 * Does this only store the voxels that differ from the generator?
+	 */
+	FORCEINLINE bool IsDiff() const
+	{
+		return Mask.Num() > 0;
+	}
+
+	/**
+	 * Only keep the voxels whose value or material differ from the generator, if it makes the chunk smaller
+	 * @param	GeneratorValues		Generator values of the chunk
+	 * @param	GeneratorMaterials	Generator materials of the chunk
+	 */
+	void EncodeDiff(const FVoxelValue GeneratorValues[], const FVoxelMaterial GeneratorMaterials[]);
+
+	/**
+	 * Copy the voxels of this chunk into arrays. If IsDiff, only the stored voxels are written: the arrays must already hold the generator ones
+	 * @param	OutValues		Array of Values.Num() values if not IsDiff, of Mask.Num() * 32 values or less else
+	 * @param	OutMaterials	Same size as OutValues
+	 */
+	void GetValuesAndMaterials(FVoxelValue OutValues[], FVoxelMaterial OutMaterials[]) const;
 };
 
 FORCEINLINE FArchive& operator<<(FArchive &Ar, FVoxelChunkSave& Save)
 {
 	Ar << Save.Id;
+	Ar << Save.Mask;
 	Ar << Save.Values;
 	Ar << Save.Materials;
 
 	return Ar;
 }
 
+// Versions of FVoxelWorldSave
+namespace EVoxelSaveVersion
+{
+	enum Type
+	{
+		// Chunk Ids in base 9
+		BeforeMortonIds = 0,
+		// Chunk Ids are Morton codes, see FOctree::Id
+		MortonIds,
+		// Chunks are compressed by blocks, see FVoxelSaveBlock
+		Blocks,
+		// The Ids of the chunks are stored after the block table, see FVoxelWorldSave::GetChunkIds
+		ChunkIndex,
+		// Chunks can only store the voxels that differ from the generator, see FVoxelChunkSave::Mask
+		GeneratorDiff,
+
+		LatestVersion = GeneratorDiff
+	};
+}
+
+UENUM(BlueprintType)
+enum class EVoxelSaveCompression : uint8
+{
+	// Smaller saves
+	Zlib,
+	// Several times faster to save & load, bigger saves
+	LZ4
+};
+
+/**
+ * Entry of the block table of a save. The table is at the end of the save data, followed by the Ids of the chunks and by its position as an int32
+ * Chunks are compressed by blocks of up to VOXEL_SAVE_BLOCK_CHUNKS, independently of each other: any chunk can be read without reading the others
+ * A block only has chunks of one subtree of the octree, see FVoxelWorldSaveWriter::WriteChunk
+ */
+struct FVoxelSaveBlock
+{
+	// Ids of the first and last chunks of the block
+	uint64 FirstId;
+	uint64 LastId;
+
+	int32 ChunkCount;
+	// Size of the serialized chunks
+	int32 Size;
+
+	// Position and size of the compressed chunks in the save data
+	int32 Offset;
+	int32 CompressedSize;
+};
+
+FORCEINLINE FArchive& operator<<(FArchive &Ar, FVoxelSaveBlock& Block)
+{
+	Ar << Block.FirstId;
+	Ar << Block.LastId;
+	Ar << Block.ChunkCount;
+	Ar << Block.Size;
+	Ar << Block.Offset;
+	Ar << Block.CompressedSize;
+
+	return Ar;
+}
+
 USTRUCT(BlueprintType, Category = Voxel)
 struct VOXEL_API FVoxelWorldSave
 {
@@ -42,10 +141,190 @@ public:
 	UPROPERTY()
 		TArray<uint8> Data;
 
+	// Size of the saved values, see VOXEL_VALUE_QUANTIZATION. Saves without this field have float values
+	UPROPERTY()
+		int ValueSize;
+
+	// See EVoxelSaveVersion. Saves without this field are BeforeMortonIds
+	UPROPERTY()
+		int Version;
+
+	// Width of the saved chunks, see VOXEL_LEAF_SIZE. Saves without this field have 16^3 chunks
+	UPROPERTY()
+		int LeafSize;
+
+	// Does this only hold the chunks edited since the previous save? See AVoxelWorld::GetDeltaSave
+	UPROPERTY(VisibleAnywhere)
+		bool bIsDelta;
+
+	// Compression of the blocks. Saves older than EVoxelSaveVersion::Blocks are a single zlib stream
+	UPROPERTY(VisibleAnywhere)
+		EVoxelSaveCompression Compression;
+
 
 	FVoxelWorldSave();
 
-	void Init(int NewDepth, const std::deque<TSharedRef<FVoxelChunkSave>>& ChunksList);
+	/**
+	 * Check the fields and the block table of the save without decompressing anything, eg before loading a save read from disk
+	 * @param	OutError	Why the save can't be read
+	 * @return	Whether the save can be read
+	 */
+	bool Validate(FString& OutError) const;
+
+	/**
+	 * Get the block table of the save
+	 * @param	OutBlocks	Blocks, in octree order
+	 * @return	false if the save is older than EVoxelSaveVersion::Blocks, its chunks can only be read in one go, or if the table is corrupted
+	 */
+	bool GetBlocks(TArray<FVoxelSaveBlock>& OutBlocks) const;
+
+	/**
+	 * Get the block table and the Ids of all the chunks, without decompressing anything
+	 * @param	OutBlocks	Blocks, in octree order
+	 * @param	OutChunkIds	Ids of the chunks of the blocks, in octree order
+	 * @return	false if the save is older than EVoxelSaveVersion::ChunkIndex, or if the table is corrupted
+	 */
+	bool GetChunkIds(TArray<FVoxelSaveBlock>& OutBlocks, TArray<uint64>& OutChunkIds) const;
+
+	/**
+	 * Fold a full save and the deltas that followed it into a new full save, reading them one chunk at a time
+	 * @param	Base		Full save
+	 * @param	Deltas		Deltas saved after Base, in order
+	 * @param	OutSave		Full save with the last version of each chunk. Must not be one of the saves read
+	 * @return	false if the saves can't be compacted, eg if they don't follow each other or are corrupted: the error is logged and OutSave is empty
+	 */
+	static bool CompactDeltas(const FVoxelWorldSave& Base, const TArray<FVoxelWorldSave>& Deltas, FVoxelWorldSave& OutSave);
+};
+
+/**
+ * Writes the chunks of a FVoxelWorldSave one at a time. Each block of VOXEL_SAVE_BLOCK_CHUNKS chunks is compressed on GThreadPool once written,
+ * and added to the save data once it and the previous ones are compressed: the whole uncompressed save is never in memory
+ */
+class VOXEL_API FVoxelWorldSaveWriter
+{
+public:
+	/**
+	 * @param	Save		Save to write. Its previous data is discarded, and it is a full save until told otherwise
+	 * @param	Depth		Depth of the world
+	 * @param	Compression	Compression of the blocks
+	 */
+	FVoxelWorldSaveWriter(FVoxelWorldSave& Save, int Depth, EVoxelSaveCompression Compression);
+	~FVoxelWorldSaveWriter();
+
+	/**
+	 * Write the next chunk. Order matters: chunks must be written in octree order
+	 * A new block is started when the current one is full, or when the chunk is in another subtree of VOXEL_SAVE_BLOCK_CHUNKS nodes or more
+	 * @param	Chunk	Chunk with VOXEL_LEAF_VOXELS voxels, stored or not, see FVoxelChunkSave::EncodeDiff
+	 */
+	void WriteChunk(const FVoxelChunkSave& Chunk);
+
+	/**
+	 * Compress the last block and write the block table and the chunk Ids. Must be called once all the chunks are written
+	 */
+	void Finish();
+
+private:
+	struct FBlock
+	{
+		// Serialized chunks. Freed once compressed
+		TArray<uint8> Data;
+		TArray<uint8> CompressedData;
+		// Set by the compression task
+		std::atomic<bool> bIsCompressed;
+
+		FBlock()
+			: bIsCompressed(false)
+		{
+		}
+	};
+
+	FVoxelWorldSave& Save;
+	FVoxelTaskGroup* const Tasks;
+
+	// Block table. The last block is being written
+	TArray<FVoxelSaveBlock> Entries;
+	// Ids of the chunks written
+	TArray<uint64> ChunkIds;
+	// Blocks not added to the save data yet, matching the last entries
+	TArray<FBlock*> Blocks;
+
+	/**
+	 * Compress the last block on GThreadPool
+	 */
+	void CompressLastBlock();
+
+	/**
+	 * Add the blocks compressed so far to the save data, in order
+	 */
+	void AddCompressedBlocks();
+};
+
+/**
+ * Reads the chunks of a FVoxelWorldSave one at a time, decompressing the save as it goes
+ * Readers of different blocks can be used on different threads
+ */
+class VOXEL_API FVoxelWorldSaveReader
+{
+public:
+	/**
+	 * Read all the chunks
+	 * @param	Save	Save to read. Must outlive the reader
+	 */
+	FVoxelWorldSaveReader(const FVoxelWorldSave& Save);
+	/**
+	 * Only read the chunks of some blocks
+	 * @param	Save		Save to read. Must outlive the reader
+	 * @param	Blocks		Block table of Save, see FVoxelWorldSave::GetBlocks. Must outlive the reader
+	 * @param	FirstBlock	Index of the first block to read
+	 * @param	LastBlock	Index of the last block to read, inclusive
+	 */
+	FVoxelWorldSaveReader(const FVoxelWorldSave& Save, const TArray<FVoxelSaveBlock>& Blocks, int FirstBlock, int LastBlock);
+	~FVoxelWorldSaveReader();
+
+	/**
+	 * Get the current chunk, in octree order. Its Id is always a Morton code, see FOctree::Id
+	 * It can only have the voxels that differ from the generator: use FVoxelChunkSave::GetValuesAndMaterials to read them
+	 * @return	nullptr once all the chunks are read
+	 */
+	const FVoxelChunkSave* GetChunk() const;
+
+	/**
+	 * Read the next chunk
+	 */
+	void NextChunk();
+
+	/**
+	 * Did the reader stop on data it can't read? The error is logged, and GetChunk returns nullptr from then on
+	 */
+	bool HasError() const;
+
+private:
+	const FVoxelWorldSave& Save;
+
+	// Saves older than EVoxelSaveVersion::Blocks: decompressor of the whole data, and position of the end of the chunks in the uncompressed data
+	FArchiveLoadCompressedProxy* Decompressor;
+	int64 End;
+
+	// Other saves: block table if read by this, blocks to read, and the uncompressed chunks of the current block
+	TArray<FVoxelSaveBlock> OwnedBlocks;
+	const TArray<FVoxelSaveBlock>& Blocks;
+	int NextBlock;
+	int LastBlock;
+	TArray<uint8> BlockData;
+	int32 BlockPosition;
+
+	FVoxelChunkSave Chunk;
+	bool bHasChunk;
+	bool bHasError;
+
+	/**
+	 * Deserialize Chunk, converting it to the current format
+	 * @return	false if the data can't be read
+	 */
+	bool ReadChunk(FArchive& Ar);
 
-	std::deque<FVoxelChunkSave> GetChunksList() const;
+	/**
+	 * Log an error and stop reading
+	 */
+	void SetError(const FString& Error);
 };
\ No newline at end of file
@@ -0,0 +1,132 @@
+// Copyright 2017 Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+// Storage of the voxel values: 0 for float, 8 for int8 fixed point, 16 for int16 fixed point
+// Quantized values are clamped to [-1, 1] (generators output values in this range)
+#ifndef VOXEL_VALUE_QUANTIZATION
+#define VOXEL_VALUE_QUANTIZATION 0
+#endif
+
+/**
+ * Conversion between float values and their stored representation
+ */
+template<typename T>
+struct TVoxelValuePolicy
+{
+};
+
+template<>
+struct TVoxelValuePolicy<float>
+{
+	typedef float Type;
+
+	FORCEINLINE static float ToFloat(float Value)
+	{
+		return Value;
+	}
+
+	FORCEINLINE static float FromFloat(float Value)
+	{
+		return Value;
+	}
+};
+
+/**
+ * Fixed point in [-1, 1]. The sign is kept: positive (empty) values never round to 0 (full)
+ */
+template<typename T, int32 Scale>
+struct TVoxelValueFixedPointPolicy
+{
+	typedef T Type;
+
+	FORCEINLINE static float ToFloat(T Value)
+	{
+		return Value / (float)Scale;
+	}
+
+	FORCEINLINE static T FromFloat(float Value)
+	{
+		const int32 Result = FMath::Clamp(FMath::RoundToInt(Value * Scale), -Scale, Scale);
+		return (T)(Value > 0 ? FMath::Max(Result, 1) : FMath::Min(Result, 0));
+	}
+};
+
+template<>
+struct TVoxelValuePolicy<int8> : TVoxelValueFixedPointPolicy<int8, 127>
+{
+};
+
+template<>
+struct TVoxelValuePolicy<int16> : TVoxelValueFixedPointPolicy<int16, 32767>
+{
+};
+
+#if VOXEL_VALUE_QUANTIZATION == 8
+typedef int8 FVoxelValue;
+#elif VOXEL_VALUE_QUANTIZATION == 16
+typedef int16 FVoxelValue;
+#else
+typedef float FVoxelValue;
+#endif
+
+typedef TVoxelValuePolicy<FVoxelValue> FVoxelValuePolicy;
+
+/**
+ * Bounds of a set of voxel values
+ */
+struct FVoxelValueRange
+{
+	FVoxelValue Min;
+	FVoxelValue Max;
+	// Whether no value has been added
+	bool bIsEmpty;
+
+	FVoxelValueRange()
+		: Min(0)
+		, Max(0)
+		, bIsEmpty(true)
+	{
+	}
+
+	FVoxelValueRange(FVoxelValue Min, FVoxelValue Max)
+		: Min(Min)
+		, Max(Max)
+		, bIsEmpty(false)
+	{
+	}
+
+	FORCEINLINE void Add(FVoxelValue Value)
+	{
+		if (bIsEmpty)
+		{
+			Min = Value;
+			Max = Value;
+			bIsEmpty = false;
+		}
+		else
+		{
+			Min = FMath::Min(Min, Value);
+			Max = FMath::Max(Max, Value);
+		}
+	}
+
+	FORCEINLINE void Add(const FVoxelValueRange& Other)
+	{
+		if (!Other.bIsEmpty)
+		{
+			Add(Other.Min);
+			Add(Other.Max);
+		}
+	}
+
+	/**
+	 * Are all the values empty (> 0), or all full? If so, there is no surface between them
+	 */
+	FORCEINLINE bool HasSingleSign() const
+	{
+		return !bIsEmpty && (Min > 0 || Max <= 0);
+	}
+};
@@ -158,19 +158,41 @@ public:
 		void SetMaterial(const FIntVector& Position, const FVoxelMaterial& Material);
 
 	/**
-	 * Get array to save world
+	 * Get array to save world. Edited chunks only store the voxels that differ from the world generator: load it with the same generator
 	 * @return	SaveArray
 	 */
 	UFUNCTION(BlueprintCallable, Category = "Voxel")
 		void GetSave(FVoxelWorldSave& OutSave) const;
 	/**
-	 * Load world from save
+	 * Get the voxels edited since the last save, delta save or load. Cheap when few voxels have been edited since
+	 * To restore the world, load the full save and then its deltas in order with bReset = false
+	 * @param	OutSave		Delta save
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Voxel")
+		void GetDeltaSave(FVoxelWorldSave& OutSave) const;
+	/**
+	 * Fold a full save and the deltas that followed it into a new full save
+	 * @param	Base		Full save
+	 * @param	Deltas		Deltas saved after Base, in order
+	 * @param	OutSave		New full save
+	 * @return	false if the saves can't be compacted: the error is logged
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Voxel")
+		static bool CompactDeltaSaves(const FVoxelWorldSave& Base, const TArray<FVoxelWorldSave>& Deltas, FVoxelWorldSave& OutSave);
+	/**
+	 * Load world from save. Recent saves are loaded lazily: their voxels are only decompressed when first accessed
 	 * @param	Save	Save to load from
-	 * @param	bReset	Reset existing world? Set to false only if current world is unmodified
+	 * @param	bReset	Reset existing world? Set to false only if current world is unmodified, or to load a delta save
 	 */
 	UFUNCTION(BlueprintCallable, Category = "Voxel")
 		void LoadFromSave(const FVoxelWorldSave& Save, bool bReset = true);
 
+	/**
+	 * Log the compression ratio and the decompression time of the edited voxels, eg after loading a save
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Voxel")
+		void LogLeafCompressionReport() const;
+
 protected:
 	// Called when the game starts or when spawned
 	void BeginPlay() override;
@@ -187,7 +209,7 @@ private:
 		UMaterialInterface* VoxelMaterial;
 
 	// Width = 16 * 2^Depth
-	UPROPERTY(EditAnywhere, Category = "Voxel", meta = (ClampMin = "0", ClampMax = "19", UIMin = "0", UIMax = "19", DisplayName = "Depth"))
+	UPROPERTY(EditAnywhere, Category = "Voxel", meta = (ClampMin = "0", ClampMax = "20", UIMin = "0", UIMax = "20", DisplayName = "Depth"))
 		int NewDepth;
 
 	// Size of a voxel in cm
@@ -245,6 +267,18 @@ private:
 	UPROPERTY(EditAnywhere, Category = "Voxel", meta = (ClampMin = "1", UIMin = "1"), AdvancedDisplay)
 		int FoliageThreadCount;
 
+	// Memory of the edited voxels above which the least recently used ones are written to disk, in MB. 0 to keep them all in memory
+	UPROPERTY(EditAnywhere, Category = "Voxel", meta = (ClampMin = "0", UIMin = "0"), AdvancedDisplay)
+		int EditedVoxelsMemoryBudget;
+
+	// Time in seconds after which edited voxels that aren't accessed are compressed in memory. 0 to never compress them
+	UPROPERTY(EditAnywhere, Category = "Voxel", meta = (ClampMin = "0", UIMin = "0"), AdvancedDisplay)
+		int EditedVoxelsCompressionDelay;
+
+	// Compression of the saves made by GetSave & GetDeltaSave
+	UPROPERTY(EditAnywhere, Category = "Voxel", AdvancedDisplay)
+		EVoxelSaveCompression SaveCompression;
+
 
 	UPROPERTY()
 		UVoxelWorldGenerator* InstancedWorldGenerator;
@@ -263,6 +297,7 @@ private:
 	bool bComputeCollisions;
 
 	float TimeSinceSync;
+	float TimeSinceColdLeafsUpdate;
 
 	void CreateWorld();
 	void DestroyWorld();
@@ -4,6 +4,7 @@
 
 #include "CoreMinimal.h"
 #include "VoxelMaterial.h"
+#include "VoxelBox.h"
 #include "VoxelWorldGenerator.generated.h"
 
 class AVoxelWorld;
@@ -81,6 +82,21 @@ public:
 		}
 	}
 
+	/**
+	 * Get bounds of the values of a box without computing them, used to skip the chunks that can't contain a surface
+	 * Must be conservative: every value returned by GetValuesAndMaterials in Box must be in [OutMin, OutMax]
+	 *
+	 * @param	Box		Voxels to check
+	 * @param	Step	Only the voxels whose coordinates are multiples of Step are read
+	 * @param	OutMin	Lower bound of the values
+	 * @param	OutMax	Upper bound of the values
+	 * @return	Whether the bounds are known
+	 */
+	virtual bool GetValueRange(const FVoxelBox& Box, const int Step, float& OutMin, float& OutMax) const
+	{
+		return false;
+	}
+
 	/**
 	 * If you need a reference to Voxel World
 	 */
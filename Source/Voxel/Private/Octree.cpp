@@ -2,10 +2,11 @@
 
 #include "Octree.h"
 
-FOctree::FOctree(FIntVector Position, uint8 Depth, uint64 Id /*= -1*/) : Position(Position), Depth(Depth), Id(Id), bHasChilds(false)
+FOctree::FOctree(uint8 LeafSize, FIntVector Position, uint8 Depth, uint64 Id /*= -1*/) : Position(Position), Depth(Depth), LeafSize(LeafSize), Id(Id), bHasChilds(false)
 {
 	// Max for Id
-	check(Depth <= 19);
+	check(Depth <= MAX_OCTREE_DEPTH);
+	check(FMath::IsPowerOfTwo(LeafSize));
 }
 
 bool FOctree::operator==(const FOctree& Other) const
@@ -26,7 +27,7 @@ bool FOctree::operator>(const FOctree& Other) const
 
 int FOctree::Size() const
 {
-	return 16 << Depth;
+	return LeafSize << Depth;
 }
 
 FIntVector FOctree::GetMinimalCornerPosition() const
@@ -46,7 +47,7 @@ FVoxelBox FOctree::GetBounds() const
 
 bool FOctree::IsLeaf() const
 {
-	return !bHasChilds;
+	return !bHasChilds.load(std::memory_order_acquire);
 }
 
 bool FOctree::IsInOctree(int X, int Y, int Z) const
@@ -70,7 +71,103 @@ void FOctree::GlobalToLocal(int X, int Y, int Z, int& OutX, int& OutY, int& OutZ
 	OutZ = Z - (Position.Z - Size() / 2);
 }
 
-uint64 FOctree::GetTopIdFromDepth(int8 Depth)
+uint64 FOctree::GetTopId()
 {
-	return IntPow9(Depth);
+	return 1;
+}
+
+uint64 FOctree::GetChildId(uint64 Id, int ChildIndex)
+{
+	check(0 <= ChildIndex && ChildIndex < 8);
+	return (Id << 3) | ChildIndex;
+}
+
+uint64 FOctree::GetAncestorId(uint64 Id, int Levels)
+{
+	return Id >> (3 * Levels);
+}
+
+uint64 FOctree::GetIdFromLegacyId(uint64 LegacyId, int WorldDepth)
+{
+	check(0 <= WorldDepth && WorldDepth <= 19);
+
+	// Digits of the child indices, from the leaf to the root
+	uint64 Pow = 1;
+	for (int i = 0; i < WorldDepth; i++)
+	{
+		Pow *= 9;
+	}
+	check(Pow <= LegacyId && LegacyId < 2 * Pow);
+	uint64 Digits = LegacyId - Pow;
+
+	uint64 Id = GetTopId();
+	for (int Level = WorldDepth - 1; Level >= 0; Level--)
+	{
+		Pow /= 9;
+		const uint64 Digit = Digits / Pow;
+		Digits -= Digit * Pow;
+
+		check(1 <= Digit && Digit <= 8);
+		Id = GetChildId(Id, Digit - 1);
+	}
+	return Id;
+}
+
+bool FOctree::IsValidLegacyId(uint64 LegacyId, int WorldDepth)
+{
+	// 2 * 9^20 doesn't fit in 64 bits
+	if (WorldDepth < 0 || WorldDepth > 19)
+	{
+		return false;
+	}
+
+	uint64 Pow = 1;
+	for (int i = 0; i < WorldDepth; i++)
+	{
+		Pow *= 9;
+	}
+	if (LegacyId < Pow || LegacyId >= 2 * Pow)
+	{
+		return false;
+	}
+	uint64 Digits = LegacyId - Pow;
+
+	// Same digits as GetIdFromLegacyId
+	for (int Level = WorldDepth - 1; Level >= 0; Level--)
+	{
+		Pow /= 9;
+		const uint64 Digit = Digits / Pow;
+		Digits -= Digit * Pow;
+
+		if (Digit < 1 || Digit > 8)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+FIntVector FOctree::GetPositionFromId(uint64 Id, int RootSize)
+{
+	check(Id >= GetTopId());
+
+	// Number of levels below the root. Ids have at most 1 + 3 * MAX_OCTREE_DEPTH bits: don't shift further
+	int Levels = 0;
+	while (Levels < MAX_OCTREE_DEPTH && GetAncestorId(Id, Levels + 1) >= GetTopId())
+	{
+		Levels++;
+	}
+	checkf(GetAncestorId(Id, Levels) == GetTopId(), TEXT("Invalid Id %llu"), Id);
+
+	FIntVector Position = FIntVector::ZeroValue;
+	int Size = RootSize;
+	for (int Level = Levels - 1; Level >= 0; Level--)
+	{
+		// Same offsets as the childs
+		const int ChildIndex = GetAncestorId(Id, Level) & 7;
+		const int d = Size / 4;
+		Position += FIntVector((ChildIndex & 1) ? d : -d, (ChildIndex & 2) ? d : -d, (ChildIndex & 4) ? d : -d);
+		Size /= 2;
+	}
+	return Position;
 }
@@ -3,16 +3,28 @@
 #pragma once
 #include "CoreMinimal.h"
 #include "VoxelBox.h"
+#include <atomic>
 
-FORCEINLINE uint64 IntPow9(int Power)
+// Max depth of an octree. Ids use 1 + 3 * Depth bits: see FOctree::Id
+// Only one level more than the base 9 Ids, which overflowed after 19: 21 would use all the 64 bits
+#define MAX_OCTREE_DEPTH 20
+
+/**
+ * Interleave the bits of X, Y and Z (21 bits each): nodes close in space have close codes
+ */
+FORCEINLINE uint64 MortonEncode(uint32 X, uint32 Y, uint32 Z)
 {
-	check(Power <= 19);
-	uint64 Pow = 1;
-	for (int i = 0; i < Power; i++)
+	uint64 Coordinates[3] = { X, Y, Z };
+	for (auto& C : Coordinates)
 	{
-		Pow *= 9;
+		C &= 0x1fffff;
+		C = (C | C << 32) & 0x1f00000000ffff;
+		C = (C | C << 16) & 0x1f0000ff0000ff;
+		C = (C | C << 8) & 0x100f00f00f00f00f;
+		C = (C | C << 4) & 0x10c30c30c30c30c3;
+		C = (C | C << 2) & 0x1249249249249249;
 	}
-	return Pow;
+	return Coordinates[0] | (Coordinates[1] << 1) | (Coordinates[2] << 2);
 }
 
 /**
@@ -23,10 +35,11 @@ class FOctree
 public:
 	/**
 	 * Constructor
+	 * @param	LeafSize	Width of the Depth 0 nodes. Power of 2
 	 * @param	Position	Position (center) of this chunk
 	 * @param	Depth		Distance to the highest resolution
 	 */
-	FOctree(FIntVector Position, uint8 Depth, uint64 Id);
+	FOctree(uint8 LeafSize, FIntVector Position, uint8 Depth, uint64 Id);
 
 	bool operator==(const FOctree& Other) const;
 
@@ -40,7 +53,10 @@ public:
 	// Distance to the highest resolution
 	const uint8 Depth;
 
-	// Id of the Octree (position in the octree)
+	// Width of the Depth 0 nodes
+	const uint8 LeafSize;
+
+	// Id of the Octree (position in the octree). Morton code: the root is 1, and each level appends the 3 bits of the child index
 	const uint64 Id;
 
 	/**
@@ -81,9 +97,45 @@ public:
 	 */
 	FORCEINLINE void GlobalToLocal(int X, int Y, int Z, int& OutX, int& OutY, int& OutZ) const;
 
-	FORCEINLINE static uint64 GetTopIdFromDepth(int8 Depth);
+	/**
+	 * Id of the root
+	 */
+	FORCEINLINE static uint64 GetTopId();
+
+	/**
+	 * Get the Id of a child
+	 * @param	Id			Id of the parent
+	 * @param	ChildIndex	Index of the child: X offset in bit 0, Y in bit 1 and Z in bit 2
+	 */
+	FORCEINLINE static uint64 GetChildId(uint64 Id, int ChildIndex);
+
+	/**
+	 * Get the Id of the ancestor Levels levels above
+	 */
+	FORCEINLINE static uint64 GetAncestorId(uint64 Id, int Levels);
+
+	/**
+	 * Get the center of a node from its Id
+	 * @param	Id			Id of the node
+	 * @param	RootSize	Width of the root
+	 */
+	static FIntVector GetPositionFromId(uint64 Id, int RootSize);
+
+	/**
+	 * Convert the Id of a Depth 0 node from the base 9 format of old saves
+	 * @param	LegacyId	Id in base 9: the root is 9^WorldDepth, and each level adds (ChildIndex + 1) * 9^(Depth - 1)
+	 * @param	WorldDepth	Depth of the root
+	 */
+	static uint64 GetIdFromLegacyId(uint64 LegacyId, int WorldDepth);
+
+	/**
+	 * Can LegacyId be converted by GetIdFromLegacyId? Ids read from saves can be corrupted
+	 * @param	LegacyId	Id in base 9
+	 * @param	WorldDepth	Depth of the root
+	 */
+	static bool IsValidLegacyId(uint64 LegacyId, int WorldDepth);
 
 protected:
-	// Does this octree has child?
-	bool bHasChilds;
+	// Does this octree has child? Stored with release semantics once the childs are built: readers of other lock regions can be iterating this node
+	std::atomic<bool> bHasChilds;
 };
\ No newline at end of file
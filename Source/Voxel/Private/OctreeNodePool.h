@@ -0,0 +1,80 @@
+// Copyright 2017 Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+// Number of blocks of 8 nodes allocated at once
+#define OCTREE_NODE_POOL_SLAB_SIZE 64
+
+/**
+ * Thread safe allocator of octree childs: the 8 childs of a node are contiguous, and blocks are allocated by slabs
+ */
+template<typename T>
+class TOctreeNodePool
+{
+public:
+	TOctreeNodePool()
+	{
+	}
+
+	~TOctreeNodePool()
+	{
+		Reset();
+	}
+
+	/**
+	 * Get memory for 8 nodes. They must be constructed with placement new
+	 * @return	First node of the block
+	 */
+	T* Allocate()
+	{
+		FScopeLock Lock(&Section);
+
+		if (FreeBlocks.Num() == 0)
+		{
+			uint8* Slab = (uint8*)FMemory::Malloc(OCTREE_NODE_POOL_SLAB_SIZE * 8 * sizeof(T), alignof(T));
+			Slabs.Add(Slab);
+
+			// Reversed so that blocks are used in memory order
+			for (int BlockIndex = OCTREE_NODE_POOL_SLAB_SIZE - 1; BlockIndex >= 0; BlockIndex--)
+			{
+				FreeBlocks.Add((T*)(Slab + BlockIndex * 8 * sizeof(T)));
+			}
+		}
+
+		return FreeBlocks.Pop(false);
+	}
+
+	/**
+	 * Give back a block. The 8 nodes must have been destructed
+	 * @param	Block	First node of the block, as returned by Allocate
+	 */
+	void Free(T* Block)
+	{
+		FScopeLock Lock(&Section);
+
+		FreeBlocks.Add(Block);
+	}
+
+	/**
+	 * Free all the slabs at once. Nodes that are still alive must not be used anymore, and their destructors won't be called
+	 */
+	void Reset()
+	{
+		FScopeLock Lock(&Section);
+
+		for (uint8* Slab : Slabs)
+		{
+			FMemory::Free(Slab);
+		}
+		Slabs.Empty();
+		FreeBlocks.Empty();
+	}
+
+private:
+	FCriticalSection Section;
+
+	TArray<uint8*> Slabs;
+	TArray<T*> FreeBlocks;
+};
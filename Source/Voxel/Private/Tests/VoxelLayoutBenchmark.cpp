@@ -0,0 +1,119 @@
+// Copyright 2017 Phyronnaz
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "VoxelTestUtils.h"
+#include "VoxelPolygonizer.h"
+#include "VoxelLayout.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVoxelLayoutBenchmark, "Voxel.Benchmarks.Layout", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+
+namespace VoxelLayoutBenchmark
+{
+	const int SphereCount = 40;
+	const float SphereRadius = 20;
+	// Chunks read around each sphere
+	const int ChunksPerSphere = 8;
+
+	typedef TVoxelLayout<CHUNKSIZE + 3> FCacheLayout;
+}
+
+bool FVoxelLayoutBenchmark::RunTest(const FString& Parameters)
+{
+	using namespace VoxelLayoutBenchmark;
+
+	FVoxelData Data(5, VoxelTestUtils::CreateNoiseWorldGenerator());
+	FRandomStream Stream(0);
+
+	TArray<FIntVector> Centers;
+	for (int Index = 0; Index < SphereCount; Index++)
+	{
+		Centers.Add(VoxelTestUtils::GetRandomSurfacePosition(Data, Stream, 2 * CHUNKSIZE + FMath::CeilToInt(SphereRadius)));
+	}
+
+	const double EditStartTime = FPlatformTime::Seconds();
+	for (const FIntVector& Center : Centers)
+	{
+		VoxelTestUtils::SetValueSphere(Data, Center, SphereRadius, Stream.FRand() < 0.5f);
+	}
+	const double EditTime = FPlatformTime::Seconds() - EditStartTime;
+
+	TArray<FIntVector> Chunks;
+	for (const FIntVector& Center : Centers)
+	{
+		for (int Index = 0; Index < ChunksPerSphere; Index++)
+		{
+			const FIntVector Position = Center + FIntVector(Stream.RandRange(-CHUNKSIZE, CHUNKSIZE - 1), Stream.RandRange(-CHUNKSIZE, CHUNKSIZE - 1), Stream.RandRange(-CHUNKSIZE, CHUNKSIZE - 1));
+			Chunks.Add(FIntVector(Position.X & ~(CHUNKSIZE - 1), Position.Y & ~(CHUNKSIZE - 1), Position.Z & ~(CHUNKSIZE - 1)));
+		}
+	}
+
+	// Polygonizer cache fill, then a gradient stencil on the 3 axes as the normals computation
+	double StencilSum = 0;
+	const double CacheStartTime = FPlatformTime::Seconds();
+	{
+		const FIntVector Size(CHUNKSIZE + 3, CHUNKSIZE + 3, CHUNKSIZE + 3);
+		TArray<FVoxelValue> LinearValues;
+		TArray<FVoxelMaterial> LinearMaterials;
+		LinearValues.SetNumUninitialized(Size.X * Size.Y * Size.Z);
+		LinearMaterials.SetNumUninitialized(Size.X * Size.Y * Size.Z);
+		TArray<FVoxelValue> CachedValues;
+		TArray<FVoxelMaterial> CachedMaterials;
+		CachedValues.SetNumUninitialized(FCacheLayout::Count);
+		CachedMaterials.SetNumUninitialized(FCacheLayout::Count);
+
+		for (const FIntVector& Chunk : Chunks)
+		{
+			const FVoxelBox Box(Chunk - FIntVector(1, 1, 1), Chunk + Size - FIntVector(2, 2, 2));
+			Data.BeginGet(Box);
+			Data.GetValuesAndMaterials(LinearValues.GetData(), LinearMaterials.GetData(), Box.Min, FIntVector::ZeroValue, 1, Size, Size);
+			Data.EndGet(Box);
+
+			FCacheLayout::FromLinear(LinearValues.GetData(), CachedValues.GetData());
+			FCacheLayout::FromLinear(LinearMaterials.GetData(), CachedMaterials.GetData());
+
+			for (int X = 1; X < Size.X - 1; X++)
+			{
+				for (int Y = 1; Y < Size.Y - 1; Y++)
+				{
+					for (int Z = 1; Z < Size.Z - 1; Z++)
+					{
+						const float GradientX = FVoxelValuePolicy::ToFloat(CachedValues[FCacheLayout::Index(X + 1, Y, Z)]) - FVoxelValuePolicy::ToFloat(CachedValues[FCacheLayout::Index(X - 1, Y, Z)]);
+						const float GradientY = FVoxelValuePolicy::ToFloat(CachedValues[FCacheLayout::Index(X, Y + 1, Z)]) - FVoxelValuePolicy::ToFloat(CachedValues[FCacheLayout::Index(X, Y - 1, Z)]);
+						const float GradientZ = FVoxelValuePolicy::ToFloat(CachedValues[FCacheLayout::Index(X, Y, Z + 1)]) - FVoxelValuePolicy::ToFloat(CachedValues[FCacheLayout::Index(X, Y, Z - 1)]);
+						StencilSum += GradientX * GradientX + GradientY * GradientY + GradientZ * GradientZ;
+					}
+				}
+			}
+		}
+	}
+	const double CacheTime = FPlatformTime::Seconds() - CacheStartTime;
+
+	// Full meshing of the same chunks
+	int VertexCount = 0;
+	const double MeshStartTime = FPlatformTime::Seconds();
+	{
+		TArray<bool, TFixedAllocator<6>> ChunkHasHigherRes;
+		ChunkHasHigherRes.SetNumZeroed(6);
+		for (const FIntVector& Chunk : Chunks)
+		{
+			FVoxelPolygonizer Polygonizer(0, &Data, Chunk, ChunkHasHigherRes, false, false, false, 0, 0, 0);
+			FVoxelProcMeshSection Section;
+			Polygonizer.CreateSection(Section);
+			VertexCount += Section.ProcVertexBuffer.Num();
+		}
+	}
+	const double MeshTime = FPlatformTime::Seconds() - MeshStartTime;
+
+	AddInfo(FString::Printf(TEXT("VOXEL_BRICK_LAYOUT %d: %d sphere edits %.0fms, %d cache fills + stencil %.1fms, %d chunks meshed %.1fms (%d vertices)"),
+		VOXEL_BRICK_LAYOUT, SphereCount, EditTime * 1000, Chunks.Num(), CacheTime * 1000, Chunks.Num(), MeshTime * 1000, VertexCount));
+
+	TestTrue(TEXT("Stencil computed"), StencilSum > 0);
+	TestTrue(TEXT("Chunks meshed"), VertexCount > 0);
+
+	return true;
+}
+
+#endif
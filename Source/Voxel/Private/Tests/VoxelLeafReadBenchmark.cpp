@@ -0,0 +1,90 @@
+// Copyright 2017 Phyronnaz
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "VoxelData/Private/VoxelLeafData.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVoxelLeafReadBenchmark, "Voxel.Benchmarks.LeafRead", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+
+namespace VoxelLeafReadBenchmark
+{
+	// Size of the polygonizer caches
+	const int CacheSize = 19;
+	// Reads of each leaf
+	const int ReadCount = 20000;
+}
+
+bool FVoxelLeafReadBenchmark::RunTest(const FString& Parameters)
+{
+	using namespace VoxelLeafReadBenchmark;
+
+	FRandomStream Stream(0);
+
+	TArray<FVoxelValue> GeneratorValues;
+	TArray<FVoxelMaterial> GeneratorMaterials;
+	GeneratorValues.Init(FVoxelValuePolicy::FromFloat(1), VOXEL_LEAF_VOXELS);
+	GeneratorMaterials.Init(FVoxelMaterial(), VOXEL_LEAF_VOXELS);
+
+	TArray<FVoxelValue> Values;
+	TArray<FVoxelMaterial> Materials;
+	Values.SetNumUninitialized(CacheSize * CacheSize * CacheSize);
+	Materials.SetNumUninitialized(CacheSize * CacheSize * CacheSize);
+
+	for (int bDense = 0; bDense < 2; bDense++)
+	{
+		// Every voxel is edited. Palette leafs have 4 materials, dense ones a material per voxel
+		TArray<FVoxelValue> LeafValues;
+		TArray<FVoxelMaterial> LeafMaterials;
+		for (int Index = 0; Index < VOXEL_LEAF_VOXELS; Index++)
+		{
+			LeafValues.Add(FVoxelValuePolicy::FromFloat(Stream.FRandRange(-1, 0)));
+			LeafMaterials.Add(bDense ? FVoxelMaterial(Index & 0xFF, (Index >> 8) & 0xFF, Index % 251) : FVoxelMaterial(Index % 4, 0, 255));
+		}
+
+		FVoxelLeafData LeafData;
+		LeafData.SetAllValuesAndMaterials(LeafValues.GetData(), LeafMaterials.GetData(), GeneratorValues.GetData(), GeneratorMaterials.GetData());
+		if (!TestTrue(TEXT("Leaf format"), LeafData.GetFormat() == (bDense ? EVoxelLeafFormat::Dense : EVoxelLeafFormat::Palette)))
+		{
+			return false;
+		}
+
+		for (int Step = 1; Step <= 2; Step++)
+		{
+			// Whole leaf, as much of it as fits in the cache after its first row
+			const int ReadSize = FMath::Min(VOXEL_LEAF_SIZE / Step, CacheSize - 1);
+			const FIntVector Size(ReadSize, ReadSize, ReadSize);
+			const FIntVector StartIndex(1, 1, 1);
+			const FIntVector ArraySize(CacheSize, CacheSize, CacheSize);
+
+			const double StartTime = FPlatformTime::Seconds();
+			for (int Read = 0; Read < ReadCount; Read++)
+			{
+				LeafData.GetValuesAndMaterials(Values.GetData(), Materials.GetData(), FIntVector::ZeroValue, StartIndex, Step, Size, ArraySize);
+			}
+			const double Time = FPlatformTime::Seconds() - StartTime;
+
+			int Errors = 0;
+			for (int X = 0; X < ReadSize; X++)
+			{
+				for (int Y = 0; Y < ReadSize; Y++)
+				{
+					for (int Z = 0; Z < ReadSize; Z++)
+					{
+						const int LeafIndex = X * Step + VOXEL_LEAF_SIZE * Y * Step + VOXEL_LEAF_SIZE * VOXEL_LEAF_SIZE * Z * Step;
+						const int CacheIndex = (X + 1) + CacheSize * (Y + 1) + CacheSize * CacheSize * (Z + 1);
+						Errors += Values[CacheIndex] != LeafValues[LeafIndex] || !(Materials[CacheIndex] == LeafMaterials[LeafIndex]);
+					}
+				}
+			}
+			TestEqual(TEXT("Voxels read"), Errors, 0);
+
+			AddInfo(FString::Printf(TEXT("%s leaf, Step %d: %.2fus per read of %d^3 voxels"), bDense ? TEXT("Dense") : TEXT("Palette"), Step, Time / ReadCount * 1e6, ReadSize));
+		}
+	}
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,98 @@
+// Copyright 2017 Phyronnaz
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "VoxelTestUtils.h"
+#include "VoxelConfig.h"
+#include "VoxelSave.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVoxelLeafSizeBenchmark, "Voxel.Benchmarks.LeafSize", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+
+/**
+ * One cell of the VOXEL_LEAF_SIZE x VOXEL_BRICK_LAYOUT matrix: run it in a build for each combination
+ */
+namespace VoxelLeafSizeBenchmark
+{
+	// 256^3 world
+	const int Depth = 4;
+	// Scattered sculpting
+	const int SphereCount = 200;
+	const int MinSphereRadius = 3;
+	const int MaxSphereRadius = 7;
+	// Size of the chunks reading the whole world, as the render chunks of the LODs do
+	const int ReadSizes[] = { 16, 32, 64 };
+}
+
+bool FVoxelLeafSizeBenchmark::RunTest(const FString& Parameters)
+{
+	using namespace VoxelLeafSizeBenchmark;
+
+	FVoxelData Data(Depth, VoxelTestUtils::CreateNoiseWorldGenerator());
+	FRandomStream Stream(0);
+
+	const double EditStartTime = FPlatformTime::Seconds();
+	for (int Index = 0; Index < SphereCount; Index++)
+	{
+		const FIntVector Center = VoxelTestUtils::GetRandomSurfacePosition(Data, Stream, MaxSphereRadius + 2);
+		VoxelTestUtils::SetValueSphere(Data, Center, Stream.RandRange(MinSphereRadius, MaxSphereRadius), Index % 2 == 0);
+	}
+	const double EditTime = FPlatformTime::Seconds() - EditStartTime;
+
+	FVoxelLeafCompressionReport Report;
+	Data.GetLeafCompressionReport(Report);
+
+	AddInfo(FString::Printf(TEXT("VOXEL_LEAF_SIZE %d, VOXEL_BRICK_LAYOUT %d: %d sphere edits %.1fms, %d edited leafs using %.1fKB"),
+		VOXEL_LEAF_SIZE, VOXEL_BRICK_LAYOUT, SphereCount, EditTime * 1000, Report.LeafCount, Report.UncompressedSize / 1024.));
+
+	const int HalfSize = Data.Size() / 2;
+	for (const int ReadSize : ReadSizes)
+	{
+		const FIntVector Size(ReadSize, ReadSize, ReadSize);
+		TArray<FVoxelValue> Values;
+		TArray<FVoxelMaterial> Materials;
+		Values.SetNumUninitialized(Size.X * Size.Y * Size.Z);
+		Materials.SetNumUninitialized(Size.X * Size.Y * Size.Z);
+
+		int Errors = 0;
+		const double ReadStartTime = FPlatformTime::Seconds();
+		for (int X = -HalfSize; X < HalfSize; X += ReadSize)
+		{
+			for (int Y = -HalfSize; Y < HalfSize; Y += ReadSize)
+			{
+				for (int Z = -HalfSize; Z < HalfSize; Z += ReadSize)
+				{
+					const FIntVector Start(X, Y, Z);
+					const FVoxelBox Box(Start, Start + Size - FIntVector(1, 1, 1));
+					Data.BeginGet(Box);
+					Data.GetValuesAndMaterials(Values.GetData(), Materials.GetData(), Start, FIntVector::ZeroValue, 1, Size, Size);
+					// Spot check against the single voxel accessors
+					const FIntVector Middle = Start + Size / 2;
+					Errors += Values[ReadSize / 2 + ReadSize * (ReadSize / 2) + ReadSize * ReadSize * (ReadSize / 2)] != FVoxelValuePolicy::FromFloat(Data.GetValue(Middle.X, Middle.Y, Middle.Z));
+					Data.EndGet(Box);
+				}
+			}
+		}
+		const double ReadTime = FPlatformTime::Seconds() - ReadStartTime;
+
+		TestEqual(TEXT("Voxels read"), Errors, 0);
+		AddInfo(FString::Printf(TEXT("VOXEL_LEAF_SIZE %d, VOXEL_BRICK_LAYOUT %d: whole world read by %d^3 chunks %.1fms"),
+			VOXEL_LEAF_SIZE, VOXEL_BRICK_LAYOUT, ReadSize, ReadTime * 1000));
+	}
+
+	FVoxelWorldSave Save;
+	const double SaveStartTime = FPlatformTime::Seconds();
+	Data.GetSave(Save);
+	const double SaveTime = FPlatformTime::Seconds() - SaveStartTime;
+
+	AddInfo(FString::Printf(TEXT("VOXEL_LEAF_SIZE %d, VOXEL_BRICK_LAYOUT %d: save of %d bytes in %.1fms"),
+		VOXEL_LEAF_SIZE, VOXEL_BRICK_LAYOUT, Save.Data.Num(), SaveTime * 1000));
+
+	TestTrue(TEXT("Leafs edited"), Report.LeafCount > 0);
+	TestTrue(TEXT("World saved"), Save.Data.Num() > 0);
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,141 @@
+// Copyright 2017 Phyronnaz
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "VoxelTestUtils.h"
+#include "VoxelPolygonizer.h"
+#include <atomic>
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVoxelLockContentionBenchmark, "Voxel.Benchmarks.LockContention", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+
+namespace VoxelLockContentionBenchmark
+{
+	// Threads filling polygonizer caches, as the mesh builders do
+	const int MeshThreadCount = 8;
+	// Threads sculpting spheres, as the tools do
+	const int EditThreadCount = 2;
+	// Duration of each run, in seconds
+	const double Duration = 3;
+
+	struct FResult
+	{
+		int Reads;
+		int Edits;
+		// Longest time a mesh thread waited for a cache fill, in ms
+		double MaxReadTime;
+	};
+
+	/**
+	 * Fill 19^3 caches of random chunks while spheres are sculpted
+	 * @param	bWorldLock	Lock the whole world for every access, as before the lock regions
+	 */
+	FResult Run(FVoxelData& Data, bool bWorldLock)
+	{
+		std::atomic<int> Reads(0);
+		std::atomic<int> Edits(0);
+		TArray<double> MaxReadTimes;
+		MaxReadTimes.SetNumZeroed(MeshThreadCount);
+
+		const double EndTime = FPlatformTime::Seconds() + Duration;
+		VoxelTestUtils::RunThreads(MeshThreadCount + EditThreadCount, [&](int ThreadIndex)
+		{
+			FRandomStream Stream(ThreadIndex);
+			if (ThreadIndex < MeshThreadCount)
+			{
+				const FIntVector Size(CHUNKSIZE + 3, CHUNKSIZE + 3, CHUNKSIZE + 3);
+				TArray<FVoxelValue> Values;
+				TArray<FVoxelMaterial> Materials;
+				Values.SetNumUninitialized(Size.X * Size.Y * Size.Z);
+				Materials.SetNumUninitialized(Size.X * Size.Y * Size.Z);
+
+				while (FPlatformTime::Seconds() < EndTime)
+				{
+					const FIntVector Position = VoxelTestUtils::GetRandomSurfacePosition(Data, Stream, CHUNKSIZE);
+					const FIntVector Start(Position.X & ~(CHUNKSIZE - 1), Position.Y & ~(CHUNKSIZE - 1), Position.Z & ~(CHUNKSIZE - 1));
+					const FVoxelBox Box(Start - FIntVector(1, 1, 1), Start + Size - FIntVector(2, 2, 2));
+
+					const double StartTime = FPlatformTime::Seconds();
+					bWorldLock ? Data.BeginGet() : Data.BeginGet(Box);
+					Data.GetValuesAndMaterials(Values.GetData(), Materials.GetData(), Box.Min, FIntVector::ZeroValue, 1, Size, Size);
+					bWorldLock ? Data.EndGet() : Data.EndGet(Box);
+					MaxReadTimes[ThreadIndex] = FMath::Max(MaxReadTimes[ThreadIndex], (FPlatformTime::Seconds() - StartTime) * 1000);
+
+					Reads++;
+				}
+			}
+			else
+			{
+				while (FPlatformTime::Seconds() < EndTime)
+				{
+					const FIntVector Center = VoxelTestUtils::GetRandomSurfacePosition(Data, Stream, 16);
+					const float Radius = 6;
+					if (bWorldLock)
+					{
+						// Same edit, locking the whole world
+						Data.BeginSet();
+						{
+							FVoxelAccessor Accessor(&Data);
+							for (int X = -8; X <= 8; X++)
+							{
+								for (int Y = -8; Y <= 8; Y++)
+								{
+									for (int Z = -8; Z <= 8; Z++)
+									{
+										const float Distance = FVector(X, Y, Z).Size();
+										if (Distance <= Radius + 2)
+										{
+											Accessor.SetValue(Center.X + X, Center.Y + Y, Center.Z + Z, FMath::Clamp(Radius - Distance, -2.f, 2.f) / -2);
+										}
+									}
+								}
+							}
+						}
+						Data.EndSet();
+					}
+					else
+					{
+						VoxelTestUtils::SetValueSphere(Data, Center, Radius, true);
+					}
+					Edits++;
+				}
+			}
+		});
+
+		FResult Result;
+		Result.Reads = Reads;
+		Result.Edits = Edits;
+		Result.MaxReadTime = 0;
+		for (double MaxReadTime : MaxReadTimes)
+		{
+			Result.MaxReadTime = FMath::Max(Result.MaxReadTime, MaxReadTime);
+		}
+		return Result;
+	}
+}
+
+bool FVoxelLockContentionBenchmark::RunTest(const FString& Parameters)
+{
+	using namespace VoxelLockContentionBenchmark;
+
+	UNoiseWorldGenerator* Generator = VoxelTestUtils::CreateNoiseWorldGenerator();
+
+	for (int bWorldLock = 1; bWorldLock >= 0; bWorldLock--)
+	{
+		FVoxelData Data(4, Generator);
+		const FResult Result = Run(Data, bWorldLock != 0);
+
+		AddInfo(FString::Printf(TEXT("%s: %d mesh threads, %.0f cache fills/s, max fill %.2fms; %d edit threads, %.0f edits/s"),
+			bWorldLock ? TEXT("World lock") : TEXT("Region locks"),
+			MeshThreadCount, Result.Reads / Duration, Result.MaxReadTime,
+			EditThreadCount, Result.Edits / Duration));
+
+		TestTrue(TEXT("Caches filled"), Result.Reads > 0);
+		TestTrue(TEXT("Spheres sculpted"), Result.Edits > 0);
+	}
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,103 @@
+// Copyright 2017 Phyronnaz
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "VoxelTestUtils.h"
+#include "VoxelSave.h"
+#include "FlatWorldGenerator.h"
+#include <atomic>
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVoxelPendingLoadTest, "Voxel.Data.PendingLoadRace", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+namespace VoxelPendingLoadTest
+{
+	const int RunCount = 40;
+
+	const FIntVector Position(5, 5, 5);
+	const float SavedValue = 0.5f;
+	const float EditedValue = -0.5f;
+
+	// A reader holds the region while a load then an edit wait for it: the load usually gets it first
+	const float ReadTime = 0.02f;
+	const float EditDelay = 0.01f;
+	const float LoadDelay = 0.005f;
+}
+
+bool FVoxelPendingLoadTest::RunTest(const FString& Parameters)
+{
+	using namespace VoxelPendingLoadTest;
+
+	UFlatWorldGenerator* Generator = NewObject<UFlatWorldGenerator>();
+	const FVoxelBox Box(Position, Position);
+
+	// Loaded lazily: its region is only loaded when first locked
+	FVoxelWorldSave Save;
+	{
+		FVoxelData Data(2, Generator);
+		Data.BeginSet(Box);
+		Data.SetValue(Position.X, Position.Y, Position.Z, SavedValue);
+		Data.EndSet(Box);
+		Data.GetSave(Save);
+	}
+
+	FVoxelData Data(2, Generator);
+
+	int CheckedEdits = 0;
+	int LostEdits = 0;
+	for (int Run = 0; Run < RunCount; Run++)
+	{
+		std::atomic<bool> bLoadDone(false);
+		bool bLoadedBeforeEdit = false;
+
+		VoxelTestUtils::RunThreads(3, [&](int ThreadIndex)
+		{
+			if (ThreadIndex == 0)
+			{
+				Data.BeginGet(Box);
+				FPlatformProcess::Sleep(ReadTime);
+				Data.EndGet(Box);
+			}
+			else if (ThreadIndex == 1)
+			{
+				FPlatformProcess::Sleep(EditDelay);
+				Data.BeginSet(Box);
+				// Let a load that got the region first return. Saves are added while the whole world is locked: it was added before the edit
+				FPlatformProcess::Sleep(EditDelay);
+				bLoadedBeforeEdit = bLoadDone;
+				Data.SetValue(Position.X, Position.Y, Position.Z, EditedValue);
+				Data.EndSet(Box);
+			}
+			else
+			{
+				FPlatformProcess::Sleep(LoadDelay);
+				std::deque<FIntVector> ModifiedPositions;
+				Data.LoadFromSaveAndGetModifiedPositions(Save, ModifiedPositions, false);
+				bLoadDone = true;
+			}
+		});
+
+		Data.BeginGet(Box);
+		const float Value = Data.GetValue(Position.X, Position.Y, Position.Z);
+		Data.EndGet(Box);
+
+		// A save loaded before an edit must not overwrite it
+		if (bLoadedBeforeEdit)
+		{
+			CheckedEdits++;
+			if (Value != FVoxelValuePolicy::ToFloat(FVoxelValuePolicy::FromFloat(EditedValue)))
+			{
+				LostEdits++;
+			}
+		}
+	}
+
+	AddInfo(FString::Printf(TEXT("%d runs, %d with the load before the edit"), RunCount, CheckedEdits));
+
+	TestEqual(TEXT("Edits overwritten by a save loaded before them"), LostEdits, 0);
+
+	return true;
+}
+
+#endif
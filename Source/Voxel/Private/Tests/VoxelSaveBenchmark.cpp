@@ -0,0 +1,176 @@
+// Copyright 2017 Phyronnaz
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "VoxelTestUtils.h"
+#include "VoxelConfig.h"
+#include "VoxelSave.h"
+#include "Octree.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVoxelSaveBenchmark, "Voxel.Benchmarks.Save", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+
+/**
+ * Saves storing the voxels that differ from the generator against saves storing whole chunks, as before EVoxelSaveVersion::GeneratorDiff
+ */
+namespace VoxelSaveBenchmark
+{
+	// 512^3 world
+	const int Depth = 5;
+	// Player edits along the surface: digging, building and painting
+	const int StrokeCount = 3000;
+	const int MinStrokeRadius = 2;
+	const int MaxStrokeRadius = 6;
+	// Runs of each measure, the best time is kept
+	const int RunCount = 3;
+
+	/**
+	 * Save chunks with all their voxels, as GetSave did before EVoxelSaveVersion::GeneratorDiff
+	 * @param	Data		World to save. Must be locked for reading
+	 * @param	ChunkIds	Chunks to save, in octree order
+	 * @param	Compression	Compression of the blocks
+	 * @param	OutSave		Save with none of its chunks stored as a diff
+	 */
+	void GetFullChunksSave(const FVoxelData& Data, const TArray<uint64>& ChunkIds, EVoxelSaveCompression Compression, FVoxelWorldSave& OutSave)
+	{
+		const FIntVector LeafSize(VOXEL_LEAF_SIZE, VOXEL_LEAF_SIZE, VOXEL_LEAF_SIZE);
+
+		FVoxelChunkSave ChunkSave;
+		ChunkSave.Values.SetNumUninitialized(VOXEL_LEAF_VOXELS);
+		ChunkSave.Materials.SetNumUninitialized(VOXEL_LEAF_VOXELS);
+
+		FVoxelWorldSaveWriter Writer(OutSave, Data.Depth, Compression);
+		for (const uint64 Id : ChunkIds)
+		{
+			const FIntVector ChunkMin = FOctree::GetPositionFromId(Id, Data.Size()) - LeafSize / 2;
+			ChunkSave.Id = Id;
+			Data.GetValuesAndMaterials(ChunkSave.Values.GetData(), ChunkSave.Materials.GetData(), ChunkMin, FIntVector::ZeroValue, 1, LeafSize, LeafSize);
+			Writer.WriteChunk(ChunkSave);
+		}
+		Writer.Finish();
+	}
+
+	/**
+	 * Load a save and access the whole world, so that the lazily loaded regions are counted
+	 * @return	Time taken, in seconds
+	 */
+	double Load(const FVoxelWorldSave& Save, FVoxelData& OutData)
+	{
+		const double StartTime = FPlatformTime::Seconds();
+		std::deque<FIntVector> ModifiedPositions;
+		OutData.LoadFromSaveAndGetModifiedPositions(Save, ModifiedPositions, true);
+		OutData.BeginGet();
+		OutData.EndGet();
+		return FPlatformTime::Seconds() - StartTime;
+	}
+}
+
+bool FVoxelSaveBenchmark::RunTest(const FString& Parameters)
+{
+	using namespace VoxelSaveBenchmark;
+
+	UNoiseWorldGenerator* Generator = VoxelTestUtils::CreateNoiseWorldGenerator();
+	FVoxelData Data(Depth, Generator);
+	FRandomStream Stream(0);
+
+	TArray<FIntVector> StrokeCenters;
+	for (int Index = 0; Index < StrokeCount; Index++)
+	{
+		const FIntVector Center = VoxelTestUtils::GetRandomSurfacePosition(Data, Stream, MaxStrokeRadius + 2);
+		const int Radius = Stream.RandRange(MinStrokeRadius, MaxStrokeRadius);
+		switch (Index % 3)
+		{
+		case 0:
+			VoxelTestUtils::SetValueSphere(Data, Center, Radius, false);
+			break;
+		case 1:
+			VoxelTestUtils::SetValueSphere(Data, Center, Radius, true);
+			break;
+		default:
+			VoxelTestUtils::SetMaterialSphere(Data, Center, Radius, FVoxelMaterial(3, 0, 0));
+			break;
+		}
+		StrokeCenters.Add(Center);
+	}
+
+	for (const EVoxelSaveCompression Compression : { EVoxelSaveCompression::Zlib, EVoxelSaveCompression::LZ4 })
+	{
+		const TCHAR* CompressionName = Compression == EVoxelSaveCompression::Zlib ? TEXT("Zlib") : TEXT("LZ4");
+
+		FVoxelWorldSave Save;
+		double SaveTime = MAX_dbl;
+		for (int Run = 0; Run < RunCount; Run++)
+		{
+			const double StartTime = FPlatformTime::Seconds();
+			Data.GetSave(Save, Compression);
+			SaveTime = FMath::Min(SaveTime, FPlatformTime::Seconds() - StartTime);
+		}
+
+		TArray<FVoxelSaveBlock> Blocks;
+		TArray<uint64> ChunkIds;
+		if (!TestTrue(TEXT("Chunk Ids read"), Save.GetChunkIds(Blocks, ChunkIds)))
+		{
+			return false;
+		}
+
+		// Same chunks. Doesn't count taking the snapshot of the world, unlike GetSave
+		FVoxelWorldSave FullSave;
+		double FullSaveTime = MAX_dbl;
+		Data.BeginGet();
+		for (int Run = 0; Run < RunCount; Run++)
+		{
+			const double StartTime = FPlatformTime::Seconds();
+			GetFullChunksSave(Data, ChunkIds, Compression, FullSave);
+			FullSaveTime = FMath::Min(FullSaveTime, FPlatformTime::Seconds() - StartTime);
+		}
+		Data.EndGet();
+
+		int DiffCount = 0;
+		for (FVoxelWorldSaveReader Reader(Save); Reader.GetChunk(); Reader.NextChunk())
+		{
+			DiffCount += Reader.GetChunk()->IsDiff();
+		}
+
+		double LoadTime = MAX_dbl;
+		double FullLoadTime = MAX_dbl;
+		for (int Run = 0; Run < RunCount; Run++)
+		{
+			FVoxelData LoadedData(Depth, Generator);
+			LoadTime = FMath::Min(LoadTime, Load(Save, LoadedData));
+			FVoxelData FullLoadedData(Depth, Generator);
+			FullLoadTime = FMath::Min(FullLoadTime, Load(FullSave, FullLoadedData));
+
+			if (Run == 0)
+			{
+				int Errors = 0;
+				Data.BeginGet();
+				LoadedData.BeginGet();
+				FullLoadedData.BeginGet();
+				for (const FIntVector& Center : StrokeCenters)
+				{
+					const float Value = Data.GetValue(Center.X, Center.Y, Center.Z);
+					const FVoxelMaterial Material = Data.GetMaterial(Center.X, Center.Y, Center.Z);
+					Errors += Value != LoadedData.GetValue(Center.X, Center.Y, Center.Z) || !(Material == LoadedData.GetMaterial(Center.X, Center.Y, Center.Z));
+					Errors += Value != FullLoadedData.GetValue(Center.X, Center.Y, Center.Z) || !(Material == FullLoadedData.GetMaterial(Center.X, Center.Y, Center.Z));
+				}
+				FullLoadedData.EndGet();
+				LoadedData.EndGet();
+				Data.EndGet();
+				TestEqual(TEXT("Voxels loaded"), Errors, 0);
+			}
+		}
+
+		AddInfo(FString::Printf(TEXT("%s: %d edited chunks, %d stored as a diff"), CompressionName, ChunkIds.Num(), DiffCount));
+		AddInfo(FString::Printf(TEXT("%s: diff save of %d bytes in %.1fms, loaded in %.1fms"),
+			CompressionName, Save.Data.Num(), SaveTime * 1000, LoadTime * 1000));
+		AddInfo(FString::Printf(TEXT("%s: full chunks save of %d bytes written in %.1fms, loaded in %.1fms"),
+			CompressionName, FullSave.Data.Num(), FullSaveTime * 1000, FullLoadTime * 1000));
+
+		TestTrue(TEXT("Chunks saved"), ChunkIds.Num() > 0);
+	}
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,299 @@
+// Copyright 2017 Phyronnaz
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "VoxelTestUtils.h"
+#include "VoxelSave.h"
+#include "FlatWorldGenerator.h"
+#include "Octree.h"
+#include "MemoryWriter.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVoxelSaveValidationTest, "Voxel.Data.SaveValidation", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+namespace VoxelSaveValidationTest
+{
+	/**
+	 * Load a save into an unedited world
+	 * @return	Whether it was loaded
+	 */
+	bool Load(UFlatWorldGenerator* Generator, const FVoxelWorldSave& Save, std::deque<FIntVector>& OutModifiedPositions)
+	{
+		FVoxelData Data(2, Generator);
+		return Data.LoadFromSaveAndGetModifiedPositions(Save, OutModifiedPositions, true);
+	}
+
+	/**
+	 * Save of a single chunk with all its voxels, its block edited before being compressed again
+	 * @param	Id		Id of the chunk, written in the block table
+	 * @param	Edit	Edits the uncompressed block: Id, Mask, Values then Materials
+	 */
+	FVoxelWorldSave GetCorruptedChunkSave(uint64 Id, TFunctionRef<void(TArray<uint8>&)> Edit)
+	{
+		FVoxelChunkSave Chunk;
+		Chunk.Id = Id;
+		Chunk.Values.Init(FVoxelValuePolicy::FromFloat(-1), VOXEL_LEAF_VOXELS);
+		Chunk.Materials.Init(FVoxelMaterial(1, 0, 0), VOXEL_LEAF_VOXELS);
+
+		FVoxelWorldSave Save;
+		{
+			FVoxelWorldSaveWriter Writer(Save, 2, EVoxelSaveCompression::Zlib);
+			Writer.WriteChunk(Chunk);
+			Writer.Finish();
+		}
+
+		TArray<FVoxelSaveBlock> Blocks;
+		TArray<uint64> ChunkIds;
+		verify(Save.GetChunkIds(Blocks, ChunkIds));
+
+		TArray<uint8> BlockData;
+		BlockData.SetNumUninitialized(Blocks[0].Size);
+		verify(FCompression::UncompressMemory(ECompressionFlags::COMPRESS_ZLIB, BlockData.GetData(), BlockData.Num(), Save.Data.GetData() + Blocks[0].Offset, Blocks[0].CompressedSize));
+		Edit(BlockData);
+
+		int32 CompressedSize = FCompression::CompressMemoryBound(ECompressionFlags::COMPRESS_ZLIB, BlockData.Num());
+		Save.Data.SetNumUninitialized(CompressedSize);
+		verify(FCompression::CompressMemory(ECompressionFlags::COMPRESS_ZLIB, Save.Data.GetData(), CompressedSize, BlockData.GetData(), BlockData.Num()));
+		Save.Data.SetNum(CompressedSize, false);
+
+		// Same table, see FVoxelWorldSaveWriter::Finish
+		Blocks[0].Offset = 0;
+		Blocks[0].Size = BlockData.Num();
+		Blocks[0].CompressedSize = CompressedSize;
+		int32 TableOffset = Save.Data.Num();
+		FMemoryWriter Writer(Save.Data, false, true);
+		Writer << Blocks;
+		Writer << ChunkIds;
+		Writer << TableOffset;
+		return Save;
+	}
+
+	/**
+	 * Offset of the Values count of a chunk in its block, after its Id and its empty Mask
+	 */
+	const int ValuesOffset = sizeof(uint64) + sizeof(int32);
+
+	/**
+	 * Replace the empty mask of a chunk written by GetCorruptedChunkSave
+	 * @param	Block	Uncompressed block
+	 * @param	Mask	New mask
+	 */
+	void SetMask(TArray<uint8>& Block, const TArray<uint32>& Mask)
+	{
+		*(int32*)(Block.GetData() + sizeof(uint64)) = Mask.Num();
+		Block.Insert((const uint8*)Mask.GetData(), Mask.Num() * sizeof(uint32), ValuesOffset);
+	}
+}
+
+bool FVoxelSaveValidationTest::RunTest(const FString& Parameters)
+{
+	using namespace VoxelSaveValidationTest;
+
+	UFlatWorldGenerator* Generator = NewObject<UFlatWorldGenerator>();
+
+	FVoxelWorldSave Save;
+	FVoxelWorldSave Delta;
+	{
+		FVoxelData Data(2, Generator);
+		VoxelTestUtils::SetValueSphere(Data, FIntVector(0, 0, 0), 10, false);
+		Data.GetSave(Save);
+		VoxelTestUtils::SetValueSphere(Data, FIntVector(10, 0, 0), 5, true);
+		Data.GetDeltaSave(Delta);
+	}
+
+	std::deque<FIntVector> ModifiedPositions;
+	TestTrue(TEXT("Valid save loaded"), Load(Generator, Save, ModifiedPositions));
+	TestTrue(TEXT("Valid save has chunks"), ModifiedPositions.size() > 0);
+
+	// Unknown value size: rejected by LoadFromSave, and by the readers used directly
+	{
+		FVoxelWorldSave BadSave = Save;
+		BadSave.ValueSize = 3;
+
+		FString Error;
+		TestFalse(TEXT("Unknown value size validated"), BadSave.Validate(Error));
+
+		ModifiedPositions.clear();
+		TestFalse(TEXT("Unknown value size loaded"), Load(Generator, BadSave, ModifiedPositions));
+		TestEqual(TEXT("Chunks of a rejected save"), (int)ModifiedPositions.size(), 0);
+
+		FVoxelWorldSaveReader Reader(BadSave);
+		TestTrue(TEXT("Unknown value size read"), Reader.HasError() && !Reader.GetChunk());
+	}
+
+	// Unknown version
+	{
+		FVoxelWorldSave BadSave = Save;
+		BadSave.Version = EVoxelSaveVersion::LatestVersion + 1;
+
+		ModifiedPositions.clear();
+		TestFalse(TEXT("Unknown version loaded"), Load(Generator, BadSave, ModifiedPositions));
+	}
+
+	// Block table pointing outside of the data
+	{
+		FVoxelWorldSave BadSave = Save;
+		const int32 TableOffset = BadSave.Data.Num();
+		FMemory::Memcpy(BadSave.Data.GetData() + BadSave.Data.Num() - sizeof(int32), &TableOffset, sizeof(int32));
+
+		FString Error;
+		TestFalse(TEXT("Corrupted table offset validated"), BadSave.Validate(Error));
+
+		ModifiedPositions.clear();
+		TestFalse(TEXT("Corrupted table offset loaded"), Load(Generator, BadSave, ModifiedPositions));
+
+		FVoxelWorldSaveReader Reader(BadSave);
+		TestTrue(TEXT("Corrupted table offset read"), Reader.HasError() && !Reader.GetChunk());
+	}
+
+	// Block that can't be decompressed: only found when reading it
+	{
+		FVoxelWorldSave BadSave = Save;
+		TArray<FVoxelSaveBlock> Blocks;
+		if (!TestTrue(TEXT("Block table read"), BadSave.GetBlocks(Blocks) && Blocks.Num() > 0))
+		{
+			return false;
+		}
+		for (int Index = 0; Index < Blocks[0].CompressedSize; Index++)
+		{
+			BadSave.Data[Blocks[0].Offset + Index] ^= 0x5A;
+		}
+
+		FString Error;
+		TestTrue(TEXT("Corrupted block validated"), BadSave.Validate(Error));
+
+		FVoxelWorldSaveReader Reader(BadSave);
+		TestTrue(TEXT("Corrupted block read"), Reader.HasError() && !Reader.GetChunk());
+
+		// Loaded lazily: the block is read by the first access of its region, which must not crash
+		FVoxelData Data(2, Generator);
+		ModifiedPositions.clear();
+		TestTrue(TEXT("Corrupted block loaded"), Data.LoadFromSaveAndGetModifiedPositions(BadSave, ModifiedPositions, true));
+		Data.BeginGet();
+		TestEqual(TEXT("Value of a corrupted block"), Data.GetValue(0, 0, 0), FVoxelValuePolicy::ToFloat(FVoxelValuePolicy::FromFloat(Generator->GetValue(0, 0, 0))));
+		Data.EndGet();
+
+		TArray<FVoxelWorldSave> Deltas;
+		Deltas.Add(Delta);
+		FVoxelWorldSave NotCompacted;
+		TestFalse(TEXT("Corrupted block compacted"), FVoxelWorldSave::CompactDeltas(BadSave, Deltas, NotCompacted));
+		TestEqual(TEXT("Data of a failed compaction"), NotCompacted.Data.Num(), 0);
+	}
+
+	// Corrupted chunks: not loaded, and their regions are still generated
+	{
+		TArray<FVoxelSaveBlock> Blocks;
+		TArray<uint64> ChunkIds;
+		if (!TestTrue(TEXT("Chunk Ids read"), Save.GetChunkIds(Blocks, ChunkIds) && ChunkIds.Num() > 1))
+		{
+			return false;
+		}
+		const uint64 ChunkId = ChunkIds[0];
+		const uint64 OtherChunkId = ChunkIds[1];
+
+		TArray<TPair<FString, FVoxelWorldSave>> BadSaves;
+		BadSaves.Emplace(TEXT("Chunk with an unchanged save"), GetCorruptedChunkSave(ChunkId, [](TArray<uint8>& Block) {}));
+		BadSaves.Emplace(TEXT("Chunk missing a value"), GetCorruptedChunkSave(ChunkId, [](TArray<uint8>& Block)
+		{
+			int32& Num = *(int32*)(Block.GetData() + ValuesOffset);
+			Num--;
+			Block.RemoveAt(ValuesOffset + sizeof(int32), sizeof(FVoxelValue));
+		}));
+		BadSaves.Emplace(TEXT("Chunk with too many values"), GetCorruptedChunkSave(ChunkId, [](TArray<uint8>& Block)
+		{
+			*(int32*)(Block.GetData() + ValuesOffset) = MAX_int32;
+		}));
+		// All the voxels are stored: only a mask with all the bits matches them
+		BadSaves.Emplace(TEXT("Chunk with a short mask"), GetCorruptedChunkSave(ChunkId, [](TArray<uint8>& Block)
+		{
+			TArray<uint32> Mask;
+			Mask.Init(~0u, (VOXEL_LEAF_VOXELS + 31) / 32 - 1);
+			SetMask(Block, Mask);
+		}));
+		BadSaves.Emplace(TEXT("Chunk with a mask missing a voxel"), GetCorruptedChunkSave(ChunkId, [](TArray<uint8>& Block)
+		{
+			TArray<uint32> Mask;
+			Mask.Init(~0u, (VOXEL_LEAF_VOXELS + 31) / 32);
+			Mask[0] = ~1u;
+			SetMask(Block, Mask);
+		}));
+		BadSaves.Emplace(TEXT("Chunk with the Id of the root"), GetCorruptedChunkSave(ChunkId, [](TArray<uint8>& Block)
+		{
+			*(uint64*)Block.GetData() = FOctree::GetTopId();
+		}));
+		BadSaves.Emplace(TEXT("Chunk with an Id deeper than the max depth"), GetCorruptedChunkSave(ChunkId, [](TArray<uint8>& Block)
+		{
+			*(uint64*)Block.GetData() = ~(uint64)0;
+		}));
+		BadSaves.Emplace(TEXT("Chunk outside of its block"), GetCorruptedChunkSave(ChunkId, [OtherChunkId](TArray<uint8>& Block)
+		{
+			*(uint64*)Block.GetData() = OtherChunkId;
+		}));
+
+		for (int Index = 0; Index < BadSaves.Num(); Index++)
+		{
+			// The first one isn't corrupted: checks the edits of the blocks
+			const auto& BadSave = BadSaves[Index];
+			const bool bIsCorrupted = Index > 0;
+
+			FString Error;
+			TestTrue(*(BadSave.Key + TEXT(" validated")), BadSave.Value.Validate(Error));
+
+			FVoxelWorldSaveReader Reader(BadSave.Value);
+			TestEqual(*(BadSave.Key + TEXT(" read")), Reader.HasError() && !Reader.GetChunk(), bIsCorrupted);
+
+			FVoxelData Data(2, Generator);
+			ModifiedPositions.clear();
+			TestTrue(*(BadSave.Key + TEXT(" loaded")), Data.LoadFromSaveAndGetModifiedPositions(BadSave.Value, ModifiedPositions, true));
+			Data.BeginGet();
+			const FIntVector Position = FOctree::GetPositionFromId(ChunkId, Data.Size());
+			const float Value = bIsCorrupted ? Generator->GetValue(Position.X, Position.Y, Position.Z) : -1;
+			TestEqual(*(BadSave.Key + TEXT(" value")), Data.GetValue(Position.X, Position.Y, Position.Z), FVoxelValuePolicy::ToFloat(FVoxelValuePolicy::FromFloat(Value)));
+			Data.EndGet();
+		}
+
+		// Ids of chunks of another depth can't be loaded in the leafs
+		FVoxelWorldSave BadSave;
+		FString Error;
+		for (const uint64 Id : { FOctree::GetTopId(), ~(uint64)0 })
+		{
+			FVoxelChunkSave Chunk;
+			Chunk.Id = Id;
+			Chunk.Values.Init(FVoxelValuePolicy::FromFloat(-1), VOXEL_LEAF_VOXELS);
+			Chunk.Materials.Init(FVoxelMaterial(1, 0, 0), VOXEL_LEAF_VOXELS);
+			{
+				FVoxelWorldSaveWriter Writer(BadSave, 2, EVoxelSaveCompression::Zlib);
+				Writer.WriteChunk(Chunk);
+				Writer.Finish();
+			}
+			TestFalse(*FString::Printf(TEXT("Table with the Id %llu validated"), Id), BadSave.Validate(Error));
+		}
+
+		// Saves of another world size
+		BadSave = Save;
+		BadSave.Depth = 3;
+		ModifiedPositions.clear();
+		TestFalse(TEXT("Save of another depth loaded"), Load(Generator, BadSave, ModifiedPositions));
+		BadSave.Depth = 100;
+		TestFalse(TEXT("Save of an invalid depth validated"), BadSave.Validate(Error));
+	}
+
+	// Saves that don't follow each other can't be compacted
+	{
+		TArray<FVoxelWorldSave> Deltas;
+		Deltas.Add(Delta);
+		FVoxelWorldSave Compacted;
+		TestTrue(TEXT("Deltas compacted"), FVoxelWorldSave::CompactDeltas(Save, Deltas, Compacted));
+
+		FVoxelWorldSave NotCompacted;
+		TestFalse(TEXT("Delta compacted as a base"), FVoxelWorldSave::CompactDeltas(Delta, TArray<FVoxelWorldSave>(), NotCompacted));
+		Deltas[0].ValueSize = 3;
+		TestFalse(TEXT("Unknown value size compacted"), FVoxelWorldSave::CompactDeltas(Save, Deltas, NotCompacted));
+		TestEqual(TEXT("Data of a failed compaction"), NotCompacted.Data.Num(), 0);
+	}
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,152 @@
+// Copyright 2017 Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/Runnable.h"
+#include "HAL/RunnableThread.h"
+#include "VoxelData.h"
+#include "VoxelAccessor.h"
+#include "VoxelMaterial.h"
+#include "NoiseWorldGenerator.h"
+
+/**
+ * Worlds and edits shared by the tests and benchmarks
+ */
+namespace VoxelTestUtils
+{
+	/**
+	 * Noise terrain: the surface is between Z = -100 and Z = 10
+	 */
+	inline UNoiseWorldGenerator* CreateNoiseWorldGenerator()
+	{
+		UNoiseWorldGenerator* Generator = NewObject<UNoiseWorldGenerator>();
+		Generator->SetVoxelWorld(nullptr);
+		return Generator;
+	}
+
+	/**
+	 * Same edit as UVoxelTools::SetValueSphere, in voxel space
+	 * @param	Center	Center of the sphere, in voxel space. The sphere is clamped to the world
+	 * @param	Radius	Radius in voxels
+	 * @param	bAdd	Fill the sphere, or dig it
+	 */
+	inline void SetValueSphere(FVoxelData& Data, const FIntVector& Center, float Radius, bool bAdd)
+	{
+		const int IntRadius = FMath::CeilToInt(Radius) + 2;
+		const FVoxelBox Bounds(Center - FIntVector(IntRadius, IntRadius, IntRadius), Center + FIntVector(IntRadius, IntRadius, IntRadius));
+
+		Data.BeginSet(Bounds);
+		{
+			FVoxelAccessor Accessor(&Data);
+			for (int X = -IntRadius; X <= IntRadius; X++)
+			{
+				for (int Y = -IntRadius; Y <= IntRadius; Y++)
+				{
+					for (int Z = -IntRadius; Z <= IntRadius; Z++)
+					{
+						const FIntVector Position = Center + FIntVector(X, Y, Z);
+						const float Distance = FVector(X, Y, Z).Size();
+						if (Distance > Radius + 2 || !Data.IsInWorld(Position.X, Position.Y, Position.Z))
+						{
+							continue;
+						}
+
+						const float Value = FMath::Clamp(Radius - Distance + (Radius == Distance ? 0.0001f : 0), -2.f, 2.f) / 2 * (bAdd ? -1 : 1);
+						const float OldValue = Accessor.GetValue(Position.X, Position.Y, Position.Z);
+						// Only the voxels inside the sphere change of sign
+						if ((Value <= 0) == bAdd || (OldValue > 0) == (Value > 0))
+						{
+							Accessor.SetValue(Position.X, Position.Y, Position.Z, Value);
+						}
+					}
+				}
+			}
+		}
+		Data.EndSet(Bounds);
+	}
+
+	/**
+	 * Paint the voxels of a sphere
+	 * @param	Center		Center of the sphere, in voxel space
+	 * @param	Radius		Radius in voxels
+	 * @param	Material	Material to set
+	 */
+	inline void SetMaterialSphere(FVoxelData& Data, const FIntVector& Center, float Radius, const FVoxelMaterial& Material)
+	{
+		const int IntRadius = FMath::CeilToInt(Radius);
+		const FVoxelBox Bounds(Center - FIntVector(IntRadius, IntRadius, IntRadius), Center + FIntVector(IntRadius, IntRadius, IntRadius));
+
+		Data.BeginSet(Bounds);
+		{
+			FVoxelAccessor Accessor(&Data);
+			for (int X = -IntRadius; X <= IntRadius; X++)
+			{
+				for (int Y = -IntRadius; Y <= IntRadius; Y++)
+				{
+					for (int Z = -IntRadius; Z <= IntRadius; Z++)
+					{
+						const FIntVector Position = Center + FIntVector(X, Y, Z);
+						if (FVector(X, Y, Z).Size() <= Radius && Data.IsInWorld(Position.X, Position.Y, Position.Z))
+						{
+							Accessor.SetMaterial(Position.X, Position.Y, Position.Z, Material);
+						}
+					}
+				}
+			}
+		}
+		Data.EndSet(Bounds);
+	}
+
+	/**
+	 * Run a function on its own threads and wait for them
+	 * @param	ThreadCount		Number of threads
+	 * @param	Function		Called with the index of the thread
+	 */
+	inline void RunThreads(int ThreadCount, TFunction<void(int)> Function)
+	{
+		class FThread : public FRunnable
+		{
+		public:
+			FThread(TFunction<void(int)>& Function, int ThreadIndex)
+				: Function(Function)
+				, ThreadIndex(ThreadIndex)
+			{
+			}
+
+			virtual uint32 Run() override
+			{
+				Function(ThreadIndex);
+				return 0;
+			}
+
+		private:
+			TFunction<void(int)>& Function;
+			const int ThreadIndex;
+		};
+
+		TArray<FThread*> Runnables;
+		TArray<FRunnableThread*> Threads;
+		for (int ThreadIndex = 0; ThreadIndex < ThreadCount; ThreadIndex++)
+		{
+			Runnables.Add(new FThread(Function, ThreadIndex));
+			Threads.Add(FRunnableThread::Create(Runnables.Last(), *FString::Printf(TEXT("VoxelTestThread%d"), ThreadIndex)));
+		}
+		for (int ThreadIndex = 0; ThreadIndex < ThreadCount; ThreadIndex++)
+		{
+			Threads[ThreadIndex]->WaitForCompletion();
+			delete Threads[ThreadIndex];
+			delete Runnables[ThreadIndex];
+		}
+	}
+
+	/**
+	 * Random position on the terrain of CreateNoiseWorldGenerator
+	 * @param	Margin	Distance to the borders of the world
+	 */
+	inline FIntVector GetRandomSurfacePosition(const FVoxelData& Data, FRandomStream& Stream, int Margin)
+	{
+		const int Half = Data.Size() / 2 - Margin;
+		return FIntVector(Stream.RandRange(-Half, Half - 1), Stream.RandRange(-Half, Half - 1), FMath::Clamp(Stream.RandRange(-30, 10), -Half, Half - 1));
+	}
+}
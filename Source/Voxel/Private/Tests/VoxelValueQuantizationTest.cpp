@@ -0,0 +1,161 @@
+// Copyright 2017 Phyronnaz
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "VoxelData.h"
+#include "VoxelPolygonizer.h"
+#include "FlatWorldGenerator.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVoxelValueQuantizationTest, "Voxel.Data.ValueQuantization", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+namespace VoxelValueQuantizationTest
+{
+	// Sculpted sphere, off the grid so that the vertices aren't on the voxels
+	const FVector Center(0.37f, -0.81f, 0.23f);
+	const float Radius = 11.7f;
+
+	/**
+	 * Value written at a position: signed distance to the sphere, over 4 voxels on each side of the surface
+	 */
+	float GetValue(const FIntVector& Position)
+	{
+		return FMath::Clamp((FVector(Position.X, Position.Y, Position.Z) - Center).Size() / 4 - Radius / 4, -1.f, 1.f);
+	}
+
+	/**
+	 * Displacement of a vertex relative to the mesh of the float values
+	 * Quantization keeps the signs: the unquantized mesh has the same vertices on the same edges, at the positions given by the float values
+	 * @param	Position		Vertex in voxel space
+	 * @param	MaxValueError	Max error on a quantized value
+	 * @param	OutDisplacement	Distance to the unquantized vertex
+	 * @param	OutMaxDisplacement	Displacement allowed by MaxValueError on the edge of the vertex
+	 * @return	Whether an edge of the float values has a vertex at Position
+	 */
+	bool GetDisplacement(const FVector& Position, float MaxValueError, float& OutDisplacement, float& OutMaxDisplacement)
+	{
+		const FIntVector Min(FMath::FloorToInt(Position.X + KINDA_SMALL_NUMBER), FMath::FloorToInt(Position.Y + KINDA_SMALL_NUMBER), FMath::FloorToInt(Position.Z + KINDA_SMALL_NUMBER));
+
+		bool bFound = false;
+		OutDisplacement = MAX_flt;
+		for (int Axis = 0; Axis < 3; Axis++)
+		{
+			// Vertices on a voxel can come from the edges on both sides of it
+			for (int Offset = -1; Offset <= 0; Offset++)
+			{
+				FIntVector A = Min;
+				A[Axis] += Offset;
+				FIntVector B = A;
+				B[Axis]++;
+
+				bool bOnEdge = true;
+				for (int OtherAxis = 0; OtherAxis < 3; OtherAxis++)
+				{
+					const float Coordinate = Position[OtherAxis];
+					bOnEdge &= OtherAxis == Axis ? A[Axis] - KINDA_SMALL_NUMBER <= Coordinate && Coordinate <= B[Axis] + KINDA_SMALL_NUMBER : FMath::Abs(Coordinate - A[OtherAxis]) < KINDA_SMALL_NUMBER;
+				}
+
+				const float ValueAtA = GetValue(A);
+				const float ValueAtB = GetValue(B);
+				if (!bOnEdge || (ValueAtA > 0) == (ValueAtB > 0))
+				{
+					continue;
+				}
+
+				// Same interpolation as FVoxelPolygonizer::InterpolateX
+				const float t = ValueAtB / (ValueAtB - ValueAtA);
+				const float Displacement = FMath::Abs(Position[Axis] - (t * A[Axis] + (1 - t) * B[Axis]));
+				if (Displacement < OutDisplacement)
+				{
+					OutDisplacement = Displacement;
+					// Values of opposite signs: |dt| <= Error * (|ValueAtA| + |ValueAtB|) / (ValueAtB - ValueAtA)^2
+					OutMaxDisplacement = MaxValueError / FMath::Abs(ValueAtB - ValueAtA);
+				}
+				bFound = true;
+			}
+		}
+		return bFound;
+	}
+}
+
+bool FVoxelValueQuantizationTest::RunTest(const FString& Parameters)
+{
+	using namespace VoxelValueQuantizationTest;
+
+	// Error of TVoxelValueFixedPointPolicy: half a step, or a full one for the positive values rounded up to the first step
+	// Edges almost tangent to the surface have close values and amplify it: the max displacement is well above the average one
+#if VOXEL_VALUE_QUANTIZATION == 8
+	const float MaxValueError = 1.f / 127;
+	const float MaxAllowedDisplacement = 0.5f;
+#elif VOXEL_VALUE_QUANTIZATION == 16
+	const float MaxValueError = 1.f / 32767;
+	const float MaxAllowedDisplacement = 0.01f;
+#else
+	const float MaxValueError = 0;
+	const float MaxAllowedDisplacement = 0.001f;
+#endif
+
+	UFlatWorldGenerator* Generator = NewObject<UFlatWorldGenerator>();
+	FVoxelData Data(2, Generator);
+
+	// Every voxel read by the polygonizers of the 8 chunks around the center is edited
+	const FVoxelBox Box(FIntVector(-CHUNKSIZE - 1, -CHUNKSIZE - 1, -CHUNKSIZE - 1), FIntVector(CHUNKSIZE + 2, CHUNKSIZE + 2, CHUNKSIZE + 2));
+	Data.BeginSet(Box);
+	for (int X = Box.Min.X; X <= Box.Max.X; X++)
+	{
+		for (int Y = Box.Min.Y; Y <= Box.Max.Y; Y++)
+		{
+			for (int Z = Box.Min.Z; Z <= Box.Max.Z; Z++)
+			{
+				Data.SetValue(X, Y, Z, GetValue(FIntVector(X, Y, Z)));
+			}
+		}
+	}
+	Data.EndSet(Box);
+
+	TArray<bool, TFixedAllocator<6>> ChunkHasHigherRes;
+	ChunkHasHigherRes.SetNumZeroed(6);
+
+	int VertexCount = 0;
+	int OutOfBoundCount = 0;
+	float MaxDisplacement = 0;
+	double TotalDisplacement = 0;
+	for (int ChunkIndex = 0; ChunkIndex < 8; ChunkIndex++)
+	{
+		const FIntVector ChunkPosition(ChunkIndex & 1 ? 0 : -CHUNKSIZE, ChunkIndex & 2 ? 0 : -CHUNKSIZE, ChunkIndex & 4 ? 0 : -CHUNKSIZE);
+
+		FVoxelPolygonizer Polygonizer(0, &Data, ChunkPosition, ChunkHasHigherRes, false, false, false, 0, 0, 0);
+		FVoxelProcMeshSection Section;
+		Polygonizer.CreateSection(Section);
+
+		for (const FVoxelProcMeshVertex& Vertex : Section.ProcVertexBuffer)
+		{
+			const FVector Position = Vertex.Position + FVector(ChunkPosition.X, ChunkPosition.Y, ChunkPosition.Z);
+
+			float Displacement;
+			float MaxEdgeDisplacement;
+			if (!TestTrue(TEXT("Vertex on an edge of the float values"), GetDisplacement(Position, MaxValueError, Displacement, MaxEdgeDisplacement)))
+			{
+				return false;
+			}
+			if (Displacement > MaxEdgeDisplacement + KINDA_SMALL_NUMBER)
+			{
+				OutOfBoundCount++;
+			}
+			MaxDisplacement = FMath::Max(MaxDisplacement, Displacement);
+			TotalDisplacement += Displacement;
+			VertexCount++;
+		}
+	}
+
+	AddInfo(FString::Printf(TEXT("VOXEL_VALUE_QUANTIZATION %d: %d vertices, max displacement %f voxels, average %f"), VOXEL_VALUE_QUANTIZATION, VertexCount, MaxDisplacement, VertexCount ? TotalDisplacement / VertexCount : 0));
+
+	TestTrue(TEXT("Sphere meshed"), VertexCount > 0);
+	TestEqual(TEXT("Vertices displaced more than the value error allows"), OutOfBoundCount, 0);
+	TestTrue(TEXT("Max vertex displacement"), MaxDisplacement <= MaxAllowedDisplacement);
+
+	return true;
+}
+
+#endif
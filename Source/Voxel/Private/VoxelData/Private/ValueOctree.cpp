@@ -1,33 +1,123 @@
 // Copyright 2017 Phyronnaz
 
 #include "ValueOctree.h"
+#include "VoxelData.h"
+#include "VoxelLeafData.h"
+#include "VoxelGeneratorCache.h"
+#include "VoxelLeafIndex.h"
+#include "VoxelLeafPager.h"
+#include "VoxelLeafCache.h"
+#include "VoxelDataSnapshot.h"
 #include "VoxelWorldGenerator.h"
 
-FValueOctree::FValueOctree(UVoxelWorldGenerator* WorldGenerator, FIntVector Position, uint8 Depth, uint64 Id)
-	: FOctree(Position, Depth, Id)
-	, WorldGenerator(WorldGenerator)
+DECLARE_DWORD_COUNTER_STAT(TEXT("Voxel Leafs Copied On Write"), STAT_VoxelLeafsCopiedOnWrite, STATGROUP_Voxel);
+DECLARE_CYCLE_STAT(TEXT("ValueOctree ~ Page in"), STAT_FValueOctree_PageIn, STATGROUP_Voxel);
+DECLARE_CYCLE_STAT(TEXT("ValueOctree ~ Get values and materials"), STAT_FValueOctree_GetValuesAndMaterials, STATGROUP_Voxel);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Voxel Generator Queries"), STAT_VoxelGeneratorQueries, STATGROUP_Voxel);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Voxel Compressed Leafs"), STAT_VoxelCompressedLeafs, STATGROUP_Voxel);
+DECLARE_MEMORY_STAT(TEXT("Voxel Compressed Leafs Memory"), STAT_VoxelCompressedLeafsMemory, STATGROUP_Voxel);
+
+FValueOctree::FValueOctree(const FValueOctreeContext* Context, FIntVector Position, uint8 Depth, uint64 Id)
+	: FOctree(VOXEL_LEAF_SIZE, Position, Depth, Id)
+	, Context(Context)
+	, PageIndex(INDEX_NONE)
+	, LastAccess(Context->LeafPager->GetEpoch())
 	, bIsDirty(false)
+	, bHasNewEdits(false)
+	, Generation(0)
+	, bIsFullyEdited(false)
 {
 
 }
 
 FValueOctree::~FValueOctree()
 {
-	if (bHasChilds)
+	if (!IsLeaf())
 	{
-		for (auto Child : Childs)
-		{
-			delete Child;
-		}
+		DeleteChilds();
+	}
+	if (IsPagedOut())
+	{
+		Context->LeafPager->Free(PageIndex);
+	}
+	if (IsCompressed())
+	{
+		DEC_DWORD_STAT(STAT_VoxelCompressedLeafs);
+		DEC_MEMORY_STAT_BY(STAT_VoxelCompressedLeafsMemory, CompressedLeafData.GetAllocatedSize());
+	}
+	if (IsCold())
+	{
+		Context->LeafCache->Remove(this);
 	}
 }
 
 bool FValueOctree::IsDirty() const
 {
-	return bIsDirty;
+	return bIsDirty.load(std::memory_order_acquire);
+}
+
+/**
+ * Part of a GetValuesAndMaterials query inside a node, in array space: indices in [Min, Max) relative to StartIndex
+ */
+struct FValueOctreeQuery
+{
+	const FValueOctree* Node;
+	FIntVector Min;
+	FIntVector Max;
+
+	FValueOctreeQuery()
+	{
+	}
+
+	FValueOctreeQuery(const FValueOctree* Node, const FIntVector& Min, const FIntVector& Max)
+		: Node(Node)
+		, Min(Min)
+		, Max(Max)
+	{
+	}
+};
+
+/**
+ * Merge the queries that are adjacent along an axis and have the same section, so that they are generated in one call
+ * @param	Queries		Disjoint queries
+ * @param	Axis		0, 1 or 2 for X, Y or Z
+ */
+static void MergeGeneratorQueries(TArray<FValueOctreeQuery>& Queries, const int Axis)
+{
+	const int AxisB = (Axis + 1) % 3;
+	const int AxisC = (Axis + 2) % 3;
+
+	// Queries with the same section are consecutive, sorted along Axis
+	Queries.Sort([&](const FValueOctreeQuery& A, const FValueOctreeQuery& B)
+	{
+		if (A.Min[AxisB] != B.Min[AxisB]) return A.Min[AxisB] < B.Min[AxisB];
+		if (A.Min[AxisC] != B.Min[AxisC]) return A.Min[AxisC] < B.Min[AxisC];
+		if (A.Max[AxisB] != B.Max[AxisB]) return A.Max[AxisB] < B.Max[AxisB];
+		if (A.Max[AxisC] != B.Max[AxisC]) return A.Max[AxisC] < B.Max[AxisC];
+		return A.Min[Axis] < B.Min[Axis];
+	});
+
+	int Count = 0;
+	for (int Index = 0; Index < Queries.Num(); Index++)
+	{
+		const FValueOctreeQuery& Query = Queries[Index];
+		if (Count > 0)
+		{
+			FValueOctreeQuery& Last = Queries[Count - 1];
+			if (Last.Max[Axis] == Query.Min[Axis]
+				&& Last.Min[AxisB] == Query.Min[AxisB] && Last.Max[AxisB] == Query.Max[AxisB]
+				&& Last.Min[AxisC] == Query.Min[AxisC] && Last.Max[AxisC] == Query.Max[AxisC])
+			{
+				Last.Max[Axis] = Query.Max[Axis];
+				continue;
+			}
+		}
+		Queries[Count++] = Query;
+	}
+	Queries.SetNum(Count, false);
 }
 
-void FValueOctree::GetValuesAndMaterials(float InValues[], FVoxelMaterial InMaterials[], const FIntVector& Start, const FIntVector& StartIndex, const int Step, const FIntVector& Size, const FIntVector& ArraySize) const
+void FValueOctree::GetValuesAndMaterials(FVoxelValue InValues[], FVoxelMaterial InMaterials[], const FIntVector& Start, const FIntVector& StartIndex, const int Step, const FIntVector& Size, const FIntVector& ArraySize) const
 {
 	check(Size.GetMin() >= 0);
 	if (Size.X == 0 || Size.Y == 0 || Size.Z == 0)
@@ -39,341 +129,238 @@ void FValueOctree::GetValuesAndMaterials(float InValues[], FVoxelMaterial InMate
 
 	if (IsLeaf())
 	{
-		if (IsDirty())
+		// Point reads end here
+		GetLeafValuesAndMaterials(InValues, InMaterials, Start, StartIndex, Step, Size, ArraySize);
+		return;
+	}
+
+	SCOPE_CYCLE_COUNTER(STAT_FValueOctree_GetValuesAndMaterials);
+
+	TArray<FValueOctreeQuery, TInlineAllocator<64>> Stack;
+	// Unmodified parts, generated once the traversal is done
+	TArray<FValueOctreeQuery> GeneratorQueries;
+	// Leafs storing only their modified voxels, read over the generator values
+	TArray<FValueOctreeQuery> SparseLeafQueries;
+	TArray<TSharedPtr<FVoxelLeafData, ESPMode::ThreadSafe>> SparseLeafDatas;
+
+	Stack.Add(FValueOctreeQuery(this, FIntVector::ZeroValue, Size));
+	while (Stack.Num() > 0)
+	{
+		const FValueOctreeQuery Query = Stack.Pop(false);
+		const FValueOctree* Node = Query.Node;
+
+		if (!Node->IsDirty())
+		{
+			// No edit in the whole subtree
+			GeneratorQueries.Add(Query);
+		}
+		else if (Node->IsLeaf())
 		{
-			for (int I = 0; I < Size.X; I++)
+			Node->TouchLeafData();
+			TSharedPtr<FVoxelLeafData, ESPMode::ThreadSafe> ReadLeafData = Node->GetLeafDataForRead();
+
+			// Only Depth 0 leafs and merged uniform nodes have values. Bigger nodes can be flagged dirty while another thread is creating their childs
+			if (!ReadLeafData.IsValid())
+			{
+				GeneratorQueries.Add(Query);
+			}
+			else if (ReadLeafData->GetFormat() == EVoxelLeafFormat::Sparse)
+			{
+				GeneratorQueries.Add(Query);
+				SparseLeafQueries.Add(Query);
+				SparseLeafDatas.Add(ReadLeafData);
+			}
+			else
+			{
+				ReadLeafData->GetValuesAndMaterials(InValues, InMaterials, Start + Query.Min * Step - Node->GetMinimalCornerPosition(), StartIndex + Query.Min, Step, Query.Max - Query.Min, ArraySize);
+			}
+		}
+		else
+		{
+			// First index of the upper childs along each axis
+			FIntVector Split;
+			for (int Axis = 0; Axis < 3; Axis++)
+			{
+				const int Offset = Node->Position[Axis] - (Start[Axis] + Query.Min[Axis] * Step);
+				Split[Axis] = FMath::Clamp(Query.Min[Axis] + (Offset + Step - 1) / Step, Query.Min[Axis], Query.Max[Axis]);
+			}
+
+			// Same order as CreateChilds
+			for (int ChildIndex = 0; ChildIndex < 8; ChildIndex++)
 			{
-				for (int J = 0; J < Size.Y; J++)
+				FValueOctreeQuery ChildQuery(Node->Childs[ChildIndex], Query.Min, Query.Max);
+				for (int Axis = 0; Axis < 3; Axis++)
 				{
-					for (int K = 0; K < Size.Z; K++)
+					if (ChildIndex & (1 << Axis))
 					{
-						const int X = Start.X + I * Step;
-						const int Y = Start.Y + J * Step;
-						const int Z = Start.Z + K * Step;
-
-						int LocalX, LocalY, LocalZ;
-						GlobalToLocal(X, Y, Z, LocalX, LocalY, LocalZ);
-
-						const int LocalIndex = IndexFromCoordinates(LocalX, LocalY, LocalZ);
-						const int Index = (StartIndex.X + I) + ArraySize.X * (StartIndex.Y + J) + ArraySize.X * ArraySize.Y * (StartIndex.Z + K);
-
-						if (InValues)
-						{
-							InValues[Index] = Values[LocalIndex];
-						}
-						if (InMaterials)
-						{
-							InMaterials[Index] = Materials[LocalIndex];
-						}
+						ChildQuery.Min[Axis] = Split[Axis];
 					}
+					else
+					{
+						ChildQuery.Max[Axis] = Split[Axis];
+					}
+				}
+				if (ChildQuery.Min.X < ChildQuery.Max.X && ChildQuery.Min.Y < ChildQuery.Max.Y && ChildQuery.Min.Z < ChildQuery.Max.Z)
+				{
+					Stack.Add(ChildQuery);
 				}
 			}
 		}
-		else
-		{
-			WorldGenerator->GetValuesAndMaterials(InValues, InMaterials, Start, StartIndex, Step, Size, ArraySize);
-		}
 	}
-	else if (Size.X == 1 && Size.Y == 1 && Size.Z == 1 && false)
+
+	// Runs of unmodified nodes are generated together, and cover whole generator cache blocks when the nodes are smaller than them
+	for (int Axis = 0; Axis < 3; Axis++)
 	{
-		GetChild(Start.X, Start.Y, Start.Z)->GetValuesAndMaterials(InValues, InMaterials, Start, StartIndex, Step, Size, ArraySize);
+		MergeGeneratorQueries(GeneratorQueries, Axis);
 	}
-	else
+	INC_DWORD_STAT_BY(STAT_VoxelGeneratorQueries, GeneratorQueries.Num());
+
+	for (auto& Query : GeneratorQueries)
 	{
-		const int StartI = StartIndex.X;
-		const int StartJ = StartIndex.Y;
-		const int StartK = StartIndex.Z;
+		GetGeneratorValuesAndMaterials(InValues, InMaterials, Start + Query.Min * Step, StartIndex + Query.Min, Step, Query.Max - Query.Min, ArraySize);
+	}
+	for (int Index = 0; Index < SparseLeafQueries.Num(); Index++)
+	{
+		const FValueOctreeQuery& Query = SparseLeafQueries[Index];
+		SparseLeafDatas[Index]->GetValuesAndMaterials(InValues, InMaterials, Start + Query.Min * Step - Query.Node->GetMinimalCornerPosition(), StartIndex + Query.Min, Step, Query.Max - Query.Min, ArraySize);
+	}
+}
 
-		const int StartX = Start.X;
-		const int StartY = Start.Y;
-		const int StartZ = Start.Z;
+void FValueOctree::GetLeafValuesAndMaterials(FVoxelValue InValues[], FVoxelMaterial InMaterials[], const FIntVector& Start, const FIntVector& StartIndex, const int Step, const FIntVector& Size, const FIntVector& ArraySize) const
+{
+	check(IsLeaf());
 
-		const int RealSizeX = (Size.X - 1) * Step;
-		const int RealSizeY = (Size.Y - 1) * Step;
-		const int RealSizeZ = (Size.Z - 1) * Step;
+	TouchLeafData();
 
+	// Keeps the decompressed copy alive during the read
+	TSharedPtr<FVoxelLeafData, ESPMode::ThreadSafe> DecompressedLeafData;
+	const FVoxelLeafData* ReadLeafData = LeafData.Get();
+	if (IsCompressed())
+	{
+		DecompressedLeafData = Context->LeafCache->Get(this, CompressedLeafData);
+		ReadLeafData = DecompressedLeafData.Get();
+	}
 
+	// Only Depth 0 leafs and merged uniform nodes have values. Bigger nodes can be flagged dirty while another thread is creating their childs
+	if (ReadLeafData)
+	{
+		if (ReadLeafData->GetFormat() == EVoxelLeafFormat::Sparse)
+		{
+			// Only modified voxels are stored
+			GetGeneratorValuesAndMaterials(InValues, InMaterials, Start, StartIndex, Step, Size, ArraySize);
+		}
+		ReadLeafData->GetValuesAndMaterials(InValues, InMaterials, Start - GetMinimalCornerPosition(), StartIndex, Step, Size, ArraySize);
+	}
+	else
+	{
+		GetGeneratorValuesAndMaterials(InValues, InMaterials, Start, StartIndex, Step, Size, ArraySize);
+	}
+}
 
-		const int StartXBot = StartX;
-		const int StartIBot = StartI;
-		const int SizeXBot = (Position.X - StartX) / Step;
-		const int StartXTop = StartXBot + SizeXBot * Step;
-		const int StartITop = StartIBot + SizeXBot;
-		const int SizeXTop = Size.X - SizeXBot;
+void FValueOctree::SetValueAndMaterial(int X, int Y, int Z, float Value, FVoxelMaterial Material, bool bSetValue, bool bSetMaterial)
+{
+	check(IsLeaf());
+	check(IsInOctree(X, Y, Z));
 
-		const int StartYBot = StartY;
-		const int StartJBot = StartJ;
-		const int SizeYBot = (Position.Y - StartY) / Step;
-		const int StartYTop = StartYBot + SizeYBot * Step;
-		const int StartJTop = StartJBot + SizeYBot;
-		const int SizeYTop = Size.Y - SizeYBot;
+	if (Depth != 0)
+	{
+		CreateChilds();
+		bIsDirty.store(true, std::memory_order_release);
+		GetChild(X, Y, Z)->SetValueAndMaterial(X, Y, Z, Value, Material, bSetValue, bSetMaterial);
+	}
+	else
+	{
+		if (!IsDirty())
+		{
+			SetAsDirty();
+		}
+		TouchLeafData();
+		DecompressLeafData();
 
-		const int StartZBot = StartZ;
-		const int StartKBot = StartK;
-		const int SizeZBot = (Position.Z - StartZ) / Step;
-		const int StartZTop = StartZBot + SizeZBot * Step;
-		const int StartKTop = StartKBot + SizeZBot;
-		const int SizeZTop = Size.Z - SizeZBot;
+		int LocalX, LocalY, LocalZ;
+		GlobalToLocal(X, Y, Z, LocalX, LocalY, LocalZ);
 
+		MakeLeafDataUnique();
+		bHasNewEdits = true;
 
-		if (StartX + RealSizeX < Position.X || Position.X <= StartX)
+		const int Index = IndexFromCoordinates(LocalX, LocalY, LocalZ);
+		FVoxelValue StoredValue = FVoxelValuePolicy::FromFloat(Value);
+		if (!bSetValue || !bSetMaterial)
 		{
-			if (StartY + RealSizeY < Position.Y || Position.Y <= StartY)
+			FVoxelValue OldValue;
+			FVoxelMaterial OldMaterial;
+			if (LeafData->Contains(Index))
 			{
-				if (StartZ + RealSizeZ < Position.Z || Position.Z <= StartZ)
-				{
-					GetChild(StartX, StartY, StartZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartX, StartY, StartZ },
-						{ StartI, StartJ, StartK },
-						Step,
-						{ Size.X, Size.Y, Size.Z },
-						ArraySize);
-				}
-				else
-				{
-					// Split Z
-
-					GetChild(StartX, StartY, StartZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartX, StartY, StartZBot },
-						{ StartI, StartJ, StartKBot },
-						Step,
-						{ Size.X, Size.Y, SizeZBot },
-						ArraySize);
-
-					GetChild(StartX, StartY, StartZ + RealSizeZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartX, StartY, StartZTop },
-						{ StartI, StartJ, StartKTop },
-						Step,
-						{ Size.X, Size.Y, SizeZTop },
-						ArraySize);
-				}
+				LeafData->GetValueAndMaterial(Index, OldValue, OldMaterial);
 			}
 			else
 			{
-				// Split Y
-
-				if (StartZ + RealSizeZ < Position.Z || Position.Z <= StartZ)
-				{
-					GetChild(StartX, StartY, StartZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartX, StartYBot, StartZ },
-						{ StartI, StartJBot, StartK },
-						Step,
-						{ Size.X, SizeYBot, Size.Z },
-						ArraySize);
-
-					GetChild(StartX, StartY + RealSizeY, StartZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartX, StartYTop, StartZ },
-						{ StartI, StartJTop, StartK },
-						Step,
-						{ Size.X, SizeYTop, Size.Z },
-						ArraySize);
-				}
-				else
-				{
-					// Split Z
-
-					GetChild(StartX, StartY, StartZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartX, StartYBot, StartZBot },
-						{ StartI, StartJBot, StartKBot },
-						Step,
-						{ Size.X, SizeYBot, SizeZBot },
-						ArraySize);
-
-					GetChild(StartX, StartY, StartZ + RealSizeZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartX, StartYBot, StartZTop },
-						{ StartI, StartJBot, StartKTop },
-						Step,
-						{ Size.X, SizeYBot, SizeZTop },
-						ArraySize);
-
-
-					GetChild(StartX, StartY + RealSizeY, StartZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartX, StartYTop, StartZBot },
-						{ StartI, StartJTop, StartKBot },
-						Step,
-						{ Size.X, SizeYTop, SizeZBot },
-						ArraySize);
-
-					GetChild(StartX, StartY + RealSizeY, StartZ + RealSizeZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartX, StartYTop, StartZTop },
-						{ StartI, StartJTop, StartKTop },
-						Step,
-						{ Size.X, SizeYTop, SizeZTop },
-						ArraySize);
-				}
+				GetGeneratorValuesAndMaterials(&OldValue, &OldMaterial, FIntVector(X, Y, Z), FIntVector::ZeroValue, 1, FIntVector(1, 1, 1), FIntVector(1, 1, 1));
 			}
-		}
-		else
-		{
-			// Split X
 
-			if (StartY + RealSizeY < Position.Y || Position.Y <= StartY)
+			if (!bSetValue)
 			{
-				if (StartZ + RealSizeZ < Position.Z || Position.Z <= StartZ)
-				{
-					GetChild(StartX, StartY, StartZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartXBot, StartY, StartZ },
-						{ StartIBot, StartJ, StartK },
-						Step,
-						{ SizeXBot, Size.Y, Size.Z },
-						ArraySize);
-
-					GetChild(StartX + RealSizeX, StartY, StartZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartXTop, StartY, StartZ },
-						{ StartITop, StartJ, StartK },
-						Step,
-						{ SizeXTop, Size.Y, Size.Z },
-						ArraySize);
-				}
-				else
-				{
-					// Split Z
-
-					GetChild(StartX, StartY, StartZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartXBot, StartY, StartZBot },
-						{ StartIBot, StartJ, StartKBot },
-						Step,
-						{ SizeXBot, Size.Y, SizeZBot },
-						ArraySize);
-
-					GetChild(StartX, StartY, StartZ + RealSizeZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartXBot, StartY, StartZTop },
-						{ StartIBot, StartJ, StartKTop },
-						Step,
-						{ SizeXBot, Size.Y, SizeZTop },
-						ArraySize);
-
-
-					GetChild(StartX + RealSizeX, StartY, StartZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartXTop, StartY, StartZBot },
-						{ StartITop, StartJ, StartKBot },
-						Step,
-						{ SizeXTop, Size.Y, SizeZBot },
-						ArraySize);
-
-					GetChild(StartX + RealSizeX, StartY, StartZ + RealSizeZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartXTop, StartY, StartZTop },
-						{ StartITop, StartJ, StartKTop },
-						Step,
-						{ SizeXTop, Size.Y, SizeZTop },
-						ArraySize);
-				}
+				StoredValue = OldValue;
 			}
-			else
+			if (!bSetMaterial)
 			{
-				// Split Y
-
-				if (StartZ + RealSizeZ < Position.Z || Position.Z <= StartZ)
-				{
-					GetChild(StartX, StartY, StartZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartXBot, StartYBot, StartZ },
-						{ StartIBot, StartJBot, StartK },
-						Step,
-						{ SizeXBot, SizeYBot, Size.Z },
-						ArraySize);
-
-					GetChild(StartX, StartY + RealSizeY, StartZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartXBot, StartYTop, StartZ },
-						{ StartIBot, StartJTop, StartK },
-						Step,
-						{ SizeXBot, SizeYTop, Size.Z },
-						ArraySize);
-
-					GetChild(StartX + RealSizeX, StartY, StartZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartXTop, StartYBot, StartZ },
-						{ StartITop, StartJBot, StartK },
-						Step,
-						{ SizeXTop, SizeYBot, Size.Z },
-						ArraySize);
-
-					GetChild(StartX + RealSizeX, StartY + RealSizeY, StartZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartXTop, StartYTop, StartZ },
-						{ StartITop, StartJTop, StartK },
-						Step,
-						{ SizeXTop, SizeYTop, Size.Z },
-						ArraySize);
-				}
-				else
-				{
-					// Split Z
-
-					GetChild(StartX, StartY, StartZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartXBot, StartYBot, StartZBot },
-						{ StartIBot, StartJBot, StartKBot },
-						Step,
-						{ SizeXBot, SizeYBot, SizeZBot },
-						ArraySize);
-
-					GetChild(StartX, StartY, StartZ + RealSizeZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartXBot, StartYBot, StartZTop },
-						{ StartIBot, StartJBot, StartKTop },
-						Step,
-						{ SizeXBot, SizeYBot, SizeZTop },
-						ArraySize);
-
-
-					GetChild(StartX, StartY + RealSizeY, StartZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartXBot, StartYTop, StartZBot },
-						{ StartIBot, StartJTop, StartKBot },
-						Step,
-						{ SizeXBot, SizeYTop, SizeZBot },
-						ArraySize);
-
-					GetChild(StartX, StartY + RealSizeY, StartZ + RealSizeZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartXBot, StartYTop, StartZTop },
-						{ StartIBot, StartJTop, StartKTop },
-						Step,
-						{ SizeXBot, SizeYTop, SizeZTop },
-						ArraySize);
-
-
-
-
-
-					GetChild(StartX + RealSizeX, StartY, StartZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartXTop, StartYBot, StartZBot },
-						{ StartITop, StartJBot, StartKBot },
-						Step,
-						{ SizeXTop, SizeYBot, SizeZBot },
-						ArraySize);
-
-					GetChild(StartX + RealSizeX, StartY, StartZ + RealSizeZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartXTop, StartYBot, StartZTop },
-						{ StartITop, StartJBot, StartKTop },
-						Step,
-						{ SizeXTop, SizeYBot, SizeZTop },
-						ArraySize);
-
-
-					GetChild(StartX + RealSizeX, StartY + RealSizeY, StartZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartXTop, StartYTop, StartZBot },
-						{ StartITop, StartJTop, StartKBot },
-						Step,
-						{ SizeXTop, SizeYTop, SizeZBot },
-						ArraySize);
-
-					GetChild(StartX + RealSizeX, StartY + RealSizeY, StartZ + RealSizeZ)->GetValuesAndMaterials(InValues, InMaterials,
-						{ StartXTop, StartYTop, StartZTop },
-						{ StartITop, StartJTop, StartKTop },
-						Step,
-						{ SizeXTop, SizeYTop, SizeZTop },
-						ArraySize);
-				}
+				Material = OldMaterial;
 			}
 		}
+
+		LeafData->SetValueAndMaterial(Index, StoredValue, Material);
+
+		if (LeafData->NeedsDense())
+		{
+			TArray<FVoxelValue> GeneratorValues;
+			TArray<FVoxelMaterial> GeneratorMaterials;
+			GeneratorValues.SetNumUninitialized(VOXEL_LEAF_VOXELS);
+			GeneratorMaterials.SetNumUninitialized(VOXEL_LEAF_VOXELS);
+			GetGeneratorValuesAndMaterials(GeneratorValues.GetData(), GeneratorMaterials.GetData());
+
+			LeafData->MakeDense(GeneratorValues.GetData(), GeneratorMaterials.GetData());
+		}
 	}
 }
 
-void FValueOctree::SetValueAndMaterial(int X, int Y, int Z, float Value, FVoxelMaterial Material, bool bSetValue, bool bSetMaterial)
+void FValueOctree::AddChunksToSnapshot(const FVoxelBox& Box, uint64 MinGeneration, FVoxelDataSnapshot& Snapshot) const
+{
+	check(!IsLeaf() == (Childs.Num() == 8));
+
+	// Generation is the one of the last edit of the node or of its childs. Skipped leafs aren't paged in
+	const FVoxelBox Bounds(GetMinimalCornerPosition(), GetMaximalCornerPosition() - FIntVector(1, 1, 1));
+	if (!IsDirty() || Generation.load() < MinGeneration || !Bounds.Intersect(Box))
+	{
+		return;
+	}
+
+	if (IsLeaf())
+	{
+		TouchLeafData();
+		check(LeafData || IsCompressed());
+
+		// Merged uniform nodes are added as their Depth 0 chunks
+		AddUniformChunksToSnapshot(Position, Depth, Id, Box, Snapshot);
+	}
+	else
+	{
+		for (auto Child : Childs)
+		{
+			Child->AddChunksToSnapshot(Box, MinGeneration, Snapshot);
+		}
+	}
+}
+
+void FValueOctree::LoadChunk(const FVoxelChunkSave& Chunk, std::deque<FIntVector>& OutModifiedPositions)
 {
 	check(IsLeaf());
-	check(IsInOctree(X, Y, Z));
+	checkf(GetAncestorId(Chunk.Id, Depth) == Id, TEXT("Invalid chunk Id"));
 
 	if (Depth != 0)
 	{
 		CreateChilds();
-		bIsDirty = true;
-		GetChild(X, Y, Z)->SetValueAndMaterial(X, Y, Z, Value, Material, bSetValue, bSetMaterial);
+		bIsDirty.store(true, std::memory_order_release);
+		Childs[GetAncestorId(Chunk.Id, Depth - 1) & 7]->LoadChunk(Chunk, OutModifiedPositions);
 	}
 	else
 	{
@@ -381,120 +368,538 @@ void FValueOctree::SetValueAndMaterial(int X, int Y, int Z, float Value, FVoxelM
 		{
 			SetAsDirty();
 		}
+		TouchLeafData();
+		DecompressLeafData();
+		MakeLeafDataUnique();
+		bHasNewEdits = true;
+
+		TArray<FVoxelValue> GeneratorValues;
+		TArray<FVoxelMaterial> GeneratorMaterials;
+		GeneratorValues.SetNumUninitialized(VOXEL_LEAF_VOXELS);
+		GeneratorMaterials.SetNumUninitialized(VOXEL_LEAF_VOXELS);
+		GetGeneratorValuesAndMaterials(GeneratorValues.GetData(), GeneratorMaterials.GetData());
+
+		if (Chunk.IsDiff())
+		{
+			// The voxels that aren't saved are the generator ones
+			TArray<FVoxelValue> Values(GeneratorValues);
+			TArray<FVoxelMaterial> Materials(GeneratorMaterials);
+			Chunk.GetValuesAndMaterials(Values.GetData(), Materials.GetData());
+			LeafData->SetAllValuesAndMaterials(Values.GetData(), Materials.GetData(), GeneratorValues.GetData(), GeneratorMaterials.GetData());
+		}
+		else
+		{
+			LeafData->SetAllValuesAndMaterials(Chunk.Values.GetData(), Chunk.Materials.GetData(), GeneratorValues.GetData(), GeneratorMaterials.GetData());
+		}
 
-		int LocalX, LocalY, LocalZ;
-		GlobalToLocal(X, Y, Z, LocalX, LocalY, LocalZ);
+		// With neighbors
+		GetDirtyChunksPositions(OutModifiedPositions);
+	}
+}
+
+void FValueOctree::CreateChilds()
+{
+	check(IsLeaf());
+	check(Childs.Num() == 0);
+	check(Depth != 0);
 
-		int Index = IndexFromCoordinates(LocalX, LocalY, LocalZ);
-		if (bSetValue)
+	int d = Size() / 4;
+
+	// Siblings are contiguous
+	FValueOctree* Block = Context->NodePool->Allocate();
+	bIsFullyEdited.store(false, std::memory_order_release);
+
+	Childs.Add(new (&Block[0]) FValueOctree(Context, Position + FIntVector(-d, -d, -d), Depth - 1, GetChildId(Id, 0)));
+	Childs.Add(new (&Block[1]) FValueOctree(Context, Position + FIntVector(+d, -d, -d), Depth - 1, GetChildId(Id, 1)));
+	Childs.Add(new (&Block[2]) FValueOctree(Context, Position + FIntVector(-d, +d, -d), Depth - 1, GetChildId(Id, 2)));
+	Childs.Add(new (&Block[3]) FValueOctree(Context, Position + FIntVector(+d, +d, -d), Depth - 1, GetChildId(Id, 3)));
+	Childs.Add(new (&Block[4]) FValueOctree(Context, Position + FIntVector(-d, -d, +d), Depth - 1, GetChildId(Id, 4)));
+	Childs.Add(new (&Block[5]) FValueOctree(Context, Position + FIntVector(+d, -d, +d), Depth - 1, GetChildId(Id, 5)));
+	Childs.Add(new (&Block[6]) FValueOctree(Context, Position + FIntVector(-d, +d, +d), Depth - 1, GetChildId(Id, 6)));
+	Childs.Add(new (&Block[7]) FValueOctree(Context, Position + FIntVector(+d, +d, +d), Depth - 1, GetChildId(Id, 7)));
+
+	FVoxelValue UniformValue;
+	FVoxelMaterial UniformMaterial;
+	if (LeafData && LeafData->IsUniform(UniformValue, UniformMaterial))
+	{
+		// Merged uniform node: childs keep its value & material
+		for (auto Child : Childs)
 		{
-			Values[Index] = Value;
+			Child->LeafData = MakeShareable(new FVoxelLeafData(UniformValue, UniformMaterial));
+			Child->bIsDirty.store(true, std::memory_order_release);
+			Child->Generation = Generation.load();
 		}
-		if (bSetMaterial)
+		LeafData.Reset();
+	}
+	check(!LeafData.IsValid());
+
+	if (Depth == 1)
+	{
+		for (auto Child : Childs)
 		{
-			Materials[Index] = Material;
+			Context->LeafIndex->Add(Child);
 		}
 	}
+
+	// Readers of other regions can be iterating this node: publishes the childs
+	bHasChilds.store(true, std::memory_order_release);
+	check(!IsLeaf() == (Childs.Num() == 8));
 }
 
-void FValueOctree::AddDirtyChunksToSaveList(std::deque<TSharedRef<FVoxelChunkSave>>& SaveList)
+void FValueOctree::DeleteChilds()
 {
-	check(!IsLeaf() == (Childs.Num() == 8));
-	check(!(IsDirty() && IsLeaf() && Depth != 0));
+	check(Childs.Num() == 8);
 
-	if (IsDirty())
+	for (auto Child : Childs)
 	{
-		if (IsLeaf())
+		if (Depth == 1)
 		{
-			auto SaveStruct = TSharedRef<FVoxelChunkSave>(new FVoxelChunkSave(Id, Position, Values, Materials));
-			SaveList.push_back(SaveStruct);
+			Context->LeafIndex->Remove(Child);
 		}
-		else
+		Child->~FValueOctree();
+	}
+	Context->NodePool->Free(Childs[0]);
+	Childs.Empty();
+}
+
+void FValueOctree::CreateChildsOverlappingBox(const FVoxelBox& Box, int MinDepth)
+{
+	if (Depth <= MinDepth || !GetBounds().Intersect(Box))
+	{
+		return;
+	}
+
+	if (IsLeaf())
+	{
+		// Childs first: readers seeing a dirty node must find its childs
+		CreateChilds();
+		bIsDirty.store(true, std::memory_order_release);
+	}
+	for (auto Child : Childs)
+	{
+		Child->CreateChildsOverlappingBox(Box, MinDepth);
+	}
+}
+
+bool FValueOctree::CompactOverlappingBox(const FVoxelBox& Box, int MaxMergeDepth, uint64 NewGeneration)
+{
+	// Nodes only touching Box can be in another lock region
+	const FVoxelBox Bounds(GetMinimalCornerPosition(), GetMaximalCornerPosition() - FIntVector(1, 1, 1));
+	if (!IsDirty() || !Bounds.Intersect(Box))
+	{
+		return false;
+	}
+
+	bool bEdited = false;
+	if (IsLeaf())
+	{
+		// Leafs not edited since their last compaction are left as they are: they can be shared with snapshots
+		if (Depth == 0 && bHasNewEdits)
 		{
-			for (auto Child : Childs)
+			// Compressed & paged out leafs have no new edits
+			check(!IsCold());
+
+			// Snapshots created since the edit share the leaf data
+			MakeLeafDataUnique();
+			// SetValueAndMaterial only widens the range
+			LeafData->UpdateValueRange();
+			LeafData->TryMakeUniform();
+
+			bEdited = true;
+			bHasNewEdits = false;
+		}
+	}
+	else
+	{
+		for (auto Child : Childs)
+		{
+			bEdited |= Child->CompactOverlappingBox(Box, MaxMergeDepth, NewGeneration);
+		}
+		if (Depth <= MaxMergeDepth)
+		{
+			TryMergeChilds();
+			if (!IsLeaf())
 			{
-				Child->AddDirtyChunksToSaveList(SaveList);
+				UpdateValueRange();
 			}
 		}
 	}
+
+	if (bEdited)
+	{
+		UpdateGeneration(NewGeneration);
+	}
+	return bEdited;
+}
+
+uint32 FValueOctree::GetLeafDataSize() const
+{
+	// Readers can be paging it in: CompressedLeafData can only be read once PageIndex is reset
+	if (IsPagedOut())
+	{
+		return 0;
+	}
+	return LeafData.IsValid() ? LeafData->GetAllocatedSize() : CompressedLeafData.GetAllocatedSize();
+}
+
+uint32 FValueOctree::GetLastAccess() const
+{
+	return LastAccess.load(std::memory_order_relaxed);
+}
+
+bool FValueOctree::CanBeCompressed() const
+{
+	return Depth == 0 && IsLeaf() && LeafData.IsValid() && LeafData.IsUnique() && !bHasNewEdits && LeafData->GetFormat() != EVoxelLeafFormat::Uniform;
+}
+
+void FValueOctree::Compress()
+{
+	check(CanBeCompressed());
+
+	// Used by GetValueRange & UpdateValueRange while compressed
+	ValueRange = LeafData->GetValueRange();
+	bIsFullyEdited.store(LeafData->GetFormat() != EVoxelLeafFormat::Sparse, std::memory_order_release);
+
+	LeafData->Compress(CompressedLeafData);
+	LeafData.Reset();
+
+	INC_DWORD_STAT(STAT_VoxelCompressedLeafs);
+	INC_MEMORY_STAT_BY(STAT_VoxelCompressedLeafsMemory, CompressedLeafData.GetAllocatedSize());
+}
+
+bool FValueOctree::CanBePagedOut() const
+{
+	return Depth == 0 && IsLeaf() && !IsPagedOut() && (IsCompressed() || CanBeCompressed());
+}
+
+void FValueOctree::PageOut()
+{
+	check(CanBePagedOut());
+
+	if (!IsCompressed())
+	{
+		Compress();
+	}
+
+	{
+		FScopeLock Lock(&Context->LeafPager->Section);
+		PageIndex = Context->LeafPager->Write(CompressedLeafData);
+	}
+
+	DEC_DWORD_STAT(STAT_VoxelCompressedLeafs);
+	DEC_MEMORY_STAT_BY(STAT_VoxelCompressedLeafsMemory, CompressedLeafData.GetAllocatedSize());
+	CompressedLeafData.Empty();
 }
 
-void FValueOctree::LoadFromSaveAndGetModifiedPositions(std::deque<FVoxelChunkSave>& Save, std::deque<FIntVector>& OutModifiedPositions)
+void FValueOctree::AddToCompressionReport(FVoxelLeafCompressionReport& Report) const
 {
-	if (Save.empty())
+	check(Depth == 0 && IsLeaf());
+
+	if (!IsDirty())
 	{
 		return;
 	}
 
-	if (Depth == 0)
+	TouchLeafData();
+
+	// Compress a copy if resident: the leaf itself stays as it is
+	TArray<uint8> Compressed;
+	if (IsCompressed())
+	{
+		Compressed = CompressedLeafData;
+	}
+	else if (LeafData.IsValid() && LeafData->GetFormat() != EVoxelLeafFormat::Uniform)
+	{
+		LeafData->Compress(Compressed);
+	}
+	else
+	{
+		return;
+	}
+
+	FVoxelLeafData Decompressed;
+	const double StartTime = FPlatformTime::Seconds();
+	Decompressed.Decompress(Compressed);
+	const double DecompressionTime = FPlatformTime::Seconds() - StartTime;
+
+	Report.LeafCount++;
+	Report.UncompressedSize += Decompressed.GetAllocatedSize();
+	Report.CompressedSize += Compressed.Num();
+	Report.DecompressionTime += DecompressionTime;
+	Report.MaxDecompressionTime = FMath::Max(Report.MaxDecompressionTime, DecompressionTime);
+}
+
+uint64 FValueOctree::GetGenerationOverlappingBox(const FVoxelBox& Box) const
+{
+	const FVoxelBox Bounds(GetMinimalCornerPosition(), GetMaximalCornerPosition() - FIntVector(1, 1, 1));
+	if (!IsDirty() || !Bounds.Intersect(Box))
+	{
+		return 0;
+	}
+
+	if (IsLeaf() || (Box.IsInside(Bounds.Min) && Box.IsInside(Bounds.Max)))
 	{
-		if (Save.front().Id == Id)
+		return Generation.load();
+	}
+	else
+	{
+		uint64 MaxGeneration = 0;
+		for (auto Child : Childs)
 		{
-			bIsDirty = true;
-			for (int X = 0; X < 16; X++)
-			{
-				for (int Y = 0; Y < 16; Y++)
-				{
-					for (int Z = 0; Z < 16; Z++)
-					{
-						const int Index = X + 16 * Y + 16 * 16 * Z;
-						Values[Index] = Save.front().Values[Index];
-						Materials[Index] = Save.front().Materials[Index];
-					}
-				}
-			}
-			Save.pop_front();
+			MaxGeneration = FMath::Max(MaxGeneration, Child->GetGenerationOverlappingBox(Box));
+		}
+		return MaxGeneration;
+	}
+}
+
+bool FValueOctree::GetValueRange(const FVoxelBox& Box, const int Step, FVoxelValueRange& OutRange) const
+{
+	const FVoxelBox Bounds(GetMinimalCornerPosition(), GetMaximalCornerPosition() - FIntVector(1, 1, 1));
+	if (!Bounds.Intersect(Box))
+	{
+		return true;
+	}
+	if (!IsDirty())
+	{
+		// Generator values
+		return Context->GeneratorCache->GetValueRange(Bounds.Overlap(Box), Step, OutRange);
+	}
 
-			// Update neighbors
-			const int S = Size();
-			OutModifiedPositions.push_front(Position - FIntVector(0, 0, 0));
-			OutModifiedPositions.push_front(Position - FIntVector(S, 0, 0));
-			OutModifiedPositions.push_front(Position - FIntVector(0, S, 0));
-			OutModifiedPositions.push_front(Position - FIntVector(S, S, 0));
-			OutModifiedPositions.push_front(Position - FIntVector(0, 0, S));
-			OutModifiedPositions.push_front(Position - FIntVector(S, 0, S));
-			OutModifiedPositions.push_front(Position - FIntVector(0, S, S));
-			OutModifiedPositions.push_front(Position - FIntVector(S, S, S));
+	if (IsLeaf())
+	{
+		if (IsCold())
+		{
+			// Bounds saved by Compress
+			OutRange.Add(ValueRange);
+			return bIsFullyEdited.load(std::memory_order_acquire) || Context->GeneratorCache->GetValueRange(Bounds.Overlap(Box), Step, OutRange);
+		}
+		// Bigger nodes can be flagged dirty while another thread is creating their childs
+		if (!LeafData)
+		{
+			return false;
 		}
+		OutRange.Add(LeafData->GetValueRange());
+		if (LeafData->GetFormat() == EVoxelLeafFormat::Sparse)
+		{
+			// The voxels that aren't stored are generator values
+			return Context->GeneratorCache->GetValueRange(Bounds.Overlap(Box), Step, OutRange);
+		}
+		return true;
+	}
+	else if (bIsFullyEdited.load(std::memory_order_acquire))
+	{
+		OutRange.Add(ValueRange);
+		return true;
 	}
 	else
 	{
-		uint64 Pow = IntPow9(Depth);
-		if (Id / Pow == Save.front().Id / Pow)
+		for (auto Child : Childs)
 		{
-			if (IsLeaf())
+			if (!Child->GetValueRange(Box, Step, OutRange))
 			{
-				CreateChilds();
-				bIsDirty = true;
+				return false;
 			}
-			for (auto Child : Childs)
+		}
+		return true;
+	}
+}
+
+void FValueOctree::UpdateValueRange()
+{
+	check(!IsLeaf());
+
+	bIsFullyEdited.store(false, std::memory_order_relaxed);
+	ValueRange = FVoxelValueRange();
+	for (auto Child : Childs)
+	{
+		if (Child->IsLeaf() && Child->IsCold())
+		{
+			if (!Child->bIsFullyEdited.load(std::memory_order_acquire))
+			{
+				return;
+			}
+			ValueRange.Add(Child->ValueRange);
+		}
+		else if (Child->IsLeaf())
+		{
+			if (!Child->LeafData || Child->LeafData->GetFormat() == EVoxelLeafFormat::Sparse)
+			{
+				return;
+			}
+			ValueRange.Add(Child->LeafData->GetValueRange());
+		}
+		else
+		{
+			if (!Child->bIsFullyEdited.load(std::memory_order_acquire))
 			{
-				Child->LoadFromSaveAndGetModifiedPositions(Save, OutModifiedPositions);
+				return;
 			}
+			ValueRange.Add(Child->ValueRange);
 		}
 	}
+	bIsFullyEdited.store(true, std::memory_order_release);
 }
 
-void FValueOctree::CreateChilds()
+void FValueOctree::UpdateGeneration(uint64 NewGeneration)
 {
-	check(IsLeaf());
-	check(Childs.Num() == 0);
-	check(Depth != 0);
+	uint64 OldGeneration = Generation.load();
+	while (OldGeneration < NewGeneration && !Generation.compare_exchange_weak(OldGeneration, NewGeneration))
+	{
+	}
+}
 
-	int d = Size() / 4;
-	uint64 Pow = IntPow9(Depth - 1);
-
-	Childs.Add(new FValueOctree(WorldGenerator, Position + FIntVector(-d, -d, -d), Depth - 1, Id + 1 * Pow));
-	Childs.Add(new FValueOctree(WorldGenerator, Position + FIntVector(+d, -d, -d), Depth - 1, Id + 2 * Pow));
-	Childs.Add(new FValueOctree(WorldGenerator, Position + FIntVector(-d, +d, -d), Depth - 1, Id + 3 * Pow));
-	Childs.Add(new FValueOctree(WorldGenerator, Position + FIntVector(+d, +d, -d), Depth - 1, Id + 4 * Pow));
-	Childs.Add(new FValueOctree(WorldGenerator, Position + FIntVector(-d, -d, +d), Depth - 1, Id + 5 * Pow));
-	Childs.Add(new FValueOctree(WorldGenerator, Position + FIntVector(+d, -d, +d), Depth - 1, Id + 6 * Pow));
-	Childs.Add(new FValueOctree(WorldGenerator, Position + FIntVector(-d, +d, +d), Depth - 1, Id + 7 * Pow));
-	Childs.Add(new FValueOctree(WorldGenerator, Position + FIntVector(+d, +d, +d), Depth - 1, Id + 8 * Pow));
-
-	bHasChilds = true;
-	check(!IsLeaf() == (Childs.Num() == 8));
+void FValueOctree::TryMergeChilds()
+{
+	check(!IsLeaf());
+
+	FVoxelValue UniformValue;
+	FVoxelMaterial UniformMaterial;
+	for (int ChildIndex = 0; ChildIndex < 8; ChildIndex++)
+	{
+		FValueOctree* Child = Childs[ChildIndex];
+
+		FVoxelValue ChildValue;
+		FVoxelMaterial ChildMaterial;
+		if (!Child->IsLeaf() || !Child->LeafData || !Child->LeafData->IsUniform(ChildValue, ChildMaterial))
+		{
+			return;
+		}
+		if (ChildIndex == 0)
+		{
+			UniformValue = ChildValue;
+			UniformMaterial = ChildMaterial;
+		}
+		else if (ChildValue != UniformValue || !(ChildMaterial == UniformMaterial))
+		{
+			return;
+		}
+	}
+
+	bHasChilds.store(false, std::memory_order_release);
+	DeleteChilds();
+
+	LeafData = MakeShareable(new FVoxelLeafData(UniformValue, UniformMaterial));
+	check(IsDirty());
+}
+
+void FValueOctree::AddUniformChunksToSnapshot(const FIntVector& ChunkPosition, int ChunkDepth, uint64 ChunkId, const FVoxelBox& Box, FVoxelDataSnapshot& Snapshot) const
+{
+	const int ChunkSize = VOXEL_LEAF_SIZE << ChunkDepth;
+	const FIntVector ChunkMin = ChunkPosition - FIntVector(ChunkSize / 2, ChunkSize / 2, ChunkSize / 2);
+	if (!FVoxelBox(ChunkMin, ChunkMin + FIntVector(ChunkSize - 1, ChunkSize - 1, ChunkSize - 1)).Intersect(Box))
+	{
+		return;
+	}
+
+	if (ChunkDepth == 0)
+	{
+		FVoxelSnapshotChunk Chunk;
+		Chunk.Id = ChunkId;
+		Chunk.Position = ChunkPosition;
+		Chunk.LeafData = GetLeafDataForRead();
+		Chunk.LeafMin = GetMinimalCornerPosition();
+		Snapshot.AddChunk(Chunk);
+	}
+	else
+	{
+		// Same order as CreateChilds
+		const int d = ChunkSize / 4;
+		for (int ChildIndex = 0; ChildIndex < 8; ChildIndex++)
+		{
+			const FIntVector Offset((ChildIndex & 1) ? d : -d, (ChildIndex & 2) ? d : -d, (ChildIndex & 4) ? d : -d);
+			AddUniformChunksToSnapshot(ChunkPosition + Offset, ChunkDepth - 1, GetChildId(ChunkId, ChildIndex), Box, Snapshot);
+		}
+	}
+}
+
+bool FValueOctree::IsPagedOut() const
+{
+	return PageIndex.load(std::memory_order_acquire) != INDEX_NONE;
+}
+
+bool FValueOctree::IsCompressed() const
+{
+	return CompressedLeafData.Num() > 0;
+}
+
+bool FValueOctree::IsCold() const
+{
+	// Don't read CompressedLeafData if paged out: a reader may be paging it in
+	return IsPagedOut() || IsCompressed();
+}
+
+void FValueOctree::TouchLeafData() const
+{
+	if (IsPagedOut())
+	{
+		PageIn();
+	}
+
+	// Avoid writing the same cache line from all the threads
+	const uint32 Epoch = Context->LeafPager->GetEpoch();
+	if (LastAccess.load(std::memory_order_relaxed) != Epoch)
+	{
+		LastAccess.store(Epoch, std::memory_order_relaxed);
+	}
+}
+
+void FValueOctree::PageIn() const
+{
+	SCOPE_CYCLE_COUNTER(STAT_FValueOctree_PageIn);
+
+	FScopeLock Lock(&Context->LeafPager->Section);
+
+	// Another reader may have paged it in while we were waiting
+	const int32 Page = PageIndex.load(std::memory_order_relaxed);
+	if (Page != INDEX_NONE)
+	{
+		Context->LeafPager->Read(Page, CompressedLeafData);
+		PageIndex.store(INDEX_NONE, std::memory_order_release);
+
+		INC_DWORD_STAT(STAT_VoxelCompressedLeafs);
+		INC_MEMORY_STAT_BY(STAT_VoxelCompressedLeafsMemory, CompressedLeafData.GetAllocatedSize());
+	}
+}
+
+TSharedPtr<FVoxelLeafData, ESPMode::ThreadSafe> FValueOctree::GetLeafDataForRead() const
+{
+	if (IsCompressed())
+	{
+		return Context->LeafCache->Get(this, CompressedLeafData);
+	}
+	return LeafData;
+}
+
+void FValueOctree::DecompressLeafData()
+{
+	if (!IsCompressed())
+	{
+		return;
+	}
+
+	// Reuse the copy of the readers if any. Snapshots can share it: MakeLeafDataUnique copies it if needed
+	LeafData = Context->LeafCache->Remove(this);
+	if (!LeafData.IsValid())
+	{
+		LeafData = MakeShareable(new FVoxelLeafData());
+		LeafData->Decompress(CompressedLeafData);
+	}
+
+	DEC_DWORD_STAT(STAT_VoxelCompressedLeafs);
+	DEC_MEMORY_STAT_BY(STAT_VoxelCompressedLeafsMemory, CompressedLeafData.GetAllocatedSize());
+	CompressedLeafData.Empty();
+}
+
+void FValueOctree::MakeLeafDataUnique()
+{
+	check(LeafData.IsValid());
+
+	// Snapshots can only be created with a read lock, so no new reference can appear while we hold the write lock
+	if (!LeafData.IsUnique())
+	{
+		LeafData = MakeShareable(new FVoxelLeafData(*LeafData));
+		INC_DWORD_STAT(STAT_VoxelLeafsCopiedOnWrite);
+	}
 }
 
 void FValueOctree::SetAsDirty()
@@ -502,30 +907,39 @@ void FValueOctree::SetAsDirty()
 	check(!IsDirty());
 	check(Depth == 0);
 
-	FIntVector Min = GetMinimalCornerPosition();
-	GetValuesAndMaterials(Values, Materials, FIntVector(Min.X, Min.Y, Min.Z), FIntVector::ZeroValue, 1, FIntVector(16, 16, 16), FIntVector(16, 16, 16));
+	// Empty sparse leaf: values are still the generator ones
+	LeafData = MakeShareable(new FVoxelLeafData());
+	bIsDirty.store(true, std::memory_order_release);
+}
 
-	bIsDirty = true;
+void FValueOctree::GetGeneratorValuesAndMaterials(FVoxelValue OutValues[], FVoxelMaterial OutMaterials[]) const
+{
+	GetGeneratorValuesAndMaterials(OutValues, OutMaterials, GetMinimalCornerPosition(), FIntVector::ZeroValue, 1, FIntVector(VOXEL_LEAF_SIZE, VOXEL_LEAF_SIZE, VOXEL_LEAF_SIZE), FIntVector(VOXEL_LEAF_SIZE, VOXEL_LEAF_SIZE, VOXEL_LEAF_SIZE));
+}
+
+void FValueOctree::GetGeneratorValuesAndMaterials(FVoxelValue OutValues[], FVoxelMaterial OutMaterials[], const FIntVector& Start, const FIntVector& StartIndex, const int Step, const FIntVector& Size, const FIntVector& ArraySize) const
+{
+	Context->GeneratorCache->GetValuesAndMaterials(OutValues, OutMaterials, Start, StartIndex, Step, Size, ArraySize);
 }
 
 int FValueOctree::IndexFromCoordinates(int X, int Y, int Z) const
 {
-	check(0 <= X && X < 16);
-	check(0 <= Y && Y < 16);
-	check(0 <= Z && Z < 16);
-	return X + 16 * Y + 16 * 16 * Z;
+	check(0 <= X && X < VOXEL_LEAF_SIZE);
+	check(0 <= Y && Y < VOXEL_LEAF_SIZE);
+	check(0 <= Z && Z < VOXEL_LEAF_SIZE);
+	return X + VOXEL_LEAF_SIZE * Y + VOXEL_LEAF_SIZE * VOXEL_LEAF_SIZE * Z;
 }
 
 void FValueOctree::CoordinatesFromIndex(int Index, int& OutX, int& OutY, int& OutZ) const
 {
-	check(0 <= Index && Index < 16 * 16 * 16);
+	check(0 <= Index && Index < VOXEL_LEAF_VOXELS);
 
-	OutX = Index % 16;
+	OutX = Index % VOXEL_LEAF_SIZE;
 
-	Index = (Index - OutX) / 16;
-	OutY = Index % 16;
+	Index = (Index - OutX) / VOXEL_LEAF_SIZE;
+	OutY = Index % VOXEL_LEAF_SIZE;
 
-	Index = (Index - OutY) / 16;
+	Index = (Index - OutY) / VOXEL_LEAF_SIZE;
 	OutZ = Index;
 }
 
@@ -558,16 +972,8 @@ void FValueOctree::GetDirtyChunksPositions(std::deque<FIntVector>& OutPositions)
 	{
 		if (IsLeaf())
 		{
-			// With neighbors
-			const int S = Size();
-			OutPositions.push_front(Position - FIntVector(0, 0, 0));
-			OutPositions.push_front(Position - FIntVector(S, 0, 0));
-			OutPositions.push_front(Position - FIntVector(0, S, 0));
-			OutPositions.push_front(Position - FIntVector(S, S, 0));
-			OutPositions.push_front(Position - FIntVector(0, 0, S));
-			OutPositions.push_front(Position - FIntVector(S, 0, S));
-			OutPositions.push_front(Position - FIntVector(0, S, S));
-			OutPositions.push_front(Position - FIntVector(S, S, S));
+			// Merged uniform nodes add all their render chunks
+			GetChunksPositions(GetMinimalCornerPosition(), Size(), OutPositions);
 		}
 		else
 		{
@@ -577,4 +983,29 @@ void FValueOctree::GetDirtyChunksPositions(std::deque<FIntVector>& OutPositions)
 			}
 		}
 	}
+}
+
+void FValueOctree::GetChunksPositions(const FIntVector& Min, int Width, std::deque<FIntVector>& OutPositions)
+{
+	for (int X = 0; X < Width; X += 16)
+	{
+		for (int Y = 0; Y < Width; Y += 16)
+		{
+			for (int Z = 0; Z < Width; Z += 16)
+			{
+				const FIntVector ChunkPosition = Min + FIntVector(X + 8, Y + 8, Z + 8);
+
+				// With neighbors
+				const int S = 16;
+				OutPositions.push_front(ChunkPosition - FIntVector(0, 0, 0));
+				OutPositions.push_front(ChunkPosition - FIntVector(S, 0, 0));
+				OutPositions.push_front(ChunkPosition - FIntVector(0, S, 0));
+				OutPositions.push_front(ChunkPosition - FIntVector(S, S, 0));
+				OutPositions.push_front(ChunkPosition - FIntVector(0, 0, S));
+				OutPositions.push_front(ChunkPosition - FIntVector(S, 0, S));
+				OutPositions.push_front(ChunkPosition - FIntVector(0, S, S));
+				OutPositions.push_front(ChunkPosition - FIntVector(S, S, S));
+			}
+		}
+	}
 }
\ No newline at end of file
@@ -4,11 +4,55 @@
 
 #include "CoreMinimal.h"
 #include "Octree.h"
+#include "OctreeNodePool.h"
 #include "VoxelSave.h"
 #include <deque>
+#include <atomic>
 
 class UVoxelWorldGenerator;
+class FVoxelLeafData;
+class FVoxelGeneratorCache;
+class FVoxelLeafIndex;
+class FVoxelLeafPager;
+class FVoxelLeafCache;
+class FVoxelDataSnapshot;
 struct FVoxelAsset;
+struct FVoxelLeafCompressionReport;
+class FValueOctree;
+
+/**
+ * Objects of a world shared by all its octree nodes. Owned by FVoxelData, and destroyed after the nodes
+ */
+struct FValueOctreeContext
+{
+	FValueOctreeContext(UVoxelWorldGenerator* WorldGenerator, FVoxelGeneratorCache* GeneratorCache, TOctreeNodePool<FValueOctree>* NodePool, FVoxelLeafIndex* LeafIndex, FVoxelLeafPager* LeafPager, FVoxelLeafCache* LeafCache)
+		: WorldGenerator(WorldGenerator)
+		, GeneratorCache(GeneratorCache)
+		, NodePool(NodePool)
+		, LeafIndex(LeafIndex)
+		, LeafPager(LeafPager)
+		, LeafCache(LeafCache)
+	{
+	}
+
+	// Generator for this world
+	UVoxelWorldGenerator* const WorldGenerator;
+
+	// Cache of the generator output
+	FVoxelGeneratorCache* const GeneratorCache;
+
+	// Allocator of the childs
+	TOctreeNodePool<FValueOctree>* const NodePool;
+
+	// Index of the Depth 0 nodes, updated when they are created or deleted
+	FVoxelLeafIndex* const LeafIndex;
+
+	// Page file of the leafs
+	FVoxelLeafPager* const LeafPager;
+
+	// Decompressed copies of the compressed leafs
+	FVoxelLeafCache* const LeafCache;
+};
 
 /**
  * Octree that holds modified values & colors
@@ -18,15 +62,15 @@ class FValueOctree : public FOctree
 public:
 	/**
 	 * Constructor
-	 * @param	Position		Position (center) of this in voxel space
-	 * @param	Depth			Distance to the highest resolution
-	 * @param	WorldGenerator	Generator of the current world
+	 * @param	Context		Objects of the world, shared by all the nodes
+	 * @param	Position	Position (center) of this in voxel space
+	 * @param	Depth		Distance to the highest resolution
 	 */
-	FValueOctree(UVoxelWorldGenerator* WorldGenerator, FIntVector Position, uint8 Depth, uint64 Id);
+	FValueOctree(const FValueOctreeContext* Context, FIntVector Position, uint8 Depth, uint64 Id);
 	~FValueOctree();
 
-	// Generator for this world
-	UVoxelWorldGenerator* WorldGenerator;
+	// Objects of the world, shared by all the nodes
+	const FValueOctreeContext* const Context;
 
 	/**
 	 * Does this chunk have been modified?
@@ -35,25 +79,48 @@ public:
 	FORCEINLINE bool IsDirty() const;
 
 	/**
-	 * Get value and color at position
-	 * @param	GlobalPosition	Position in voxel space
-	 * @return	Value
-	 * @return	Color
+	 * Get the generation of the last edit of the voxels of Box, 0 if they have never been edited
+	 * @param	Box		Voxels to check
 	 */
-	void GetValuesAndMaterials(float Values[], FVoxelMaterial Materials[], const FIntVector& Start, const FIntVector& StartIndex, const int Step, const FIntVector& Size, const FIntVector& ArraySize) const;
+	uint64 GetGenerationOverlappingBox(const FVoxelBox& Box) const;
+
+	/**
+	 * Add the bounds of the values overlapping Box to OutRange. Can be wider than the actual values
+	 * Edited values are bounded by the leafs, the others by the world generator
+	 * @param	Box			Voxels to check
+	 * @param	Step		Only the voxels whose coordinates are multiples of Step are read
+	 * @param	OutRange	Range to add to
+	 * @return	Whether the bounds of all the voxels of Box in this node are known. If false, OutRange is incomplete
+	 */
+	bool GetValueRange(const FVoxelBox& Box, const int Step, FVoxelValueRange& OutRange) const;
+
+	/**
+	 * Get the values & materials of a box, in one traversal: unmodified nodes are generated together at the end
+	 * @param	Values		Output values. Can be nullptr
+	 * @param	Materials	Output materials. Can be nullptr
+	 * @param	Start		Position of the first voxel. The whole box must be in this node
+	 * @param	StartIndex	Index of the first voxel in the arrays
+	 * @param	Step		Distance between two voxels
+	 * @param	Size		Number of voxels along each axis
+	 * @param	ArraySize	Size of the arrays
+	 */
+	void GetValuesAndMaterials(FVoxelValue Values[], FVoxelMaterial Materials[], const FIntVector& Start, const FIntVector& StartIndex, const int Step, const FIntVector& Size, const FIntVector& ArraySize) const;
 
 	void SetValueAndMaterial(int X, int Y, int Z, float Value, FVoxelMaterial Material, bool bSetValue, bool bSetMaterial);
 
 	/**
-	 * Add dirty chunks to SaveList
-	 * @param	SaveList		List to save chunks into
+	 * Add the dirty Depth 0 chunks overlapping Box to a snapshot, in octree order. Their leafs are shared, not copied
+	 * @param	Box				Box of the snapshot
+	 * @param	MinGeneration	Only add the chunks edited at this generation or after
+	 * @param	Snapshot		Snapshot to add the chunks to
 	 */
-	void AddDirtyChunksToSaveList(std::deque<TSharedRef<FVoxelChunkSave>>& SaveList);
+	void AddChunksToSnapshot(const FVoxelBox& Box, uint64 MinGeneration, FVoxelDataSnapshot& Snapshot) const;
 	/**
-	 * Load chunks from SaveArray
-	 * @param	SaveArray	Array to load chunks from
+	 * Load a chunk of a save. Must be called on the leaf containing it, like SetValueAndMaterial
+	 * @param	Chunk					Depth 0 chunk
+	 * @param	OutModifiedPositions	Positions of the render chunks to update
 	 */
-	void LoadFromSaveAndGetModifiedPositions(std::deque<FVoxelChunkSave>& Save, std::deque<FIntVector>& OutModifiedPositions);
+	void LoadChunk(const FVoxelChunkSave& Chunk, std::deque<FIntVector>& OutModifiedPositions);
 
 	/**
 	* Get direct child that owns GlobalPosition
@@ -63,12 +130,75 @@ public:
 
 	FORCEINLINE FValueOctree* GetLeaf(int X, int Y, int Z);
 
+	/**
+	 * Create childs of all the nodes overlapping Box, down to MinDepth
+	 * @param	Box			Box to subdivide
+	 * @param	MinDepth	Depth at which to stop
+	 */
+	void CreateChildsOverlappingBox(const FVoxelBox& Box, int MinDepth);
+
+	/**
+	 * Make the leafs overlapping Box that were edited since the last call uniform when possible, and merge uniform childs
+	 * Leafs edited since the last call and their parents get NewGeneration
+	 * @param	Box				Box that has been edited
+	 * @param	MaxMergeDepth	Max depth of the nodes whose childs can be merged
+	 * @param	NewGeneration	Generation of this edit
+	 * @return	Whether a leaf of this node has been edited
+	 */
+	bool CompactOverlappingBox(const FVoxelBox& Box, int MaxMergeDepth, uint64 NewGeneration);
+
+	/**
+	 * Memory used by the values of this leaf, compressed or not. 0 if paged out
+	 */
+	uint32 GetLeafDataSize() const;
+
+	/**
+	 * Pager epoch of the last access to the values of this leaf
+	 */
+	uint32 GetLastAccess() const;
+
+	/**
+	 * Can the values of this leaf be compressed? Only Depth 0 leafs that are compacted, not uniform and not shared with a snapshot can
+	 */
+	bool CanBeCompressed() const;
+
+	/**
+	 * Compress the values of this leaf. Readers use a decompressed copy from LeafCache, writers decompress them in place
+	 * The region of this leaf must be locked for writing
+	 */
+	void Compress();
+
+	/**
+	 * Can the values of this leaf be written to the page file? It must be compressed or compressible
+	 */
+	bool CanBePagedOut() const;
+
+	/**
+	 * Compress the values of this leaf if needed, write them to the page file and free them. They are paged in on the next access
+	 * Its region must be locked for writing
+	 */
+	void PageOut();
+
+	/**
+	 * Add this leaf to a compression report: compress it if needed and time its decompression. The region of this leaf must be locked
+	 * @see FVoxelData::GetLeafCompressionReport
+	 */
+	void AddToCompressionReport(FVoxelLeafCompressionReport& Report) const;
+
 	/**
 	 * Queue update of dirty chunks
 	 * @param	World	Voxel world
 	 */
 	void GetDirtyChunksPositions(std::deque<FIntVector>& OutPositions);
 
+	/**
+	 * Add the positions of the 16^3 render chunks of a box, with their neighbors
+	 * @param	Min				Minimal corner of the box
+	 * @param	Width			Width of the box, multiple of 16
+	 * @param	OutPositions	Positions to add to
+	 */
+	static void GetChunksPositions(const FIntVector& Min, int Width, std::deque<FIntVector>& OutPositions);
+
 private:
 	/*
 	Childs of this octree in the following order:
@@ -81,23 +211,120 @@ private:
 	*/
 	TArray<FValueOctree*, TFixedAllocator<8>> Childs;
 
-	// Values if dirty
-	float Values[16 * 16 * 16];
-	// Materials if dirty
-	FVoxelMaterial Materials[16 * 16 * 16];
+	// Values & materials if dirty leaf. Leafs with Depth != 0 are merged uniform nodes
+	// Shared with the snapshots: copied before being modified if not unique
+	// Null if compressed or paged out, see TouchLeafData
+	TSharedPtr<FVoxelLeafData, ESPMode::ThreadSafe> LeafData;
 
-	bool bIsDirty;
+	// LeafData compressed by FVoxelLeafData::Compress if the leaf is idle. Read back by readers when paged in
+	mutable TArray<uint8> CompressedLeafData;
+
+	// Page of CompressedLeafData in the page file, INDEX_NONE if in memory. Set back to INDEX_NONE after CompressedLeafData when paged in
+	mutable std::atomic<int32> PageIndex;
+	// Pager epoch of the last access to the values
+	mutable std::atomic<uint32> LastAccess;
+
+	// Set with release semantics after the childs or the leaf data: nodes above the lock regions are read by the other regions
+	std::atomic<bool> bIsDirty;
+
+	// Has this leaf been edited since the last CompactOverlappingBox?
+	bool bHasNewEdits;
+
+	// Generation of the last edit of this node or of its childs. Nodes above the lock regions are updated by several writers
+	std::atomic<uint64> Generation;
+
+	// If not leaf: are all the voxels of the childs edited? Only computed up to the lock regions depth, see CompactOverlappingBox
+	// If compressed or paged out leaf: were its values not sparse?
+	// Stored with release semantics after ValueRange
+	std::atomic<bool> bIsFullyEdited;
+	// If bIsFullyEdited: bounds of the values of the childs. If compressed or paged out leaf: bounds of its values
+	FVoxelValueRange ValueRange;
+
+	/**
+	 * Recompute bIsFullyEdited and ValueRange from the childs
+	 */
+	void UpdateValueRange();
+
+	/**
+	 * Set Generation to NewGeneration if it is bigger
+	 */
+	void UpdateGeneration(uint64 NewGeneration);
 
 	/**
-	 * Create childs of this octree
+	 * Create childs of this octree. Childs of a merged uniform node are uniform
 	 */
 	void CreateChilds();
 
+	/**
+	 * Destruct the childs and give their memory back to the pool
+	 */
+	void DeleteChilds();
+
+	/**
+	 * Replace the childs by an uniform leaf if they are all uniform with the same value & material
+	 */
+	void TryMergeChilds();
+
+	/**
+	 * Add the Depth 0 chunks of a merged uniform node overlapping Box to a snapshot
+	 */
+	void AddUniformChunksToSnapshot(const FIntVector& ChunkPosition, int ChunkDepth, uint64 ChunkId, const FVoxelBox& Box, FVoxelDataSnapshot& Snapshot) const;
+
+	FORCEINLINE bool IsPagedOut() const;
+	FORCEINLINE bool IsCompressed() const;
+
+	/**
+	 * Is this leaf compressed or paged out? If so, ValueRange & bIsFullyEdited hold the bounds of its values
+	 */
+	FORCEINLINE bool IsCold() const;
+
+	/**
+	 * Page in the values if needed and record the access. Must be called before using LeafData or CompressedLeafData
+	 */
+	FORCEINLINE void TouchLeafData() const;
+
+	/**
+	 * Read CompressedLeafData from the page file. Several readers can call it at the same time
+	 */
+	void PageIn() const;
+
+	/**
+	 * Get the values of this leaf for reading: LeafData, or its decompressed copy if compressed. TouchLeafData must be called before
+	 */
+	TSharedPtr<FVoxelLeafData, ESPMode::ThreadSafe> GetLeafDataForRead() const;
+
+	/**
+	 * Decompress LeafData in place if compressed, before modifying it. TouchLeafData must be called before
+	 */
+	void DecompressLeafData();
+
+	/**
+	 * Copy LeafData if a snapshot is using it. Must be called before modifying it
+	 */
+	void MakeLeafDataUnique();
+
 	/**
 	 * Init arrays
 	 */
 	void SetAsDirty();
 
+	/**
+	 * GetValuesAndMaterials of a leaf
+	 * @see		GetValuesAndMaterials
+	 */
+	void GetLeafValuesAndMaterials(FVoxelValue Values[], FVoxelMaterial Materials[], const FIntVector& Start, const FIntVector& StartIndex, const int Step, const FIntVector& Size, const FIntVector& ArraySize) const;
+
+	/**
+	 * Get the generator values & materials of this leaf
+	 */
+	void GetGeneratorValuesAndMaterials(FVoxelValue OutValues[], FVoxelMaterial OutMaterials[]) const;
+
+	/**
+	 * Get generator values & materials from the cache
+	 * @see		GetValuesAndMaterials
+	 */
+	void GetGeneratorValuesAndMaterials(FVoxelValue OutValues[], FVoxelMaterial OutMaterials[], const FIntVector& Start, const FIntVector& StartIndex, const int Step, const FIntVector& Size, const FIntVector& ArraySize) const;
+
 	FORCEINLINE int IndexFromCoordinates(int X, int Y, int Z) const;
 
 	FORCEINLINE void CoordinatesFromIndex(int Index, int& OutX, int& OutY, int& OutZ) const;
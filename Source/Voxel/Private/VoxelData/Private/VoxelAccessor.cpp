@@ -0,0 +1,160 @@
+// Copyright 2017 Phyronnaz
+
+#include "VoxelAccessor.h"
+#include "VoxelData.h"
+#include "ValueOctree.h"
+#include "VoxelGeneratorCache.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Voxel Accessor Leaf Lookups"), STAT_VoxelAccessorLeafLookups, STATGROUP_Voxel);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Voxel Accessor Generator Blocks"), STAT_VoxelAccessorGeneratorBlocks, STATGROUP_Voxel);
+
+FVoxelAccessor::FVoxelAccessor(FVoxelData* Data)
+	: Data(Data)
+	, CenterBlock(FIntVector::ZeroValue)
+	, LastBlock(nullptr)
+	, LastBlockCoordinates(FIntVector::ZeroValue)
+{
+
+}
+
+float FVoxelAccessor::GetValue(int X, int Y, int Z)
+{
+	FVoxelValue Value;
+	Read(X, Y, Z, &Value, nullptr);
+	return FVoxelValuePolicy::ToFloat(Value);
+}
+
+FVoxelMaterial FVoxelAccessor::GetMaterial(int X, int Y, int Z)
+{
+	FVoxelMaterial Material;
+	Read(X, Y, Z, nullptr, &Material);
+	return Material;
+}
+
+void FVoxelAccessor::GetValueAndMaterial(int X, int Y, int Z, float& OutValue, FVoxelMaterial& OutMaterial)
+{
+	FVoxelValue Value;
+	Read(X, Y, Z, &Value, &OutMaterial);
+	OutValue = FVoxelValuePolicy::ToFloat(Value);
+}
+
+void FVoxelAccessor::SetValue(int X, int Y, int Z, float Value)
+{
+	check(Data->IsInWorld(X, Y, Z));
+	GetLeaf(GetBlock(X, Y, Z), X, Y, Z)->SetValueAndMaterial(X, Y, Z, Value, FVoxelMaterial(), true, false);
+}
+
+void FVoxelAccessor::SetMaterial(int X, int Y, int Z, const FVoxelMaterial& Material)
+{
+	check(Data->IsInWorld(X, Y, Z));
+	GetLeaf(GetBlock(X, Y, Z), X, Y, Z)->SetValueAndMaterial(X, Y, Z, 0, Material, false, true);
+}
+
+void FVoxelAccessor::SetValueAndMaterial(int X, int Y, int Z, float Value, const FVoxelMaterial& Material)
+{
+	check(Data->IsInWorld(X, Y, Z));
+	GetLeaf(GetBlock(X, Y, Z), X, Y, Z)->SetValueAndMaterial(X, Y, Z, Value, Material, true, true);
+}
+
+FVoxelAccessor::FBlock& FVoxelAccessor::GetBlock(int X, int Y, int Z)
+{
+	const FIntVector BlockCoordinates(X >> VOXEL_LEAF_SIZE_LOG2, Y >> VOXEL_LEAF_SIZE_LOG2, Z >> VOXEL_LEAF_SIZE_LOG2);
+	if (LIKELY(LastBlock && BlockCoordinates == LastBlockCoordinates))
+	{
+		return *LastBlock;
+	}
+
+	FIntVector Offset = BlockCoordinates - CenterBlock;
+	if (UNLIKELY(!LastBlock || FMath::Abs(Offset.X) > 1 || FMath::Abs(Offset.Y) > 1 || FMath::Abs(Offset.Z) > 1))
+	{
+		Recenter(BlockCoordinates);
+		Offset = FIntVector::ZeroValue;
+	}
+
+	LastBlock = &Blocks[(Offset.X + 1) + 3 * (Offset.Y + 1) + 9 * (Offset.Z + 1)];
+	LastBlockCoordinates = BlockCoordinates;
+	return *LastBlock;
+}
+
+FValueOctree* FVoxelAccessor::GetLeaf(FBlock& Block, int X, int Y, int Z)
+{
+	// Blocks are Depth 0 nodes (or the whole world if Depth = 0): a leaf found for a voxel contains the whole block
+	if (UNLIKELY(!Block.Leaf))
+	{
+		INC_DWORD_STAT(STAT_VoxelAccessorLeafLookups);
+		Block.Leaf = Data->GetLeaf(X, Y, Z);
+	}
+	else if (UNLIKELY(!Block.Leaf->IsLeaf()))
+	{
+		// Subdivided by a write
+		Block.Leaf = Block.Leaf->GetLeaf(X, Y, Z);
+	}
+	return Block.Leaf;
+}
+
+void FVoxelAccessor::Recenter(const FIntVector& NewCenterBlock)
+{
+	FBlock OldBlocks[27];
+	for (int Index = 0; Index < 27; Index++)
+	{
+		OldBlocks[Index] = MoveTemp(Blocks[Index]);
+		Blocks[Index] = FBlock();
+	}
+
+	for (int X = -1; X <= 1; X++)
+	{
+		for (int Y = -1; Y <= 1; Y++)
+		{
+			for (int Z = -1; Z <= 1; Z++)
+			{
+				const FIntVector OldOffset = NewCenterBlock + FIntVector(X, Y, Z) - CenterBlock;
+				if (FMath::Abs(OldOffset.X) <= 1 && FMath::Abs(OldOffset.Y) <= 1 && FMath::Abs(OldOffset.Z) <= 1)
+				{
+					Blocks[(X + 1) + 3 * (Y + 1) + 9 * (Z + 1)] = MoveTemp(OldBlocks[(OldOffset.X + 1) + 3 * (OldOffset.Y + 1) + 9 * (OldOffset.Z + 1)]);
+				}
+			}
+		}
+	}
+
+	CenterBlock = NewCenterBlock;
+}
+
+void FVoxelAccessor::Read(int X, int Y, int Z, FVoxelValue* OutValue, FVoxelMaterial* OutMaterial)
+{
+	FBlock& Block = GetBlock(X, Y, Z);
+
+	// Voxels outside of the world are generator ones
+	if (LIKELY(Data->IsInWorld(X, Y, Z)))
+	{
+		FValueOctree* Leaf = GetLeaf(Block, X, Y, Z);
+		if (Leaf->IsDirty())
+		{
+			Leaf->GetValuesAndMaterials(OutValue, OutMaterial, FIntVector(X, Y, Z), FIntVector::ZeroValue, 1, FIntVector(1, 1, 1), FIntVector(1, 1, 1));
+			return;
+		}
+	}
+
+	if (!Block.GeneratorBlock.IsValid())
+	{
+		if (Block.GeneratorReads++ == 0)
+		{
+			// Single reads stay cheap: only generate this voxel
+			Data->GeneratorCache->GenerateValuesAndMaterials(OutValue, OutMaterial, FIntVector(X, Y, Z), FIntVector::ZeroValue, 1, FIntVector(1, 1, 1), FIntVector(1, 1, 1));
+			return;
+		}
+
+		INC_DWORD_STAT(STAT_VoxelAccessorGeneratorBlocks);
+		Block.GeneratorBlock = Data->GeneratorCache->GetBlock(FVoxelGeneratorCacheKey(FIntVector(X >> VOXEL_LEAF_SIZE_LOG2, Y >> VOXEL_LEAF_SIZE_LOG2, Z >> VOXEL_LEAF_SIZE_LOG2) * VOXEL_LEAF_SIZE, 1));
+	}
+
+	const int Mask = VOXEL_LEAF_SIZE - 1;
+	const int Index = (X & Mask) + VOXEL_LEAF_SIZE * (Y & Mask) + VOXEL_LEAF_SIZE * VOXEL_LEAF_SIZE * (Z & Mask);
+	if (OutValue)
+	{
+		*OutValue = Block.GeneratorBlock->Values[Index];
+	}
+	if (OutMaterial)
+	{
+		*OutMaterial = Block.GeneratorBlock->Materials[Index];
+	}
+}
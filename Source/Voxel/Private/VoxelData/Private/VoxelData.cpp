@@ -1,28 +1,62 @@
 // Copyright 2017 Phyronnaz
 
 #include "VoxelData.h"
+#include "VoxelPrivate.h"
 #include "ValueOctree.h"
+#include "VoxelGeneratorCache.h"
+#include "VoxelLeafIndex.h"
+#include "VoxelLeafPager.h"
+#include "VoxelLeafCache.h"
+#include "VoxelPendingSaves.h"
+#include "VoxelDataSnapshot.h"
+#include "VoxelAccessor.h"
 #include "VoxelSave.h"
+#include "VoxelTaskGroup.h"
 #include "VoxelWorldGenerator.h"
 
-FVoxelData::FVoxelData(int Depth, UVoxelWorldGenerator* WorldGenerator)
+DECLARE_CYCLE_STAT(TEXT("VoxelData ~ Wait for read lock"), STAT_VoxelData_WaitRead, STATGROUP_Voxel);
+DECLARE_CYCLE_STAT(TEXT("VoxelData ~ Wait for write lock"), STAT_VoxelData_WaitWrite, STATGROUP_Voxel);
+DECLARE_CYCLE_STAT(TEXT("VoxelData ~ Subdivide for write"), STAT_VoxelData_Subdivide, STATGROUP_Voxel);
+DECLARE_CYCLE_STAT(TEXT("VoxelData ~ Compact after write"), STAT_VoxelData_Compact, STATGROUP_Voxel);
+DECLARE_CYCLE_STAT(TEXT("VoxelData ~ Sample batch"), STAT_VoxelData_SampleBatch, STATGROUP_Voxel);
+DECLARE_CYCLE_STAT(TEXT("VoxelData ~ Create snapshot"), STAT_VoxelData_CreateSnapshot, STATGROUP_Voxel);
+DECLARE_CYCLE_STAT(TEXT("VoxelData ~ Get delta save"), STAT_VoxelData_GetDeltaSave, STATGROUP_Voxel);
+DECLARE_CYCLE_STAT(TEXT("VoxelData ~ Load chunks"), STAT_VoxelData_LoadChunks, STATGROUP_Voxel);
+DECLARE_CYCLE_STAT(TEXT("VoxelData ~ Load pending region"), STAT_VoxelData_LoadPendingRegion, STATGROUP_Voxel);
+DECLARE_CYCLE_STAT(TEXT("VoxelData ~ Page out leafs"), STAT_VoxelData_PageOutLeafs, STATGROUP_Voxel);
+DECLARE_CYCLE_STAT(TEXT("VoxelData ~ Compress idle leafs"), STAT_VoxelData_CompressIdleLeafs, STATGROUP_Voxel);
+DECLARE_CYCLE_STAT(TEXT("VoxelData ~ Leaf compression report"), STAT_VoxelData_LeafCompressionReport, STATGROUP_Voxel);
+
+FVoxelData::FVoxelData(int Depth, UVoxelWorldGenerator* WorldGenerator, uint64 LeafMemoryBudget, uint32 LeafCompressionDelay)
 	: Depth(Depth)
 	, WorldGenerator(WorldGenerator)
+	, OctreeDepth(Depth + 4 - VOXEL_LEAF_SIZE_LOG2)
+	, LockRegionDepth(FMath::Clamp(VOXEL_LOCK_REGION_DEPTH + 4 - VOXEL_LEAF_SIZE_LOG2, 0, OctreeDepth))
+	, GeneratorCache(new FVoxelGeneratorCache(WorldGenerator))
+	, LeafIndex(new FVoxelLeafIndex(Depth, LockRegionDepth))
+	, LeafPager(new FVoxelLeafPager(LeafMemoryBudget))
+	, LeafCache(new FVoxelLeafCache())
+	, OctreeContext(new FValueOctreeContext(WorldGenerator, GeneratorCache, &NodePool, LeafIndex, LeafPager, LeafCache))
+	, PendingSaves(new FVoxelPendingSaves(Depth, OctreeDepth, LockRegionDepth))
+	, LeafCompressionDelay(LeafCompressionDelay)
+	, LastGeneration(0)
+	, SavedGeneration(0)
 {
-	MainOctree = new FValueOctree(WorldGenerator, FIntVector::ZeroValue, Depth, FOctree::GetTopIdFromDepth(Depth));
-
-	GetCount.Reset();
+	static_assert(VOXEL_LOCK_COUNT == 4 * 4 * 4, "Lock index is computed from region coordinates modulo 4");
+	checkf(0 <= OctreeDepth && OctreeDepth <= MAX_OCTREE_DEPTH, TEXT("World depth %d is too small or too big for leafs of %d voxels"), Depth, VOXEL_LEAF_SIZE);
 
-	CanGetEvent = FGenericPlatformProcess::GetSynchEventFromPool(true);
-	CanSetEvent = FGenericPlatformProcess::GetSynchEventFromPool(false);
-
-	CanGetEvent->Trigger();
-	CanSetEvent->Trigger();
+	MainOctree = new FValueOctree(OctreeContext, FIntVector::ZeroValue, OctreeDepth, FOctree::GetTopId());
 }
 
 FVoxelData::~FVoxelData()
 {
 	delete MainOctree;
+	delete GeneratorCache;
+	delete LeafIndex;
+	delete LeafPager;
+	delete LeafCache;
+	delete OctreeContext;
+	delete PendingSaves;
 }
 
 int FVoxelData::Size() const
@@ -30,51 +64,328 @@ int FVoxelData::Size() const
 	return 16 << Depth;
 }
 
-void FVoxelData::BeginSet()
+void FVoxelData::BeginSet(const FVoxelBox& Box)
 {
-	WaitingSetCount.Increment();
-	CanGetEvent->Reset();
-	CanSetEvent->Wait(); // Auto reset
-	CanGetEvent->Reset(); // Make sure
+	LockWrite(GetLocksMask(Box));
 
-	WaitingSetCount.Decrement();
+	// Saves are only added while the whole world is locked: the ones pending now were loaded before this edit, and must not be applied after it
+	LoadPendingRegions(Box, 0);
 
-	SetCount.Increment();
-	check(SetCount.GetValue() == 1);
+	if (LockRegionDepth < OctreeDepth)
+	{
+		SCOPE_CYCLE_COUNTER(STAT_VoxelData_Subdivide);
+
+		// Nodes above the regions are shared with other readers/writers: make sure SetValueAndMaterial won't have to create their childs
+		FScopeLock Lock(&StructureLock);
+		MainOctree->CreateChildsOverlappingBox(Box, LockRegionDepth);
+	}
 }
 
-void FVoxelData::EndSet()
+void FVoxelData::EndSet(const FVoxelBox& Box)
 {
-	check(SetCount.GetValue() == 1);
-	SetCount.Decrement();
-
-	CanSetEvent->Trigger();
-	if (WaitingSetCount.GetValue() == 0)
 	{
-		CanGetEvent->Trigger();
+		SCOPE_CYCLE_COUNTER(STAT_VoxelData_Compact);
+
+		// Nodes up to the regions depth are only accessed with their region lock
+		MainOctree->CompactOverlappingBox(Box, LockRegionDepth, ++LastGeneration);
 	}
+	UnlockWrite(GetLocksMask(Box));
+}
+
+void FVoxelData::BeginGet(const FVoxelBox& Box)
+{
+	LockReadLoaded(Box, 0);
+}
+
+void FVoxelData::EndGet(const FVoxelBox& Box)
+{
+	UnlockRead(GetLocksMask(Box));
+}
+
+void FVoxelData::BeginSet()
+{
+	LockWrite(~(uint64)0);
+
+	// As in BeginSet(Box). The nodes above the regions aren't created: the world would be subdivided down to the regions
+	LoadPendingRegions(GetWorldBox(), 0);
+}
+
+void FVoxelData::EndSet()
+{
+	UnlockWrite(~(uint64)0);
 }
 
 void FVoxelData::BeginGet()
 {
-	CanGetEvent->Wait();
-	CanSetEvent->Reset();
-	GetCount.Increment();
+	LockReadLoaded(GetWorldBox(), 0);
 }
 
 void FVoxelData::EndGet()
 {
-	GetCount.Decrement();
-	if (GetCount.GetValue() == 0)
+	// Small worlds don't use all the locks
+	UnlockRead(GetLocksMask(GetWorldBox()));
+}
+
+FVoxelBox FVoxelData::GetWorldBox() const
+{
+	const int S = Size() / 2;
+	return FVoxelBox(FIntVector(-S, -S, -S), FIntVector(S - 1, S - 1, S - 1));
+}
+
+uint64 FVoxelData::GetLocksMask(const FVoxelBox& Box) const
+{
+	const int S = Size() / 2;
+	const FVoxelBox WorldBox(FIntVector(-S, -S, -S), FIntVector(S - 1, S - 1, S - 1));
+	if (!WorldBox.Intersect(Box))
 	{
-		CanSetEvent->Trigger();
+		// Only the generator is used outside of the world
+		return 0;
+	}
+	const FVoxelBox ClampedBox = WorldBox.Overlap(Box);
+
+	// Region coordinates, starting at 0 on the world min corner
+	const int Shift = VOXEL_LEAF_SIZE_LOG2 + LockRegionDepth;
+	const FIntVector Min((ClampedBox.Min.X + S) >> Shift, (ClampedBox.Min.Y + S) >> Shift, (ClampedBox.Min.Z + S) >> Shift);
+	const FIntVector Max((ClampedBox.Max.X + S) >> Shift, (ClampedBox.Max.Y + S) >> Shift, (ClampedBox.Max.Z + S) >> Shift);
+
+	if (Max.X - Min.X >= 3 && Max.Y - Min.Y >= 3 && Max.Z - Min.Z >= 3)
+	{
+		return ~(uint64)0;
+	}
+
+	uint64 Mask = 0;
+	for (int X = Min.X; X <= FMath::Min(Max.X, Min.X + 3); X++)
+	{
+		for (int Y = Min.Y; Y <= FMath::Min(Max.Y, Min.Y + 3); Y++)
+		{
+			for (int Z = Min.Z; Z <= FMath::Min(Max.Z, Min.Z + 3); Z++)
+			{
+				const uint64 ONE = 1;
+				Mask |= ONE << ((X & 3) + 4 * (Y & 3) + 16 * (Z & 3));
+			}
+		}
+	}
+	return Mask;
+}
+
+int FVoxelData::GetLockIndex(uint64 RegionId) const
+{
+	const int S = Size() / 2;
+	const int Shift = VOXEL_LEAF_SIZE_LOG2 + LockRegionDepth;
+	const FIntVector Position = FOctree::GetPositionFromId(RegionId, Size());
+	// Same as GetLocksMask
+	return (((Position.X + S) >> Shift) & 3) + 4 * (((Position.Y + S) >> Shift) & 3) + 16 * (((Position.Z + S) >> Shift) & 3);
+}
+
+void FVoxelData::LockRead(uint64 Mask)
+{
+	SCOPE_CYCLE_COUNTER(STAT_VoxelData_WaitRead);
+
+	// Always lock in the same order to avoid deadlocks
+	for (int i = 0; i < VOXEL_LOCK_COUNT; i++)
+	{
+		if (Mask & ((uint64)1 << i))
+		{
+			Locks[i].ReadLock();
+		}
+	}
+}
+
+void FVoxelData::UnlockRead(uint64 Mask)
+{
+	for (int i = VOXEL_LOCK_COUNT - 1; i >= 0; i--)
+	{
+		if (Mask & ((uint64)1 << i))
+		{
+			Locks[i].ReadUnlock();
+		}
+	}
+}
+
+void FVoxelData::LockWrite(uint64 Mask)
+{
+	SCOPE_CYCLE_COUNTER(STAT_VoxelData_WaitWrite);
+
+	for (int i = 0; i < VOXEL_LOCK_COUNT; i++)
+	{
+		if (Mask & ((uint64)1 << i))
+		{
+			Locks[i].WriteLock();
+		}
+	}
+}
+
+void FVoxelData::UnlockWrite(uint64 Mask)
+{
+	for (int i = VOXEL_LOCK_COUNT - 1; i >= 0; i--)
+	{
+		if (Mask & ((uint64)1 << i))
+		{
+			Locks[i].WriteUnlock();
+		}
 	}
 }
 
 void FVoxelData::Reset()
 {
+	PendingSaves->Reset();
 	delete MainOctree;
-	MainOctree = new FValueOctree(WorldGenerator, FIntVector::ZeroValue, Depth, FOctree::GetTopIdFromDepth(Depth));
+	MainOctree = new FValueOctree(OctreeContext, FIntVector::ZeroValue, OctreeDepth, FOctree::GetTopId());
+}
+
+void FVoxelData::UpdateColdLeafs()
+{
+	CompressIdleLeafs();
+	PageOutLeafs();
+
+	LeafPager->NextEpoch();
+}
+
+void FVoxelData::GetLeafCompressionReport(FVoxelLeafCompressionReport& OutReport)
+{
+	SCOPE_CYCLE_COUNTER(STAT_VoxelData_LeafCompressionReport);
+
+	OutReport = FVoxelLeafCompressionReport();
+
+	TArray<FValueOctree*> Leafs;
+
+	BeginGet();
+	LeafIndex->GetLeafs(Leafs);
+	for (auto Leaf : Leafs)
+	{
+		Leaf->AddToCompressionReport(OutReport);
+	}
+	EndGet();
+}
+
+void FVoxelData::CompressIdleLeafs()
+{
+	if (LeafCompressionDelay == 0)
+	{
+		return;
+	}
+
+	SCOPE_CYCLE_COUNTER(STAT_VoxelData_CompressIdleLeafs);
+
+	const uint32 Epoch = LeafPager->GetEpoch();
+	auto IsIdle = [&](const FValueOctree* Leaf) { return Leaf->CanBeCompressed() && Epoch - Leaf->GetLastAccess() >= LeafCompressionDelay; };
+
+	TArray<FValueOctree*> Leafs;
+
+	// One lock at a time, so that the other regions can still be edited
+	for (int LockIndex = 0; LockIndex < VOXEL_LOCK_COUNT; LockIndex++)
+	{
+		const uint64 Mask = (uint64)1 << LockIndex;
+
+		// Readers are enough to know if there is something to compress
+		bool bHasIdleLeafs = false;
+		LockRead(Mask);
+		Leafs.Reset();
+		LeafIndex->GetLeafs(LockIndex, Leafs);
+		for (auto Leaf : Leafs)
+		{
+			if (IsIdle(Leaf))
+			{
+				bHasIdleLeafs = true;
+				break;
+			}
+		}
+		UnlockRead(Mask);
+
+		if (bHasIdleLeafs)
+		{
+			LockWrite(Mask);
+
+			// The leafs may have changed while unlocked
+			Leafs.Reset();
+			LeafIndex->GetLeafs(LockIndex, Leafs);
+			for (auto Leaf : Leafs)
+			{
+				if (IsIdle(Leaf))
+				{
+					Leaf->Compress();
+				}
+			}
+
+			UnlockWrite(Mask);
+		}
+	}
+}
+
+void FVoxelData::PageOutLeafs()
+{
+	if (LeafPager->MaxMemory == 0)
+	{
+		return;
+	}
+
+	SCOPE_CYCLE_COUNTER(STAT_VoxelData_PageOutLeafs);
+
+	TArray<FValueOctree*> Leafs;
+
+	// Last access & size of the leafs that can be paged out
+	TArray<TPair<uint32, uint32>> Candidates;
+
+	// One lock at a time, so that the other regions can still be edited. Readers are enough to know if we are above the budget
+	uint64 ResidentMemory = 0;
+	for (int LockIndex = 0; LockIndex < VOXEL_LOCK_COUNT; LockIndex++)
+	{
+		const uint64 Mask = (uint64)1 << LockIndex;
+		LockRead(Mask);
+		Leafs.Reset();
+		LeafIndex->GetLeafs(LockIndex, Leafs);
+		for (auto Leaf : Leafs)
+		{
+			const uint32 LeafDataSize = Leaf->GetLeafDataSize();
+			ResidentMemory += LeafDataSize;
+			if (Leaf->CanBePagedOut())
+			{
+				Candidates.Emplace(Leaf->GetLastAccess(), LeafDataSize);
+			}
+		}
+		UnlockRead(Mask);
+	}
+
+	if (ResidentMemory <= LeafPager->MaxMemory || Candidates.Num() == 0)
+	{
+		return;
+	}
+
+	// Go below the budget so that we don't page out at every call
+	const uint64 TargetMemory = LeafPager->MaxMemory / 4 * 3;
+
+	// Least recently used first: the leafs accessed at MaxLastAccess or before are enough to reach the target
+	Candidates.Sort([](const TPair<uint32, uint32>& A, const TPair<uint32, uint32>& B) { return A.Key < B.Key; });
+	uint64 MemoryToFree = ResidentMemory - TargetMemory;
+	uint32 MaxLastAccess = 0;
+	for (int Index = 0; Index < Candidates.Num() && MemoryToFree > 0; Index++)
+	{
+		MemoryToFree -= FMath::Min<uint64>(MemoryToFree, Candidates[Index].Value);
+		MaxLastAccess = Candidates[Index].Key;
+	}
+
+	MemoryToFree = ResidentMemory - TargetMemory;
+	for (int LockIndex = 0; LockIndex < VOXEL_LOCK_COUNT && MemoryToFree > 0; LockIndex++)
+	{
+		const uint64 Mask = (uint64)1 << LockIndex;
+		LockWrite(Mask);
+
+		// The leafs may have changed or been accessed while unlocked
+		Leafs.Reset();
+		LeafIndex->GetLeafs(LockIndex, Leafs);
+		Leafs.Sort([](const FValueOctree& A, const FValueOctree& B) { return A.GetLastAccess() < B.GetLastAccess(); });
+		for (int Index = 0; Index < Leafs.Num() && MemoryToFree > 0 && Leafs[Index]->GetLastAccess() <= MaxLastAccess; Index++)
+		{
+			FValueOctree* Leaf = Leafs[Index];
+			if (Leaf->CanBePagedOut())
+			{
+				MemoryToFree -= FMath::Min<uint64>(MemoryToFree, Leaf->GetLeafDataSize());
+				Leaf->PageOut();
+			}
+		}
+
+		UnlockWrite(Mask);
+	}
 }
 
 void FVoxelData::TestWorldGenerator()
@@ -84,7 +395,7 @@ void FVoxelData::TestWorldGenerator()
 	FIntVector InSize(25, 25, 25);
 	TArray<FIntVector> Positions = { FIntVector::ZeroValue, FIntVector(2 * 3 * 4 * 5 * 6 * 7 * 8 * 9) };
 
-	float* CachedValues = new float[InSize.X * InSize.Y * InSize.Z];
+	FVoxelValue* CachedValues = new FVoxelValue[InSize.X * InSize.Y * InSize.Z];
 	FVoxelMaterial* CachedMaterials = new FVoxelMaterial[InSize.X * InSize.Y * InSize.Z];
 
 	for (auto Position : Positions)
@@ -104,7 +415,7 @@ void FVoxelData::TestWorldGenerator()
 						GetValueAndMaterial(Position.X + X * Step, Position.Y + Y * Step, Position.Z + Z * Step, Value, Material);
 
 						const int Index = X + InSize.X * Y + InSize.X * InSize.Y * Z;
-						float CachedValue = CachedValues[Index];
+						float CachedValue = FVoxelValuePolicy::ToFloat(CachedValues[Index]);
 						FVoxelMaterial CachedMaterial = CachedMaterials[Index];
 
 						checkf(FMath::Abs(Value - CachedValue) < 0.1f, TEXT("Invalid world generator! Values returned are not coherent for different Step"));
@@ -119,65 +430,79 @@ void FVoxelData::TestWorldGenerator()
 	EndGet();
 }
 
-void FVoxelData::GetValuesAndMaterials(float Values[], FVoxelMaterial Materials[], const FIntVector& Start, const FIntVector& StartIndex, const int Step, const FIntVector& InSize, const FIntVector& ArraySize) const
+void FVoxelData::GetValuesAndMaterials(FVoxelValue Values[], FVoxelMaterial Materials[], const FIntVector& Start, const FIntVector& StartIndex, const int Step, const FIntVector& InSize, const FIntVector& ArraySize) const
 {
 	if (InSize.X <= 0 || InSize.Y <= 0 || InSize.Z <= 0)
 	{
 		return;
 	}
-	if (UNLIKELY(!IsInWorld(Start.X, Start.Y, Start.Z) || !IsInWorld(Start.X + (InSize.X - 1) * Step, Start.Y + (InSize.Y - 1) * Step, Start.Z + (InSize.Z - 1) * Step)))
+	if (LIKELY(IsInWorld(Start.X, Start.Y, Start.Z) && IsInWorld(Start.X + (InSize.X - 1) * Step, Start.Y + (InSize.Y - 1) * Step, Start.Z + (InSize.Z - 1) * Step)))
 	{
-		for (int X = 0; X < InSize.X; X++)
+		MainOctree->GetValuesAndMaterials(Values, Materials, Start, StartIndex, Step, InSize, ArraySize);
+		return;
+	}
+
+	// Clip the box to the world, in array space: indices in [Min, Max) are inside
+	const int S = Size() / 2;
+	auto CeilDiv = [&](int A)
+	{
+		return A >= 0 ? (A + Step - 1) / Step : -(-A / Step);
+	};
+	FIntVector Min;
+	FIntVector Max;
+	for (int Axis = 0; Axis < 3; Axis++)
+	{
+		// First indices at or after -S and S
+		Min[Axis] = FMath::Clamp(CeilDiv(-S - Start[Axis]), 0, InSize[Axis]);
+		Max[Axis] = FMath::Clamp(CeilDiv(S - Start[Axis]), Min[Axis], InSize[Axis]);
+	}
+
+	// Voxels outside of the world are generator ones: generate the slabs around the world in up to 6 calls
+	auto Generate = [&](const FIntVector& PartMin, const FIntVector& PartMax)
+	{
+		const FIntVector PartSize = PartMax - PartMin;
+		if (PartSize.X > 0 && PartSize.Y > 0 && PartSize.Z > 0)
 		{
-			for (int Y = 0; Y < InSize.Y; Y++)
-			{
-				for (int Z = 0; Z < InSize.Z; Z++)
-				{
-					const int Index = (StartIndex.X + X) + ArraySize.X * (StartIndex.Y + Y) + ArraySize.X * ArraySize.Y * (StartIndex.Z + Z);
-					int RX = Start.X + X * Step;
-					int RY = Start.Y + Y * Step;
-					int RZ = Start.Z + Z * Step;
-					if (Values)
-					{
-						if (IsInWorld(RX, RY, RZ))
-						{
-							Values[Index] = GetValue(RX, RY, RZ);
-						}
-						else
-						{
-							Values[Index] = WorldGenerator->GetValue(RX, RY, RZ);
-						}
-					}
-					if (Materials)
-					{
-						if (IsInWorld(RX, RY, RZ))
-						{
-							Materials[Index] = GetMaterial(RX, RY, RZ);
-						}
-						else
-						{
-							Materials[Index] = WorldGenerator->GetMaterial(RX, RY, RZ);
-						}
-					}
-				}
-			}
+			GeneratorCache->GetValuesAndMaterials(Values, Materials, Start + PartMin * Step, StartIndex + PartMin, Step, PartSize, ArraySize);
 		}
-	}
-	else
+	};
+	Generate(FIntVector(0, 0, 0), FIntVector(Min.X, InSize.Y, InSize.Z));
+	Generate(FIntVector(Max.X, 0, 0), FIntVector(InSize.X, InSize.Y, InSize.Z));
+	Generate(FIntVector(Min.X, 0, 0), FIntVector(Max.X, Min.Y, InSize.Z));
+	Generate(FIntVector(Min.X, Max.Y, 0), FIntVector(Max.X, InSize.Y, InSize.Z));
+	Generate(FIntVector(Min.X, Min.Y, 0), FIntVector(Max.X, Max.Y, Min.Z));
+	Generate(FIntVector(Min.X, Min.Y, Max.Z), FIntVector(Max.X, Max.Y, InSize.Z));
+
+	const FIntVector InsideSize = Max - Min;
+	if (InsideSize.X > 0 && InsideSize.Y > 0 && InsideSize.Z > 0)
 	{
-		MainOctree->GetValuesAndMaterials(Values, Materials, Start, StartIndex, Step, InSize, ArraySize);
+		MainOctree->GetValuesAndMaterials(Values, Materials, Start + Min * Step, StartIndex + Min, Step, InsideSize, ArraySize);
 	}
 }
 
 float FVoxelData::GetValue(int X, int Y, int Z) const
 {
-	float Values[1];
+	if (LIKELY(IsInWorld(X, Y, Z)))
+	{
+		FVoxelValue Value;
+		GetLeaf(X, Y, Z)->GetValuesAndMaterials(&Value, nullptr, FIntVector(X, Y, Z), FIntVector::ZeroValue, 1, FIntVector(1, 1, 1), FIntVector(1, 1, 1));
+		return FVoxelValuePolicy::ToFloat(Value);
+	}
+
+	FVoxelValue Values[1];
 	GetValuesAndMaterials(Values, nullptr, FIntVector(X, Y, Z), FIntVector::ZeroValue, 1, FIntVector(1, 1, 1), FIntVector(1, 1, 1));
-	return Values[0];
+	return FVoxelValuePolicy::ToFloat(Values[0]);
 }
 
 FVoxelMaterial FVoxelData::GetMaterial(int X, int Y, int Z) const
 {
+	if (LIKELY(IsInWorld(X, Y, Z)))
+	{
+		FVoxelMaterial Material;
+		GetLeaf(X, Y, Z)->GetValuesAndMaterials(nullptr, &Material, FIntVector(X, Y, Z), FIntVector::ZeroValue, 1, FIntVector(1, 1, 1), FIntVector(1, 1, 1));
+		return Material;
+	}
+
 	FVoxelMaterial Materials[1];
 	GetValuesAndMaterials(nullptr, Materials, FIntVector(X, Y, Z), FIntVector::ZeroValue, 1, FIntVector(1, 1, 1), FIntVector(1, 1, 1));
 	return Materials[0];
@@ -185,54 +510,161 @@ FVoxelMaterial FVoxelData::GetMaterial(int X, int Y, int Z) const
 
 void FVoxelData::GetValueAndMaterial(int X, int Y, int Z, float& OutValue, FVoxelMaterial& OutMaterial)
 {
-	float Values[1];
+	FVoxelValue Values[1];
 	FVoxelMaterial Materials[1];
-	GetValuesAndMaterials(Values, Materials, FIntVector(X, Y, Z), FIntVector::ZeroValue, 1, FIntVector(1, 1, 1), FIntVector(1, 1, 1));
+	if (LIKELY(IsInWorld(X, Y, Z)))
+	{
+		GetLeaf(X, Y, Z)->GetValuesAndMaterials(Values, Materials, FIntVector(X, Y, Z), FIntVector::ZeroValue, 1, FIntVector(1, 1, 1), FIntVector(1, 1, 1));
+	}
+	else
+	{
+		GetValuesAndMaterials(Values, Materials, FIntVector(X, Y, Z), FIntVector::ZeroValue, 1, FIntVector(1, 1, 1), FIntVector(1, 1, 1));
+	}
 
-	OutValue = Values[0];
+	OutValue = FVoxelValuePolicy::ToFloat(Values[0]);
 	OutMaterial = Materials[0];
 }
 
-void FVoxelData::SetValue(int X, int Y, int Z, float Value)
+void FVoxelData::SampleBatch(const FIntVector Positions[], float OutValues[], FVoxelMaterial OutMaterials[], int Count) const
 {
-	check(IsInWorld(X, Y, Z));
-	MainOctree->GetLeaf(X, Y, Z)->SetValueAndMaterial(X, Y, Z, Value, FVoxelMaterial(), true, false);
+	SCOPE_CYCLE_COUNTER(STAT_VoxelData_SampleBatch);
+
+	// Sort the positions by Depth 0 node
+	const int S = Size() / 2;
+	TArray<TPair<uint64, int>> SortedPositions;
+	SortedPositions.Reserve(Count);
+	for (int Index = 0; Index < Count; Index++)
+	{
+		const FIntVector& P = Positions[Index];
+		if (IsInWorld(P.X, P.Y, P.Z))
+		{
+			SortedPositions.Emplace(MortonEncode((P.X + S) >> VOXEL_LEAF_SIZE_LOG2, (P.Y + S) >> VOXEL_LEAF_SIZE_LOG2, (P.Z + S) >> VOXEL_LEAF_SIZE_LOG2), Index);
+		}
+		else
+		{
+			if (OutValues)
+			{
+				OutValues[Index] = FVoxelValuePolicy::ToFloat(FVoxelValuePolicy::FromFloat(WorldGenerator->GetValue(P.X, P.Y, P.Z)));
+			}
+			if (OutMaterials)
+			{
+				OutMaterials[Index] = WorldGenerator->GetMaterial(P.X, P.Y, P.Z);
+			}
+		}
+	}
+	SortedPositions.Sort([](const TPair<uint64, int>& A, const TPair<uint64, int>& B) { return A.Key < B.Key; });
+
+	TArray<FVoxelValue> BoxValues;
+	TArray<FVoxelMaterial> BoxMaterials;
+	int GroupStart = 0;
+	while (GroupStart < SortedPositions.Num())
+	{
+		int GroupEnd = GroupStart + 1;
+		FVoxelBox GroupBox(Positions[SortedPositions[GroupStart].Value], Positions[SortedPositions[GroupStart].Value]);
+		while (GroupEnd < SortedPositions.Num() && SortedPositions[GroupEnd].Key == SortedPositions[GroupStart].Key)
+		{
+			const FIntVector& P = Positions[SortedPositions[GroupEnd].Value];
+			GroupBox.Min = FIntVector(FMath::Min(GroupBox.Min.X, P.X), FMath::Min(GroupBox.Min.Y, P.Y), FMath::Min(GroupBox.Min.Z, P.Z));
+			GroupBox.Max = FIntVector(FMath::Max(GroupBox.Max.X, P.X), FMath::Max(GroupBox.Max.Y, P.Y), FMath::Max(GroupBox.Max.Z, P.Z));
+			GroupEnd++;
+		}
+
+		// The whole group is in the same leaf
+		const FValueOctree* Leaf = GetLeaf(GroupBox.Min.X, GroupBox.Min.Y, GroupBox.Min.Z);
+		const FIntVector BoxSize = GroupBox.Max - GroupBox.Min + FIntVector(1, 1, 1);
+		const int GroupCount = GroupEnd - GroupStart;
+
+		if (GroupCount > 1 && BoxSize.X * BoxSize.Y * BoxSize.Z <= 8 * GroupCount)
+		{
+			// Dense enough: read the box once
+			BoxValues.SetNumUninitialized(BoxSize.X * BoxSize.Y * BoxSize.Z, false);
+			BoxMaterials.SetNumUninitialized(BoxSize.X * BoxSize.Y * BoxSize.Z, false);
+			Leaf->GetValuesAndMaterials(OutValues ? BoxValues.GetData() : nullptr, OutMaterials ? BoxMaterials.GetData() : nullptr, GroupBox.Min, FIntVector::ZeroValue, 1, BoxSize, BoxSize);
+
+			for (int SortedIndex = GroupStart; SortedIndex < GroupEnd; SortedIndex++)
+			{
+				const int Index = SortedPositions[SortedIndex].Value;
+				const FIntVector P = Positions[Index] - GroupBox.Min;
+				const int BoxIndex = P.X + BoxSize.X * P.Y + BoxSize.X * BoxSize.Y * P.Z;
+				if (OutValues)
+				{
+					OutValues[Index] = FVoxelValuePolicy::ToFloat(BoxValues[BoxIndex]);
+				}
+				if (OutMaterials)
+				{
+					OutMaterials[Index] = BoxMaterials[BoxIndex];
+				}
+			}
+		}
+		else
+		{
+			for (int SortedIndex = GroupStart; SortedIndex < GroupEnd; SortedIndex++)
+			{
+				const int Index = SortedPositions[SortedIndex].Value;
+				FVoxelValue Value;
+				FVoxelMaterial Material;
+				Leaf->GetValuesAndMaterials(OutValues ? &Value : nullptr, OutMaterials ? &Material : nullptr, Positions[Index], FIntVector::ZeroValue, 1, FIntVector(1, 1, 1), FIntVector(1, 1, 1));
+				if (OutValues)
+				{
+					OutValues[Index] = FVoxelValuePolicy::ToFloat(Value);
+				}
+				if (OutMaterials)
+				{
+					OutMaterials[Index] = Material;
+				}
+			}
+		}
+
+		GroupStart = GroupEnd;
+	}
 }
 
-void FVoxelData::SetValue(int X, int Y, int Z, float Value, FValueOctree*& LastOctree)
+void FVoxelData::SampleBatchTrilinear(const FVector Positions[], float OutValues[], int Count) const
 {
-	check(IsInWorld(X, Y, Z));
-	if (UNLIKELY(!LastOctree || !LastOctree->IsLeaf() || !LastOctree->IsInOctree(X, Y, Z)))
+	// Sample the 8 corners of all the positions at once
+	TArray<FIntVector> Corners;
+	TArray<float> CornerValues;
+	Corners.SetNumUninitialized(8 * Count);
+	CornerValues.SetNumUninitialized(8 * Count);
+	for (int Index = 0; Index < Count; Index++)
 	{
-		LastOctree = MainOctree->GetLeaf(X, Y, Z);
+		const FIntVector Min(FMath::FloorToInt(Positions[Index].X), FMath::FloorToInt(Positions[Index].Y), FMath::FloorToInt(Positions[Index].Z));
+		for (int Corner = 0; Corner < 8; Corner++)
+		{
+			Corners[8 * Index + Corner] = Min + FIntVector(Corner & 1, (Corner >> 1) & 1, (Corner >> 2) & 1);
+		}
+	}
+
+	SampleBatch(Corners.GetData(), CornerValues.GetData(), nullptr, Corners.Num());
+
+	for (int Index = 0; Index < Count; Index++)
+	{
+		const FVector Alpha = Positions[Index] - FVector(Corners[8 * Index]);
+		const float* V = &CornerValues[8 * Index];
+		OutValues[Index] = FMath::Lerp(
+			FMath::Lerp(FMath::Lerp(V[0], V[1], Alpha.X), FMath::Lerp(V[2], V[3], Alpha.X), Alpha.Y),
+			FMath::Lerp(FMath::Lerp(V[4], V[5], Alpha.X), FMath::Lerp(V[6], V[7], Alpha.X), Alpha.Y),
+			Alpha.Z);
 	}
-	LastOctree->SetValueAndMaterial(X, Y, Z, Value, FVoxelMaterial(), true, false);
 }
 
-void FVoxelData::SetMaterial(int X, int Y, int Z, FVoxelMaterial Material)
+void FVoxelData::SetValue(int X, int Y, int Z, float Value)
 {
 	check(IsInWorld(X, Y, Z));
-	MainOctree->GetLeaf(X, Y, Z)->SetValueAndMaterial(X, Y, Z, 0, Material, false, true);
+	GetLeaf(X, Y, Z)->SetValueAndMaterial(X, Y, Z, Value, FVoxelMaterial(), true, false);
 }
 
-void FVoxelData::SetMaterial(int X, int Y, int Z, FVoxelMaterial Material, FValueOctree*& LastOctree)
+void FVoxelData::SetMaterial(int X, int Y, int Z, FVoxelMaterial Material)
 {
 	check(IsInWorld(X, Y, Z));
-	if (UNLIKELY(!LastOctree || !LastOctree->IsLeaf() || !LastOctree->IsInOctree(X, Y, Z)))
-	{
-		LastOctree = MainOctree->GetLeaf(X, Y, Z);
-	}
-	LastOctree->SetValueAndMaterial(X, Y, Z, 0, Material, false, true);
+	GetLeaf(X, Y, Z)->SetValueAndMaterial(X, Y, Z, 0, Material, false, true);
 }
 
-void FVoxelData::SetValueAndMaterial(int X, int Y, int Z, float Value, FVoxelMaterial Material, FValueOctree*& LastOctree)
+FValueOctree* FVoxelData::GetLeaf(int X, int Y, int Z) const
 {
-	check(IsInWorld(X, Y, Z));
-	if (UNLIKELY(!LastOctree || !LastOctree->IsLeaf() || !LastOctree->IsInOctree(X, Y, Z)))
-	{
-		LastOctree = MainOctree->GetLeaf(X, Y, Z);
-	}
-	LastOctree->SetValueAndMaterial(X, Y, Z, Value, Material, true, true);
+	// Depth 0 nodes are indexed. Other leafs are unmodified or merged nodes, close to the root
+	FValueOctree* Leaf = LeafIndex->Find(X, Y, Z);
+	return Leaf ? Leaf : MainOctree->GetLeaf(X, Y, Z);
 }
 
 bool FVoxelData::IsInWorld(int X, int Y, int Z) const
@@ -251,26 +683,377 @@ FORCEINLINE void FVoxelData::ClampToWorld(int& X, int& Y, int& Z) const
 	Z = FMath::Clamp(Z, -S, S - 1);
 }
 
-void FVoxelData::GetSave(FVoxelWorldSave& OutSave)
+uint64 FVoxelData::GetGeneration(const FVoxelBox& Box)
 {
-	BeginGet();
-	std::deque<TSharedRef<FVoxelChunkSave>> SaveList;
-	MainOctree->AddDirtyChunksToSaveList(SaveList);
-	OutSave.Init(Depth, SaveList);
-	EndGet();
+	BeginGet(Box);
+	const uint64 Generation = MainOctree->GetGenerationOverlappingBox(Box);
+	EndGet(Box);
+	return Generation;
+}
+
+bool FVoxelData::GetValueRange(const FVoxelBox& Box, const int Step, FVoxelValueRange& OutRange)
+{
+	OutRange = FVoxelValueRange();
+
+	if (!IsInWorld(Box.Min.X, Box.Min.Y, Box.Min.Z) || !IsInWorld(Box.Max.X, Box.Max.Y, Box.Max.Z))
+	{
+		// Voxels outside of the world are generator values
+		if (!GeneratorCache->GetValueRange(Box, Step, OutRange))
+		{
+			return false;
+		}
+	}
+
+	BeginGet(Box);
+	const bool bIsKnown = MainOctree->GetValueRange(Box, Step, OutRange);
+	EndGet(Box);
+	return bIsKnown;
 }
 
-void FVoxelData::LoadFromSaveAndGetModifiedPositions(const FVoxelWorldSave& Save, std::deque<FIntVector>& OutModifiedPositions, bool bReset)
+TSharedRef<FVoxelDataSnapshot, ESPMode::ThreadSafe> FVoxelData::CreateSnapshot(const FVoxelBox& Box, uint64 MinGeneration)
 {
-	BeginSet();
+	SCOPE_CYCLE_COUNTER(STAT_VoxelData_CreateSnapshot);
+
+	// Regions only loaded at an older generation wouldn't be in the snapshot anyway
+	LockReadLoaded(Box, MinGeneration);
+
+	// Writers get their generation while they hold their locks: the edits of Box up to LastGeneration are done
+	TSharedRef<FVoxelDataSnapshot, ESPMode::ThreadSafe> Snapshot = MakeShareable(new FVoxelDataSnapshot(GeneratorCache, Depth, Box, LastGeneration.load()));
+	MainOctree->AddChunksToSnapshot(Box, MinGeneration, *Snapshot);
+
+	UnlockRead(GetLocksMask(Box));
+
+	return Snapshot;
+}
+
+void FVoxelData::GetSave(FVoxelWorldSave& OutSave, EVoxelSaveCompression Compression)
+{
+	const int S = Size() / 2;
+	auto Snapshot = CreateSnapshot(FVoxelBox(FIntVector(-S, -S, -S), FIntVector(S - 1, S - 1, S - 1)));
+
+	// The world is only locked while creating the snapshot
+	Snapshot->GetSave(OutSave, Depth, Compression);
+	SavedGeneration = Snapshot->Generation;
+}
+
+void FVoxelData::GetDeltaSave(FVoxelWorldSave& OutSave, EVoxelSaveCompression Compression)
+{
+	SCOPE_CYCLE_COUNTER(STAT_VoxelData_GetDeltaSave);
+
+	const int S = Size() / 2;
+	auto Snapshot = CreateSnapshot(FVoxelBox(FIntVector(-S, -S, -S), FIntVector(S - 1, S - 1, S - 1)), SavedGeneration + 1);
+
+	Snapshot->GetSave(OutSave, Depth, Compression);
+	OutSave.bIsDelta = true;
+	SavedGeneration = Snapshot->Generation;
+}
+
+bool FVoxelData::LoadFromSaveAndGetModifiedPositions(const FVoxelWorldSave& Save, std::deque<FIntVector>& OutModifiedPositions, bool bReset)
+{
+	check(!(Save.bIsDelta && bReset));
+
+	FString Error;
+	if (!Save.Validate(Error))
+	{
+		UE_LOG(LogVoxel, Error, TEXT("LoadFromSave: %s"), *Error);
+		return false;
+	}
+	if (Save.Depth != Depth)
+	{
+		// The Ids of its chunks would be outside of the world
+		UE_LOG(LogVoxel, Error, TEXT("LoadFromSave: Current Depth is %d while Save one is %d"), Depth, Save.Depth);
+		return false;
+	}
+
+	const int S = Size() / 2;
+	const FVoxelBox WorldBox(FIntVector(-S, -S, -S), FIntVector(S - 1, S - 1, S - 1));
+
+	// Not BeginSet(): the regions pending now are only loaded if needed
+	LockWrite(~(uint64)0);
+
+	const bool bIsLazy = Save.LeafSize == VOXEL_LEAF_SIZE && Save.Version >= EVoxelSaveVersion::ChunkIndex;
+	if (!bIsLazy && !bReset)
+	{
+		// The chunks of this save must be loaded after the pending ones
+		LoadPendingRegions(WorldBox, 0);
+	}
+
+	// Edits that aren't saved yet must stay in the next delta
+	TArray<uint64> UnsavedRegions;
+	PendingSaves->GetRegions(WorldBox, SavedGeneration + 1, UnsavedRegions);
+	const bool bWasSaved = bReset || (MainOctree->GetGenerationOverlappingBox(MainOctree->GetBounds()) <= SavedGeneration && UnsavedRegions.Num() == 0);
+
 	if (bReset)
 	{
 		MainOctree->GetDirtyChunksPositions(OutModifiedPositions);
 		Reset();
 	}
 
-	auto SaveList = Save.GetChunksList();
-	MainOctree->LoadFromSaveAndGetModifiedPositions(SaveList, OutModifiedPositions);
-	check(SaveList.empty());
-	EndSet();
+	const uint64 Generation = ++LastGeneration;
+
+	TArray<FVoxelSaveBlock> Blocks;
+	if (bIsLazy)
+	{
+		verify(PendingSaves->Add(Save, Generation, OutModifiedPositions));
+	}
+	else if (Save.LeafSize != VOXEL_LEAF_SIZE)
+	{
+		FVoxelWorldSaveReader Reader(Save);
+		LoadResizedChunks(Reader, Save.LeafSize);
+		MainOctree->GetDirtyChunksPositions(OutModifiedPositions);
+	}
+	else if (!Save.GetBlocks(Blocks))
+	{
+		// Older saves are a single stream
+		FVoxelWorldSaveReader Reader(Save);
+		LoadChunks(Reader, OutModifiedPositions);
+	}
+	else
+	{
+		// Lock regions are disjoint subtrees: blocks are grouped so that each region is loaded by a single task
+		TArray<int> LastBlocks;
+		for (int Index = 0; Index < Blocks.Num(); Index++)
+		{
+			if (Index == Blocks.Num() - 1 || FOctree::GetAncestorId(Blocks[Index].LastId, LockRegionDepth) != FOctree::GetAncestorId(Blocks[Index + 1].FirstId, LockRegionDepth))
+			{
+				LastBlocks.Add(Index);
+			}
+		}
+
+		// The leafs are indexed by lock and not by region, see FVoxelLeafIndex: groups with regions of the same lock are loaded by the same task
+		// LockTasks is a union-find of the locks: the root of a lock is the task loading its regions
+		int LockTasks[VOXEL_LOCK_COUNT];
+		for (int LockIndex = 0; LockIndex < VOXEL_LOCK_COUNT; LockIndex++)
+		{
+			LockTasks[LockIndex] = LockIndex;
+		}
+		auto GetTask = [&LockTasks](int LockIndex)
+		{
+			while (LockTasks[LockIndex] != LockIndex)
+			{
+				LockIndex = LockTasks[LockIndex];
+			}
+			return LockIndex;
+		};
+		for (int Group = 0; Group < LastBlocks.Num(); Group++)
+		{
+			const int FirstBlock = Group == 0 ? 0 : LastBlocks[Group - 1] + 1;
+			const uint64 FirstRegionId = FOctree::GetAncestorId(Blocks[FirstBlock].FirstId, LockRegionDepth);
+			const uint64 LastRegionId = FOctree::GetAncestorId(Blocks[LastBlocks[Group]].LastId, LockRegionDepth);
+			// Any 2 * VOXEL_LOCK_COUNT consecutive regions contain an aligned 4x4x4 cube of regions, which has every lock
+			const uint64 LastCheckedRegionId = FMath::Min(LastRegionId, FirstRegionId + 2 * VOXEL_LOCK_COUNT - 1);
+			const int Task = GetTask(GetLockIndex(FirstRegionId));
+			for (uint64 RegionId = FirstRegionId + 1; RegionId <= LastCheckedRegionId; RegionId++)
+			{
+				LockTasks[GetTask(GetLockIndex(RegionId))] = Task;
+			}
+		}
+
+		TArray<int> TaskGroups[VOXEL_LOCK_COUNT];
+		for (int Group = 0; Group < LastBlocks.Num(); Group++)
+		{
+			const int FirstBlock = Group == 0 ? 0 : LastBlocks[Group - 1] + 1;
+			TaskGroups[GetTask(GetLockIndex(FOctree::GetAncestorId(Blocks[FirstBlock].FirstId, LockRegionDepth)))].Add(Group);
+		}
+
+		TArray<std::deque<FIntVector>> ModifiedPositions;
+		ModifiedPositions.SetNum(LastBlocks.Num());
+		{
+			FVoxelTaskGroup Tasks;
+			for (auto& Groups : TaskGroups)
+			{
+				if (Groups.Num() > 0)
+				{
+					Tasks.Add([this, &Save, &Blocks, &LastBlocks, &Groups, &ModifiedPositions]()
+					{
+						for (int Group : Groups)
+						{
+							FVoxelWorldSaveReader Reader(Save, Blocks, Group == 0 ? 0 : LastBlocks[Group - 1] + 1, LastBlocks[Group]);
+							LoadChunks(Reader, ModifiedPositions[Group]);
+						}
+					});
+				}
+			}
+		}
+
+		for (auto& GroupModifiedPositions : ModifiedPositions)
+		{
+			OutModifiedPositions.insert(OutModifiedPositions.end(), GroupModifiedPositions.begin(), GroupModifiedPositions.end());
+		}
+	}
+
+	MainOctree->CompactOverlappingBox(MainOctree->GetBounds(), LockRegionDepth, Generation);
+	if (bWasSaved)
+	{
+		SavedGeneration = Generation;
+	}
+	UnlockWrite(~(uint64)0);
+
+	return true;
+}
+
+void FVoxelData::LoadPendingRegions(const FVoxelBox& Box, uint64 MinGeneration)
+{
+	if (PendingSaves->IsEmpty())
+	{
+		return;
+	}
+
+	TArray<uint64> RegionIds;
+	PendingSaves->GetRegions(Box, MinGeneration, RegionIds);
+	if (RegionIds.Num() == 0)
+	{
+		return;
+	}
+
+	if (RegionIds.Num() == 1)
+	{
+		LoadPendingRegion(RegionIds[0]);
+	}
+	else
+	{
+		// Regions are disjoint subtrees, but the leafs are indexed by lock: the regions of a lock are loaded by the same task
+		TArray<uint64> LockRegionIds[VOXEL_LOCK_COUNT];
+		for (auto RegionId : RegionIds)
+		{
+			LockRegionIds[GetLockIndex(RegionId)].Add(RegionId);
+		}
+
+		FVoxelTaskGroup Tasks;
+		for (auto& Ids : LockRegionIds)
+		{
+			if (Ids.Num() > 0)
+			{
+				Tasks.Add([this, &Ids]()
+				{
+					for (auto RegionId : Ids)
+					{
+						LoadPendingRegion(RegionId);
+					}
+				});
+			}
+		}
+	}
+}
+
+bool FVoxelData::HasPendingRegions(const FVoxelBox& Box, uint64 MinGeneration) const
+{
+	if (PendingSaves->IsEmpty())
+	{
+		return false;
+	}
+
+	TArray<uint64> RegionIds;
+	PendingSaves->GetRegions(Box, MinGeneration, RegionIds);
+	return RegionIds.Num() > 0;
+}
+
+void FVoxelData::LockReadLoaded(const FVoxelBox& Box, uint64 MinGeneration)
+{
+	const uint64 Mask = GetLocksMask(Box);
+	while (true)
+	{
+		LockRead(Mask);
+		// Saves are only added while the whole world is locked: none can be added until we unlock
+		if (!HasPendingRegions(Box, MinGeneration))
+		{
+			return;
+		}
+		UnlockRead(Mask);
+
+		// Loading needs the write locks. A save can be added once they are released: check again
+		LockWrite(Mask);
+		LoadPendingRegions(Box, MinGeneration);
+		UnlockWrite(Mask);
+	}
+}
+
+void FVoxelData::LoadPendingRegion(uint64 RegionId)
+{
+	SCOPE_CYCLE_COUNTER(STAT_VoxelData_LoadPendingRegion);
+
+	const FVoxelBox RegionBox = PendingSaves->GetRegionBox(RegionId);
+
+	if (LockRegionDepth < OctreeDepth)
+	{
+		// As in BeginSet
+		FScopeLock Lock(&StructureLock);
+		MainOctree->CreateChildsOverlappingBox(RegionBox, LockRegionDepth);
+	}
+
+	// Their render chunks were given by LoadFromSaveAndGetModifiedPositions
+	std::deque<FIntVector> ModifiedPositions;
+	const uint64 Generation = PendingSaves->LoadRegion(RegionId, [&](const FVoxelChunkSave& Chunk)
+	{
+		const FIntVector Position = FOctree::GetPositionFromId(Chunk.Id, Size());
+		GetLeaf(Position.X, Position.Y, Position.Z)->LoadChunk(Chunk, ModifiedPositions);
+	});
+
+	if (Generation > 0)
+	{
+		// The leafs get the generation of the load and not a new one: they aren't in the next delta if it was saved
+		MainOctree->CompactOverlappingBox(RegionBox, LockRegionDepth, Generation);
+	}
+}
+
+void FVoxelData::LoadChunks(FVoxelWorldSaveReader& Reader, std::deque<FIntVector>& OutModifiedPositions)
+{
+	SCOPE_CYCLE_COUNTER(STAT_VoxelData_LoadChunks);
+
+	uint64 LastRegionId = 0;
+	for (; Reader.GetChunk(); Reader.NextChunk())
+	{
+		const FVoxelChunkSave& Chunk = *Reader.GetChunk();
+		const FIntVector Position = FOctree::GetPositionFromId(Chunk.Id, Size());
+
+		const uint64 RegionId = FOctree::GetAncestorId(Chunk.Id, LockRegionDepth);
+		if (RegionId != LastRegionId && LockRegionDepth < OctreeDepth)
+		{
+			// Other readers can be creating the nodes above their regions, as in BeginSet
+			FScopeLock Lock(&StructureLock);
+			MainOctree->CreateChildsOverlappingBox(FVoxelBox(Position, Position), LockRegionDepth);
+		}
+		LastRegionId = RegionId;
+
+		GetLeaf(Position.X, Position.Y, Position.Z)->LoadChunk(Chunk, OutModifiedPositions);
+	}
+}
+
+void FVoxelData::LoadResizedChunks(FVoxelWorldSaveReader& Reader, int SaveLeafSize)
+{
+	check(FMath::IsPowerOfTwo(SaveLeafSize));
+
+	const int ChunkVoxels = SaveLeafSize * SaveLeafSize * SaveLeafSize;
+	TArray<FVoxelValue> Values;
+	TArray<FVoxelMaterial> Materials;
+	Values.SetNumUninitialized(ChunkVoxels);
+	Materials.SetNumUninitialized(ChunkVoxels);
+
+	FVoxelAccessor Accessor(this);
+	for (; Reader.GetChunk(); Reader.NextChunk())
+	{
+		const FVoxelChunkSave& Chunk = *Reader.GetChunk();
+		check(Chunk.IsDiff() ? Chunk.Mask.Num() == (ChunkVoxels + 31) / 32 : Chunk.Values.Num() == ChunkVoxels);
+
+		// The Ids are those of an octree whose Depth 0 nodes are SaveLeafSize wide
+		const FIntVector Min = FOctree::GetPositionFromId(Chunk.Id, Size()) - FIntVector(SaveLeafSize / 2, SaveLeafSize / 2, SaveLeafSize / 2);
+		if (Chunk.IsDiff())
+		{
+			// The voxels that aren't saved are the generator ones
+			const FIntVector ChunkSize(SaveLeafSize, SaveLeafSize, SaveLeafSize);
+			GeneratorCache->GetValuesAndMaterials(Values.GetData(), Materials.GetData(), Min, FIntVector::ZeroValue, 1, ChunkSize, ChunkSize);
+		}
+		Chunk.GetValuesAndMaterials(Values.GetData(), Materials.GetData());
+		for (int Z = 0; Z < SaveLeafSize; Z++)
+		{
+			for (int Y = 0; Y < SaveLeafSize; Y++)
+			{
+				for (int X = 0; X < SaveLeafSize; X++)
+				{
+					const int Index = X + SaveLeafSize * Y + SaveLeafSize * SaveLeafSize * Z;
+					Accessor.SetValueAndMaterial(Min.X + X, Min.Y + Y, Min.Z + Z, FVoxelValuePolicy::ToFloat(Values[Index]), Materials[Index]);
+				}
+			}
+		}
+	}
 }
\ No newline at end of file
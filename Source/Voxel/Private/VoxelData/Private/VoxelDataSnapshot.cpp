@@ -0,0 +1,142 @@
+// Copyright 2017 Phyronnaz
+
+#include "VoxelDataSnapshot.h"
+#include "VoxelLeafData.h"
+#include "VoxelGeneratorCache.h"
+#include "VoxelSave.h"
+#include "Octree.h"
+
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Voxel Snapshots"), STAT_VoxelSnapshots, STATGROUP_Voxel);
+
+FVoxelDataSnapshot::FVoxelDataSnapshot(FVoxelGeneratorCache* GeneratorCache, int Depth, const FVoxelBox& Box, uint64 Generation)
+	: Box(Box)
+	, Generation(Generation)
+	, GeneratorCache(GeneratorCache)
+	, HalfSize(8 << Depth)
+{
+	INC_DWORD_STAT(STAT_VoxelSnapshots);
+}
+
+FVoxelDataSnapshot::~FVoxelDataSnapshot()
+{
+	DEC_DWORD_STAT(STAT_VoxelSnapshots);
+}
+
+void FVoxelDataSnapshot::GetValuesAndMaterials(FVoxelValue Values[], FVoxelMaterial Materials[], const FIntVector& Start, const FIntVector& StartIndex, const int Step, const FIntVector& Size, const FIntVector& ArraySize) const
+{
+	check(Size.GetMin() >= 0);
+	if (Size.X == 0 || Size.Y == 0 || Size.Z == 0)
+	{
+		return;
+	}
+	const FIntVector End = Start + (Size - FIntVector(1, 1, 1)) * Step;
+	check(Box.IsInside(Start) && Box.IsInside(End));
+
+	// Most of the voxels are usually unmodified: get everything from the generator, and overwrite the modified chunks
+	GeneratorCache->GetValuesAndMaterials(Values, Materials, Start, StartIndex, Step, Size, ArraySize);
+
+	if (Chunks.Num() == 0)
+	{
+		return;
+	}
+
+	// Min corners of the chunks overlapping the request. Chunks are aligned on the world min corner
+	const FIntVector MinChunk(
+		((FMath::Max(Start.X, -HalfSize) + HalfSize) & ~(VOXEL_LEAF_SIZE - 1)) - HalfSize,
+		((FMath::Max(Start.Y, -HalfSize) + HalfSize) & ~(VOXEL_LEAF_SIZE - 1)) - HalfSize,
+		((FMath::Max(Start.Z, -HalfSize) + HalfSize) & ~(VOXEL_LEAF_SIZE - 1)) - HalfSize);
+	const FIntVector MaxChunk(
+		((FMath::Min(End.X, HalfSize - 1) + HalfSize) & ~(VOXEL_LEAF_SIZE - 1)) - HalfSize,
+		((FMath::Min(End.Y, HalfSize - 1) + HalfSize) & ~(VOXEL_LEAF_SIZE - 1)) - HalfSize,
+		((FMath::Min(End.Z, HalfSize - 1) + HalfSize) & ~(VOXEL_LEAF_SIZE - 1)) - HalfSize);
+
+	for (int ChunkX = MinChunk.X; ChunkX <= MaxChunk.X; ChunkX += VOXEL_LEAF_SIZE)
+	{
+		for (int ChunkY = MinChunk.Y; ChunkY <= MaxChunk.Y; ChunkY += VOXEL_LEAF_SIZE)
+		{
+			for (int ChunkZ = MinChunk.Z; ChunkZ <= MaxChunk.Z; ChunkZ += VOXEL_LEAF_SIZE)
+			{
+				const int* ChunkIndex = ChunksIndices.Find(GetChunkKey(ChunkX, ChunkY, ChunkZ));
+				if (!ChunkIndex)
+				{
+					continue;
+				}
+				const FVoxelSnapshotChunk& Chunk = Chunks[*ChunkIndex];
+
+				// Part of the request inside this chunk, in array space
+				const FIntVector Min(
+					FMath::Max(0, CeilDiv(ChunkX - Start.X, Step)),
+					FMath::Max(0, CeilDiv(ChunkY - Start.Y, Step)),
+					FMath::Max(0, CeilDiv(ChunkZ - Start.Z, Step)));
+				const FIntVector Max(
+					FMath::Min(Size.X, CeilDiv(ChunkX + VOXEL_LEAF_SIZE - Start.X, Step)),
+					FMath::Min(Size.Y, CeilDiv(ChunkY + VOXEL_LEAF_SIZE - Start.Y, Step)),
+					FMath::Min(Size.Z, CeilDiv(ChunkZ + VOXEL_LEAF_SIZE - Start.Z, Step)));
+				if (Min.X >= Max.X || Min.Y >= Max.Y || Min.Z >= Max.Z)
+				{
+					continue;
+				}
+
+				// Sparse leafs only write their modified voxels, on top of the generator ones
+				Chunk.LeafData->GetValuesAndMaterials(Values, Materials, Start + Min * Step - Chunk.LeafMin, StartIndex + Min, Step, Max - Min, ArraySize);
+			}
+		}
+	}
+}
+
+void FVoxelDataSnapshot::GetValueAndMaterial(int X, int Y, int Z, float& OutValue, FVoxelMaterial& OutMaterial) const
+{
+	FVoxelValue Value;
+	GetValuesAndMaterials(&Value, &OutMaterial, FIntVector(X, Y, Z), FIntVector::ZeroValue, 1, FIntVector(1, 1, 1), FIntVector(1, 1, 1));
+	OutValue = FVoxelValuePolicy::ToFloat(Value);
+}
+
+void FVoxelDataSnapshot::GetSave(FVoxelWorldSave& OutSave, int Depth, EVoxelSaveCompression Compression) const
+{
+	FVoxelWorldSaveWriter Writer(OutSave, Depth, Compression);
+
+	FVoxelChunkSave ChunkSave;
+	TArray<FVoxelValue> GeneratorValues;
+	TArray<FVoxelMaterial> GeneratorMaterials;
+	GeneratorValues.SetNumUninitialized(VOXEL_LEAF_VOXELS);
+	GeneratorMaterials.SetNumUninitialized(VOXEL_LEAF_VOXELS);
+
+	const FIntVector LeafSize(VOXEL_LEAF_SIZE, VOXEL_LEAF_SIZE, VOXEL_LEAF_SIZE);
+	for (auto& Chunk : Chunks)
+	{
+		const FIntVector ChunkMin = Chunk.Position - FIntVector(VOXEL_LEAF_SIZE / 2, VOXEL_LEAF_SIZE / 2, VOXEL_LEAF_SIZE / 2);
+		GeneratorCache->GetValuesAndMaterials(GeneratorValues.GetData(), GeneratorMaterials.GetData(), ChunkMin, FIntVector::ZeroValue, 1, LeafSize, LeafSize);
+
+		// Sparse leafs only write their modified voxels, on top of the generator ones
+		ChunkSave.Id = Chunk.Id;
+		ChunkSave.Mask.Reset();
+		ChunkSave.Values.SetNumUninitialized(VOXEL_LEAF_VOXELS);
+		ChunkSave.Materials.SetNumUninitialized(VOXEL_LEAF_VOXELS);
+		FMemory::Memcpy(ChunkSave.Values.GetData(), GeneratorValues.GetData(), VOXEL_LEAF_VOXELS * sizeof(FVoxelValue));
+		FMemory::Memcpy(ChunkSave.Materials.GetData(), GeneratorMaterials.GetData(), VOXEL_LEAF_VOXELS * sizeof(FVoxelMaterial));
+		Chunk.LeafData->GetValuesAndMaterials(ChunkSave.Values.GetData(), ChunkSave.Materials.GetData(), ChunkMin - Chunk.LeafMin, FIntVector::ZeroValue, 1, LeafSize, LeafSize);
+
+		// Voxels edited back to the generator ones aren't saved either
+		ChunkSave.EncodeDiff(GeneratorValues.GetData(), GeneratorMaterials.GetData());
+
+		Writer.WriteChunk(ChunkSave);
+	}
+
+	Writer.Finish();
+}
+
+void FVoxelDataSnapshot::AddChunk(const FVoxelSnapshotChunk& Chunk)
+{
+	const FIntVector ChunkMin = Chunk.Position - FIntVector(VOXEL_LEAF_SIZE / 2, VOXEL_LEAF_SIZE / 2, VOXEL_LEAF_SIZE / 2);
+	ChunksIndices.Add(GetChunkKey(ChunkMin.X, ChunkMin.Y, ChunkMin.Z), Chunks.Add(Chunk));
+}
+
+uint64 FVoxelDataSnapshot::GetChunkKey(int X, int Y, int Z) const
+{
+	return MortonEncode((X + HalfSize) >> VOXEL_LEAF_SIZE_LOG2, (Y + HalfSize) >> VOXEL_LEAF_SIZE_LOG2, (Z + HalfSize) >> VOXEL_LEAF_SIZE_LOG2);
+}
+
+int FVoxelDataSnapshot::CeilDiv(int A, int B)
+{
+	return A >= 0 ? (A + B - 1) / B : -(-A / B);
+}
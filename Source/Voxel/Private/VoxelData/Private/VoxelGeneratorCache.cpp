@@ -0,0 +1,225 @@
+// Copyright 2017 Phyronnaz
+
+#include "VoxelGeneratorCache.h"
+#include "VoxelWorldGenerator.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Generator Cache Hits"), STAT_VoxelGeneratorCacheHits, STATGROUP_Voxel);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Generator Cache Misses"), STAT_VoxelGeneratorCacheMisses, STATGROUP_Voxel);
+DECLARE_MEMORY_STAT(TEXT("Generator Cache Memory"), STAT_VoxelGeneratorCacheMemory, STATGROUP_Voxel);
+DECLARE_CYCLE_STAT(TEXT("GeneratorCache ~ Generate"), STAT_VoxelGeneratorCache_Generate, STATGROUP_Voxel);
+
+FVoxelGeneratorCache::FVoxelGeneratorCache(UVoxelWorldGenerator* WorldGenerator, uint32 MaxMemory)
+	: WorldGenerator(WorldGenerator)
+	, MaxBlocks(FMath::Max<int>(1, MaxMemory / sizeof(FVoxelGeneratorCacheBlock)))
+	, AccessCounter(0)
+{
+
+}
+
+FVoxelGeneratorCache::~FVoxelGeneratorCache()
+{
+	Empty();
+}
+
+void FVoxelGeneratorCache::GetValuesAndMaterials(FVoxelValue Values[], FVoxelMaterial Materials[], const FIntVector& Start, const FIntVector& StartIndex, const int Step, const FIntVector& Size, const FIntVector& ArraySize)
+{
+	check(Size.GetMin() >= 0);
+	if (Size.X == 0 || Size.Y == 0 || Size.Z == 0)
+	{
+		return;
+	}
+
+	// Blocks are aligned on the Step grid, as Start
+	const int BlockSize = VOXEL_LEAF_SIZE * Step;
+	const FIntVector LastPosition = Start + (Size - FIntVector(1, 1, 1)) * Step;
+	const FIntVector MinBlock(FloorDiv(Start.X, BlockSize), FloorDiv(Start.Y, BlockSize), FloorDiv(Start.Z, BlockSize));
+	const FIntVector MaxBlock(FloorDiv(LastPosition.X, BlockSize), FloorDiv(LastPosition.Y, BlockSize), FloorDiv(LastPosition.Z, BlockSize));
+
+	for (int BlockX = MinBlock.X; BlockX <= MaxBlock.X; BlockX++)
+	{
+		for (int BlockY = MinBlock.Y; BlockY <= MaxBlock.Y; BlockY++)
+		{
+			for (int BlockZ = MinBlock.Z; BlockZ <= MaxBlock.Z; BlockZ++)
+			{
+				const FIntVector BlockPosition = FIntVector(BlockX, BlockY, BlockZ) * BlockSize;
+
+				// Part of the request inside this block, in array space
+				const FIntVector Min(
+					FMath::Max(0, (BlockPosition.X - Start.X) / Step),
+					FMath::Max(0, (BlockPosition.Y - Start.Y) / Step),
+					FMath::Max(0, (BlockPosition.Z - Start.Z) / Step));
+				const FIntVector Max(
+					FMath::Min(Size.X, (BlockPosition.X + BlockSize - Start.X) / Step),
+					FMath::Min(Size.Y, (BlockPosition.Y + BlockSize - Start.Y) / Step),
+					FMath::Min(Size.Z, (BlockPosition.Z + BlockSize - Start.Z) / Step));
+				const FIntVector PartSize = Max - Min;
+
+				if (PartSize.X != VOXEL_LEAF_SIZE || PartSize.Y != VOXEL_LEAF_SIZE || PartSize.Z != VOXEL_LEAF_SIZE)
+				{
+					// Borders: only generate what's needed
+					GenerateValuesAndMaterials(Values, Materials, Start + Min * Step, StartIndex + Min, Step, PartSize, ArraySize);
+					continue;
+				}
+
+				auto Block = GetBlock(FVoxelGeneratorCacheKey(BlockPosition, Step));
+				for (int K = 0; K < VOXEL_LEAF_SIZE; K++)
+				{
+					for (int J = 0; J < VOXEL_LEAF_SIZE; J++)
+					{
+						const int Index = (StartIndex.X + Min.X) + ArraySize.X * (StartIndex.Y + Min.Y + J) + ArraySize.X * ArraySize.Y * (StartIndex.Z + Min.Z + K);
+						const int BlockIndex = VOXEL_LEAF_SIZE * J + VOXEL_LEAF_SIZE * VOXEL_LEAF_SIZE * K;
+						if (Values)
+						{
+							FMemory::Memcpy(&Values[Index], &Block->Values[BlockIndex], VOXEL_LEAF_SIZE * sizeof(FVoxelValue));
+						}
+						if (Materials)
+						{
+							FMemory::Memcpy(&Materials[Index], &Block->Materials[BlockIndex], VOXEL_LEAF_SIZE * sizeof(FVoxelMaterial));
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+void FVoxelGeneratorCache::GenerateValuesAndMaterials(FVoxelValue Values[], FVoxelMaterial Materials[], const FIntVector& Start, const FIntVector& StartIndex, const int Step, const FIntVector& Size, const FIntVector& ArraySize) const
+{
+	SCOPE_CYCLE_COUNTER(STAT_VoxelGeneratorCache_Generate);
+
+#if VOXEL_VALUE_QUANTIZATION
+	if (!Values)
+	{
+		WorldGenerator->GetValuesAndMaterials(nullptr, Materials, Start, StartIndex, Step, Size, ArraySize);
+		return;
+	}
+
+	// Generators output floats: generate in a packed array and quantize
+	TArray<float> GeneratorValues;
+	TArray<FVoxelMaterial> GeneratorMaterials;
+	GeneratorValues.SetNumUninitialized(Size.X * Size.Y * Size.Z);
+	if (Materials)
+	{
+		GeneratorMaterials.SetNumUninitialized(Size.X * Size.Y * Size.Z);
+	}
+	WorldGenerator->GetValuesAndMaterials(GeneratorValues.GetData(), Materials ? GeneratorMaterials.GetData() : nullptr, Start, FIntVector::ZeroValue, Step, Size, Size);
+
+	for (int K = 0; K < Size.Z; K++)
+	{
+		for (int J = 0; J < Size.Y; J++)
+		{
+			for (int I = 0; I < Size.X; I++)
+			{
+				const int GeneratorIndex = I + Size.X * J + Size.X * Size.Y * K;
+				const int Index = (StartIndex.X + I) + ArraySize.X * (StartIndex.Y + J) + ArraySize.X * ArraySize.Y * (StartIndex.Z + K);
+
+				Values[Index] = FVoxelValuePolicy::FromFloat(GeneratorValues[GeneratorIndex]);
+				if (Materials)
+				{
+					Materials[Index] = GeneratorMaterials[GeneratorIndex];
+				}
+			}
+		}
+	}
+#else
+	WorldGenerator->GetValuesAndMaterials(Values, Materials, Start, StartIndex, Step, Size, ArraySize);
+#endif
+}
+
+bool FVoxelGeneratorCache::GetValueRange(const FVoxelBox& Box, const int Step, FVoxelValueRange& OutRange) const
+{
+	float Min;
+	float Max;
+	if (!WorldGenerator->GetValueRange(Box, Step, Min, Max))
+	{
+		return false;
+	}
+
+	// The conversion is monotonic: the bounds stay conservative
+	OutRange.Add(FVoxelValuePolicy::FromFloat(Min));
+	OutRange.Add(FVoxelValuePolicy::FromFloat(Max));
+	return true;
+}
+
+void FVoxelGeneratorCache::Empty()
+{
+	FScopeLock Lock(&Section);
+
+	DEC_MEMORY_STAT_BY(STAT_VoxelGeneratorCacheMemory, Blocks.Num() * sizeof(FVoxelGeneratorCacheBlock));
+	Blocks.Empty();
+}
+
+TSharedPtr<const FVoxelGeneratorCacheBlock, ESPMode::ThreadSafe> FVoxelGeneratorCache::GetBlock(const FVoxelGeneratorCacheKey& Key)
+{
+	{
+		FScopeLock Lock(&Section);
+
+		FEntry* Entry = Blocks.Find(Key);
+		if (Entry)
+		{
+			INC_DWORD_STAT(STAT_VoxelGeneratorCacheHits);
+			Entry->LastAccess = ++AccessCounter;
+			return Entry->Block;
+		}
+	}
+
+	INC_DWORD_STAT(STAT_VoxelGeneratorCacheMisses);
+
+	// Generate without lock: another thread may generate the same block, the result is the same
+	FVoxelGeneratorCacheBlock* NewBlock = new FVoxelGeneratorCacheBlock();
+	GenerateValuesAndMaterials(NewBlock->Values, NewBlock->Materials, Key.Position, FIntVector::ZeroValue, Key.Step, FIntVector(VOXEL_LEAF_SIZE, VOXEL_LEAF_SIZE, VOXEL_LEAF_SIZE), FIntVector(VOXEL_LEAF_SIZE, VOXEL_LEAF_SIZE, VOXEL_LEAF_SIZE));
+	TSharedPtr<const FVoxelGeneratorCacheBlock, ESPMode::ThreadSafe> Block(NewBlock);
+
+	{
+		FScopeLock Lock(&Section);
+
+		if (!Blocks.Contains(Key))
+		{
+			INC_MEMORY_STAT_BY(STAT_VoxelGeneratorCacheMemory, sizeof(FVoxelGeneratorCacheBlock));
+		}
+		FEntry& Entry = Blocks.Add(Key);
+		Entry.Block = Block;
+		Entry.LastAccess = ++AccessCounter;
+
+		if (Blocks.Num() > MaxBlocks)
+		{
+			Evict();
+		}
+	}
+
+	return Block;
+}
+
+int FVoxelGeneratorCache::FloorDiv(int A, int B)
+{
+	return A >= 0 ? A / B : -((-A + B - 1) / B);
+}
+
+void FVoxelGeneratorCache::Evict()
+{
+	TArray<uint64> Accesses;
+	Accesses.Reserve(Blocks.Num());
+	for (auto& It : Blocks)
+	{
+		Accesses.Add(It.Value.LastAccess);
+	}
+	Accesses.Sort();
+
+	// Evict in batches to amortize the sort
+	const int RemovedCount = Blocks.Num() - MaxBlocks * 3 / 4;
+	const uint64 MaxRemovedAccess = Accesses[RemovedCount - 1];
+
+	TArray<FVoxelGeneratorCacheKey> RemovedKeys;
+	for (auto& It : Blocks)
+	{
+		if (It.Value.LastAccess <= MaxRemovedAccess)
+		{
+			RemovedKeys.Add(It.Key);
+		}
+	}
+	for (auto& Key : RemovedKeys)
+	{
+		Blocks.Remove(Key);
+	}
+	DEC_MEMORY_STAT_BY(STAT_VoxelGeneratorCacheMemory, RemovedKeys.Num() * sizeof(FVoxelGeneratorCacheBlock));
+}
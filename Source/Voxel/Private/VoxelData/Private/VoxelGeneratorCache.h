@@ -0,0 +1,124 @@
+// Copyright 2017 Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "VoxelMaterial.h"
+#include "VoxelValue.h"
+#include "VoxelConfig.h"
+#include "VoxelBox.h"
+
+class UVoxelWorldGenerator;
+
+// Default memory budget of the generator cache, in MB
+#ifndef VOXEL_GENERATOR_CACHE_SIZE_MB
+#define VOXEL_GENERATOR_CACHE_SIZE_MB 64
+#endif
+
+/**
+ * Generator output of a VOXEL_LEAF_SIZE^3 block, at a given Step. At Step 1, blocks are the data leafs
+ */
+struct FVoxelGeneratorCacheBlock
+{
+	FVoxelValue Values[VOXEL_LEAF_VOXELS];
+	FVoxelMaterial Materials[VOXEL_LEAF_VOXELS];
+};
+
+/**
+ * Key of a cached block: a block starts at a multiple of VOXEL_LEAF_SIZE * Step
+ */
+struct FVoxelGeneratorCacheKey
+{
+	FIntVector Position;
+	int Step;
+
+	FVoxelGeneratorCacheKey()
+		: Position(FIntVector::ZeroValue)
+		, Step(0)
+	{
+	}
+
+	FVoxelGeneratorCacheKey(const FIntVector& Position, int Step)
+		: Position(Position)
+		, Step(Step)
+	{
+	}
+
+	FORCEINLINE bool operator==(const FVoxelGeneratorCacheKey& Other) const
+	{
+		return Position == Other.Position && Step == Other.Step;
+	}
+
+	FORCEINLINE friend uint32 GetTypeHash(const FVoxelGeneratorCacheKey& Key)
+	{
+		return HashCombine(GetTypeHash(Key.Position), GetTypeHash(Key.Step));
+	}
+};
+
+/**
+ * Thread safe cache of the world generator output, used for the voxels that aren't modified
+ */
+class FVoxelGeneratorCache
+{
+public:
+	/**
+	 * @param	WorldGenerator	Generator of the world
+	 * @param	MaxMemory		Memory budget in bytes. Least recently used blocks are evicted above it
+	 */
+	FVoxelGeneratorCache(UVoxelWorldGenerator* WorldGenerator, uint32 MaxMemory = VOXEL_GENERATOR_CACHE_SIZE_MB * 1024 * 1024);
+	~FVoxelGeneratorCache();
+
+	/**
+	 * Get generator values & materials. Blocks entirely inside the requested area are cached, the others are generated
+	 * @see		UVoxelWorldGenerator::GetValuesAndMaterials
+	 */
+	void GetValuesAndMaterials(FVoxelValue Values[], FVoxelMaterial Materials[], const FIntVector& Start, const FIntVector& StartIndex, const int Step, const FIntVector& Size, const FIntVector& ArraySize);
+
+	/**
+	 * Get generator values & materials without using the cache, converted to the stored value type
+	 * @see		UVoxelWorldGenerator::GetValuesAndMaterials
+	 */
+	void GenerateValuesAndMaterials(FVoxelValue Values[], FVoxelMaterial Materials[], const FIntVector& Start, const FIntVector& StartIndex, const int Step, const FIntVector& Size, const FIntVector& ArraySize) const;
+
+	/**
+	 * Add the generator bounds of the values of Box to OutRange, converted to the stored value type
+	 * @see		UVoxelWorldGenerator::GetValueRange
+	 * @return	Whether the bounds are known. If false, OutRange is unchanged
+	 */
+	bool GetValueRange(const FVoxelBox& Box, const int Step, FVoxelValueRange& OutRange) const;
+
+	/**
+	 * Get a block from the cache, or generate it. Values are indexed by X + VOXEL_LEAF_SIZE * Y + VOXEL_LEAF_SIZE^2 * Z
+	 * @param	Key		Block to get
+	 */
+	TSharedPtr<const FVoxelGeneratorCacheBlock, ESPMode::ThreadSafe> GetBlock(const FVoxelGeneratorCacheKey& Key);
+
+	/**
+	 * Remove all the blocks
+	 */
+	void Empty();
+
+private:
+	struct FEntry
+	{
+		TSharedPtr<const FVoxelGeneratorCacheBlock, ESPMode::ThreadSafe> Block;
+		uint64 LastAccess;
+	};
+
+	UVoxelWorldGenerator* const WorldGenerator;
+	const int MaxBlocks;
+
+	FCriticalSection Section;
+	TMap<FVoxelGeneratorCacheKey, FEntry> Blocks;
+	uint64 AccessCounter;
+
+	/**
+	 * Floor of A / B, B > 0
+	 */
+	FORCEINLINE static int FloorDiv(int A, int B);
+
+	/**
+	 * Evict the least recently used blocks until 3/4 of the budget is used. Section must be locked
+	 */
+	void Evict();
+};
@@ -0,0 +1,109 @@
+// Copyright 2017 Phyronnaz
+
+#include "VoxelLeafCache.h"
+#include "VoxelLeafData.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Leaf Cache Hits"), STAT_VoxelLeafCacheHits, STATGROUP_Voxel);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Leaf Cache Misses"), STAT_VoxelLeafCacheMisses, STATGROUP_Voxel);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Leaf Cache Leafs"), STAT_VoxelLeafCacheLeafs, STATGROUP_Voxel);
+
+FVoxelLeafCache::FVoxelLeafCache(int MaxLeafs)
+	: MaxLeafs(FMath::Max(1, MaxLeafs))
+	, AccessCounter(0)
+{
+
+}
+
+FVoxelLeafCache::~FVoxelLeafCache()
+{
+	Empty();
+}
+
+TSharedPtr<FVoxelLeafData, ESPMode::ThreadSafe> FVoxelLeafCache::Get(const FValueOctree* Leaf, const TArray<uint8>& CompressedLeafData)
+{
+	{
+		FScopeLock Lock(&Section);
+
+		FEntry* Entry = Leafs.Find(Leaf);
+		if (Entry)
+		{
+			INC_DWORD_STAT(STAT_VoxelLeafCacheHits);
+			Entry->LastAccess = ++AccessCounter;
+			return Entry->LeafData;
+		}
+	}
+
+	INC_DWORD_STAT(STAT_VoxelLeafCacheMisses);
+
+	// Decompress without lock: another thread may decompress the same leaf, the result is the same
+	TSharedPtr<FVoxelLeafData, ESPMode::ThreadSafe> LeafData = MakeShareable(new FVoxelLeafData());
+	LeafData->Decompress(CompressedLeafData);
+
+	{
+		FScopeLock Lock(&Section);
+
+		if (!Leafs.Contains(Leaf))
+		{
+			INC_DWORD_STAT(STAT_VoxelLeafCacheLeafs);
+		}
+		FEntry& Entry = Leafs.Add(Leaf);
+		Entry.LeafData = LeafData;
+		Entry.LastAccess = ++AccessCounter;
+
+		if (Leafs.Num() > MaxLeafs)
+		{
+			Evict();
+		}
+	}
+
+	return LeafData;
+}
+
+TSharedPtr<FVoxelLeafData, ESPMode::ThreadSafe> FVoxelLeafCache::Remove(const FValueOctree* Leaf)
+{
+	FScopeLock Lock(&Section);
+
+	FEntry Entry;
+	if (Leafs.RemoveAndCopyValue(Leaf, Entry))
+	{
+		DEC_DWORD_STAT(STAT_VoxelLeafCacheLeafs);
+	}
+	return Entry.LeafData;
+}
+
+void FVoxelLeafCache::Empty()
+{
+	FScopeLock Lock(&Section);
+
+	DEC_DWORD_STAT_BY(STAT_VoxelLeafCacheLeafs, Leafs.Num());
+	Leafs.Empty();
+}
+
+void FVoxelLeafCache::Evict()
+{
+	TArray<uint64> Accesses;
+	Accesses.Reserve(Leafs.Num());
+	for (auto& It : Leafs)
+	{
+		Accesses.Add(It.Value.LastAccess);
+	}
+	Accesses.Sort();
+
+	// Evict in batches to amortize the sort
+	const int RemovedCount = Leafs.Num() - MaxLeafs * 3 / 4;
+	const uint64 MaxRemovedAccess = Accesses[RemovedCount - 1];
+
+	TArray<const FValueOctree*> RemovedLeafs;
+	for (auto& It : Leafs)
+	{
+		if (It.Value.LastAccess <= MaxRemovedAccess)
+		{
+			RemovedLeafs.Add(It.Key);
+		}
+	}
+	for (auto Leaf : RemovedLeafs)
+	{
+		Leafs.Remove(Leaf);
+	}
+	DEC_DWORD_STAT_BY(STAT_VoxelLeafCacheLeafs, RemovedLeafs.Num());
+}
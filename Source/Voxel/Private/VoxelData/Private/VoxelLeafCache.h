@@ -0,0 +1,64 @@
+// Copyright 2017 Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class FValueOctree;
+class FVoxelLeafData;
+
+// Number of decompressed leafs kept by the cache
+#ifndef VOXEL_LEAF_CACHE_SIZE
+#define VOXEL_LEAF_CACHE_SIZE 128
+#endif
+
+/**
+ * Thread safe cache of the decompressed copies of the compressed leafs, so that readers don't decompress a leaf at each access
+ * The compressed leafs are only decompressed in place when edited
+ */
+class FVoxelLeafCache
+{
+public:
+	/**
+	 * @param	MaxLeafs	Number of leafs kept. Least recently used leafs are evicted above it
+	 */
+	FVoxelLeafCache(int MaxLeafs = VOXEL_LEAF_CACHE_SIZE);
+	~FVoxelLeafCache();
+
+	/**
+	 * Get the decompressed copy of a leaf, decompressing it if needed
+	 * @param	Leaf				Compressed node
+	 * @param	CompressedLeafData	Compressed values of Leaf
+	 * @return	Read only copy of the leaf
+	 */
+	TSharedPtr<FVoxelLeafData, ESPMode::ThreadSafe> Get(const FValueOctree* Leaf, const TArray<uint8>& CompressedLeafData);
+
+	/**
+	 * Remove the copy of a leaf. Must be called when it is decompressed in place or deleted
+	 * @return	The removed copy, or nullptr if not cached
+	 */
+	TSharedPtr<FVoxelLeafData, ESPMode::ThreadSafe> Remove(const FValueOctree* Leaf);
+
+	/**
+	 * Remove all the leafs
+	 */
+	void Empty();
+
+private:
+	struct FEntry
+	{
+		TSharedPtr<FVoxelLeafData, ESPMode::ThreadSafe> LeafData;
+		uint64 LastAccess;
+	};
+
+	const int MaxLeafs;
+
+	FCriticalSection Section;
+	TMap<const FValueOctree*, FEntry> Leafs;
+	uint64 AccessCounter;
+
+	/**
+	 * Evict the least recently used leafs until 3/4 of the budget is used. Section must be locked
+	 */
+	void Evict();
+};
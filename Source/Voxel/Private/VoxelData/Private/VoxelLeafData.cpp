@@ -0,0 +1,685 @@
+// Copyright 2017 Phyronnaz
+
+#include "VoxelLeafData.h"
+#include "VoxelLZ4.h"
+#include "MemoryWriter.h"
+#include "MemoryReader.h"
+
+DECLARE_MEMORY_STAT(TEXT("Voxel Leafs Memory"), STAT_VoxelLeafsMemory, STATGROUP_Voxel);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Voxel Sparse Leafs"), STAT_VoxelSparseLeafs, STATGROUP_Voxel);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Voxel Uniform Leafs"), STAT_VoxelUniformLeafs, STATGROUP_Voxel);
+DECLARE_CYCLE_STAT(TEXT("LeafData ~ Copy"), STAT_VoxelLeafData_Copy, STATGROUP_Voxel);
+DECLARE_CYCLE_STAT(TEXT("LeafData ~ Compress"), STAT_VoxelLeafData_Compress, STATGROUP_Voxel);
+DECLARE_CYCLE_STAT(TEXT("LeafData ~ Decompress"), STAT_VoxelLeafData_Decompress, STATGROUP_Voxel);
+
+FVoxelLeafData::FVoxelLeafData()
+	: Format(EVoxelLeafFormat::Sparse)
+	, ReportedSize(0)
+{
+	INC_DWORD_STAT(STAT_VoxelSparseLeafs);
+	UpdateStats();
+}
+
+FVoxelLeafData::FVoxelLeafData(FVoxelValue Value, const FVoxelMaterial& Material)
+	: Format(EVoxelLeafFormat::Uniform)
+	, UniformValue(Value)
+	, UniformMaterial(Material)
+	, ReportedSize(0)
+{
+	INC_DWORD_STAT(STAT_VoxelUniformLeafs);
+	UpdateStats();
+}
+
+FVoxelLeafData::FVoxelLeafData(const FVoxelLeafData& Other)
+	: Format(Other.Format)
+	, SparseIndices(Other.SparseIndices)
+	, SparseValues(Other.SparseValues)
+	, SparseMaterials(Other.SparseMaterials)
+	, Values(Other.Values)
+	, Palette(Other.Palette)
+	, PaletteIndices(Other.PaletteIndices)
+	, Materials(Other.Materials)
+	, UniformValue(Other.UniformValue)
+	, UniformMaterial(Other.UniformMaterial)
+	, ValueRange(Other.ValueRange)
+	, ReportedSize(0)
+{
+	if (Format == EVoxelLeafFormat::Sparse)
+	{
+		INC_DWORD_STAT(STAT_VoxelSparseLeafs);
+	}
+	else if (Format == EVoxelLeafFormat::Uniform)
+	{
+		INC_DWORD_STAT(STAT_VoxelUniformLeafs);
+	}
+	UpdateStats();
+}
+
+FVoxelLeafData::~FVoxelLeafData()
+{
+	if (Format == EVoxelLeafFormat::Sparse)
+	{
+		DEC_DWORD_STAT(STAT_VoxelSparseLeafs);
+	}
+	else if (Format == EVoxelLeafFormat::Uniform)
+	{
+		DEC_DWORD_STAT(STAT_VoxelUniformLeafs);
+	}
+	DEC_MEMORY_STAT_BY(STAT_VoxelLeafsMemory, ReportedSize);
+}
+
+EVoxelLeafFormat FVoxelLeafData::GetFormat() const
+{
+	return Format;
+}
+
+bool FVoxelLeafData::Contains(int Index) const
+{
+	if (Format == EVoxelLeafFormat::Sparse)
+	{
+		const int SparseIndex = LowerBound(Index);
+		return SparseIndex < SparseIndices.Num() && SparseIndices[SparseIndex] == Index;
+	}
+	else
+	{
+		return true;
+	}
+}
+
+bool FVoxelLeafData::NeedsDense() const
+{
+	return Format == EVoxelLeafFormat::Sparse && SparseIndices.Num() > VOXEL_SPARSE_LEAF_MAX_VOXELS;
+}
+
+bool FVoxelLeafData::IsUniform(FVoxelValue& OutValue, FVoxelMaterial& OutMaterial) const
+{
+	if (Format == EVoxelLeafFormat::Uniform)
+	{
+		OutValue = UniformValue;
+		OutMaterial = UniformMaterial;
+		return true;
+	}
+	else
+	{
+		return false;
+	}
+}
+
+FVoxelValueRange FVoxelLeafData::GetValueRange() const
+{
+	if (Format == EVoxelLeafFormat::Uniform)
+	{
+		return FVoxelValueRange(UniformValue, UniformValue);
+	}
+	else
+	{
+		return ValueRange;
+	}
+}
+
+void FVoxelLeafData::UpdateValueRange()
+{
+	ValueRange = FVoxelValueRange();
+	if (Format == EVoxelLeafFormat::Sparse)
+	{
+		for (FVoxelValue Value : SparseValues)
+		{
+			ValueRange.Add(Value);
+		}
+	}
+	else if (Format != EVoxelLeafFormat::Uniform)
+	{
+		for (FVoxelValue Value : Values)
+		{
+			ValueRange.Add(Value);
+		}
+	}
+}
+
+bool FVoxelLeafData::TryMakeUniform()
+{
+	if (Format == EVoxelLeafFormat::Uniform)
+	{
+		return true;
+	}
+	if (Format == EVoxelLeafFormat::Sparse)
+	{
+		return false;
+	}
+
+	const FVoxelValue Value = Values[0];
+	for (int Index = 1; Index < VOXEL_LEAF_VOXELS; Index++)
+	{
+		if (Values[Index] != Value)
+		{
+			return false;
+		}
+	}
+	if (Format == EVoxelLeafFormat::Palette)
+	{
+		// Palette entries are unique
+		const uint8 PaletteIndex = PaletteIndices[0];
+		for (int Index = 1; Index < VOXEL_LEAF_VOXELS; Index++)
+		{
+			if (PaletteIndices[Index] != PaletteIndex)
+			{
+				return false;
+			}
+		}
+	}
+	else
+	{
+		for (int Index = 1; Index < VOXEL_LEAF_VOXELS; Index++)
+		{
+			if (!(Materials[Index] == Materials[0]))
+			{
+				return false;
+			}
+		}
+	}
+
+	const FVoxelMaterial Material = GetDenseMaterial(0);
+	Empty();
+	SetFormat(EVoxelLeafFormat::Uniform);
+	UniformValue = Value;
+	UniformMaterial = Material;
+	UpdateStats();
+
+	return true;
+}
+
+void FVoxelLeafData::GetValuesAndMaterials(FVoxelValue InValues[], FVoxelMaterial InMaterials[], const FIntVector& LocalStart, const FIntVector& StartIndex, const int Step, const FIntVector& Size, const FIntVector& ArraySize) const
+{
+	if (Format == EVoxelLeafFormat::Uniform)
+	{
+		// Fill
+		for (int K = 0; K < Size.Z; K++)
+		{
+			for (int J = 0; J < Size.Y; J++)
+			{
+				const int RowIndex = StartIndex.X + ArraySize.X * (StartIndex.Y + J) + ArraySize.X * ArraySize.Y * (StartIndex.Z + K);
+				if (InValues)
+				{
+					for (int I = 0; I < Size.X; I++)
+					{
+						InValues[RowIndex + I] = UniformValue;
+					}
+				}
+				if (InMaterials)
+				{
+					for (int I = 0; I < Size.X; I++)
+					{
+						InMaterials[RowIndex + I] = UniformMaterial;
+					}
+				}
+			}
+		}
+		return;
+	}
+
+	check(0 <= LocalStart.X && LocalStart.X + (Size.X - 1) * Step < VOXEL_LEAF_SIZE);
+	check(0 <= LocalStart.Y && LocalStart.Y + (Size.Y - 1) * Step < VOXEL_LEAF_SIZE);
+	check(0 <= LocalStart.Z && LocalStart.Z + (Size.Z - 1) * Step < VOXEL_LEAF_SIZE);
+
+	if (Format == EVoxelLeafFormat::Sparse)
+	{
+		// Overwrite the generator values with the modified ones
+		for (int SparseIndex = 0; SparseIndex < SparseIndices.Num(); SparseIndex++)
+		{
+			const int LocalIndex = SparseIndices[SparseIndex];
+			const int X = LocalIndex % VOXEL_LEAF_SIZE - LocalStart.X;
+			const int Y = (LocalIndex / VOXEL_LEAF_SIZE) % VOXEL_LEAF_SIZE - LocalStart.Y;
+			const int Z = LocalIndex / (VOXEL_LEAF_SIZE * VOXEL_LEAF_SIZE) - LocalStart.Z;
+
+			if (X < 0 || Y < 0 || Z < 0 || X % Step != 0 || Y % Step != 0 || Z % Step != 0)
+			{
+				continue;
+			}
+			const int I = X / Step;
+			const int J = Y / Step;
+			const int K = Z / Step;
+			if (I >= Size.X || J >= Size.Y || K >= Size.Z)
+			{
+				continue;
+			}
+
+			const int Index = (StartIndex.X + I) + ArraySize.X * (StartIndex.Y + J) + ArraySize.X * ArraySize.Y * (StartIndex.Z + K);
+			if (InValues)
+			{
+				InValues[Index] = SparseValues[SparseIndex];
+			}
+			if (InMaterials)
+			{
+				InMaterials[Index] = SparseMaterials[SparseIndex];
+			}
+		}
+	}
+	else
+	{
+		SCOPE_CYCLE_COUNTER(STAT_VoxelLeafData_Copy);
+
+		const FVoxelValue* const LeafValues = Values.GetData();
+		const FVoxelMaterial* const LeafMaterials = Materials.GetData();
+		const FVoxelMaterial* const LeafPalette = Palette.GetData();
+		const uint8* const LeafPaletteIndices = PaletteIndices.GetData();
+		const bool bPalette = Format == EVoxelLeafFormat::Palette;
+
+		for (int K = 0; K < Size.Z; K++)
+		{
+			for (int J = 0; J < Size.Y; J++)
+			{
+				const int RowIndex = StartIndex.X + ArraySize.X * (StartIndex.Y + J) + ArraySize.X * ArraySize.Y * (StartIndex.Z + K);
+#if VOXEL_BRICK_LAYOUT
+				// Leaf rows aren't contiguous
+				const int LocalY = LocalStart.Y + J * Step;
+				const int LocalZ = LocalStart.Z + K * Step;
+				for (int I = 0; I < Size.X; I++)
+				{
+					const int LocalIndex = FVoxelLeafLayout::Index(LocalStart.X + I * Step, LocalY, LocalZ);
+					if (InValues)
+					{
+						InValues[RowIndex + I] = LeafValues[LocalIndex];
+					}
+					if (InMaterials)
+					{
+						InMaterials[RowIndex + I] = bPalette ? LeafPalette[LeafPaletteIndices[LocalIndex]] : LeafMaterials[LocalIndex];
+					}
+				}
+#else
+				// Copy row by row: rows are contiguous in the output, and in the leaf if Step == 1
+				const int LocalRowIndex = LocalStart.X + VOXEL_LEAF_SIZE * (LocalStart.Y + J * Step) + VOXEL_LEAF_SIZE * VOXEL_LEAF_SIZE * (LocalStart.Z + K * Step);
+
+				if (InValues)
+				{
+					if (Step == 1)
+					{
+						FMemory::Memcpy(&InValues[RowIndex], &LeafValues[LocalRowIndex], Size.X * sizeof(FVoxelValue));
+					}
+					else
+					{
+						for (int I = 0; I < Size.X; I++)
+						{
+							InValues[RowIndex + I] = LeafValues[LocalRowIndex + I * Step];
+						}
+					}
+				}
+				if (InMaterials)
+				{
+					if (bPalette)
+					{
+						for (int I = 0; I < Size.X; I++)
+						{
+							InMaterials[RowIndex + I] = LeafPalette[LeafPaletteIndices[LocalRowIndex + I * Step]];
+						}
+					}
+					else if (Step == 1)
+					{
+						FMemory::Memcpy(&InMaterials[RowIndex], &LeafMaterials[LocalRowIndex], Size.X * sizeof(FVoxelMaterial));
+					}
+					else
+					{
+						for (int I = 0; I < Size.X; I++)
+						{
+							InMaterials[RowIndex + I] = LeafMaterials[LocalRowIndex + I * Step];
+						}
+					}
+				}
+#endif
+			}
+		}
+	}
+}
+
+void FVoxelLeafData::GetValueAndMaterial(int Index, FVoxelValue& OutValue, FVoxelMaterial& OutMaterial) const
+{
+	check(Contains(Index));
+
+	if (Format == EVoxelLeafFormat::Sparse)
+	{
+		const int SparseIndex = LowerBound(Index);
+		OutValue = SparseValues[SparseIndex];
+		OutMaterial = SparseMaterials[SparseIndex];
+	}
+	else if (Format == EVoxelLeafFormat::Uniform)
+	{
+		OutValue = UniformValue;
+		OutMaterial = UniformMaterial;
+	}
+	else
+	{
+		const int DenseIndex = FVoxelLeafLayout::FromLinearIndex(Index);
+		OutValue = Values[DenseIndex];
+		OutMaterial = GetDenseMaterial(DenseIndex);
+	}
+}
+
+void FVoxelLeafData::SetValueAndMaterial(int Index, FVoxelValue Value, const FVoxelMaterial& Material)
+{
+	check(0 <= Index && Index < VOXEL_LEAF_VOXELS);
+
+	if (Format == EVoxelLeafFormat::Sparse)
+	{
+		ValueRange.Add(Value);
+
+		const int SparseIndex = LowerBound(Index);
+		if (SparseIndex < SparseIndices.Num() && SparseIndices[SparseIndex] == Index)
+		{
+			SparseValues[SparseIndex] = Value;
+			SparseMaterials[SparseIndex] = Material;
+		}
+		else
+		{
+			SparseIndices.Insert((uint16)Index, SparseIndex);
+			SparseValues.Insert(Value, SparseIndex);
+			SparseMaterials.Insert(Material, SparseIndex);
+			UpdateStats();
+		}
+	}
+	else if (Format == EVoxelLeafFormat::Uniform)
+	{
+		if (Value == UniformValue && Material == UniformMaterial)
+		{
+			return;
+		}
+
+		SetFormat(EVoxelLeafFormat::Palette);
+		Values.Init(UniformValue, VOXEL_LEAF_VOXELS);
+		Palette.Add(UniformMaterial);
+		PaletteIndices.SetNumZeroed(VOXEL_LEAF_VOXELS);
+		ValueRange = FVoxelValueRange(UniformValue, UniformValue);
+		ValueRange.Add(Value);
+
+		const int DenseIndex = FVoxelLeafLayout::FromLinearIndex(Index);
+		Values[DenseIndex] = Value;
+		SetDenseMaterial(DenseIndex, Material);
+		UpdateStats();
+	}
+	else
+	{
+		ValueRange.Add(Value);
+
+		const int DenseIndex = FVoxelLeafLayout::FromLinearIndex(Index);
+		Values[DenseIndex] = Value;
+		SetDenseMaterial(DenseIndex, Material);
+	}
+}
+
+void FVoxelLeafData::MakeDense(const FVoxelValue GeneratorValues[], const FVoxelMaterial GeneratorMaterials[])
+{
+	check(Format == EVoxelLeafFormat::Sparse);
+
+	TArray<uint16> OldIndices = MoveTemp(SparseIndices);
+	TArray<FVoxelValue> OldValues = MoveTemp(SparseValues);
+	TArray<FVoxelMaterial> OldMaterials = MoveTemp(SparseMaterials);
+
+	Empty();
+	SetFormat(EVoxelLeafFormat::Palette);
+
+	Values.SetNumUninitialized(VOXEL_LEAF_VOXELS);
+	PaletteIndices.SetNumZeroed(VOXEL_LEAF_VOXELS);
+
+	for (int Index = 0; Index < VOXEL_LEAF_VOXELS; Index++)
+	{
+		const int DenseIndex = FVoxelLeafLayout::FromLinearIndex(Index);
+		Values[DenseIndex] = GeneratorValues[Index];
+		SetDenseMaterial(DenseIndex, GeneratorMaterials[Index]);
+	}
+	for (int SparseIndex = 0; SparseIndex < OldIndices.Num(); SparseIndex++)
+	{
+		const int DenseIndex = FVoxelLeafLayout::FromLinearIndex(OldIndices[SparseIndex]);
+		Values[DenseIndex] = OldValues[SparseIndex];
+		SetDenseMaterial(DenseIndex, OldMaterials[SparseIndex]);
+	}
+
+	UpdateValueRange();
+	UpdateStats();
+}
+
+void FVoxelLeafData::SetAllValuesAndMaterials(const FVoxelValue InValues[], const FVoxelMaterial InMaterials[], const FVoxelValue GeneratorValues[], const FVoxelMaterial GeneratorMaterials[])
+{
+	Empty();
+	SetFormat(EVoxelLeafFormat::Sparse);
+
+	for (int Index = 0; Index < VOXEL_LEAF_VOXELS; Index++)
+	{
+		if (InValues[Index] != GeneratorValues[Index] || !(InMaterials[Index] == GeneratorMaterials[Index]))
+		{
+			// Indices are added in order
+			SparseIndices.Add(Index);
+			SparseValues.Add(InValues[Index]);
+			SparseMaterials.Add(InMaterials[Index]);
+		}
+	}
+
+	if (NeedsDense())
+	{
+		SparseIndices.Empty();
+		SparseValues.Empty();
+		SparseMaterials.Empty();
+		MakeDense(InValues, InMaterials);
+		TryMakeUniform();
+	}
+	else
+	{
+		SparseIndices.Shrink();
+		SparseValues.Shrink();
+		SparseMaterials.Shrink();
+		UpdateValueRange();
+		UpdateStats();
+	}
+}
+
+uint32 FVoxelLeafData::GetAllocatedSize() const
+{
+	return sizeof(FVoxelLeafData)
+		+ SparseIndices.GetAllocatedSize()
+		+ SparseValues.GetAllocatedSize()
+		+ SparseMaterials.GetAllocatedSize()
+		+ Values.GetAllocatedSize()
+		+ Palette.GetAllocatedSize()
+		+ PaletteIndices.GetAllocatedSize()
+		+ Materials.GetAllocatedSize();
+}
+
+void FVoxelLeafData::Serialize(FArchive& Ar)
+{
+	uint8 SavedFormat = (uint8)Format;
+	Ar << SavedFormat;
+	if (Ar.IsLoading())
+	{
+		check(Format == EVoxelLeafFormat::Sparse && SparseIndices.Num() == 0);
+		SetFormat((EVoxelLeafFormat)SavedFormat);
+	}
+
+	Ar << SparseIndices;
+	Ar << SparseValues;
+	Ar << SparseMaterials;
+	Ar << Values;
+	Ar << Palette;
+	Ar << PaletteIndices;
+	Ar << Materials;
+	Ar << UniformValue;
+	Ar << UniformMaterial;
+	Ar << ValueRange.Min;
+	Ar << ValueRange.Max;
+	Ar << ValueRange.bIsEmpty;
+
+	if (Ar.IsLoading())
+	{
+		UpdateStats();
+	}
+}
+
+void FVoxelLeafData::Compress(TArray<uint8>& OutCompressedData)
+{
+	SCOPE_CYCLE_COUNTER(STAT_VoxelLeafData_Compress);
+
+	TArray<uint8> Data;
+	FMemoryWriter Writer(Data);
+	Serialize(Writer);
+
+	TArray<uint8> Compressed;
+	FVoxelLZ4::Compress(Data.GetData(), Data.Num(), Compressed);
+
+	// Uncompressed size, then the LZ4 block
+	int32 Size = Data.Num();
+	OutCompressedData.Empty(sizeof(int32) + Compressed.Num());
+	OutCompressedData.Append((uint8*)&Size, sizeof(int32));
+	OutCompressedData.Append(Compressed);
+}
+
+void FVoxelLeafData::Decompress(const TArray<uint8>& CompressedData)
+{
+	SCOPE_CYCLE_COUNTER(STAT_VoxelLeafData_Decompress);
+
+	check(CompressedData.Num() >= sizeof(int32));
+	int32 Size;
+	FMemory::Memcpy(&Size, CompressedData.GetData(), sizeof(int32));
+
+	TArray<uint8> Data;
+	Data.SetNumUninitialized(Size);
+	verify(FVoxelLZ4::Decompress(CompressedData.GetData() + sizeof(int32), CompressedData.Num() - sizeof(int32), Data.GetData(), Size));
+
+	FMemoryReader Reader(Data);
+	Serialize(Reader);
+}
+
+int FVoxelLeafData::LowerBound(int Index) const
+{
+	int Min = 0;
+	int Max = SparseIndices.Num();
+	while (Min < Max)
+	{
+		const int Middle = (Min + Max) / 2;
+		if (SparseIndices[Middle] < Index)
+		{
+			Min = Middle + 1;
+		}
+		else
+		{
+			Max = Middle;
+		}
+	}
+	return Min;
+}
+
+FVoxelMaterial FVoxelLeafData::GetDenseMaterial(int Index) const
+{
+	if (Format == EVoxelLeafFormat::Palette)
+	{
+		return Palette[PaletteIndices[Index]];
+	}
+	else
+	{
+		check(Format == EVoxelLeafFormat::Dense);
+		return Materials[Index];
+	}
+}
+
+void FVoxelLeafData::SetDenseMaterial(int Index, const FVoxelMaterial& Material)
+{
+	if (Format == EVoxelLeafFormat::Palette)
+	{
+		int PaletteIndex = Palette.Find(Material);
+		if (PaletteIndex == INDEX_NONE)
+		{
+			if (Palette.Num() == 256 && !CompactPalette())
+			{
+				// Too many materials: store them directly
+				Materials.SetNumUninitialized(VOXEL_LEAF_VOXELS);
+				for (int OtherIndex = 0; OtherIndex < VOXEL_LEAF_VOXELS; OtherIndex++)
+				{
+					Materials[OtherIndex] = Palette[PaletteIndices[OtherIndex]];
+				}
+				Palette.Empty();
+				PaletteIndices.Empty();
+				Format = EVoxelLeafFormat::Dense;
+
+				Materials[Index] = Material;
+				UpdateStats();
+				return;
+			}
+			PaletteIndex = Palette.Add(Material);
+		}
+		PaletteIndices[Index] = PaletteIndex;
+	}
+	else
+	{
+		check(Format == EVoxelLeafFormat::Dense);
+		Materials[Index] = Material;
+	}
+}
+
+bool FVoxelLeafData::CompactPalette()
+{
+	check(Format == EVoxelLeafFormat::Palette);
+
+	bool Used[256] = { false };
+	for (uint8 PaletteIndex : PaletteIndices)
+	{
+		Used[PaletteIndex] = true;
+	}
+
+	uint8 NewIndices[256];
+	TArray<FVoxelMaterial> NewPalette;
+	for (int PaletteIndex = 0; PaletteIndex < Palette.Num(); PaletteIndex++)
+	{
+		if (Used[PaletteIndex])
+		{
+			NewIndices[PaletteIndex] = NewPalette.Add(Palette[PaletteIndex]);
+		}
+	}
+	if (NewPalette.Num() == Palette.Num())
+	{
+		return false;
+	}
+
+	for (uint8& PaletteIndex : PaletteIndices)
+	{
+		PaletteIndex = NewIndices[PaletteIndex];
+	}
+	Palette = MoveTemp(NewPalette);
+	return true;
+}
+
+void FVoxelLeafData::SetFormat(EVoxelLeafFormat NewFormat)
+{
+	if (Format == EVoxelLeafFormat::Sparse)
+	{
+		DEC_DWORD_STAT(STAT_VoxelSparseLeafs);
+	}
+	else if (Format == EVoxelLeafFormat::Uniform)
+	{
+		DEC_DWORD_STAT(STAT_VoxelUniformLeafs);
+	}
+
+	Format = NewFormat;
+
+	if (Format == EVoxelLeafFormat::Sparse)
+	{
+		INC_DWORD_STAT(STAT_VoxelSparseLeafs);
+	}
+	else if (Format == EVoxelLeafFormat::Uniform)
+	{
+		INC_DWORD_STAT(STAT_VoxelUniformLeafs);
+	}
+}
+
+void FVoxelLeafData::Empty()
+{
+	SparseIndices.Empty();
+	SparseValues.Empty();
+	SparseMaterials.Empty();
+	Values.Empty();
+	Palette.Empty();
+	PaletteIndices.Empty();
+	Materials.Empty();
+}
+
+void FVoxelLeafData::UpdateStats()
+{
+	const uint32 NewSize = GetAllocatedSize();
+	INC_MEMORY_STAT_BY(STAT_VoxelLeafsMemory, NewSize);
+	DEC_MEMORY_STAT_BY(STAT_VoxelLeafsMemory, ReportedSize);
+	ReportedSize = NewSize;
+}
@@ -0,0 +1,189 @@
+// Copyright 2017 Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "VoxelMaterial.h"
+#include "VoxelValue.h"
+#include "VoxelConfig.h"
+#include "VoxelLayout.h"
+
+// Above this number of modified voxels, a sparse leaf is converted to a dense one
+#define VOXEL_SPARSE_LEAF_MAX_VOXELS (VOXEL_LEAF_VOXELS / 4)
+
+/**
+ * How the voxels of a dirty leaf are stored
+ */
+enum class EVoxelLeafFormat : uint8
+{
+	// Only the modified voxels are stored, the others are the generator ones
+	Sparse,
+	// All the values are stored, materials are indices into a palette
+	Palette,
+	// All the values and materials are stored
+	Dense,
+	// All the voxels have the same value & material
+	Uniform
+};
+
+// Layout of the Palette & Dense arrays
+typedef TVoxelLayout<VOXEL_LEAF_SIZE> FVoxelLeafLayout;
+static_assert(FVoxelLeafLayout::Count == VOXEL_LEAF_VOXELS, "Leaf arrays have VOXEL_LEAF_SIZE^3 elements");
+
+/**
+ * Values & materials of a dirty FValueOctree leaf (VOXEL_LEAF_SIZE^3 voxels, or any size if uniform)
+ * Indices given to this class are linear (X + VOXEL_LEAF_SIZE * Y + VOXEL_LEAF_SIZE^2 * Z), whatever the layout
+ */
+class FVoxelLeafData
+{
+public:
+	/**
+	 * Create an empty sparse leaf: all the voxels are the generator ones
+	 */
+	FVoxelLeafData();
+	/**
+	 * Create an uniform leaf
+	 */
+	FVoxelLeafData(FVoxelValue Value, const FVoxelMaterial& Material);
+	/**
+	 * Copy a leaf, used to modify a leaf shared with snapshots
+	 */
+	FVoxelLeafData(const FVoxelLeafData& Other);
+	~FVoxelLeafData();
+
+	FVoxelLeafData& operator=(const FVoxelLeafData&) = delete;
+
+	FORCEINLINE EVoxelLeafFormat GetFormat() const;
+
+	/**
+	 * Does this leaf store the voxel at Index? Always true if not sparse
+	 */
+	FORCEINLINE bool Contains(int Index) const;
+
+	/**
+	 * Should this leaf be converted to a dense one?
+	 */
+	FORCEINLINE bool NeedsDense() const;
+
+	/**
+	 * Get the value & material of an uniform leaf
+	 * @return	Whether this leaf is uniform
+	 */
+	FORCEINLINE bool IsUniform(FVoxelValue& OutValue, FVoxelMaterial& OutMaterial) const;
+
+	/**
+	 * Get the bounds of the stored values. Conservative: SetValueAndMaterial only widens them, see UpdateValueRange
+	 * If sparse, the generator values aren't included
+	 */
+	FORCEINLINE FVoxelValueRange GetValueRange() const;
+
+	/**
+	 * Recompute the exact bounds of the stored values
+	 */
+	void UpdateValueRange();
+
+	/**
+	 * Switch to the uniform format if all the voxels are the same. Sparse leafs are never uniform
+	 * @return	Whether this leaf is uniform
+	 */
+	bool TryMakeUniform();
+
+	/**
+	 * Copy the voxels of this leaf into arrays. If sparse, only the stored voxels are written: the arrays must already hold the generator values
+	 * @param	LocalStart	Start in leaf space (0 <= LocalStart < VOXEL_LEAF_SIZE). Ignored if uniform
+	 * @see		FValueOctree::GetValuesAndMaterials
+	 */
+	void GetValuesAndMaterials(FVoxelValue Values[], FVoxelMaterial Materials[], const FIntVector& LocalStart, const FIntVector& StartIndex, const int Step, const FIntVector& Size, const FIntVector& ArraySize) const;
+
+	/**
+	 * Get a stored voxel
+	 * @param	Index	Index in leaf space. Contains(Index) must be true
+	 */
+	void GetValueAndMaterial(int Index, FVoxelValue& OutValue, FVoxelMaterial& OutMaterial) const;
+
+	/**
+	 * Set a voxel. NeedsDense must be checked after
+	 * @param	Index	Index in leaf space
+	 */
+	void SetValueAndMaterial(int Index, FVoxelValue Value, const FVoxelMaterial& Material);
+
+	/**
+	 * Store all the voxels
+	 * @param	GeneratorValues		Generator values of this leaf
+	 * @param	GeneratorMaterials	Generator materials of this leaf
+	 */
+	void MakeDense(const FVoxelValue GeneratorValues[], const FVoxelMaterial GeneratorMaterials[]);
+
+	/**
+	 * Replace the content of this leaf, using the smallest format
+	 * @param	InValues			New values of this leaf
+	 * @param	InMaterials			New materials of this leaf
+	 * @param	GeneratorValues		Generator values of this leaf
+	 * @param	GeneratorMaterials	Generator materials of this leaf
+	 */
+	void SetAllValuesAndMaterials(const FVoxelValue InValues[], const FVoxelMaterial InMaterials[], const FVoxelValue GeneratorValues[], const FVoxelMaterial GeneratorMaterials[]);
+
+	/**
+	 * Memory used by this leaf, in bytes
+	 */
+	uint32 GetAllocatedSize() const;
+
+	/**
+	 * Save or load this leaf, used to page it out. Loading must be done on an empty leaf
+	 */
+	void Serialize(FArchive& Ar);
+
+	/**
+	 * Serialize and compress this leaf, used for the idle leafs
+	 * @param	OutCompressedData	Compressed leaf, with no slack
+	 */
+	void Compress(TArray<uint8>& OutCompressedData);
+
+	/**
+	 * Load a leaf compressed by Compress. Must be done on an empty leaf
+	 */
+	void Decompress(const TArray<uint8>& CompressedData);
+
+private:
+	EVoxelLeafFormat Format;
+
+	// Sparse: sorted indices of the modified voxels, and their values & materials
+	TArray<uint16> SparseIndices;
+	TArray<FVoxelValue> SparseValues;
+	TArray<FVoxelMaterial> SparseMaterials;
+
+	// Palette & Dense, in FVoxelLeafLayout order
+	TArray<FVoxelValue> Values;
+	// Palette
+	TArray<FVoxelMaterial> Palette;
+	TArray<uint8> PaletteIndices;
+	// Dense
+	TArray<FVoxelMaterial> Materials;
+
+	// Uniform
+	FVoxelValue UniformValue;
+	FVoxelMaterial UniformMaterial;
+
+	// Bounds of the stored values if not uniform
+	FVoxelValueRange ValueRange;
+
+	// Size reported to the memory stat
+	uint32 ReportedSize;
+
+	// First sparse index whose voxel index is >= Index
+	int LowerBound(int Index) const;
+
+	// Index: in FVoxelLeafLayout order
+	FORCEINLINE FVoxelMaterial GetDenseMaterial(int Index) const;
+	void SetDenseMaterial(int Index, const FVoxelMaterial& Material);
+
+	/**
+	 * Remove unused palette entries
+	 * @return	Whether an entry has been freed
+	 */
+	bool CompactPalette();
+
+	void SetFormat(EVoxelLeafFormat NewFormat);
+	void Empty();
+	void UpdateStats();
+};
@@ -0,0 +1,95 @@
+// Copyright 2017 Phyronnaz
+
+#include "VoxelLeafIndex.h"
+#include "ValueOctree.h"
+
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Voxel Indexed Leafs"), STAT_VoxelIndexedLeafs, STATGROUP_Voxel);
+
+FVoxelLeafIndex::FVoxelLeafIndex(int Depth, int RegionDepth)
+	: HalfSize(8 << Depth)
+	, RegionDepth(RegionDepth)
+{
+
+}
+
+FVoxelLeafIndex::~FVoxelLeafIndex()
+{
+	for (auto& Map : Maps)
+	{
+		DEC_DWORD_STAT_BY(STAT_VoxelIndexedLeafs, Map.Num());
+	}
+}
+
+void FVoxelLeafIndex::Add(FValueOctree* Leaf)
+{
+	check(Leaf->Depth == 0);
+
+	const FIntVector Min = Leaf->GetMinimalCornerPosition();
+	int MapIndex;
+	uint64 Key;
+	GetMapAndKey(Min.X, Min.Y, Min.Z, MapIndex, Key);
+
+	check(!Maps[MapIndex].Contains(Key));
+	Maps[MapIndex].Add(Key, Leaf);
+	INC_DWORD_STAT(STAT_VoxelIndexedLeafs);
+}
+
+void FVoxelLeafIndex::Remove(FValueOctree* Leaf)
+{
+	check(Leaf->Depth == 0);
+
+	const FIntVector Min = Leaf->GetMinimalCornerPosition();
+	int MapIndex;
+	uint64 Key;
+	GetMapAndKey(Min.X, Min.Y, Min.Z, MapIndex, Key);
+
+	verify(Maps[MapIndex].Remove(Key) == 1);
+	DEC_DWORD_STAT(STAT_VoxelIndexedLeafs);
+}
+
+FValueOctree* FVoxelLeafIndex::Find(int X, int Y, int Z) const
+{
+	int MapIndex;
+	uint64 Key;
+	GetMapAndKey(X, Y, Z, MapIndex, Key);
+
+	FValueOctree* const* Leaf = Maps[MapIndex].Find(Key);
+	return Leaf ? *Leaf : nullptr;
+}
+
+void FVoxelLeafIndex::GetLeafs(TArray<FValueOctree*>& OutLeafs) const
+{
+	for (auto& Map : Maps)
+	{
+		for (auto& It : Map)
+		{
+			OutLeafs.Add(It.Value);
+		}
+	}
+}
+
+void FVoxelLeafIndex::GetLeafs(int LockIndex, TArray<FValueOctree*>& OutLeafs) const
+{
+	check(0 <= LockIndex && LockIndex < VOXEL_LOCK_COUNT);
+
+	for (auto& It : Maps[LockIndex])
+	{
+		OutLeafs.Add(It.Value);
+	}
+}
+
+void FVoxelLeafIndex::GetMapAndKey(int X, int Y, int Z, int& OutMapIndex, uint64& OutKey) const
+{
+	// Depth 0 node coordinates, starting at 0 on the world min corner
+	const uint32 CX = (X + HalfSize) >> VOXEL_LEAF_SIZE_LOG2;
+	const uint32 CY = (Y + HalfSize) >> VOXEL_LEAF_SIZE_LOG2;
+	const uint32 CZ = (Z + HalfSize) >> VOXEL_LEAF_SIZE_LOG2;
+
+	// Same mapping as FVoxelData::GetLocksMask
+	const uint32 RX = CX >> RegionDepth;
+	const uint32 RY = CY >> RegionDepth;
+	const uint32 RZ = CZ >> RegionDepth;
+	OutMapIndex = (RX & 3) + 4 * (RY & 3) + 16 * (RZ & 3);
+
+	OutKey = MortonEncode(CX, CY, CZ);
+}
@@ -0,0 +1,64 @@
+// Copyright 2017 Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "VoxelData.h"
+
+class FValueOctree;
+
+/**
+ * Index of the Depth 0 nodes of the value octree, by Morton code of their position
+ * Split in one map per lock of FVoxelData: map i is only modified when Locks[i] is locked for writing
+ */
+class FVoxelLeafIndex
+{
+public:
+	/**
+	 * Constructor
+	 * @param	Depth			Depth of the world
+	 * @param	RegionDepth		Depth of the lock regions
+	 */
+	FVoxelLeafIndex(int Depth, int RegionDepth);
+	~FVoxelLeafIndex();
+
+	/**
+	 * Add a Depth 0 node. Its region must be locked for writing
+	 */
+	void Add(FValueOctree* Leaf);
+	/**
+	 * Remove a Depth 0 node. Its region must be locked for writing
+	 */
+	void Remove(FValueOctree* Leaf);
+
+	/**
+	 * Get the Depth 0 node containing a position. Its region must be locked
+	 * @param	X, Y, Z		Position in voxel space, inside the world
+	 * @return	The node, or nullptr if it hasn't been created
+	 */
+	FValueOctree* Find(int X, int Y, int Z) const;
+
+	/**
+	 * Get all the Depth 0 nodes. The whole world must be locked
+	 */
+	void GetLeafs(TArray<FValueOctree*>& OutLeafs) const;
+	/**
+	 * Get the Depth 0 nodes of the regions of a lock. FVoxelData::Locks[LockIndex] must be locked
+	 */
+	void GetLeafs(int LockIndex, TArray<FValueOctree*>& OutLeafs) const;
+
+private:
+	// Half of the world size
+	const int HalfSize;
+	const int RegionDepth;
+
+	TMap<uint64, FValueOctree*> Maps[VOXEL_LOCK_COUNT];
+
+	/**
+	 * Get the map and the key of a position
+	 * @param	X, Y, Z		Position in voxel space
+	 * @param	OutMapIndex	Index of the lock of the region
+	 * @param	OutKey		Morton code of the Depth 0 node
+	 */
+	FORCEINLINE void GetMapAndKey(int X, int Y, int Z, int& OutMapIndex, uint64& OutKey) const;
+};
@@ -0,0 +1,126 @@
+// Copyright 2017 Phyronnaz
+
+#include "VoxelLeafPager.h"
+#include "HAL/PlatformFilemanager.h"
+#include "Misc/Paths.h"
+#include "Misc/Guid.h"
+
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Voxel Leafs Paged Out"), STAT_VoxelLeafsPagedOut, STATGROUP_Voxel);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Voxel Leaf Page File Pages"), STAT_VoxelLeafPageFilePages, STATGROUP_Voxel);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Voxel Leaf Page Outs"), STAT_VoxelLeafPageOuts, STATGROUP_Voxel);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Voxel Leaf Page Ins"), STAT_VoxelLeafPageIns, STATGROUP_Voxel);
+DECLARE_CYCLE_STAT(TEXT("LeafPager ~ Page out"), STAT_VoxelLeafPager_PageOut, STATGROUP_Voxel);
+DECLARE_CYCLE_STAT(TEXT("LeafPager ~ Page in"), STAT_VoxelLeafPager_PageIn, STATGROUP_Voxel);
+
+FVoxelLeafPager::FVoxelLeafPager(uint64 MaxMemory)
+	: MaxMemory(MaxMemory)
+	, File(nullptr)
+	, PageCount(0)
+	, Epoch(0)
+{
+
+}
+
+FVoxelLeafPager::~FVoxelLeafPager()
+{
+	DEC_DWORD_STAT_BY(STAT_VoxelLeafsPagedOut, PageCount - FreePages.Num());
+	DEC_DWORD_STAT_BY(STAT_VoxelLeafPageFilePages, PageCount);
+
+	if (File)
+	{
+		delete File;
+		FPlatformFileManager::Get().GetPlatformFile().DeleteFile(*Filename);
+	}
+}
+
+int32 FVoxelLeafPager::Write(const TArray<uint8>& CompressedLeafData)
+{
+	SCOPE_CYCLE_COUNTER(STAT_VoxelLeafPager_PageOut);
+
+	if (!File)
+	{
+		OpenFile();
+	}
+
+	// Size, then the data. Whole pages, so that the last one can be read entirely
+	const int32 Size = CompressedLeafData.Num();
+	check(sizeof(int32) + Size <= VOXEL_LEAF_PAGE_SIZE);
+	Buffer.SetNumUninitialized(VOXEL_LEAF_PAGE_SIZE);
+	FMemory::Memcpy(Buffer.GetData(), &Size, sizeof(int32));
+	FMemory::Memcpy(Buffer.GetData() + sizeof(int32), CompressedLeafData.GetData(), Size);
+
+	int32 PageIndex;
+	if (FreePages.Num() > 0)
+	{
+		PageIndex = FreePages.Pop(false);
+	}
+	else
+	{
+		PageIndex = PageCount++;
+		INC_DWORD_STAT(STAT_VoxelLeafPageFilePages);
+	}
+
+	verify(File->Seek((int64)PageIndex * VOXEL_LEAF_PAGE_SIZE));
+	verify(File->Write(Buffer.GetData(), VOXEL_LEAF_PAGE_SIZE));
+
+	INC_DWORD_STAT(STAT_VoxelLeafsPagedOut);
+	INC_DWORD_STAT(STAT_VoxelLeafPageOuts);
+
+	return PageIndex;
+}
+
+void FVoxelLeafPager::Read(int32 PageIndex, TArray<uint8>& OutCompressedLeafData)
+{
+	SCOPE_CYCLE_COUNTER(STAT_VoxelLeafPager_PageIn);
+
+	check(File);
+	check(0 <= PageIndex && PageIndex < PageCount);
+
+	Buffer.SetNumUninitialized(VOXEL_LEAF_PAGE_SIZE);
+	verify(File->Seek((int64)PageIndex * VOXEL_LEAF_PAGE_SIZE));
+	verify(File->Read(Buffer.GetData(), VOXEL_LEAF_PAGE_SIZE));
+
+	int32 Size;
+	FMemory::Memcpy(&Size, Buffer.GetData(), sizeof(int32));
+	check(0 < Size && sizeof(int32) + Size <= VOXEL_LEAF_PAGE_SIZE);
+	OutCompressedLeafData.Empty(Size);
+	OutCompressedLeafData.Append(Buffer.GetData() + sizeof(int32), Size);
+
+	FreePages.Add(PageIndex);
+
+	DEC_DWORD_STAT(STAT_VoxelLeafsPagedOut);
+	INC_DWORD_STAT(STAT_VoxelLeafPageIns);
+}
+
+void FVoxelLeafPager::Free(int32 PageIndex)
+{
+	FScopeLock Lock(&Section);
+
+	check(0 <= PageIndex && PageIndex < PageCount);
+	FreePages.Add(PageIndex);
+
+	DEC_DWORD_STAT(STAT_VoxelLeafsPagedOut);
+}
+
+uint32 FVoxelLeafPager::GetEpoch() const
+{
+	return Epoch.load(std::memory_order_relaxed);
+}
+
+void FVoxelLeafPager::NextEpoch()
+{
+	Epoch++;
+}
+
+void FVoxelLeafPager::OpenFile()
+{
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+
+	const FString Directory = FPaths::Combine(FPaths::GameSavedDir(), TEXT("VoxelPages"));
+	PlatformFile.CreateDirectoryTree(*Directory);
+
+	// One file per world
+	Filename = FPaths::Combine(Directory, FGuid::NewGuid().ToString() + TEXT(".pages"));
+	File = PlatformFile.OpenWrite(*Filename, false, true);
+	checkf(File, TEXT("Can't create the voxel page file %s"), *Filename);
+}
@@ -0,0 +1,82 @@
+// Copyright 2017 Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "VoxelValue.h"
+#include "VoxelConfig.h"
+#include "VoxelMaterial.h"
+#include "VoxelLZ4.h"
+#include <atomic>
+
+class IFileHandle;
+
+// Size of a page of the page file. Must fit a compressed dense leaf and its palette: 32KB for 16^3 leafs
+#define VOXEL_LEAF_PAGE_SIZE (VOXEL_LEAF_SIZE == 8 ? 8 * 1024 : VOXEL_LEAF_VOXELS * 8)
+
+static_assert(sizeof(int32) + sizeof(int32) + VOXEL_LZ4_MAX_COMPRESSED_SIZE(VOXEL_LEAF_VOXELS * (sizeof(FVoxelValue) + sizeof(FVoxelMaterial)) + 1024) <= VOXEL_LEAF_PAGE_SIZE, "Compressed dense leafs must fit in a page");
+
+/**
+ * Page file of the leafs paged out by FVoxelData::PageOutLeafs, one compressed leaf per page
+ * The file is created on the first page out and deleted with this
+ */
+class FVoxelLeafPager
+{
+public:
+	/**
+	 * @param	MaxMemory	Memory budget of the resident leafs in bytes. 0 to never page out
+	 */
+	FVoxelLeafPager(uint64 MaxMemory);
+	~FVoxelLeafPager();
+
+	// Memory budget of the resident leafs
+	const uint64 MaxMemory;
+
+	// Locked to access the file and to page in a leaf
+	FCriticalSection Section;
+
+	/**
+	 * Write a leaf to a free page. Section must be locked
+	 * @param	CompressedLeafData	Leaf compressed by FVoxelLeafData::Compress
+	 * @return	Index of the page
+	 */
+	int32 Write(const TArray<uint8>& CompressedLeafData);
+
+	/**
+	 * Read a leaf and free its page. Section must be locked
+	 * @param	PageIndex			Page returned by Write
+	 * @param	OutCompressedLeafData	Leaf given to Write
+	 */
+	void Read(int32 PageIndex, TArray<uint8>& OutCompressedLeafData);
+
+	/**
+	 * Free a page without reading it, when its node is deleted
+	 */
+	void Free(int32 PageIndex);
+
+	/**
+	 * Current time of the least recently used clock, stored by the leafs when they are accessed
+	 */
+	uint32 GetEpoch() const;
+
+	/**
+	 * Advance the clock, after each page out pass
+	 */
+	void NextEpoch();
+
+private:
+	FString Filename;
+	IFileHandle* File;
+
+	// Pages that can be reused
+	TArray<int32> FreePages;
+	// Number of pages in the file
+	int32 PageCount;
+
+	std::atomic<uint32> Epoch;
+
+	// Serialization buffer
+	TArray<uint8> Buffer;
+
+	void OpenFile();
+};
@@ -0,0 +1,176 @@
+// Copyright 2017 Phyronnaz
+
+#include "VoxelPendingSaves.h"
+#include "ValueOctree.h"
+
+DECLARE_CYCLE_STAT(TEXT("VoxelPendingSaves ~ Add"), STAT_VoxelPendingSaves_Add, STATGROUP_Voxel);
+DECLARE_CYCLE_STAT(TEXT("VoxelPendingSaves ~ Load region"), STAT_VoxelPendingSaves_LoadRegion, STATGROUP_Voxel);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Voxel Pending Regions"), STAT_VoxelPendingRegions, STATGROUP_Voxel);
+
+FVoxelPendingSaves::FVoxelPendingSaves(int Depth, int OctreeDepth, int RegionDepth)
+	: HalfSize(8 << Depth)
+	, OctreeDepth(OctreeDepth)
+	, RegionDepth(RegionDepth)
+	, RegionCount(0)
+{
+
+}
+
+bool FVoxelPendingSaves::Add(const FVoxelWorldSave& Save, uint64 Generation, std::deque<FIntVector>& OutModifiedPositions)
+{
+	SCOPE_CYCLE_COUNTER(STAT_VoxelPendingSaves_Add);
+
+	check(Save.LeafSize == VOXEL_LEAF_SIZE && Generation > 0);
+
+	TSharedPtr<FPendingSave, ESPMode::ThreadSafe> PendingSave = MakeShareable(new FPendingSave());
+	TArray<uint64> ChunkIds;
+	if (!Save.GetChunkIds(PendingSave->Blocks, ChunkIds))
+	{
+		return false;
+	}
+	PendingSave->Save = Save;
+	PendingSave->Generation = Generation;
+
+	FScopeLock Lock(&Section);
+	DEC_DWORD_STAT_BY(STAT_VoxelPendingRegions, Regions.Num());
+
+	int ChunkIndex = 0;
+	uint64 LastRegionId = 0;
+	TArray<FRegionBlocks>* RegionBlocks = nullptr;
+	for (int BlockIndex = 0; BlockIndex < PendingSave->Blocks.Num(); BlockIndex++)
+	{
+		for (int Index = 0; Index < PendingSave->Blocks[BlockIndex].ChunkCount; Index++, ChunkIndex++)
+		{
+			const uint64 ChunkId = ChunkIds[ChunkIndex];
+
+			// Chunks are in octree order: the chunks of a region follow each other
+			const uint64 RegionId = FOctree::GetAncestorId(ChunkId, RegionDepth);
+			if (RegionId != LastRegionId)
+			{
+				RegionBlocks = &Regions.FindOrAdd(RegionId);
+				LastRegionId = RegionId;
+			}
+			if (RegionBlocks->Num() > 0 && RegionBlocks->Last().Save == PendingSave)
+			{
+				RegionBlocks->Last().LastBlock = BlockIndex;
+			}
+			else
+			{
+				FRegionBlocks Blocks;
+				Blocks.Save = PendingSave;
+				Blocks.FirstBlock = BlockIndex;
+				Blocks.LastBlock = BlockIndex;
+				RegionBlocks->Add(Blocks);
+			}
+
+			const int HalfLeafSize = VOXEL_LEAF_SIZE / 2;
+			const FIntVector Min = FOctree::GetPositionFromId(ChunkId, 2 * HalfSize) - FIntVector(HalfLeafSize, HalfLeafSize, HalfLeafSize);
+			FValueOctree::GetChunksPositions(Min, VOXEL_LEAF_SIZE, OutModifiedPositions);
+		}
+	}
+	check(ChunkIndex == ChunkIds.Num());
+
+	RegionCount = Regions.Num();
+	INC_DWORD_STAT_BY(STAT_VoxelPendingRegions, Regions.Num());
+	return true;
+}
+
+void FVoxelPendingSaves::GetRegions(const FVoxelBox& Box, uint64 MinGeneration, TArray<uint64>& OutRegionIds) const
+{
+	const FVoxelBox WorldBox(FIntVector(-HalfSize, -HalfSize, -HalfSize), FIntVector(HalfSize - 1, HalfSize - 1, HalfSize - 1));
+	if (!WorldBox.Intersect(Box))
+	{
+		return;
+	}
+	const FVoxelBox ClampedBox = WorldBox.Overlap(Box);
+
+	// Region coordinates, as FVoxelData::GetLocksMask
+	const int Shift = VOXEL_LEAF_SIZE_LOG2 + RegionDepth;
+	const FIntVector Min((ClampedBox.Min.X + HalfSize) >> Shift, (ClampedBox.Min.Y + HalfSize) >> Shift, (ClampedBox.Min.Z + HalfSize) >> Shift);
+	const FIntVector Max((ClampedBox.Max.X + HalfSize) >> Shift, (ClampedBox.Max.Y + HalfSize) >> Shift, (ClampedBox.Max.Z + HalfSize) >> Shift);
+	const int64 BoxRegionCount = (int64)(Max.X - Min.X + 1) * (Max.Y - Min.Y + 1) * (Max.Z - Min.Z + 1);
+
+	FScopeLock Lock(&Section);
+
+	if (BoxRegionCount <= Regions.Num())
+	{
+		// Small box: look its regions up
+		const uint64 FirstRegionId = (uint64)1 << (3 * (OctreeDepth - RegionDepth));
+		for (int X = Min.X; X <= Max.X; X++)
+		{
+			for (int Y = Min.Y; Y <= Max.Y; Y++)
+			{
+				for (int Z = Min.Z; Z <= Max.Z; Z++)
+				{
+					const uint64 RegionId = FirstRegionId | MortonEncode(X, Y, Z);
+					const TArray<FRegionBlocks>* RegionBlocks = Regions.Find(RegionId);
+					if (RegionBlocks && RegionBlocks->Last().Save->Generation >= MinGeneration)
+					{
+						OutRegionIds.Add(RegionId);
+					}
+				}
+			}
+		}
+	}
+	else
+	{
+		for (auto& It : Regions)
+		{
+			if (It.Value.Last().Save->Generation >= MinGeneration && GetRegionBox(It.Key).Intersect(ClampedBox))
+			{
+				OutRegionIds.Add(It.Key);
+			}
+		}
+	}
+}
+
+FVoxelBox FVoxelPendingSaves::GetRegionBox(uint64 RegionId) const
+{
+	const int HalfRegionSize = (VOXEL_LEAF_SIZE << RegionDepth) / 2;
+	const FIntVector Position = FOctree::GetPositionFromId(RegionId, 2 * HalfSize);
+	return FVoxelBox(Position - FIntVector(HalfRegionSize, HalfRegionSize, HalfRegionSize), Position + FIntVector(HalfRegionSize - 1, HalfRegionSize - 1, HalfRegionSize - 1));
+}
+
+uint64 FVoxelPendingSaves::LoadRegion(uint64 RegionId, TFunctionRef<void(const FVoxelChunkSave&)> Function)
+{
+	SCOPE_CYCLE_COUNTER(STAT_VoxelPendingSaves_LoadRegion);
+
+	TArray<FRegionBlocks> RegionBlocks;
+	{
+		FScopeLock Lock(&Section);
+		if (!Regions.RemoveAndCopyValue(RegionId, RegionBlocks))
+		{
+			// Loaded by another thread while we were waiting for the region lock
+			return 0;
+		}
+		RegionCount = Regions.Num();
+		DEC_DWORD_STAT(STAT_VoxelPendingRegions);
+	}
+
+	// Ids of the Depth 0 nodes of the region. Its first and last blocks can have chunks of other regions
+	const uint64 FirstId = RegionId << (3 * RegionDepth);
+	const uint64 LastId = ((RegionId + 1) << (3 * RegionDepth)) - 1;
+
+	for (auto& Blocks : RegionBlocks)
+	{
+		FVoxelWorldSaveReader Reader(Blocks.Save->Save, Blocks.Save->Blocks, Blocks.FirstBlock, Blocks.LastBlock);
+		for (; Reader.GetChunk() && Reader.GetChunk()->Id <= LastId; Reader.NextChunk())
+		{
+			if (Reader.GetChunk()->Id >= FirstId)
+			{
+				Function(*Reader.GetChunk());
+			}
+		}
+	}
+
+	// The save is freed with its last region
+	return RegionBlocks.Last().Save->Generation;
+}
+
+void FVoxelPendingSaves::Reset()
+{
+	FScopeLock Lock(&Section);
+	DEC_DWORD_STAT_BY(STAT_VoxelPendingRegions, Regions.Num());
+	Regions.Empty();
+	RegionCount = 0;
+}
@@ -0,0 +1,94 @@
+// Copyright 2017 Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "VoxelBox.h"
+#include "VoxelSave.h"
+#include <deque>
+#include <atomic>
+
+/**
+ * Chunks of the saves loaded lazily, by lock region. Nothing is decompressed until a region is first locked, see FVoxelData::LoadPendingRegions
+ * Saves are indexed with their chunk Ids (see FVoxelWorldSave::GetChunkIds), and freed once all their regions are loaded
+ */
+class FVoxelPendingSaves
+{
+public:
+	/**
+	 * Constructor
+	 * @param	Depth			Depth of the world
+	 * @param	OctreeDepth		Depth of the value octree
+	 * @param	RegionDepth		Depth of the lock regions
+	 */
+	FVoxelPendingSaves(int Depth, int OctreeDepth, int RegionDepth);
+
+	/**
+	 * Add the chunks of a save after the pending ones. Only its chunk Ids are read
+	 * @param	Save					Save with VOXEL_LEAF_SIZE chunks. Copied
+	 * @param	Generation				Generation of the leafs of the save once loaded
+	 * @param	OutModifiedPositions	Positions of the render chunks to update
+	 * @return	false if the save is older than EVoxelSaveVersion::ChunkIndex: it must be loaded right away
+	 */
+	bool Add(const FVoxelWorldSave& Save, uint64 Generation, std::deque<FIntVector>& OutModifiedPositions);
+
+	/**
+	 * Is there no pending region? Doesn't lock
+	 */
+	FORCEINLINE bool IsEmpty() const
+	{
+		return RegionCount.load() == 0;
+	}
+
+	/**
+	 * Get the pending regions overlapping a box
+	 * @param	Box				Voxels to access
+	 * @param	MinGeneration	Only get the regions with chunks added at this generation or after
+	 * @param	OutRegionIds	Ids of the regions, see FOctree::Id
+	 */
+	void GetRegions(const FVoxelBox& Box, uint64 MinGeneration, TArray<uint64>& OutRegionIds) const;
+
+	/**
+	 * Get the voxels of a region
+	 */
+	FVoxelBox GetRegionBox(uint64 RegionId) const;
+
+	/**
+	 * Remove a region and read its chunks. The region must be locked for writing
+	 * @param	RegionId	Region to load
+	 * @param	Function	Called on each chunk of the region, saves in the order they were added
+	 * @return	Generation of the last save with chunks in the region, 0 if it wasn't pending anymore
+	 */
+	uint64 LoadRegion(uint64 RegionId, TFunctionRef<void(const FVoxelChunkSave&)> Function);
+
+	/**
+	 * Forget all the pending regions
+	 */
+	void Reset();
+
+private:
+	struct FPendingSave
+	{
+		FVoxelWorldSave Save;
+		TArray<FVoxelSaveBlock> Blocks;
+		uint64 Generation;
+	};
+
+	// Blocks of a save with chunks in a region. Regions are subtrees: their chunks are consecutive
+	struct FRegionBlocks
+	{
+		TSharedPtr<FPendingSave, ESPMode::ThreadSafe> Save;
+		int32 FirstBlock;
+		int32 LastBlock;
+	};
+
+	// Half of the world size
+	const int HalfSize;
+	const int OctreeDepth;
+	const int RegionDepth;
+
+	mutable FCriticalSection Section;
+	TMap<uint64, TArray<FRegionBlocks>> Regions;
+	// Regions.Num(), read without locking
+	std::atomic<int32> RegionCount;
+};
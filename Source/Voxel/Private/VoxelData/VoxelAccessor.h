@@ -0,0 +1,102 @@
+// Copyright 2017 Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "VoxelMaterial.h"
+#include "VoxelValue.h"
+#include "VoxelConfig.h"
+
+class FVoxelData;
+class FValueOctree;
+struct FVoxelGeneratorCacheBlock;
+
+/**
+ * Cursor to read & write scattered voxels of a FVoxelData, faster than its point accessors when consecutive accesses are close
+ * Caches the leafs of the VOXEL_LEAF_SIZE^3 block of the last access and of its 26 neighbors: stepping to a neighbor block doesn't go through the octree
+ * Generator values of the unmodified leafs are read by block from FVoxelGeneratorCache, from the second read of a block on
+ *
+ * The voxels accessed must be locked (BeginGet to read, BeginSet to write) during the whole life of the accessor, which must not outlive the lock
+ * Not thread safe: use one accessor per thread
+ */
+class FVoxelAccessor
+{
+public:
+	/**
+	 * @param	Data	World to access
+	 */
+	FVoxelAccessor(FVoxelData* Data);
+
+	FVoxelData* const Data;
+
+	/**
+	 * Get value & material at position. Can be outside of the world
+	 * @param	X, Y, Z		Position in voxel space
+	 */
+	float GetValue(int X, int Y, int Z);
+	FVoxelMaterial GetMaterial(int X, int Y, int Z);
+	void GetValueAndMaterial(int X, int Y, int Z, float& OutValue, FVoxelMaterial& OutMaterial);
+
+	/**
+	 * Set value & material at position. Must be inside the world
+	 * @param	X, Y, Z		Position in voxel space
+	 */
+	void SetValue(int X, int Y, int Z, float Value);
+	void SetMaterial(int X, int Y, int Z, const FVoxelMaterial& Material);
+	void SetValueAndMaterial(int X, int Y, int Z, float Value, const FVoxelMaterial& Material);
+
+private:
+	/**
+	 * Cached data of a block the size of a data leaf, aligned on multiples of VOXEL_LEAF_SIZE
+	 */
+	struct FBlock
+	{
+		// Leaf containing the block. Can be bigger than the block, or have been subdivided by a write since
+		FValueOctree* Leaf;
+		// Generator values of the block, once read more than once
+		TSharedPtr<const FVoxelGeneratorCacheBlock, ESPMode::ThreadSafe> GeneratorBlock;
+		// Number of reads of the generator values, before GeneratorBlock is set
+		int GeneratorReads;
+
+		FBlock()
+			: Leaf(nullptr)
+			, GeneratorReads(0)
+		{
+		}
+	};
+
+	// Blocks around CenterBlock, indexed by (X + 1) + 3 * (Y + 1) + 9 * (Z + 1) where X, Y, Z in [-1, 1] are the offsets to CenterBlock
+	FBlock Blocks[27];
+	// Coordinates (position / VOXEL_LEAF_SIZE) of the block at the center of Blocks
+	FIntVector CenterBlock;
+
+	// Last block accessed
+	FBlock* LastBlock;
+	FIntVector LastBlockCoordinates;
+
+	/**
+	 * Get the cached block containing a position, moving the neighborhood if needed
+	 * @param	X, Y, Z		Position in voxel space
+	 */
+	FORCEINLINE FBlock& GetBlock(int X, int Y, int Z);
+
+	/**
+	 * Get the leaf containing a position inside the world
+	 * @param	Block		Block containing the position
+	 * @param	X, Y, Z		Position in voxel space
+	 */
+	FORCEINLINE FValueOctree* GetLeaf(FBlock& Block, int X, int Y, int Z);
+
+	/**
+	 * Move the neighborhood to be centered on NewCenterBlock, keeping the blocks that are in both
+	 */
+	void Recenter(const FIntVector& NewCenterBlock);
+
+	/**
+	 * Read a voxel
+	 * @param	X, Y, Z			Position in voxel space
+	 * @param	OutValue		Can be nullptr
+	 * @param	OutMaterial		Can be nullptr
+	 */
+	void Read(int X, int Y, int Z, FVoxelValue* OutValue, FVoxelMaterial* OutMaterial);
+};
@@ -4,11 +4,52 @@
 
 #include "CoreMinimal.h"
 #include "VoxelMaterial.h"
+#include "VoxelValue.h"
+#include "VoxelConfig.h"
+#include "VoxelBox.h"
+#include "OctreeNodePool.h"
+#include "VoxelSave.h"
 #include <deque>
+#include <atomic>
 
 class FValueOctree;
 class UVoxelWorldGenerator;
-class FEvent;
+class FVoxelGeneratorCache;
+class FVoxelLeafIndex;
+class FVoxelLeafPager;
+class FVoxelLeafCache;
+struct FValueOctreeContext;
+class FVoxelPendingSaves;
+class FVoxelDataSnapshot;
+
+// Number of reader/writer locks. Must be 4 * 4 * 4 as regions are mapped to locks by their coordinates modulo 4
+#define VOXEL_LOCK_COUNT 64
+// Size of the lock regions, whatever VOXEL_LEAF_SIZE is: width = 16 * 2^VOXEL_LOCK_REGION_DEPTH
+#define VOXEL_LOCK_REGION_DEPTH 2
+
+/**
+ * Compression of the edited leafs, see FVoxelData::GetLeafCompressionReport
+ */
+struct FVoxelLeafCompressionReport
+{
+	// Number of edited leafs that aren't uniform
+	int LeafCount;
+	// Memory used by these leafs uncompressed and compressed, in bytes
+	uint64 UncompressedSize;
+	uint64 CompressedSize;
+	// Total and worst time to decompress a leaf, in seconds
+	double DecompressionTime;
+	double MaxDecompressionTime;
+
+	FVoxelLeafCompressionReport()
+		: LeafCount(0)
+		, UncompressedSize(0)
+		, CompressedSize(0)
+		, DecompressionTime(0)
+		, MaxDecompressionTime(0)
+	{
+	}
+};
 
 /**
  * Class that handle voxel data. Mainly an interface to FValueOctree
@@ -20,11 +61,13 @@ public:
 	 * Constructor
 	 * @param	Depth			Depth of this world; Width = 16 * 2^Depth
 	 * @param	WorldGenerator	Generator for this world
+	 * @param	LeafMemoryBudget	Memory of the edited voxels above which UpdateColdLeafs writes them to disk, in bytes. 0 to keep them in memory
+	 * @param	LeafCompressionDelay	Number of UpdateColdLeafs calls without access after which an edited leaf is compressed. 0 to never compress
 	 */
-	FVoxelData(int Depth, UVoxelWorldGenerator* WorldGenerator);
+	FVoxelData(int Depth, UVoxelWorldGenerator* WorldGenerator, uint64 LeafMemoryBudget = 0, uint32 LeafCompressionDelay = 0);
 	~FVoxelData();
 
-	// Depth of the octree
+	// Depth of the world, as the render octree: Width = 16 * 2^Depth
 	const int Depth;
 
 	UVoxelWorldGenerator* const WorldGenerator;
@@ -32,7 +75,27 @@ public:
 	// Size = 16 * 2^Depth
 	FORCEINLINE int Size() const;
 
-	// TODO: Doc
+	/**
+	 * Lock the regions overlapping Box for writing. Nodes bigger than a region are subdivided, so that the edit doesn't touch other regions
+	 * Regions of saves that aren't loaded yet are loaded once locked, before the edit: no lock must be held when calling this
+	 * @param	Box		Voxels that are going to be modified. Must also contain every voxel read during the edit
+	 */
+	void BeginSet(const FVoxelBox& Box);
+	/**
+	 * Make the modified leafs uniform when possible, merge uniform nodes and unlock
+	 * @param	Box		Same box as BeginSet
+	 */
+	void EndSet(const FVoxelBox& Box);
+
+	/**
+	 * Lock the regions overlapping Box for reading. Writers in other regions are not blocked
+	 * Regions of saves that aren't loaded yet are loaded first, under write locks: no lock must be held when calling this
+	 * @param	Box		Voxels that are going to be read
+	 */
+	void BeginGet(const FVoxelBox& Box);
+	void EndGet(const FVoxelBox& Box);
+
+	// Lock the whole world. As with a box, regions of saves that aren't loaded yet are loaded first: this loads all of them
 	void BeginSet();
 	void EndSet();
 
@@ -41,28 +104,86 @@ public:
 
 	void Reset();
 
+	/**
+	 * Compress the idle edited leafs, then page out leafs if above the memory budget. Must be called at a fixed rate, eg every second
+	 * Cold leafs are decompressed or read back when accessed
+	 */
+	void UpdateColdLeafs();
+
+	/**
+	 * Measure the compression of the edited leafs: compress and decompress each of them. Locks the whole world for reading
+	 * Regions of saves that aren't loaded yet are loaded first, as by BeginGet()
+	 * @param	OutReport	Sizes and decompression times
+	 */
+	void GetLeafCompressionReport(FVoxelLeafCompressionReport& OutReport);
+
 	void TestWorldGenerator();
 
 	/**
 	* Get value and color at position
 	* @param	Position	Position in voxel space
-	* @return	Value
+	* @return	Value, quantized if VOXEL_VALUE_QUANTIZATION
 	* @return	Color
 	*/
-	void GetValuesAndMaterials(float Values[], FVoxelMaterial Materials[], const FIntVector& Start, const FIntVector& StartIndex, const int Step, const FIntVector& Size, const FIntVector& ArraySize) const;
+	void GetValuesAndMaterials(FVoxelValue Values[], FVoxelMaterial Materials[], const FIntVector& Start, const FIntVector& StartIndex, const int Step, const FIntVector& Size, const FIntVector& ArraySize) const;
 
+	/**
+	 * Get a single voxel, going through the octree. Use a FVoxelAccessor to access many nearby voxels
+	 * @param	X, Y, Z		Position in voxel space
+	 */
 	FORCEINLINE float GetValue(int X, int Y, int Z) const;
 	FORCEINLINE FVoxelMaterial GetMaterial(int X, int Y, int Z) const;
 
 	FORCEINLINE void GetValueAndMaterial(int X, int Y, int Z, float& OutValue, FVoxelMaterial& OutMaterial);
 
+	/**
+	 * Get the values & materials of scattered positions. Positions are grouped by Depth 0 node, and each group is read with as few octree accesses as possible
+	 * @param	Positions		Positions in voxel space. Their regions must be locked
+	 * @param	OutValues		Values at Positions. Can be nullptr
+	 * @param	OutMaterials	Materials at Positions. Can be nullptr
+	 * @param	Count			Number of positions
+	 */
+	void SampleBatch(const FIntVector Positions[], float OutValues[], FVoxelMaterial OutMaterials[], int Count) const;
+	/**
+	 * Trilinear interpolation of the values at scattered positions
+	 * @param	Positions		Positions in voxel space. The regions of the voxels around them must be locked
+	 * @param	OutValues		Interpolated values
+	 * @param	Count			Number of positions
+	 */
+	void SampleBatchTrilinear(const FVector Positions[], float OutValues[], int Count) const;
+
+	/**
+	 * Get the generation of the last edit of the voxels of Box. Generations only increase: if it is the same as before, these voxels haven't changed
+	 * @param	Box		Voxels to check
+	 * @return	Generation, 0 if never edited
+	 */
+	uint64 GetGeneration(const FVoxelBox& Box);
+
+	/**
+	 * Get bounds of the values of Box, without reading the voxels. Known if the voxels of Box are edited, or if the world generator can bound them
+	 * @param	Box			Voxels to check
+	 * @param	Step		Only the voxels whose coordinates are multiples of Step are read
+	 * @param	OutRange	Bounds of the values. Can be wider than the actual values
+	 * @return	Whether the bounds are known
+	 */
+	bool GetValueRange(const FVoxelBox& Box, const int Step, FVoxelValueRange& OutRange);
+
+	/**
+	 * Create a read only copy of the voxels of Box. Box is locked only during the creation: the snapshot can then be read without lock while the world is edited
+	 * Modified leafs are shared with the octree and only copied when edited after the creation
+	 * Regions of saves that aren't loaded yet are loaded if they can have leafs at MinGeneration or after
+	 * @param	Box				Voxels that will be read
+	 * @param	MinGeneration	Only the leafs edited at this generation or after are in the snapshot, the others are read from the generator
+	 * @return	Snapshot, must not outlive this
+	 */
+	TSharedRef<FVoxelDataSnapshot, ESPMode::ThreadSafe> CreateSnapshot(const FVoxelBox& Box, uint64 MinGeneration = 0);
+
 	/**
 	 * Set value at position
 	 * @param	Position	Position in voxel space
 	 * @param	Value to set
 	 */
 	FORCEINLINE void SetValue(int X, int Y, int Z, float Value);
-	FORCEINLINE void SetValue(int X, int Y, int Z, float Value, FValueOctree*& LastOctree);
 
 	/**
 	 * Set color at position
@@ -70,9 +191,6 @@ public:
 	 * @param	Color to set
 	 */
 	FORCEINLINE void SetMaterial(int X, int Y, int Z, FVoxelMaterial Material);
-	FORCEINLINE void SetMaterial(int X, int Y, int Z, FVoxelMaterial Material, FValueOctree*& LastOctree);
-
-	FORCEINLINE void SetValueAndMaterial(int X, int Y, int Z, float Value, FVoxelMaterial Material, FValueOctree*& LastOctree);
 
 	/**
 	 * Is Position in this world?
@@ -85,25 +203,151 @@ public:
 
 	/**
 	 * Get save array of this world
+	 * @param	Compression		Compression of the save
 	 * @return SaveArray
 	 */
-	void GetSave(FVoxelWorldSave& OutSave);
+	void GetSave(FVoxelWorldSave& OutSave, EVoxelSaveCompression Compression = EVoxelSaveCompression::Zlib);
+
+	/**
+	 * Save the leafs edited since the last GetSave, GetDeltaSave or load. Only these leafs are read
+	 * @param	OutSave			Delta to load after the previous saves, with bReset = false
+	 * @param	Compression		Compression of the save
+	 */
+	void GetDeltaSave(FVoxelWorldSave& OutSave, EVoxelSaveCompression Compression = EVoxelSaveCompression::Zlib);
 
 	/**
 	 * Load this world from save array
 	 * @param	SaveArray	Array to load from
 	 * @param	World		VoxelWorld
-	 * @param	bReset		Reset all chunks?
+	 * @param	bReset		Reset all chunks? Must be false for deltas
+	 * Saves with a chunk index are loaded lazily: only their chunk Ids are read, and a lock region is loaded the first time it is locked by BeginGet, BeginSet or CreateSnapshot
+	 * Older blocks saves are decompressed and loaded in parallel. Saves made with another VOXEL_LEAF_SIZE are loaded voxel by voxel
+	 * If the world has no edits since its last save, the next delta is relative to this one
+	 * Saves that fail FVoxelWorldSave::Validate are logged and rejected. If chunk data turns out to be corrupted, it is logged and the following chunks aren't loaded
+	 * @return	false if the save was rejected: nothing was loaded
 	 */
-	void LoadFromSaveAndGetModifiedPositions(const FVoxelWorldSave& Save, std::deque<FIntVector>& OutModifiedPositions, bool bReset);
+	bool LoadFromSaveAndGetModifiedPositions(const FVoxelWorldSave& Save, std::deque<FIntVector>& OutModifiedPositions, bool bReset);
 
 private:
+	friend class FVoxelAccessor;
+
 	FValueOctree* MainOctree;
 
-	FThreadSafeCounter GetCount;
-	FEvent* CanGetEvent;
-	FEvent* CanSetEvent;
+	// Depth of MainOctree: its Depth 0 nodes are VOXEL_LEAF_SIZE wide
+	const int OctreeDepth;
+
+	// Depth of the octree nodes used as lock regions, can be less than VOXEL_LOCK_REGION_DEPTH for small worlds
+	const int LockRegionDepth;
+
+	// Cache of the generator output for the voxels that aren't modified
+	FVoxelGeneratorCache* const GeneratorCache;
+
+	// Allocator of the octree nodes. Destroyed after MainOctree
+	TOctreeNodePool<FValueOctree> NodePool;
+
+	// Index of the Depth 0 nodes, for constant time point accesses
+	FVoxelLeafIndex* const LeafIndex;
+
+	// Page file of the cold leafs. Destroyed after MainOctree
+	FVoxelLeafPager* const LeafPager;
+
+	// Recently decompressed leafs. Destroyed after MainOctree
+	FVoxelLeafCache* const LeafCache;
+
+	// The objects above, given to the octree nodes. Destroyed after MainOctree
+	FValueOctreeContext* const OctreeContext;
+
+	// Chunks of the saves loaded lazily, by region
+	FVoxelPendingSaves* const PendingSaves;
+
+	// Epochs without access after which a leaf is compressed, 0 to never compress
+	const uint32 LeafCompressionDelay;
+
+	// Lock i protects every region whose coordinates modulo 4 are (i % 4, i / 4 % 4, i / 16)
+	FRWLock Locks[VOXEL_LOCK_COUNT];
+
+	// Serializes subdivision of the nodes above the lock regions
+	FCriticalSection StructureLock;
+
+	// Generation of the last edit
+	std::atomic<uint64> LastGeneration;
+
+	// Generation of the data when it was last saved or loaded: the next delta has the leafs edited after it
+	// Only used by GetSave, GetDeltaSave and LoadFromSaveAndGetModifiedPositions, which must not be called at the same time
+	uint64 SavedGeneration;
+
+	// Box of all the voxels of the octree
+	FVoxelBox GetWorldBox() const;
+
+	/**
+	 * Get the locks needed to access Box
+	 * @param	Box		Voxels to access
+	 * @return	Bit i set if Locks[i] is needed
+	 */
+	uint64 GetLocksMask(const FVoxelBox& Box) const;
+	/**
+	 * Get the lock of a region. Regions of the same lock share their map of the leaf index, see FVoxelLeafIndex
+	 * @param	RegionId	Id of a node at LockRegionDepth
+	 * @return	Index in Locks
+	 */
+	int GetLockIndex(uint64 RegionId) const;
+
+	/**
+	 * Get the leaf containing a position, using the index if it is a Depth 0 node. Its region must be locked
+	 * @param	X, Y, Z		Position in voxel space, inside the world
+	 */
+	FORCEINLINE FValueOctree* GetLeaf(int X, int Y, int Z) const;
+
+	/**
+	 * Compress the leafs that haven't been accessed for LeafCompressionDelay epochs. Locks the regions one lock at a time
+	 */
+	void CompressIdleLeafs();
+
+	/**
+	 * If the edited voxels use more memory than the budget, write the least recently used leafs to the page file until they use 3/4 of it
+	 * Locks the regions one lock at a time
+	 */
+	void PageOutLeafs();
+
+	/**
+	 * Does a region overlapping Box have pending chunks? Box must be locked, so that no save can be added
+	 * @param	MinGeneration	Only check the regions with chunks of saves loaded at this generation or after
+	 */
+	bool HasPendingRegions(const FVoxelBox& Box, uint64 MinGeneration) const;
+	/**
+	 * Lock Box for reading once its pending regions are loaded
+	 * Readers can't load: if there are pending regions, the read locks are released and the regions are loaded under write locks
+	 * @param	MinGeneration	Only load the regions with chunks of saves loaded at this generation or after
+	 */
+	void LockReadLoaded(const FVoxelBox& Box, uint64 MinGeneration);
+	/**
+	 * Load the regions overlapping Box that have pending chunks, in parallel. Box must be locked for writing
+	 * @param	Box				Voxels that are going to be accessed
+	 * @param	MinGeneration	Only load the regions with chunks of saves loaded at this generation or after
+	 */
+	void LoadPendingRegions(const FVoxelBox& Box, uint64 MinGeneration);
+	/**
+	 * Load the pending chunks of a region, if it hasn't been loaded already. The region must be locked for writing
+	 */
+	void LoadPendingRegion(uint64 RegionId);
+
+	/**
+	 * Load the chunks of a save made with the same VOXEL_LEAF_SIZE. The regions of the chunks must be locked for writing
+	 * Several readers can be loaded at the same time if they don't have chunks in the same lock region
+	 * @param	Reader					Reader of the save
+	 * @param	OutModifiedPositions	Positions of the render chunks to update
+	 */
+	void LoadChunks(FVoxelWorldSaveReader& Reader, std::deque<FIntVector>& OutModifiedPositions);
+
+	/**
+	 * Write the chunks of a save made with another VOXEL_LEAF_SIZE voxel by voxel. The whole world must be locked for writing
+	 * @param	Reader			Reader of the save
+	 * @param	SaveLeafSize	Width of its chunks
+	 */
+	void LoadResizedChunks(FVoxelWorldSaveReader& Reader, int SaveLeafSize);
 
-	FThreadSafeCounter SetCount;
-	FThreadSafeCounter WaitingSetCount;
+	void LockRead(uint64 Mask);
+	void UnlockRead(uint64 Mask);
+	void LockWrite(uint64 Mask);
+	void UnlockWrite(uint64 Mask);
 };
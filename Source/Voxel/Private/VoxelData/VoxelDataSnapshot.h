@@ -0,0 +1,93 @@
+// Copyright 2017 Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "VoxelMaterial.h"
+#include "VoxelValue.h"
+#include "VoxelConfig.h"
+#include "VoxelBox.h"
+#include "VoxelSave.h"
+
+class FVoxelLeafData;
+class FVoxelGeneratorCache;
+
+/**
+ * Modified VOXEL_LEAF_SIZE^3 chunk referenced by a snapshot
+ */
+struct FVoxelSnapshotChunk
+{
+	// Id of the Depth 0 node
+	uint64 Id;
+	// Center of the chunk
+	FIntVector Position;
+	// Data of the leaf containing the chunk. Never modified: edits copy it
+	TSharedPtr<const FVoxelLeafData, ESPMode::ThreadSafe> LeafData;
+	// Minimal corner of the leaf. Different from the chunk one for merged uniform nodes
+	FIntVector LeafMin;
+};
+
+/**
+ * Read only copy of the voxels of a box, created by FVoxelData::CreateSnapshot
+ * Leafs are shared with the octree and copied on write, so creating a snapshot is cheap and reading it doesn't need any lock
+ * Must not outlive the FVoxelData that created it
+ */
+class FVoxelDataSnapshot
+{
+public:
+	/**
+	 * Constructor
+	 * @param	GeneratorCache	Generator of the unmodified voxels
+	 * @param	Depth			Depth of the world
+	 * @param	Box				Voxels that can be read
+	 * @param	Generation		Generation of the world data
+	 */
+	FVoxelDataSnapshot(FVoxelGeneratorCache* GeneratorCache, int Depth, const FVoxelBox& Box, uint64 Generation);
+	~FVoxelDataSnapshot();
+
+	// Voxels that can be read
+	const FVoxelBox Box;
+
+	// Generation of the world data when the snapshot was created: all the edits up to it are in the snapshot
+	const uint64 Generation;
+
+	/**
+	 * Get values & materials. The voxels must be inside Box
+	 * @see		FVoxelData::GetValuesAndMaterials
+	 */
+	void GetValuesAndMaterials(FVoxelValue Values[], FVoxelMaterial Materials[], const FIntVector& Start, const FIntVector& StartIndex, const int Step, const FIntVector& Size, const FIntVector& ArraySize) const;
+
+	/**
+	 * Get value & material at position. Must be inside Box
+	 */
+	void GetValueAndMaterial(int X, int Y, int Z, float& OutValue, FVoxelMaterial& OutMaterial) const;
+
+	/**
+	 * Write the modified chunks to a save, in octree order. Only one chunk is copied at a time
+	 * @param	OutSave		Save to write
+	 * @param	Depth		Depth of the world
+	 * @param	Compression	Compression of the save
+	 */
+	void GetSave(FVoxelWorldSave& OutSave, int Depth, EVoxelSaveCompression Compression) const;
+
+	/**
+	 * Add a modified chunk. Chunks must be added in octree order
+	 */
+	void AddChunk(const FVoxelSnapshotChunk& Chunk);
+
+private:
+	FVoxelGeneratorCache* const GeneratorCache;
+	// Half of the world size
+	const int HalfSize;
+
+	TArray<FVoxelSnapshotChunk> Chunks;
+	// Index in Chunks by Morton code of the chunk coordinates
+	TMap<uint64, int> ChunksIndices;
+
+	FORCEINLINE uint64 GetChunkKey(int X, int Y, int Z) const;
+
+	/**
+	 * Ceil of A / B, B > 0
+	 */
+	FORCEINLINE static int CeilDiv(int A, int B);
+};
@@ -0,0 +1,211 @@
+// Copyright 2017 Phyronnaz
+
+#include "VoxelLZ4.h"
+
+// Minimal match length
+#define LZ4_MIN_MATCH 4
+// The last bytes are always literals
+#define LZ4_LAST_LITERALS 5
+// Last position where a match can start, from the end
+#define LZ4_MATCH_FIND_LIMIT 12
+// Matches can only reference the last 64KB
+#define LZ4_MAX_DISTANCE 65535
+#define LZ4_HASH_LOG 12
+
+void FVoxelLZ4::Compress(const uint8* Data, int32 Size, TArray<uint8>& OutCompressed)
+{
+	OutCompressed.SetNumUninitialized(VOXEL_LZ4_MAX_COMPRESSED_SIZE(Size));
+	uint8* Output = OutCompressed.GetData();
+
+	const uint8* const End = Data + Size;
+	const uint8* Anchor = Data;
+
+	if (Size > LZ4_MATCH_FIND_LIMIT)
+	{
+		const uint8* const MatchLimit = End - LZ4_LAST_LITERALS;
+		const uint8* const FindLimit = End - LZ4_MATCH_FIND_LIMIT;
+
+		// Last position of each hash, relative to Data
+		int32 Table[1 << LZ4_HASH_LOG];
+		for (int32& Position : Table)
+		{
+			Position = INDEX_NONE;
+		}
+
+		const uint8* Input = Data;
+		while (Input < FindLimit)
+		{
+			uint32 Sequence;
+			FMemory::Memcpy(&Sequence, Input, sizeof(uint32));
+			const uint32 HashIndex = Hash(Sequence);
+			const int32 Candidate = Table[HashIndex];
+			Table[HashIndex] = Input - Data;
+
+			bool bIsMatch = false;
+			if (Candidate != INDEX_NONE && Input - (Data + Candidate) <= LZ4_MAX_DISTANCE)
+			{
+				uint32 CandidateSequence;
+				FMemory::Memcpy(&CandidateSequence, Data + Candidate, sizeof(uint32));
+				bIsMatch = CandidateSequence == Sequence;
+			}
+			if (!bIsMatch)
+			{
+				Input++;
+				continue;
+			}
+
+			const uint8* Match = Data + Candidate;
+			// Extend backwards over the pending literals
+			while (Input > Anchor && Match > Data && Input[-1] == Match[-1])
+			{
+				Input--;
+				Match--;
+			}
+			const uint8* MatchEnd = Input + LZ4_MIN_MATCH;
+			const uint8* Reference = Match + LZ4_MIN_MATCH;
+			while (MatchEnd < MatchLimit && *MatchEnd == *Reference)
+			{
+				MatchEnd++;
+				Reference++;
+			}
+
+			const int32 LiteralLength = Input - Anchor;
+			const int32 MatchLength = MatchEnd - Input - LZ4_MIN_MATCH;
+			const int32 Distance = Input - Match;
+
+			// Token: literal length in the high bits, match length in the low bits
+			uint8* Token = Output++;
+			*Token = FMath::Min(LiteralLength, 15) << 4 | FMath::Min(MatchLength, 15);
+			if (LiteralLength >= 15)
+			{
+				WriteLength(Output, LiteralLength - 15);
+			}
+			FMemory::Memcpy(Output, Anchor, LiteralLength);
+			Output += LiteralLength;
+
+			*Output++ = Distance & 0xFF;
+			*Output++ = Distance >> 8;
+			if (MatchLength >= 15)
+			{
+				WriteLength(Output, MatchLength - 15);
+			}
+
+			Input = MatchEnd;
+			Anchor = Input;
+		}
+	}
+
+	// Last literals
+	const int32 LiteralLength = End - Anchor;
+	*Output++ = FMath::Min(LiteralLength, 15) << 4;
+	if (LiteralLength >= 15)
+	{
+		WriteLength(Output, LiteralLength - 15);
+	}
+	FMemory::Memcpy(Output, Anchor, LiteralLength);
+	Output += LiteralLength;
+
+	check(Output - OutCompressed.GetData() <= OutCompressed.Num());
+	OutCompressed.SetNum(Output - OutCompressed.GetData(), false);
+}
+
+bool FVoxelLZ4::Decompress(const uint8* Compressed, int32 CompressedSize, uint8* OutData, int32 Size)
+{
+	const uint8* Input = Compressed;
+	const uint8* const InputEnd = Compressed + CompressedSize;
+	uint8* Output = OutData;
+	uint8* const OutputEnd = OutData + Size;
+
+	while (Input < InputEnd)
+	{
+		const uint8 Token = *Input++;
+
+		int32 LiteralLength = Token >> 4;
+		if (LiteralLength == 15 && !ReadLength(Input, InputEnd, LiteralLength))
+		{
+			return false;
+		}
+		if (LiteralLength > InputEnd - Input || LiteralLength > OutputEnd - Output)
+		{
+			return false;
+		}
+		FMemory::Memcpy(Output, Input, LiteralLength);
+		Input += LiteralLength;
+		Output += LiteralLength;
+
+		if (Input == InputEnd)
+		{
+			// Last sequence has no match
+			break;
+		}
+
+		if (InputEnd - Input < 2)
+		{
+			return false;
+		}
+		const int32 Distance = Input[0] | Input[1] << 8;
+		Input += 2;
+		if (Distance == 0 || Distance > Output - OutData)
+		{
+			return false;
+		}
+
+		int32 MatchLength = Token & 15;
+		if (MatchLength == 15 && !ReadLength(Input, InputEnd, MatchLength))
+		{
+			return false;
+		}
+		MatchLength += LZ4_MIN_MATCH;
+		if (MatchLength > OutputEnd - Output)
+		{
+			return false;
+		}
+
+		const uint8* Reference = Output - Distance;
+		if (Distance >= MatchLength)
+		{
+			FMemory::Memcpy(Output, Reference, MatchLength);
+			Output += MatchLength;
+		}
+		else
+		{
+			// Overlapping copy: repeats the last Distance bytes
+			for (int32 Index = 0; Index < MatchLength; Index++)
+			{
+				*Output++ = *Reference++;
+			}
+		}
+	}
+
+	return Output == OutputEnd;
+}
+
+uint32 FVoxelLZ4::Hash(uint32 Sequence)
+{
+	return (Sequence * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+void FVoxelLZ4::WriteLength(uint8*& Output, int32 Length)
+{
+	while (Length >= 255)
+	{
+		*Output++ = 255;
+		Length -= 255;
+	}
+	*Output++ = Length;
+}
+
+bool FVoxelLZ4::ReadLength(const uint8*& Input, const uint8* InputEnd, int32& Length)
+{
+	uint8 Byte;
+	do
+	{
+		if (Input == InputEnd)
+		{
+			return false;
+		}
+		Byte = *Input++;
+		Length += Byte;
+	} while (Byte == 255);
+	return true;
+}
@@ -0,0 +1,51 @@
+// Copyright 2017 Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+// Worst case size of the compressed data, for Size bytes of uncompressed data
+#define VOXEL_LZ4_MAX_COMPRESSED_SIZE(Size) ((Size) + (Size) / 255 + 16)
+
+/**
+ * Fast compression used for the idle leafs and the saves, in the LZ4 block format
+ * Favors decompression speed over ratio: leafs are decompressed when read by the render threads
+ */
+class FVoxelLZ4
+{
+public:
+	/**
+	 * Compress data
+	 * @param	Data			Data to compress
+	 * @param	Size			Size of Data
+	 * @param	OutCompressed	Compressed data. Its size is at most VOXEL_LZ4_MAX_COMPRESSED_SIZE(Size)
+	 */
+	static void Compress(const uint8* Data, int32 Size, TArray<uint8>& OutCompressed);
+
+	/**
+	 * Decompress data
+	 * @param	Compressed		Data returned by Compress
+	 * @param	CompressedSize	Size of Compressed
+	 * @param	OutData			Decompressed data
+	 * @param	Size			Size of the uncompressed data
+	 * @return	Whether Compressed is valid and has exactly Size bytes
+	 */
+	static bool Decompress(const uint8* Compressed, int32 CompressedSize, uint8* OutData, int32 Size);
+
+private:
+	/**
+	 * Hash of 4 bytes, index in the match table
+	 */
+	FORCEINLINE static uint32 Hash(uint32 Sequence);
+
+	/**
+	 * Write the extra bytes of a literal or match length >= 15
+	 */
+	FORCEINLINE static void WriteLength(uint8*& Output, int32 Length);
+
+	/**
+	 * Read the extra bytes of a literal or match length
+	 * @return	Whether the input was long enough
+	 */
+	FORCEINLINE static bool ReadLength(const uint8*& Input, const uint8* InputEnd, int32& Length);
+};
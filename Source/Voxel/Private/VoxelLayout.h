@@ -0,0 +1,69 @@
+// Copyright 2017 Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "VoxelConfig.h"
+
+/**
+ * Index of the voxels in an array of Size^3 voxels. Arrays given to or returned by FVoxelData are always linear
+ */
+template<int Size>
+struct TVoxelLayout
+{
+#if VOXEL_BRICK_LAYOUT
+	// Number of bricks on each axis
+	static const int BrickCount = (Size + 3) / 4;
+	// Number of elements to allocate
+	static const int Count = BrickCount * BrickCount * BrickCount * 64;
+
+	FORCEINLINE static int Index(int X, int Y, int Z)
+	{
+		const int Brick = (X >> 2) + BrickCount * (Y >> 2) + BrickCount * BrickCount * (Z >> 2);
+		return 64 * Brick + SpreadBits(X & 3) + (SpreadBits(Y & 3) << 1) + (SpreadBits(Z & 3) << 2);
+	}
+
+	// 0b0ab -> 0b00a00b
+	FORCEINLINE static int SpreadBits(int Value)
+	{
+		return (Value & 1) | ((Value & 2) << 2);
+	}
+#else
+	// Number of elements to allocate
+	static const int Count = Size * Size * Size;
+
+	FORCEINLINE static int Index(int X, int Y, int Z)
+	{
+		return X + Size * Y + Size * Size * Z;
+	}
+#endif
+
+	/**
+	 * Convert a linear index
+	 * @param	LinearIndex		X + Size * Y + Size * Size * Z
+	 */
+	FORCEINLINE static int FromLinearIndex(int LinearIndex)
+	{
+		return Index(LinearIndex % Size, (LinearIndex / Size) % Size, LinearIndex / (Size * Size));
+	}
+
+	/**
+	 * Reorder a linear array
+	 * @param	In		Linear array of Size^3 elements
+	 * @param	Out		Array of Count elements
+	 */
+	template<typename T>
+	static void FromLinear(const T In[], T Out[])
+	{
+		for (int Z = 0; Z < Size; Z++)
+		{
+			for (int Y = 0; Y < Size; Y++)
+			{
+				for (int X = 0; X < Size; X++)
+				{
+					Out[Index(X, Y, Z)] = In[X + Size * Y + Size * Size * Z];
+				}
+			}
+		}
+	}
+};
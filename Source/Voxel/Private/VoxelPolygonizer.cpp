@@ -3,6 +3,7 @@
 #include "VoxelPolygonizer.h"
 #include "Transvoxel.h"
 #include "VoxelData.h"
+#include "VoxelDataSnapshot.h"
 #include "VoxelMaterial.h"
 #include <deque>
 #include "Kismet/KismetArrayLibrary.h"
@@ -16,6 +17,7 @@ DECLARE_CYCLE_STAT(TEXT("VoxelPolygonizer ~ MajorColor"), STAT_MAJOR_COLOR, STAT
 DECLARE_CYCLE_STAT(TEXT("VoxelPolygonizer ~ GetValueAndColor"), STAT_GETVALUEANDCOLOR, STATGROUP_Voxel);
 DECLARE_CYCLE_STAT(TEXT("VoxelPolygonizer ~ Get2DValueAndColor"), STAT_GET2DVALUEANDCOLOR, STATGROUP_Voxel);
 DECLARE_CYCLE_STAT(TEXT("VoxelPolygonizer ~ AmbientOcclusion"), STAT_AMBIENT_OCCLUSION, STATGROUP_Voxel);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Voxel Chunks Skipped By Value Range"), STAT_VoxelChunksSkippedByValueRange, STATGROUP_Voxel);
 
 FVoxelPolygonizer::FVoxelPolygonizer(int Depth, FVoxelData* Data, const FIntVector& ChunkPosition, const TArray<bool, TFixedAllocator<6>>& ChunkHasHigherRes, bool bComputeTransitions, bool bComputeCollisions, bool bEnableAmbientOcclusion, int RayMaxDistance, int RayCount, float NormalThresholdForSimplification)
 	: Depth(Depth)
@@ -34,6 +36,16 @@ FVoxelPolygonizer::FVoxelPolygonizer(int Depth, FVoxelData* Data, const FIntVect
 
 void FVoxelPolygonizer::CreateSection(FVoxelProcMeshSection& OutSection)
 {
+	// No surface if all the values have the same sign. Transitions read the voxels at half the step
+	const int ReadStep = bComputeTransitions ? FMath::Max(1, Step() / 2) : Step();
+	FVoxelValueRange ValueRange;
+	if (Data->GetValueRange(GetBounds(-1, CHUNKSIZE + 1), ReadStep, ValueRange) && ValueRange.HasSingleSign())
+	{
+		INC_DWORD_STAT(STAT_VoxelChunksSkippedByValueRange);
+		OutSection.Reset();
+		return;
+	}
+
 	for (int i = 0; i < 17; i++)
 	{
 		for (int j = 0; j < 17; j++)
@@ -45,13 +57,26 @@ void FVoxelPolygonizer::CreateSection(FVoxelProcMeshSection& OutSection)
 		}
 	}
 
+	// Every voxel read outside of the cache is in the cache bounds: the world is only locked while creating the snapshot
+	Snapshot = Data->CreateSnapshot(GetBounds(-1, CHUNKSIZE + 1));
+
 	{
 		SCOPE_CYCLE_COUNTER(STAT_CACHE);
 
 		FIntVector Size(CHUNKSIZE + 3, CHUNKSIZE + 3, CHUNKSIZE + 3);
-		Data->BeginGet();
-		Data->GetValuesAndMaterials(CachedValues, CachedMaterials, ChunkPosition - FIntVector(1, 1, 1) * Step(), FIntVector::ZeroValue, Step(), Size, Size);
-		Data->EndGet();
+#if VOXEL_BRICK_LAYOUT
+		TArray<FVoxelValue> LinearValues;
+		TArray<FVoxelMaterial> LinearMaterials;
+		LinearValues.SetNumUninitialized(Size.X * Size.Y * Size.Z);
+		LinearMaterials.SetNumUninitialized(Size.X * Size.Y * Size.Z);
+
+		Snapshot->GetValuesAndMaterials(LinearValues.GetData(), LinearMaterials.GetData(), ChunkPosition - FIntVector(1, 1, 1) * Step(), FIntVector::ZeroValue, Step(), Size, Size);
+
+		FCacheLayout::FromLinear(LinearValues.GetData(), CachedValues);
+		FCacheLayout::FromLinear(LinearMaterials.GetData(), CachedMaterials);
+#else
+		Snapshot->GetValuesAndMaterials(CachedValues, CachedMaterials, ChunkPosition - FIntVector(1, 1, 1) * Step(), FIntVector::ZeroValue, Step(), Size, Size);
+#endif
 
 		// Cache signs
 		for (int CubeX = 0; CubeX < 6; CubeX++)
@@ -80,7 +105,7 @@ void FVoxelPolygonizer::CreateSection(FVoxelProcMeshSection& OutSection)
 								check(0 <= X + 1 && X + 1 < CHUNKSIZE + 3);
 								check(0 <= Y + 1 && Y + 1 < CHUNKSIZE + 3);
 								check(0 <= Z + 1 && Z + 1 < CHUNKSIZE + 3);
-								float CurrentValue = CachedValues[(X + 1) + (CHUNKSIZE + 3) * (Y + 1) + (CHUNKSIZE + 3) * (CHUNKSIZE + 3) * (Z + 1)];
+								const FVoxelValue CurrentValue = CachedValues[FCacheLayout::Index(X + 1, Y + 1, Z + 1)];
 
 								bool Sign = CurrentValue > 0;
 								CurrentCube = CurrentCube | (CurrentBit * Sign);
@@ -113,7 +138,6 @@ void FVoxelPolygonizer::CreateSection(FVoxelProcMeshSection& OutSection)
 					{
 						continue;
 					}
-					Data->BeginGet();
 					for (int LocalX = 0; LocalX < 3; LocalX++)
 					{
 						for (int LocalY = 0; LocalY < 3; LocalY++)
@@ -335,7 +359,6 @@ void FVoxelPolygonizer::CreateSection(FVoxelProcMeshSection& OutSection)
 							}
 						}
 					}
-					Data->EndGet();
 				}
 			}
 		}
@@ -681,7 +704,6 @@ void FVoxelPolygonizer::CreateSection(FVoxelProcMeshSection& OutSection)
 		const int OldVerticesSize = VerticesSize;
 		const int OldTrianglesSize = TrianglesSize;
 
-		Data->BeginGet();
 		{
 			SCOPE_CYCLE_COUNTER(STAT_TRANSITIONS_ITER);
 
@@ -831,7 +853,6 @@ void FVoxelPolygonizer::CreateSection(FVoxelProcMeshSection& OutSection)
 				}
 			}
 		}
-		Data->EndGet();
 
 		{
 			SCOPE_CYCLE_COUNTER(STAT_ADD_TRANSITIONS_TO_SECTION);
@@ -930,15 +951,21 @@ void FVoxelPolygonizer::CreateSection(FVoxelProcMeshSection& OutSection)
 		}
 	}
 
+	// Leafs referenced by the snapshot would be copied by the next edits
+	Snapshot.Reset();
+
 	if (bEnableAmbientOcclusion)
 	{
 		SCOPE_CYCLE_COUNTER(STAT_AMBIENT_OCCLUSION);
 
 		{
-			Data->BeginGet();
-			for (auto& Vertex : OutSection.ProcVertexBuffer)
+			// Rays of all the vertices
+			TArray<FVector> RayOrigins;
+			TArray<FVector> RayDirections;
+			TArray<int> RayVertices;
+			for (int VertexIndex = 0; VertexIndex < OutSection.ProcVertexBuffer.Num(); VertexIndex++)
 			{
-				int HitCount = 0;
+				const FVoxelProcMeshVertex& Vertex = OutSection.ProcVertexBuffer[VertexIndex];
 				int TotalRays = 0;
 				FRandomStream Stream(0 * (Vertex.Position.X * 29 + Vertex.Position.Y * 284736 + Vertex.Position.Z * 49994837 + ChunkPosition.X * 292 + ChunkPosition.Y * 2929 + ChunkPosition.Z * 29938 + Step() * 282));
 
@@ -960,26 +987,85 @@ void FVoxelPolygonizer::CreateSection(FVoxelProcMeshSection& OutSection)
 						continue;
 					}
 
-					const FVector Direction = FVector(X, Y, Z).GetSafeNormal();
-
 					TotalRays++;
-					for (int i = 1; i < RayMaxDistance; i++)
+					RayOrigins.Add(Vertex.Position);
+					RayDirections.Add(FVector(X, Y, Z).GetSafeNormal());
+					RayVertices.Add(VertexIndex);
+				}
+			}
+
+			TArray<int> HitCounts;
+			HitCounts.SetNumZeroed(OutSection.ProcVertexBuffer.Num());
+
+			// March all the rays together, so that the voxels outside of the cache are sampled in batch
+			TArray<int> ActiveRays;
+			for (int Ray = 0; Ray < RayOrigins.Num(); Ray++)
+			{
+				ActiveRays.Add(Ray);
+			}
+			TArray<int> NextActiveRays;
+			TArray<int> BatchRays;
+			TArray<FIntVector> BatchPositions;
+			TArray<float> BatchValues;
+
+			// Rays can go up to RayMaxDistance steps away from the chunk
+			const FVoxelBox RaysBox = GetBounds(-RayMaxDistance, CHUNKSIZE + RayMaxDistance);
+			Data->BeginGet(RaysBox);
+			for (int i = 1; i < RayMaxDistance && ActiveRays.Num() > 0; i++)
+			{
+				NextActiveRays.Reset();
+				BatchRays.Reset();
+				BatchPositions.Reset();
+				for (int Ray : ActiveRays)
+				{
+					const FVector CurrentPosition = RayOrigins[Ray] + RayDirections[Ray] * i * Step();
+					const int X = FMath::RoundToInt(CurrentPosition.X);
+					const int Y = FMath::RoundToInt(CurrentPosition.Y);
+					const int Z = FMath::RoundToInt(CurrentPosition.Z);
+
+					if (IsInCache(X, Y, Z))
 					{
-						const FVector CurrentPosition = Vertex.Position + Direction * i * Step();
 						float Value;
 						FVoxelMaterial Dummy;
-						GetValueAndMaterial(FMath::RoundToInt(CurrentPosition.X), FMath::RoundToInt(CurrentPosition.Y), FMath::RoundToInt(CurrentPosition.Z), Value, Dummy);
-
+						GetValueAndMaterialFromCache(X / Step(), Y / Step(), Z / Step(), Value, Dummy);
 						if (Value <= 0)
 						{
-							HitCount++;
-							break;
+							HitCounts[RayVertices[Ray]]++;
+						}
+						else
+						{
+							NextActiveRays.Add(Ray);
 						}
 					}
+					else
+					{
+						BatchRays.Add(Ray);
+						BatchPositions.Add(ChunkPosition + FIntVector(X, Y, Z));
+					}
+				}
+
+				BatchValues.SetNumUninitialized(BatchPositions.Num());
+				Data->SampleBatch(BatchPositions.GetData(), BatchValues.GetData(), nullptr, BatchPositions.Num());
+				for (int BatchIndex = 0; BatchIndex < BatchRays.Num(); BatchIndex++)
+				{
+					if (BatchValues[BatchIndex] <= 0)
+					{
+						HitCounts[RayVertices[BatchRays[BatchIndex]]]++;
+					}
+					else
+					{
+						NextActiveRays.Add(BatchRays[BatchIndex]);
+					}
 				}
-				Vertex.Color.A = FMath::Clamp<int>(255.f * (1.f - HitCount / (float)TotalRays), 0, 255);
+
+				Swap(ActiveRays, NextActiveRays);
+			}
+			Data->EndGet(RaysBox);
+
+			for (int VertexIndex = 0; VertexIndex < OutSection.ProcVertexBuffer.Num(); VertexIndex++)
+			{
+				OutSection.ProcVertexBuffer[VertexIndex].Color.A = FMath::Clamp<int>(255.f * (1.f - HitCounts[VertexIndex] / (float)RayCount), 0, 255);
 			}
-			Data->EndGet();
 		}
 	}
 
@@ -1000,16 +1086,26 @@ int FVoxelPolygonizer::Step()
 	return 1 << Depth;
 }
 
+FVoxelBox FVoxelPolygonizer::GetBounds(int Min, int Max)
+{
+	return FVoxelBox(ChunkPosition + FIntVector(Min, Min, Min) * Step(), ChunkPosition + FIntVector(Max, Max, Max) * Step());
+}
+
 
-void FVoxelPolygonizer::GetValueAndMaterial(int X, int Y, int Z, float& OutValue, FVoxelMaterial& OutMaterial)
+bool FVoxelPolygonizer::IsInCache(int X, int Y, int Z)
 {
-	//SCOPE_CYCLE_COUNTER(STAT_GETVALUEANDCOLOR);
-	if ((X % Step() == 0) &&
+	return (X % Step() == 0) &&
 		(Y % Step() == 0) &&
 		(Z % Step() == 0) &&
 		(0 <= X + 1 && X + 1 < (CHUNKSIZE + 3) * Step()) &&
 		(0 <= Y + 1 && Y + 1 < (CHUNKSIZE + 3) * Step()) &&
-		(0 <= Z + 1 && Z + 1 < (CHUNKSIZE + 3) * Step()))
+		(0 <= Z + 1 && Z + 1 < (CHUNKSIZE + 3) * Step());
+}
+
+void FVoxelPolygonizer::GetValueAndMaterial(int X, int Y, int Z, float& OutValue, FVoxelMaterial& OutMaterial)
+{
+	//SCOPE_CYCLE_COUNTER(STAT_GETVALUEANDCOLOR);
+	if (IsInCache(X, Y, Z))
 	{
 		GetValueAndMaterialFromCache(X / Step(), Y / Step(), Z / Step(), OutValue, OutMaterial);
 	}
@@ -1021,7 +1117,7 @@ void FVoxelPolygonizer::GetValueAndMaterial(int X, int Y, int Z, float& OutValue
 
 void FVoxelPolygonizer::GetValueAndMaterialNoCache(int X, int Y, int Z, float& OutValue, FVoxelMaterial& OutMaterial)
 {
-	Data->GetValueAndMaterial(X + ChunkPosition.X, Y + ChunkPosition.Y, Z + ChunkPosition.Z, OutValue, OutMaterial);
+	Snapshot->GetValueAndMaterial(X + ChunkPosition.X, Y + ChunkPosition.Y, Z + ChunkPosition.Z, OutValue, OutMaterial);
 }
 
 void FVoxelPolygonizer::GetValueAndMaterialFromCache(int X, int Y, int Z, float& OutValue, FVoxelMaterial& OutMaterial)
@@ -1034,8 +1130,9 @@ void FVoxelPolygonizer::GetValueAndMaterialFromCache(int X, int Y, int Z, float&
 		(0 <= I && I < CHUNKSIZE + 3) &&
 		(0 <= J && J < CHUNKSIZE + 3) &&
 		(0 <= K && K < CHUNKSIZE + 3));
-	OutValue = CachedValues[I + (CHUNKSIZE + 3) * J + (CHUNKSIZE + 3) * (CHUNKSIZE + 3) * K];
-	OutMaterial = CachedMaterials[I + (CHUNKSIZE + 3) * J + (CHUNKSIZE + 3) * (CHUNKSIZE + 3) * K];
+	const int Index = FCacheLayout::Index(I, J, K);
+	OutValue = FVoxelValuePolicy::ToFloat(CachedValues[Index]);
+	OutMaterial = CachedMaterials[Index];
 }
 
 void FVoxelPolygonizer::Get2DValueAndMaterial(EDirection Direction, int X, int Y, float& OutValue, FVoxelMaterial& OutMaterial)
@@ -5,10 +5,14 @@
 #include "CoreMinimal.h"
 #include "VoxelProceduralMeshComponent.h"
 #include "Direction.h"
+#include "VoxelBox.h"
+#include "VoxelValue.h"
+#include "VoxelLayout.h"
 
 #define CHUNKSIZE 16
 
 class FVoxelData;
+class FVoxelDataSnapshot;
 struct FVoxelMaterial;
 
 class FVoxelPolygonizer
@@ -34,12 +38,16 @@ private:
 	const float NormalThresholdForSimplification;
 
 
-	// Cache of the sign of the values. Can lead to crash if value changed between cache and 2nd access
+	// Voxels read by this polygonizer, except for the ambient occlusion rays
+	TSharedPtr<FVoxelDataSnapshot, ESPMode::ThreadSafe> Snapshot;
+
+	// Cache of the sign of the values
 	uint64 CachedSigns[216];
 
 	// +3: 2 for normal + one for end edge
-	float CachedValues[(CHUNKSIZE + 3) * (CHUNKSIZE + 3) * (CHUNKSIZE + 3)];
-	FVoxelMaterial CachedMaterials[(CHUNKSIZE + 3) * (CHUNKSIZE + 3) * (CHUNKSIZE + 3)];
+	typedef TVoxelLayout<CHUNKSIZE + 3> FCacheLayout;
+	FVoxelValue CachedValues[FCacheLayout::Count];
+	FVoxelMaterial CachedMaterials[FCacheLayout::Count];
 
 	// Cache to get index of already created vertices
 	int Cache[CHUNKSIZE + 2][CHUNKSIZE + 2][CHUNKSIZE + 2][3];
@@ -53,6 +61,16 @@ private:
 	// Step between cubes
 	FORCEINLINE int Step();
 
+	/**
+	 * Get the voxels between Min and Max cubes, in voxel space
+	 * @param	Min		Min cube (inclusive), can be negative
+	 * @param	Max		Max cube (inclusive)
+	 */
+	FORCEINLINE FVoxelBox GetBounds(int Min, int Max);
+
+	// Is the voxel at this position (in chunk space) in CachedValues?
+	FORCEINLINE bool IsInCache(int X, int Y, int Z);
+
 	FORCEINLINE void GetValueAndMaterial(int X, int Y, int Z, float& OutValue, FVoxelMaterial& OutMaterial);
 	FORCEINLINE void GetValueAndMaterialNoCache(int X, int Y, int Z, float& OutValue, FVoxelMaterial& OutMaterial);
 	FORCEINLINE void GetValueAndMaterialFromCache(int X, int Y, int Z, float& OutValue, FVoxelMaterial& OutMaterial);
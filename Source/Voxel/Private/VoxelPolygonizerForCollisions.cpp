@@ -9,6 +9,7 @@
 DECLARE_CYCLE_STAT(TEXT("VoxelPolygonizerForCollisions ~ Main Iter"), STAT_MAIN_ITER_FC, STATGROUP_Voxel);
 DECLARE_CYCLE_STAT(TEXT("VoxelPolygonizerForCollisions ~ CreateSection"), STAT_CREATE_SECTION_FC, STATGROUP_Voxel);
 DECLARE_CYCLE_STAT(TEXT("VoxelPolygonizerForCollisions ~ Cache"), STAT_CACHE_FC, STATGROUP_Voxel);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Voxel Collision Chunks Skipped By Value Range"), STAT_VoxelCollisionChunksSkippedByValueRange, STATGROUP_Voxel);
 
 FVoxelPolygonizerForCollisions::FVoxelPolygonizerForCollisions(FVoxelData* Data, const FIntVector& ChunkPosition, bool bEnableRender)
 	: Data(Data)
@@ -19,19 +20,41 @@ FVoxelPolygonizerForCollisions::FVoxelPolygonizerForCollisions(FVoxelData* Data,
 
 void FVoxelPolygonizerForCollisions::CreateSection(FVoxelProcMeshSection& OutSection)
 {
+	// No surface if all the values have the same sign
+	FVoxelValueRange ValueRange;
+	if (Data->GetValueRange(FVoxelBox(ChunkPosition, ChunkPosition + FIntVector(CHUNKSIZE_FC, CHUNKSIZE_FC, CHUNKSIZE_FC)), 1, ValueRange) && ValueRange.HasSingleSign())
+	{
+		INC_DWORD_STAT(STAT_VoxelCollisionChunksSkippedByValueRange);
+		OutSection.Reset();
+		return;
+	}
+
 	// Create forward lists
 	std::deque<FVector> Vertices;
 	std::deque<int32> Triangles;
 	int VerticesSize = 0;
 	int TrianglesSize = 0;
 
-	Data->BeginGet();
-
 	{
 		SCOPE_CYCLE_COUNTER(STAT_CACHE_FC);
 
+		// Everything after this only reads the cache
 		FIntVector Size(CHUNKSIZE_FC + 1, CHUNKSIZE_FC + 1, CHUNKSIZE_FC + 1);
+		const FVoxelBox CacheBox(ChunkPosition, ChunkPosition + FIntVector(CHUNKSIZE_FC, CHUNKSIZE_FC, CHUNKSIZE_FC));
+#if VOXEL_BRICK_LAYOUT
+		TArray<FVoxelValue> LinearValues;
+		LinearValues.SetNumUninitialized(Size.X * Size.Y * Size.Z);
+
+		Data->BeginGet(CacheBox);
+		Data->GetValuesAndMaterials(LinearValues.GetData(), nullptr, ChunkPosition, FIntVector::ZeroValue, 1, Size, Size);
+		Data->EndGet(CacheBox);
+
+		FCacheLayout::FromLinear(LinearValues.GetData(), CachedValues);
+#else
+		Data->BeginGet(CacheBox);
 		Data->GetValuesAndMaterials(CachedValues, nullptr, ChunkPosition, FIntVector::ZeroValue, 1, Size, Size);
+		Data->EndGet(CacheBox);
+#endif
 
 
 		// Cache signs
@@ -215,7 +238,6 @@ void FVoxelPolygonizerForCollisions::CreateSection(FVoxelProcMeshSection& OutSec
 			}
 		}
 	}
-	Data->EndGet();
 
 
 	if (VerticesSize < 3)
@@ -277,7 +299,7 @@ float FVoxelPolygonizerForCollisions::GetValue(int X, int Y, int Z)
 	check(0 <= Y && Y < CHUNKSIZE_FC + 1);
 	check(0 <= Z && Z < CHUNKSIZE_FC + 1);
 
-	return CachedValues[X + (CHUNKSIZE_FC + 1) * Y + (CHUNKSIZE_FC + 1) * (CHUNKSIZE_FC + 1) * Z];
+	return FVoxelValuePolicy::ToFloat(CachedValues[FCacheLayout::Index(X, Y, Z)]);
 }
 
 void FVoxelPolygonizerForCollisions::SaveVertex(int X, int Y, int Z, short EdgeIndex, int Index)
@@ -3,6 +3,8 @@
 #include "CoreMinimal.h"
 #include "VoxelProceduralMeshComponent.h"
 #include "Direction.h"
+#include "VoxelValue.h"
+#include "VoxelLayout.h"
 
 #define CHUNKSIZE_FC 18
 
@@ -28,7 +30,8 @@ private:
 	// Cache to get index of already created vertices
 	int Cache[CHUNKSIZE_FC][CHUNKSIZE_FC][CHUNKSIZE_FC][3]; // [SizeX][SizeY][SizeZ][3];;
 
-	float CachedValues[(CHUNKSIZE_FC + 1) * (CHUNKSIZE_FC + 1) * (CHUNKSIZE_FC + 1)];
+	typedef TVoxelLayout<CHUNKSIZE_FC + 1> FCacheLayout;
+	FVoxelValue CachedValues[FCacheLayout::Count];
 
 	FORCEINLINE float GetValue(int X, int Y, int Z);
 
@@ -4,9 +4,10 @@
 #include "VoxelChunkComponent.h"
 #include "VoxelRender.h"
 #include "VoxelInvokerComponent.h"
+#include "VoxelPolygonizer.h"
 
 FChunkOctree::FChunkOctree(FVoxelRender* Render, FIntVector Position, uint8 Depth, uint64 Id)
-	: FOctree(Position, Depth, Id)
+	: FOctree(CHUNKSIZE, Position, Depth, Id)
 	, Render(Render)
 	, bHasChunk(false)
 	, VoxelChunk(nullptr)
@@ -181,16 +182,18 @@ void FChunkOctree::CreateChilds()
 	check(Depth != 0);
 
 	int d = Size() / 4;
-	uint64 Pow = IntPow9(Depth - 1);
 
-	Childs.Add(new FChunkOctree(Render, Position + FIntVector(-d, -d, -d), Depth - 1, Id + 1 * Pow));
-	Childs.Add(new FChunkOctree(Render, Position + FIntVector(+d, -d, -d), Depth - 1, Id + 2 * Pow));
-	Childs.Add(new FChunkOctree(Render, Position + FIntVector(-d, +d, -d), Depth - 1, Id + 3 * Pow));
-	Childs.Add(new FChunkOctree(Render, Position + FIntVector(+d, +d, -d), Depth - 1, Id + 4 * Pow));
-	Childs.Add(new FChunkOctree(Render, Position + FIntVector(-d, -d, +d), Depth - 1, Id + 5 * Pow));
-	Childs.Add(new FChunkOctree(Render, Position + FIntVector(+d, -d, +d), Depth - 1, Id + 6 * Pow));
-	Childs.Add(new FChunkOctree(Render, Position + FIntVector(-d, +d, +d), Depth - 1, Id + 7 * Pow));
-	Childs.Add(new FChunkOctree(Render, Position + FIntVector(+d, +d, +d), Depth - 1, Id + 8 * Pow));
+	// Siblings are contiguous
+	FChunkOctree* Block = Render->ChunkOctreePool.Allocate();
+
+	Childs.Add(new (&Block[0]) FChunkOctree(Render, Position + FIntVector(-d, -d, -d), Depth - 1, GetChildId(Id, 0)));
+	Childs.Add(new (&Block[1]) FChunkOctree(Render, Position + FIntVector(+d, -d, -d), Depth - 1, GetChildId(Id, 1)));
+	Childs.Add(new (&Block[2]) FChunkOctree(Render, Position + FIntVector(-d, +d, -d), Depth - 1, GetChildId(Id, 2)));
+	Childs.Add(new (&Block[3]) FChunkOctree(Render, Position + FIntVector(+d, +d, -d), Depth - 1, GetChildId(Id, 3)));
+	Childs.Add(new (&Block[4]) FChunkOctree(Render, Position + FIntVector(-d, -d, +d), Depth - 1, GetChildId(Id, 4)));
+	Childs.Add(new (&Block[5]) FChunkOctree(Render, Position + FIntVector(+d, -d, +d), Depth - 1, GetChildId(Id, 5)));
+	Childs.Add(new (&Block[6]) FChunkOctree(Render, Position + FIntVector(-d, +d, +d), Depth - 1, GetChildId(Id, 6)));
+	Childs.Add(new (&Block[7]) FChunkOctree(Render, Position + FIntVector(+d, +d, +d), Depth - 1, GetChildId(Id, 7)));
 
 	bHasChilds = true;
 }
@@ -203,8 +206,9 @@ void FChunkOctree::DeleteChilds()
 	for (FChunkOctree* Child : Childs)
 	{
 		Child->Delete();
-		delete Child;
+		Child->~FChunkOctree();
 	}
+	Render->ChunkOctreePool.Free(Childs[0]);
 	Childs.Reset();
 	bHasChilds = false;
 }
@@ -5,6 +5,7 @@
 #include "VoxelRender.h"
 #include "ChunkOctree.h"
 #include "VoxelPolygonizer.h"
+#include "VoxelData.h"
 #include "InstancedStaticMesh.h"
 #include "Components/InstancedStaticMeshComponent.h"
 #include "Components/HierarchicalInstancedStaticMeshComponent.h"
@@ -25,6 +26,8 @@ UVoxelChunkComponent::UVoxelChunkComponent()
 	: Render(nullptr)
 	, MeshBuilder(nullptr)
 	, CurrentOctree(nullptr)
+	, UpdatedGeneration(0)
+	, bHasBeenUpdated(false)
 {
 	bCastShadowAsTwoSided = true;
 	bUseAsyncCooking = true;
@@ -55,6 +58,7 @@ void UVoxelChunkComponent::Init(FChunkOctree* NewOctree)
 	}
 	Position = CurrentOctree->Position;
 	Size = CurrentOctree->Size();
+	bHasBeenUpdated = false;
 
 	bCookCollisions = CurrentOctree->Depth == 0 && Render->World->GetComputeExtendedCollisions();
 	/*if (bCookCollisions)
@@ -83,6 +87,9 @@ bool UVoxelChunkComponent::Update(bool bAsync)
 
 	SCOPE_CYCLE_COUNTER(STAT_Update);
 
+	// Before polygonizing, so that edits made during it are seen as changes
+	const uint64 Generation = GetDataGeneration();
+
 	// Update ChunkHasHigherRes
 	if (Render->World->GetComputeTransitions() && CurrentOctree->Depth != 0)
 	{
@@ -112,6 +119,8 @@ bool UVoxelChunkComponent::Update(bool bAsync)
 			MeshBuilder = new FAsyncPolygonizerTask(this);
 			Render->MeshThreadPool->AddQueuedWork(MeshBuilder);
 
+			UpdatedGeneration = Generation;
+			bHasBeenUpdated = true;
 			return true;
 		}
 		else
@@ -137,10 +146,27 @@ bool UVoxelChunkComponent::Update(bool bAsync)
 
 		ApplyNewMesh();
 
+		UpdatedGeneration = Generation;
+		bHasBeenUpdated = true;
 		return true;
 	}
 }
 
+bool UVoxelChunkComponent::HasDataChanged()
+{
+	check(Render);
+
+	return !bHasBeenUpdated || GetDataGeneration() != UpdatedGeneration;
+}
+
+uint64 UVoxelChunkComponent::GetDataGeneration() const
+{
+	// Same bounds as the polygonizer: one cube before and two after for normals
+	const int Step = Size / CHUNKSIZE;
+	const FIntVector Min = Position - FIntVector(Size / 2, Size / 2, Size / 2);
+	return Render->Data->GetGeneration(FVoxelBox(Min - FIntVector(Step, Step, Step), Min + FIntVector(CHUNKSIZE + 1, CHUNKSIZE + 1, CHUNKSIZE + 1) * Step));
+}
+
 void UVoxelChunkComponent::CheckTransitions()
 {
 	SCOPE_CYCLE_COUNTER(STAT_CheckTransitions);
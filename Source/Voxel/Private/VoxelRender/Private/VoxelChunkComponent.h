@@ -41,6 +41,11 @@ public:
 
 	bool UpdateFoliage();
 
+	/**
+	 * Have the voxels of this chunk been edited since its last update?
+	 */
+	bool HasDataChanged();
+
 	/**
 	 * Check if an adjacent chunk has changed its resolution, and update async if needed
 	 */
@@ -101,6 +106,16 @@ private:
 	FIntVector Position;
 	int Size;
 
+	// Generation of the voxels of this chunk at its last update. See FVoxelData::GetGeneration
+	uint64 UpdatedGeneration;
+	// Whether UpdatedGeneration is valid
+	bool bHasBeenUpdated;
+
+	/**
+	 * Get the generation of the voxels read by the polygonizer of this chunk
+	 */
+	uint64 GetDataGeneration() const;
+
 	FThreadSafeCounter CompletedFoliageTaskCount;
 
 	void OnAllFoliageComplete();
@@ -13,6 +13,7 @@
 
 DECLARE_CYCLE_STAT(TEXT("VoxelRender ~ ApplyUpdates"), STAT_ApplyUpdates, STATGROUP_Voxel);
 DECLARE_CYCLE_STAT(TEXT("VoxelRender ~ UpdateLOD"), STAT_UpdateLOD, STATGROUP_Voxel);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Voxel Chunk Updates Skipped"), STAT_VoxelChunkUpdatesSkipped, STATGROUP_Voxel);
 
 FVoxelRender::FVoxelRender(AVoxelWorld* World, AActor* ChunksParent, FVoxelData* Data, uint32 MeshThreadCount, uint32 FoliageThreadCount)
 	: World(World)
@@ -47,7 +48,7 @@ FVoxelRender::FVoxelRender(AVoxelWorld* World, AActor* ChunksParent, FVoxelData*
 	FoliageThreadPool->Create(FoliageThreadCount, 1024 * 1024);
 	CollisionThreadPool->Create(1, 1024 * 1024);
 
-	MainOctree = MakeShareable(new FChunkOctree(this, FIntVector::ZeroValue, Data->Depth, FOctree::GetTopIdFromDepth(Data->Depth)));
+	MainOctree = MakeShareable(new FChunkOctree(this, FIntVector::ZeroValue, Data->Depth, FOctree::GetTopId()));
 }
 
 FVoxelRender::~FVoxelRender()
@@ -193,13 +194,17 @@ UVoxelChunkComponent* FVoxelRender::GetInactiveChunk()
 	return Chunk;
 }
 
-void FVoxelRender::UpdateChunk(FChunkOctree* Chunk, bool bAsync)
+void FVoxelRender::UpdateChunk(FChunkOctree* Chunk, bool bAsync, bool bOnlyIfDataChanged)
 {
 	ChunksToUpdate.Add(Chunk);
 	if (!bAsync)
 	{
 		IdsOfChunksToUpdateSynchronously.Add(Chunk->Id);
 	}
+	if (!bOnlyIfDataChanged)
+	{
+		IdsOfChunksToUpdateEvenIfUnchanged.Add(Chunk->Id);
+	}
 }
 
 void FVoxelRender::UpdateChunksAtPosition(const FIntVector& Position, bool bAsync)
@@ -218,7 +223,7 @@ void FVoxelRender::UpdateChunksOverlappingBox(const FVoxelBox& Box, bool bAsync)
 
 	for (auto Chunk : OverlappingLeafs)
 	{
-		UpdateChunk(Chunk, bAsync);
+		UpdateChunk(Chunk, bAsync, true);
 	}
 
 	for (auto& Handler : CollisionComponents)
@@ -246,6 +251,12 @@ void FVoxelRender::ApplyUpdates()
 	{
 		if (Chunk->GetVoxelChunk())
 		{
+			if (!IdsOfChunksToUpdateEvenIfUnchanged.Contains(Chunk->Id) && !Chunk->GetVoxelChunk()->HasDataChanged())
+			{
+				INC_DWORD_STAT(STAT_VoxelChunkUpdatesSkipped);
+				continue;
+			}
+
 			bool bAsync = !IdsOfChunksToUpdateSynchronously.Contains(Chunk->Id);
 			bool bSuccess = Chunk->GetVoxelChunk()->Update(bAsync);
 
@@ -257,6 +268,7 @@ void FVoxelRender::ApplyUpdates()
 	}
 	ChunksToUpdate.Reset();
 	IdsOfChunksToUpdateSynchronously.Reset();
+	IdsOfChunksToUpdateEvenIfUnchanged.Reset();
 }
 
 void FVoxelRender::UpdateAll(bool bAsync)
@@ -6,6 +6,7 @@
 #include "VoxelBox.h"
 #include "Direction.h"
 #include "VoxelProceduralMeshComponent.h"
+#include "OctreeNodePool.h"
 #include <deque>
 
 class AVoxelWorld;
@@ -41,6 +42,9 @@ public:
 	FQueuedThreadPool* const FoliageThreadPool;
 	FQueuedThreadPool* const CollisionThreadPool;
 
+	// Allocator of the chunk octree nodes. Declared before MainOctree so that it is destroyed after it
+	TOctreeNodePool<FChunkOctree> ChunkOctreePool;
+
 
 	FVoxelRender(AVoxelWorld* World, AActor* ChunksParent, FVoxelData* Data, uint32 MeshThreadCount, uint32 FoliageThreadCount);
 	~FVoxelRender();
@@ -52,8 +56,13 @@ public:
 
 	UVoxelChunkComponent* GetInactiveChunk();
 
-	void UpdateChunk(FChunkOctree* Chunk, bool bAsync);
+	/**
+	 * Queue update of a chunk
+	 * @param	bOnlyIfDataChanged	If true, the update is dropped if the voxels of the chunk haven't been edited since its last update
+	 */
+	void UpdateChunk(FChunkOctree* Chunk, bool bAsync, bool bOnlyIfDataChanged = false);
 	void UpdateChunksAtPosition(const FIntVector& Position, bool bAsync);
+	// Chunks whose voxels haven't changed are not updated
 	void UpdateChunksOverlappingBox(const FVoxelBox& Box, bool bAsync);
 	void ApplyUpdates();
 
@@ -93,6 +102,8 @@ private:
 	TSet<FChunkOctree*> ChunksToUpdate;
 	// Ids of the chunks that need to be updated synchronously
 	TSet<uint64> IdsOfChunksToUpdateSynchronously;
+	// Ids of the chunks that need to be updated even if their voxels haven't changed
+	TSet<uint64> IdsOfChunksToUpdateEvenIfUnchanged;
 
 	// Shared ptr because each ChunkOctree need a reference to itself, and the Main one isn't the child of anyone
 	TSharedPtr<FChunkOctree> MainOctree;
@@ -1,12 +1,16 @@
 // Copyright 2017 Phyronnaz
 
 #include "VoxelSave.h"
-#include "BufferArchive.h"
-#include "ArchiveSaveCompressedProxy.h"
+#include "VoxelPrivate.h"
+#include "Octree.h"
+#include "VoxelLZ4.h"
+#include "VoxelTaskGroup.h"
 #include "ArchiveLoadCompressedProxy.h"
+#include "MemoryWriter.h"
 #include "MemoryReader.h"
 
-
+DECLARE_CYCLE_STAT(TEXT("VoxelSave ~ Compress block"), STAT_VoxelSave_CompressBlock, STATGROUP_Voxel);
+DECLARE_CYCLE_STAT(TEXT("VoxelSave ~ Decompress block"), STAT_VoxelSave_DecompressBlock, STATGROUP_Voxel);
 
 FVoxelChunkSave::FVoxelChunkSave()
 	: Id(-1)
@@ -14,77 +18,770 @@ FVoxelChunkSave::FVoxelChunkSave()
 
 }
 
-FVoxelChunkSave::FVoxelChunkSave(uint64 Id, FIntVector Position, float InValues[16 * 16 * 16], FVoxelMaterial InMaterials[16 * 16 * 16])
-	: Id(Id)
+void FVoxelChunkSave::EncodeDiff(const FVoxelValue GeneratorValues[], const FVoxelMaterial GeneratorMaterials[])
 {
-	Values.SetNumUninitialized(16 * 16 * 16);
-	Materials.SetNumUninitialized(16 * 16 * 16);
+	check(!IsDiff() && Values.Num() == Materials.Num());
+
+	const int VoxelCount = Values.Num();
+	TArray<uint32, TInlineAllocator<(VOXEL_LEAF_VOXELS + 31) / 32>> DiffMask;
+	DiffMask.SetNumZeroed((VoxelCount + 31) / 32);
 
-	for (int X = 0; X < 16; X++)
+	int DiffCount = 0;
+	for (int Index = 0; Index < VoxelCount; Index++)
 	{
-		for (int Y = 0; Y < 16; Y++)
+		if (Values[Index] != GeneratorValues[Index] || !(Materials[Index] == GeneratorMaterials[Index]))
 		{
-			for (int Z = 0; Z < 16; Z++)
-			{
-				const int Index = X + 16 * Y + 16 * 16 * Z;
-				Values[Index] = InValues[Index];
-				Materials[Index] = InMaterials[Index];
-			}
+			DiffMask[Index / 32] |= 1u << (Index % 32);
+			DiffCount++;
+		}
+	}
+
+	// Materials are serialized as 3 bytes, see operator<<(FArchive&, FVoxelMaterial&)
+	const int VoxelSize = sizeof(FVoxelValue) + 3;
+	if (DiffMask.Num() * sizeof(uint32) + DiffCount * VoxelSize >= VoxelCount * VoxelSize)
+	{
+		return;
+	}
+
+	// Stored voxels keep their order: they can be moved in place
+	int StoredIndex = 0;
+	for (int Word = 0; Word < DiffMask.Num(); Word++)
+	{
+		for (uint32 Bits = DiffMask[Word]; Bits; Bits &= Bits - 1)
+		{
+			const int Index = Word * 32 + FMath::CountTrailingZeros(Bits);
+			Values[StoredIndex] = Values[Index];
+			Materials[StoredIndex] = Materials[Index];
+			StoredIndex++;
 		}
 	}
+	check(StoredIndex == DiffCount);
+
+	Values.SetNum(DiffCount, false);
+	Materials.SetNum(DiffCount, false);
+	Mask = DiffMask;
+}
+
+void FVoxelChunkSave::GetValuesAndMaterials(FVoxelValue OutValues[], FVoxelMaterial OutMaterials[]) const
+{
+	if (!IsDiff())
+	{
+		FMemory::Memcpy(OutValues, Values.GetData(), Values.Num() * sizeof(FVoxelValue));
+		FMemory::Memcpy(OutMaterials, Materials.GetData(), Materials.Num() * sizeof(FVoxelMaterial));
+		return;
+	}
+
+	// Masks read from saves are checked by FVoxelWorldSaveReader::ReadChunk
+	int StoredIndex = 0;
+	for (int Word = 0; Word < Mask.Num(); Word++)
+	{
+		for (uint32 Bits = Mask[Word]; Bits; Bits &= Bits - 1)
+		{
+			const int Index = Word * 32 + FMath::CountTrailingZeros(Bits);
+			OutValues[Index] = Values[StoredIndex];
+			OutMaterials[Index] = Materials[StoredIndex];
+			StoredIndex++;
+		}
+	}
+	check(StoredIndex == Values.Num());
+}
+
+/**
+ * Compress a block of a save
+ */
+static void CompressBlock(EVoxelSaveCompression Compression, const TArray<uint8>& Data, TArray<uint8>& OutCompressed)
+{
+	SCOPE_CYCLE_COUNTER(STAT_VoxelSave_CompressBlock);
+
+	if (Compression == EVoxelSaveCompression::LZ4)
+	{
+		FVoxelLZ4::Compress(Data.GetData(), Data.Num(), OutCompressed);
+	}
+	else
+	{
+		int32 CompressedSize = FCompression::CompressMemoryBound(ECompressionFlags::COMPRESS_ZLIB, Data.Num());
+		OutCompressed.SetNumUninitialized(CompressedSize);
+		verify(FCompression::CompressMemory(ECompressionFlags::COMPRESS_ZLIB, OutCompressed.GetData(), CompressedSize, Data.GetData(), Data.Num()));
+		OutCompressed.SetNum(CompressedSize, false);
+	}
+}
+
+/**
+ * Decompress a block of a save
+ * @return	Whether the compressed data is valid
+ */
+static bool DecompressBlock(EVoxelSaveCompression Compression, const uint8* Compressed, int32 CompressedSize, TArray<uint8>& OutData, int32 Size)
+{
+	SCOPE_CYCLE_COUNTER(STAT_VoxelSave_DecompressBlock);
+
+	OutData.SetNumUninitialized(Size, false);
+	if (Compression == EVoxelSaveCompression::LZ4)
+	{
+		return FVoxelLZ4::Decompress(Compressed, CompressedSize, OutData.GetData(), Size);
+	}
+	else
+	{
+		return FCompression::UncompressMemory(ECompressionFlags::COMPRESS_ZLIB, OutData.GetData(), Size, Compressed, CompressedSize);
+	}
+}
+
+/**
+ * Depth of the subtrees a block can't span: the smallest ones with room for VOXEL_SAVE_BLOCK_CHUNKS chunks
+ * Lock regions are at least as deep for VOXEL_LEAF_SIZE up to 16: a region is loaded lazily without decompressing chunks of other regions
+ */
+static int GetBlockSubtreeDepth()
+{
+	int Depth = 0;
+	while ((1 << (3 * Depth)) < VOXEL_SAVE_BLOCK_CHUNKS)
+	{
+		Depth++;
+	}
+	return Depth;
+}
+
+/**
+ * Deserialize an array saved with operator<<. The size read isn't trusted: corrupted saves can have any
+ * @param	MaxNum	Max number of elements
+ * @return	false if the data is corrupted
+ */
+template<typename T, typename AllocatorType>
+static bool LoadArray(FArchive& Ar, TArray<T, AllocatorType>& Array, int32 MaxNum)
+{
+	int32 Num;
+	Ar << Num;
+	if (Ar.GetError() || Num < 0 || Num > MaxNum)
+	{
+		return false;
+	}
+
+	Array.SetNumUninitialized(Num);
+	for (T& Element : Array)
+	{
+		Ar << Element;
+	}
+	return !Ar.GetError();
+}
+
+/**
+ * Load values saved with another VOXEL_VALUE_QUANTIZATION
+ * @param	MaxNum	Max number of values
+ * @return	false if the data is corrupted
+ */
+template<typename T>
+static bool LoadConvertedValues(FArchive& Ar, TArray<FVoxelValue, TInlineAllocator<VOXEL_LEAF_VOXELS>>& Values, int32 MaxNum)
+{
+	TArray<T, TInlineAllocator<VOXEL_LEAF_VOXELS>> SavedValues;
+	if (!LoadArray(Ar, SavedValues, MaxNum))
+	{
+		return false;
+	}
+
+	Values.SetNumUninitialized(SavedValues.Num());
+	for (int Index = 0; Index < SavedValues.Num(); Index++)
+	{
+		Values[Index] = FVoxelValuePolicy::FromFloat(TVoxelValuePolicy<T>::ToFloat(SavedValues[Index]));
+	}
+	return true;
+}
+
+/**
+ * Depth of the chunks of a save below the root: the world is 16 << Depth wide, see FVoxelData::Size
+ */
+static int GetChunkDepth(const FVoxelWorldSave& Save)
+{
+	return Save.Depth + 4 - FMath::FloorLog2(Save.LeafSize);
+}
+
+/**
+ * Check the fields of a save, without reading its data
+ * @param	OutError	Why the save can't be read
+ */
+static bool ValidateFields(const FVoxelWorldSave& Save, FString& OutError)
+{
+	if (Save.Version < EVoxelSaveVersion::BeforeMortonIds || Save.Version > EVoxelSaveVersion::LatestVersion)
+	{
+		OutError = FString::Printf(TEXT("Unknown save version %d"), Save.Version);
+		return false;
+	}
+	if (Save.ValueSize != sizeof(float) && Save.ValueSize != sizeof(int16) && Save.ValueSize != sizeof(int8))
+	{
+		OutError = FString::Printf(TEXT("Values of %d bytes can't be read"), Save.ValueSize);
+		return false;
+	}
+	// Chunks of up to 256^3 voxels
+	if (Save.LeafSize <= 0 || Save.LeafSize > 256 || !FMath::IsPowerOfTwo(Save.LeafSize))
+	{
+		OutError = FString::Printf(TEXT("Invalid chunk width %d"), Save.LeafSize);
+		return false;
+	}
+	const int ChunkDepth = GetChunkDepth(Save);
+	if (Save.Depth < 0 || ChunkDepth < 0 || ChunkDepth > MAX_OCTREE_DEPTH)
+	{
+		OutError = FString::Printf(TEXT("Invalid depth %d for chunks %d voxels wide"), Save.Depth, Save.LeafSize);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Is Id the Id of a chunk of a save, ie of a node GetChunkDepth levels below the root? The fields of the save must be valid
+ */
+static bool IsValidChunkId(const FVoxelWorldSave& Save, uint64 Id)
+{
+	return (Id >> (3 * GetChunkDepth(Save))) == FOctree::GetTopId();
 }
 
 FVoxelWorldSave::FVoxelWorldSave()
 	: Depth(-1)
+	, ValueSize(sizeof(float))
+	, Version(EVoxelSaveVersion::BeforeMortonIds)
+	, LeafSize(16)
+	, bIsDelta(false)
+	, Compression(EVoxelSaveCompression::Zlib)
 {
 
 }
 
-void FVoxelWorldSave::Init(int NewDepth, const std::deque<TSharedRef<FVoxelChunkSave>>& ChunksList)
+bool FVoxelWorldSave::Validate(FString& OutError) const
 {
-	Depth = NewDepth;
+	if (!ValidateFields(*this, OutError))
+	{
+		return false;
+	}
 
-	FBufferArchive ToBinary;
+	TArray<FVoxelSaveBlock> Blocks;
+	TArray<uint64> ChunkIds;
+	if (Version >= EVoxelSaveVersion::ChunkIndex ? !GetChunkIds(Blocks, ChunkIds) : Version >= EVoxelSaveVersion::Blocks && !GetBlocks(Blocks))
+	{
+		OutError = TEXT("The block table is corrupted");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Read the block table and, if not null, the chunk Ids at the end of the data of a save
+ * @param	Save	Save with valid fields
+ * @return	false if the table is corrupted
+ */
+static bool ReadBlockTable(const FVoxelWorldSave& Save, TArray<FVoxelSaveBlock>& OutBlocks, TArray<uint64>* OutChunkIds)
+{
+	const TArray<uint8>& Data = Save.Data;
 
-	// Order matters
-	for (auto Chunk : ChunksList)
+	// Saves that were never written have no data
+	if (Data.Num() == 0)
 	{
-		ToBinary << *Chunk;
+		return true;
 	}
 
-	Data.Empty();
-	FArchiveSaveCompressedProxy Compressor = FArchiveSaveCompressedProxy(Data, ECompressionFlags::COMPRESS_ZLIB);
+	// Position of the table at the end
+	int32 TableOffset;
+	if (Data.Num() < (int32)sizeof(int32))
+	{
+		return false;
+	}
+	FMemory::Memcpy(&TableOffset, Data.GetData() + Data.Num() - sizeof(int32), sizeof(int32));
+	if (TableOffset < 0 || TableOffset > Data.Num() - (int32)sizeof(int32))
+	{
+		return false;
+	}
 
-	// Send entire binary array/archive to compressor
-	Compressor << ToBinary;
+	// The table can't have more entries than its bytes allow
+	const int32 TableSize = Data.Num() - TableOffset;
+	FMemoryReader Reader(Data);
+	Reader.Seek(TableOffset);
+	if (!LoadArray(Reader, OutBlocks, TableSize / (2 * sizeof(uint64) + 4 * sizeof(int32))))
+	{
+		return false;
+	}
+	if (OutChunkIds && !LoadArray(Reader, *OutChunkIds, TableSize / sizeof(uint64)))
+	{
+		return false;
+	}
 
-	// Send archive serialized data to binary array
-	Compressor.Flush();
+	// The blocks are before the table
+	int64 ChunkCount = 0;
+	for (const FVoxelSaveBlock& Block : OutBlocks)
+	{
+		if (Block.ChunkCount <= 0 || Block.Size < 0 || Block.Offset < 0 || Block.CompressedSize < 0 || (int64)Block.Offset + Block.CompressedSize > TableOffset)
+		{
+			return false;
+		}
+		if (!IsValidChunkId(Save, Block.FirstId) || !IsValidChunkId(Save, Block.LastId) || Block.FirstId > Block.LastId)
+		{
+			return false;
+		}
+		ChunkCount += Block.ChunkCount;
+	}
+	if (OutChunkIds)
+	{
+		if (OutChunkIds->Num() != ChunkCount)
+		{
+			return false;
+		}
+		// Octree order
+		for (int Index = 0; Index < OutChunkIds->Num(); Index++)
+		{
+			if (!IsValidChunkId(Save, (*OutChunkIds)[Index]) || (Index > 0 && (*OutChunkIds)[Index - 1] >= (*OutChunkIds)[Index]))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
 }
 
-std::deque<FVoxelChunkSave> FVoxelWorldSave::GetChunksList() const
+bool FVoxelWorldSave::GetBlocks(TArray<FVoxelSaveBlock>& OutBlocks) const
 {
-	std::deque<FVoxelChunkSave> ChunksList;
+	OutBlocks.Reset();
+	FString Error;
+	if (Version < EVoxelSaveVersion::Blocks || !ValidateFields(*this, Error))
+	{
+		return false;
+	}
 
-	FArchiveLoadCompressedProxy Decompressor = FArchiveLoadCompressedProxy(Data, ECompressionFlags::COMPRESS_ZLIB);
+	return ReadBlockTable(*this, OutBlocks, nullptr);
+}
 
-	check(!Decompressor.GetError());
+bool FVoxelWorldSave::GetChunkIds(TArray<FVoxelSaveBlock>& OutBlocks, TArray<uint64>& OutChunkIds) const
+{
+	OutBlocks.Reset();
+	OutChunkIds.Reset();
+	FString Error;
+	if (Version < EVoxelSaveVersion::ChunkIndex || !ValidateFields(*this, Error))
+	{
+		return false;
+	}
 
-	//Decompress
-	FBufferArchive DecompressedBinaryArray;
-	Decompressor << DecompressedBinaryArray;
+	return ReadBlockTable(*this, OutBlocks, &OutChunkIds);
+}
 
-	FMemoryReader FromBinary = FMemoryReader(DecompressedBinaryArray);
-	FromBinary.Seek(0);
+/**
+ * Call Function on each chunk of Saves in octree order, with the version of the last save having it
+ * @return	false if a save couldn't be read: Function was only called on the chunks before the error
+ */
+template<typename T>
+static bool ForEachLastChunk(const TArray<const FVoxelWorldSave*>& Saves, T Function)
+{
+	TArray<TSharedPtr<FVoxelWorldSaveReader>> Readers;
+	for (auto Save : Saves)
+	{
+		Readers.Add(MakeShareable(new FVoxelWorldSaveReader(*Save)));
+	}
 
-	while (!FromBinary.AtEnd())
+	while (true)
 	{
-		FVoxelChunkSave Chunk;
-		FromBinary << Chunk;
+		// Chunks are in octree order, which is the order of their Ids: all the readers are at the next chunk or past it
+		int LastReader = INDEX_NONE;
+		for (int Index = 0; Index < Readers.Num(); Index++)
+		{
+			if (Readers[Index]->HasError())
+			{
+				return false;
+			}
+			const FVoxelChunkSave* Chunk = Readers[Index]->GetChunk();
+			if (Chunk && (LastReader == INDEX_NONE || Chunk->Id <= Readers[LastReader]->GetChunk()->Id))
+			{
+				LastReader = Index;
+			}
+		}
+		if (LastReader == INDEX_NONE)
+		{
+			return true;
+		}
+
+		const uint64 Id = Readers[LastReader]->GetChunk()->Id;
+		Function(*Readers[LastReader]->GetChunk());
 
-		// Order matters
-		ChunksList.push_back(Chunk);
+		for (auto& Reader : Readers)
+		{
+			if (Reader->GetChunk() && Reader->GetChunk()->Id == Id)
+			{
+				Reader->NextChunk();
+			}
+		}
 	}
+}
 
-	return ChunksList;
+bool FVoxelWorldSave::CompactDeltas(const FVoxelWorldSave& Base, const TArray<FVoxelWorldSave>& Deltas, FVoxelWorldSave& OutSave)
+{
+	TArray<const FVoxelWorldSave*> Saves;
+	Saves.Add(&Base);
+	for (auto& Delta : Deltas)
+	{
+		Saves.Add(&Delta);
+	}
+	for (auto Save : Saves)
+	{
+		FString Error;
+		if (Save == &OutSave)
+		{
+			UE_LOG(LogVoxel, Error, TEXT("CompactDeltas: OutSave can't be one of the saves to compact"));
+			return false;
+		}
+		else if (!Save->Validate(Error))
+		{
+			UE_LOG(LogVoxel, Error, TEXT("CompactDeltas: %s"), *Error);
+			return false;
+		}
+		else if (Save->bIsDelta != (Save != &Base))
+		{
+			UE_LOG(LogVoxel, Error, TEXT("CompactDeltas: Base must be a full save and Deltas must be delta saves"));
+			return false;
+		}
+		else if (Save->Depth != Base.Depth)
+		{
+			UE_LOG(LogVoxel, Error, TEXT("CompactDeltas: Base Depth is %d while a delta one is %d"), Base.Depth, Save->Depth);
+			return false;
+		}
+		else if (Save->LeafSize != VOXEL_LEAF_SIZE)
+		{
+			UE_LOG(LogVoxel, Error, TEXT("CompactDeltas: Can't compact saves with %d^3 chunks: load them and save the world instead"), Save->LeafSize);
+			return false;
+		}
+	}
+
+	bool bSuccess;
+	{
+		FVoxelWorldSaveWriter Writer(OutSave, Base.Depth, Base.Compression);
+		bSuccess = ForEachLastChunk(Saves, [&](const FVoxelChunkSave& Chunk) { Writer.WriteChunk(Chunk); });
+		Writer.Finish();
+	}
+	if (!bSuccess)
+	{
+		// The reader logged the error
+		OutSave = FVoxelWorldSave();
+	}
+	return bSuccess;
+}
+
+FVoxelWorldSaveWriter::FVoxelWorldSaveWriter(FVoxelWorldSave& Save, int Depth, EVoxelSaveCompression Compression)
+	: Save(Save)
+	, Tasks(new FVoxelTaskGroup())
+{
+	Save.Depth = Depth;
+	Save.ValueSize = sizeof(FVoxelValue);
+	Save.LeafSize = VOXEL_LEAF_SIZE;
+	Save.Version = EVoxelSaveVersion::LatestVersion;
+	Save.bIsDelta = false;
+	Save.Compression = Compression;
+	Save.Data.Empty();
+}
+
+FVoxelWorldSaveWriter::~FVoxelWorldSaveWriter()
+{
+	// Wait for the tasks using the blocks
+	delete Tasks;
+	for (auto Block : Blocks)
+	{
+		delete Block;
+	}
+}
+
+void FVoxelWorldSaveWriter::WriteChunk(const FVoxelChunkSave& Chunk)
+{
+	check(Chunk.IsDiff() ? Chunk.Mask.Num() == (VOXEL_LEAF_VOXELS + 31) / 32 : Chunk.Values.Num() == VOXEL_LEAF_VOXELS);
+	check(Chunk.Materials.Num() == Chunk.Values.Num());
+	check(Entries.Num() == 0 || Entries.Last().LastId < Chunk.Id);
+
+	static const int BlockSubtreeDepth = GetBlockSubtreeDepth();
+	if (Entries.Num() == 0 || Entries.Last().ChunkCount == VOXEL_SAVE_BLOCK_CHUNKS || FOctree::GetAncestorId(Entries.Last().FirstId, BlockSubtreeDepth) != FOctree::GetAncestorId(Chunk.Id, BlockSubtreeDepth))
+	{
+		if (Entries.Num() > 0)
+		{
+			CompressLastBlock();
+		}
+
+		FVoxelSaveBlock Entry;
+		Entry.FirstId = Chunk.Id;
+		Entry.ChunkCount = 0;
+		Entries.Add(Entry);
+
+		FBlock* Block = new FBlock();
+		// Materials are serialized as 3 bytes, see operator<<(FArchive&, FVoxelMaterial&)
+		Block->Data.Reserve(VOXEL_SAVE_BLOCK_CHUNKS * (sizeof(uint64) + sizeof(int32) + VOXEL_LEAF_VOXELS * sizeof(FVoxelValue) + sizeof(int32) + VOXEL_LEAF_VOXELS * 3));
+		Blocks.Add(Block);
+	}
+
+	FVoxelSaveBlock& Entry = Entries.Last();
+	Entry.LastId = Chunk.Id;
+	Entry.ChunkCount++;
+	ChunkIds.Add(Chunk.Id);
+
+	// Saving doesn't modify it
+	FMemoryWriter Writer(Blocks.Last()->Data, false, true);
+	Writer << const_cast<FVoxelChunkSave&>(Chunk);
+}
+
+void FVoxelWorldSaveWriter::Finish()
+{
+	if (Blocks.Num() > 0)
+	{
+		CompressLastBlock();
+	}
+	Tasks->Wait();
+	AddCompressedBlocks();
+	check(Blocks.Num() == 0);
+
+	// Block table and chunk Ids after the blocks, then their position
+	int32 TableOffset = Save.Data.Num();
+	FMemoryWriter Writer(Save.Data, false, true);
+	Writer << Entries;
+	Writer << ChunkIds;
+	Writer << TableOffset;
+	checkf(Save.Data.Num() > TableOffset, TEXT("Save too big"));
+	Entries.Empty();
+	ChunkIds.Empty();
+}
+
+void FVoxelWorldSaveWriter::CompressLastBlock()
+{
+	FBlock* Block = Blocks.Last();
+	Entries.Last().Size = Block->Data.Num();
+
+	const EVoxelSaveCompression Compression = Save.Compression;
+	Tasks->Add([Block, Compression]()
+	{
+		CompressBlock(Compression, Block->Data, Block->CompressedData);
+		Block->Data.Empty();
+		Block->bIsCompressed = true;
+	});
+
+	AddCompressedBlocks();
+}
+
+void FVoxelWorldSaveWriter::AddCompressedBlocks()
+{
+	while (Blocks.Num() > 0 && Blocks[0]->bIsCompressed)
+	{
+		FBlock* Block = Blocks[0];
+		FVoxelSaveBlock& Entry = Entries[Entries.Num() - Blocks.Num()];
+		checkf((int64)Save.Data.Num() + Block->CompressedData.Num() < MAX_int32, TEXT("Save too big"));
+
+		Entry.Offset = Save.Data.Num();
+		Entry.CompressedSize = Block->CompressedData.Num();
+		Save.Data.Append(Block->CompressedData);
+
+		delete Block;
+		Blocks.RemoveAt(0);
+	}
+}
+
+FVoxelWorldSaveReader::FVoxelWorldSaveReader(const FVoxelWorldSave& Save)
+	: Save(Save)
+	, Decompressor(nullptr)
+	, End(0)
+	, Blocks(OwnedBlocks)
+	, NextBlock(0)
+	, LastBlock(-1)
+	, BlockPosition(0)
+	, bHasChunk(false)
+	, bHasError(false)
+{
+	FString Error;
+	if (!ValidateFields(Save, Error))
+	{
+		SetError(Error);
+		return;
+	}
+
+	if (Save.Version >= EVoxelSaveVersion::Blocks)
+	{
+		if (!Save.GetBlocks(OwnedBlocks))
+		{
+			SetError(TEXT("The block table is corrupted"));
+			return;
+		}
+		LastBlock = OwnedBlocks.Num() - 1;
+	}
+	else if (Save.Data.Num() > 0)
+	{
+		Decompressor = new FArchiveLoadCompressedProxy(Save.Data, ECompressionFlags::COMPRESS_ZLIB);
+
+		// Size of the chunks, then the chunks
+		int32 DataSize;
+		*Decompressor << DataSize;
+		if (Decompressor->GetError() || DataSize < 0)
+		{
+			SetError(TEXT("The save data is corrupted"));
+			return;
+		}
+		End = Decompressor->Tell() + DataSize;
+	}
+	NextChunk();
+}
+
+FVoxelWorldSaveReader::FVoxelWorldSaveReader(const FVoxelWorldSave& Save, const TArray<FVoxelSaveBlock>& Blocks, int FirstBlock, int LastBlock)
+	: Save(Save)
+	, Decompressor(nullptr)
+	, End(0)
+	, Blocks(Blocks)
+	, NextBlock(FirstBlock)
+	, LastBlock(LastBlock)
+	, BlockPosition(0)
+	, bHasChunk(false)
+	, bHasError(false)
+{
+	check(Save.Version >= EVoxelSaveVersion::Blocks);
+	check(0 <= FirstBlock && LastBlock < Blocks.Num());
+	NextChunk();
+}
+
+FVoxelWorldSaveReader::~FVoxelWorldSaveReader()
+{
+	delete Decompressor;
+}
+
+const FVoxelChunkSave* FVoxelWorldSaveReader::GetChunk() const
+{
+	return bHasChunk ? &Chunk : nullptr;
+}
+
+void FVoxelWorldSaveReader::NextChunk()
+{
+	if (bHasError)
+	{
+		return;
+	}
+
+	if (Decompressor)
+	{
+		bHasChunk = Decompressor->Tell() < End && ReadChunk(*Decompressor);
+		return;
+	}
+
+	if (BlockPosition == BlockData.Num())
+	{
+		bHasChunk = NextBlock <= LastBlock;
+		if (!bHasChunk)
+		{
+			BlockData.Empty();
+			return;
+		}
+
+		// Checked when reading the table
+		const FVoxelSaveBlock& Block = Blocks[NextBlock++];
+		check(0 <= Block.Offset && Block.Offset + Block.CompressedSize <= Save.Data.Num());
+		if (!DecompressBlock(Save.Compression, Save.Data.GetData() + Block.Offset, Block.CompressedSize, BlockData, Block.Size))
+		{
+			SetError(TEXT("A block can't be decompressed"));
+			return;
+		}
+		BlockPosition = 0;
+	}
+
+	FMemoryReader Reader(BlockData);
+	Reader.Seek(BlockPosition);
+	bHasChunk = ReadChunk(Reader);
+	BlockPosition = Reader.Tell();
+
+	// Blocks are loaded by the tasks of the regions of their range, see FVoxelData::LoadFromSaveAndGetModifiedPositions
+	const FVoxelSaveBlock& Block = Blocks[NextBlock - 1];
+	if (bHasChunk && (Chunk.Id < Block.FirstId || Block.LastId < Chunk.Id))
+	{
+		SetError(FString::Printf(TEXT("Chunk %llu is outside of its block"), Chunk.Id));
+	}
+}
+
+bool FVoxelWorldSaveReader::HasError() const
+{
+	return bHasError;
+}
+
+bool FVoxelWorldSaveReader::ReadChunk(FArchive& Ar)
+{
+	// The fields were checked by the constructor
+	const int32 ChunkVoxels = Save.LeafSize * Save.LeafSize * Save.LeafSize;
+
+	Ar << Chunk.Id;
+
+	bool bIsValid = true;
+	if (Save.Version >= EVoxelSaveVersion::GeneratorDiff)
+	{
+		bIsValid = LoadArray(Ar, Chunk.Mask, (ChunkVoxels + 31) / 32);
+	}
+	else
+	{
+		// All the voxels are stored
+		Chunk.Mask.Reset();
+	}
+
+	if (Save.ValueSize == sizeof(FVoxelValue))
+	{
+		bIsValid = bIsValid && LoadArray(Ar, Chunk.Values, ChunkVoxels);
+	}
+	else
+	{
+		switch (Save.ValueSize)
+		{
+		case sizeof(float):
+			bIsValid = bIsValid && LoadConvertedValues<float>(Ar, Chunk.Values, ChunkVoxels);
+			break;
+		case sizeof(int16):
+			bIsValid = bIsValid && LoadConvertedValues<int16>(Ar, Chunk.Values, ChunkVoxels);
+			break;
+		case sizeof(int8):
+			bIsValid = bIsValid && LoadConvertedValues<int8>(Ar, Chunk.Values, ChunkVoxels);
+			break;
+		default:
+			SetError(FString::Printf(TEXT("Values of %d bytes can't be read"), Save.ValueSize));
+			return false;
+		}
+	}
+
+	if (!bIsValid || !LoadArray(Ar, Chunk.Materials, ChunkVoxels))
+	{
+		SetError(TEXT("Chunk data is corrupted"));
+		return false;
+	}
+
+	if (Save.Version < EVoxelSaveVersion::MortonIds)
+	{
+		if (!FOctree::IsValidLegacyId(Chunk.Id, Save.Depth))
+		{
+			SetError(FString::Printf(TEXT("Invalid chunk Id %llu"), Chunk.Id));
+			return false;
+		}
+		// Same octree order: only the Ids change
+		Chunk.Id = FOctree::GetIdFromLegacyId(Chunk.Id, Save.Depth);
+	}
+
+	// Chunks are loaded in the leaf of their Id, with all their voxels
+	if (!IsValidChunkId(Save, Chunk.Id))
+	{
+		SetError(FString::Printf(TEXT("Invalid chunk Id %llu"), Chunk.Id));
+		return false;
+	}
+	if (!Chunk.IsDiff() && (Chunk.Values.Num() != ChunkVoxels || Chunk.Materials.Num() != ChunkVoxels))
+	{
+		SetError(TEXT("A chunk doesn't have all its voxels"));
+		return false;
+	}
+
+	// GetValuesAndMaterials writes a stored voxel for each bit of the mask
+	if (Chunk.IsDiff())
+	{
+		int32 DiffCount = 0;
+		for (uint32 Word : Chunk.Mask)
+		{
+			for (; Word; Word &= Word - 1)
+			{
+				DiffCount++;
+			}
+		}
+		const bool bHasBitsAfterVoxels = ChunkVoxels % 32 != 0 && (Chunk.Mask.Last() >> (ChunkVoxels % 32)) != 0;
+		if (Chunk.Mask.Num() != (ChunkVoxels + 31) / 32 || bHasBitsAfterVoxels || DiffCount != Chunk.Values.Num() || DiffCount != Chunk.Materials.Num())
+		{
+			SetError(TEXT("The mask of a chunk doesn't match its voxels"));
+			return false;
+		}
+	}
+	return true;
+}
+
+void FVoxelWorldSaveReader::SetError(const FString& Error)
+{
+	UE_LOG(LogVoxel, Error, TEXT("Can't read save: %s"), *Error);
+	bHasError = true;
+	bHasChunk = false;
 }
\ No newline at end of file
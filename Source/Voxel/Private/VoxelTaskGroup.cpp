@@ -0,0 +1,108 @@
+// Copyright 2017 Phyronnaz
+
+#include "VoxelTaskGroup.h"
+#include "IQueuedWork.h"
+
+class FVoxelTaskGroup::FTask : public IQueuedWork
+{
+public:
+	FTask(FVoxelTaskGroup* Group, TFunction<void()>&& Function)
+		: Group(Group)
+		, Function(MoveTemp(Function))
+	{
+	}
+
+	void DoThreadedWork() override
+	{
+		Function();
+
+		{
+			// The group can be deleted as soon as it sees no pending task: trigger before unlocking
+			FScopeLock Lock(&Group->Section);
+			Group->PendingTasks.RemoveSingle(this);
+			Group->TaskDoneEvent->Trigger();
+		}
+		delete this;
+	}
+
+	void Abandon() override
+	{
+		// Pool destroyed: the group is still waiting for the task
+		DoThreadedWork();
+	}
+
+private:
+	FVoxelTaskGroup* const Group;
+	TFunction<void()> Function;
+};
+
+FVoxelTaskGroup::FVoxelTaskGroup(int MaxPendingTasks)
+	: MaxPendingTasks(MaxPendingTasks > 0 ? MaxPendingTasks : 2 * FPlatformMisc::NumberOfCoresIncludingHyperthreads())
+	, TaskDoneEvent(FPlatformProcess::GetSynchEventFromPool(false))
+{
+
+}
+
+FVoxelTaskGroup::~FVoxelTaskGroup()
+{
+	Wait();
+	FPlatformProcess::ReturnSynchEventToPool(TaskDoneEvent);
+}
+
+void FVoxelTaskGroup::Add(TFunction<void()> Function)
+{
+	if (!GThreadPool)
+	{
+		Function();
+		return;
+	}
+
+	WaitForPendingTasks(MaxPendingTasks - 1);
+
+	FTask* Task = new FTask(this, MoveTemp(Function));
+	{
+		FScopeLock Lock(&Section);
+		PendingTasks.Add(Task);
+	}
+	GThreadPool->AddQueuedWork(Task);
+}
+
+void FVoxelTaskGroup::Wait()
+{
+	WaitForPendingTasks(0);
+}
+
+void FVoxelTaskGroup::WaitForPendingTasks(int MaxCount)
+{
+	while (true)
+	{
+		FTask* RetractedTask = nullptr;
+		{
+			FScopeLock Lock(&Section);
+			if (PendingTasks.Num() <= MaxCount)
+			{
+				return;
+			}
+
+			// Tasks are only deleted once removed from PendingTasks: they can't be deleted while Section is locked
+			for (auto Task : PendingTasks)
+			{
+				if (GThreadPool->RetractQueuedWork(Task))
+				{
+					RetractedTask = Task;
+					break;
+				}
+			}
+		}
+
+		if (RetractedTask)
+		{
+			RetractedTask->DoThreadedWork();
+		}
+		else
+		{
+			// All the pending tasks are running
+			TaskDoneEvent->Wait();
+		}
+	}
+}
@@ -0,0 +1,50 @@
+// Copyright 2017 Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class FEvent;
+
+/**
+ * Runs functions on GThreadPool and waits for them
+ * Tasks that haven't started when waiting are run on the waiting thread: it can itself be a GThreadPool thread
+ * Add & Wait must be called from one thread
+ */
+class FVoxelTaskGroup
+{
+public:
+	/**
+	 * @param	MaxPendingTasks		Add waits while this many tasks are pending, to bound the memory they hold. 0 for twice the number of cores
+	 */
+	FVoxelTaskGroup(int MaxPendingTasks = 0);
+	/**
+	 * Waits for the tasks
+	 */
+	~FVoxelTaskGroup();
+
+	/**
+	 * Run Function on GThreadPool, or on this thread if there is no pool
+	 */
+	void Add(TFunction<void()> Function);
+
+	/**
+	 * Wait for all the tasks added
+	 */
+	void Wait();
+
+private:
+	class FTask;
+
+	const int MaxPendingTasks;
+	FEvent* const TaskDoneEvent;
+
+	FCriticalSection Section;
+	// Tasks not done yet, oldest first. Removed by the tasks when done, before they delete themselves
+	TArray<FTask*> PendingTasks;
+
+	/**
+	 * Wait until at most MaxCount tasks are pending
+	 */
+	void WaitForPendingTasks(int MaxCount);
+};
@@ -8,6 +8,7 @@
 #include "Kismet/GameplayStatics.h"
 #include "EmptyWorldGenerator.h"
 #include "VoxelData.h"
+#include "VoxelAccessor.h"
 #include "FastNoise.h"
 #include "Misc/QueuedThreadPool.h"
 
@@ -34,9 +35,10 @@ FAsyncAddCrater::FAsyncAddCrater(FVoxelData* Data, const FIntVector LocalPositio
 
 void FAsyncAddCrater::DoThreadedWork()
 {
-	FValueOctree* LastOctree = nullptr;
 	FastNoise Noise;
-	Data->BeginSet();
+	const FVoxelBox Bounds(LocalPosition - FIntVector(IntRadius, IntRadius, IntRadius), LocalPosition + FIntVector(IntRadius, IntRadius, IntRadius));
+	Data->BeginSet(Bounds);
+	FVoxelAccessor Accessor(Data);
 	for (int X = -IntRadius; X <= IntRadius; X++)
 	{
 		for (int Y = -IntRadius; Y <= IntRadius; Y++)
@@ -64,7 +66,7 @@ void FAsyncAddCrater::DoThreadedWork()
 
 					float OldValue;
 					FVoxelMaterial OldMaterial;
-					Data->GetValueAndMaterial(CurrentPosition.X, CurrentPosition.Y, CurrentPosition.Z, OldValue, OldMaterial);
+					Accessor.GetValueAndMaterial(CurrentPosition.X, CurrentPosition.Y, CurrentPosition.Z, OldValue, OldMaterial);
 
 					bool bValid;
 					if (Value > 0)
@@ -100,14 +102,14 @@ void FAsyncAddCrater::DoThreadedWork()
 								OldMaterial.Alpha = FMath::Clamp<int>(255 - AddedBlack, 0, 255);
 							}
 
-							Data->SetValueAndMaterial(CurrentPosition.X, CurrentPosition.Y, CurrentPosition.Z, Value, OldMaterial, LastOctree);
+							Accessor.SetValueAndMaterial(CurrentPosition.X, CurrentPosition.Y, CurrentPosition.Z, Value, OldMaterial);
 						}
 					}
 				}
 			}
 		}
 	}
-	Data->EndSet();
+	Data->EndSet(Bounds);
 
 	delete this;
 }
@@ -134,13 +136,14 @@ void UVoxelTools::AddCrater(AVoxelWorld* World, const FVector Position, const fl
 	FIntVector LocalPosition = World->GlobalToLocal(Position);
 	int IntRadius = FMath::CeilToInt(Radius) + 2;
 
-	FValueOctree* LastOctree = nullptr;
 	FVoxelData* Data = World->GetData();
 
 	FastNoise Noise;
 
 	{
-		Data->BeginSet();
+		const FVoxelBox Bounds(LocalPosition - FIntVector(IntRadius, IntRadius, IntRadius), LocalPosition + FIntVector(IntRadius, IntRadius, IntRadius));
+		Data->BeginSet(Bounds);
+		FVoxelAccessor Accessor(Data);
 		for (int X = -IntRadius; X <= IntRadius; X++)
 		{
 			for (int Y = -IntRadius; Y <= IntRadius; Y++)
@@ -168,7 +171,7 @@ void UVoxelTools::AddCrater(AVoxelWorld* World, const FVector Position, const fl
 
 						float OldValue;
 						FVoxelMaterial OldMaterial;
-						Data->GetValueAndMaterial(CurrentPosition.X, CurrentPosition.Y, CurrentPosition.Z, OldValue, OldMaterial);
+						Accessor.GetValueAndMaterial(CurrentPosition.X, CurrentPosition.Y, CurrentPosition.Z, OldValue, OldMaterial);
 
 						bool bValid;
 						if (Value > 0)
@@ -204,14 +207,14 @@ void UVoxelTools::AddCrater(AVoxelWorld* World, const FVector Position, const fl
 									OldMaterial.Alpha = FMath::Clamp<int>(255 - AddedBlack, 0, 255);
 								}
 
-								Data->SetValueAndMaterial(CurrentPosition.X, CurrentPosition.Y, CurrentPosition.Z, Value, OldMaterial, LastOctree);
+								Accessor.SetValueAndMaterial(CurrentPosition.X, CurrentPosition.Y, CurrentPosition.Z, Value, OldMaterial);
 							}
 						}
 					}
 				}
 			}
 		}
-		Data->EndSet();
+		Data->EndSet(Bounds);
 	}
 	World->UpdateChunksOverlappingBox(FVoxelBox(LocalPosition + FIntVector(1, 1, 1) * -(IntRadius + 1), LocalPosition + FIntVector(1, 1, 1) * (IntRadius + 1)), bAsync);
 }
@@ -253,11 +256,12 @@ void UVoxelTools::SetValueSphere(AVoxelWorld* World, const FVector Position, con
 	FIntVector LocalPosition = World->GlobalToLocal(Position);
 	int IntRadius = FMath::CeilToInt(Radius) + 2;
 
-	FValueOctree* LastOctree = nullptr;
 	FVoxelData* Data = World->GetData();
 
 	{
-		Data->BeginSet();
+		const FVoxelBox Bounds(LocalPosition - FIntVector(IntRadius, IntRadius, IntRadius), LocalPosition + FIntVector(IntRadius, IntRadius, IntRadius));
+		Data->BeginSet(Bounds);
+		FVoxelAccessor Accessor(Data);
 		for (int X = -IntRadius; X <= IntRadius; X++)
 		{
 			for (int Y = -IntRadius; Y <= IntRadius; Y++)
@@ -276,7 +280,7 @@ void UVoxelTools::SetValueSphere(AVoxelWorld* World, const FVector Position, con
 						Value *= HardnessMultiplier;
 						Value *= (bAdd ? -1 : 1);
 
-						float OldValue = Data->GetValue(CurrentPosition.X, CurrentPosition.Y, CurrentPosition.Z);
+						float OldValue = Accessor.GetValue(CurrentPosition.X, CurrentPosition.Y, CurrentPosition.Z);
 
 						bool bValid;
 						if ((Value <= 0 && bAdd) || (Value > 0 && !bAdd))
@@ -291,14 +295,14 @@ void UVoxelTools::SetValueSphere(AVoxelWorld* World, const FVector Position, con
 						{
 							if (LIKELY(Data->IsInWorld(CurrentPosition.X, CurrentPosition.Y, CurrentPosition.Z)))
 							{
-								Data->SetValue(CurrentPosition.X, CurrentPosition.Y, CurrentPosition.Z, Value, LastOctree);
+								Accessor.SetValue(CurrentPosition.X, CurrentPosition.Y, CurrentPosition.Z, Value);
 							}
 						}
 					}
 				}
 			}
 		}
-		Data->EndSet();
+		Data->EndSet(Bounds);
 	}
 	World->UpdateChunksOverlappingBox(FVoxelBox(LocalPosition + FIntVector(1, 1, 1) * -(IntRadius + 1), LocalPosition + FIntVector(1, 1, 1) * (IntRadius + 1)), bAsync);
 }
@@ -353,11 +357,12 @@ void UVoxelTools::SetMaterialSphere(AVoxelWorld* World, const FVector Position,
 	const float VoxelDiagonalLength = 1.73205080757f;
 	const int Size = FMath::CeilToInt(Radius + FadeDistance + VoxelDiagonalLength);
 
-	FValueOctree* LastOctree = nullptr;
 	FVoxelData* Data = World->GetData();
 
 	{
-		Data->BeginSet();
+		const FVoxelBox Bounds(LocalPosition - FIntVector(Size, Size, Size), LocalPosition + FIntVector(Size, Size, Size));
+		Data->BeginSet(Bounds);
+		FVoxelAccessor Accessor(Data);
 		for (int X = -Size; X <= Size; X++)
 		{
 			for (int Y = -Size; Y <= Size; Y++)
@@ -368,7 +373,7 @@ void UVoxelTools::SetMaterialSphere(AVoxelWorld* World, const FVector Position,
 					const float Distance = FVector(X, Y, Z).Size();
 
 
-					FVoxelMaterial Material = Data->GetMaterial(CurrentPosition.X, CurrentPosition.Y, CurrentPosition.Z);
+					FVoxelMaterial Material = Accessor.GetMaterial(CurrentPosition.X, CurrentPosition.Y, CurrentPosition.Z);
 
 					if (Distance < Radius + FadeDistance + VoxelDiagonalLength)
 					{
@@ -398,7 +403,7 @@ void UVoxelTools::SetMaterialSphere(AVoxelWorld* World, const FVector Position,
 						if (LIKELY(Data->IsInWorld(CurrentPosition.X, CurrentPosition.Y, CurrentPosition.Z)))
 						{
 							// Apply changes
-							Data->SetMaterial(CurrentPosition.X, CurrentPosition.Y, CurrentPosition.Z, Material, LastOctree);
+							Accessor.SetMaterial(CurrentPosition.X, CurrentPosition.Y, CurrentPosition.Z, Material);
 						}
 					}
 					else if (Distance < Radius + FadeDistance + 2 * VoxelDiagonalLength && (bUseLayer1 ? Material.Index1 : Material.Index2) != MaterialIndex)
@@ -407,13 +412,13 @@ void UVoxelTools::SetMaterialSphere(AVoxelWorld* World, const FVector Position,
 
 						if (LIKELY(Data->IsInWorld(CurrentPosition.X, CurrentPosition.Y, CurrentPosition.Z)))
 						{
-							Data->SetMaterial(CurrentPosition.X, CurrentPosition.Y, CurrentPosition.Z, Material, LastOctree);
+							Accessor.SetMaterial(CurrentPosition.X, CurrentPosition.Y, CurrentPosition.Z, Material);
 						}
 					}
 				}
 			}
 		}
-		Data->EndSet();
+		Data->EndSet(Bounds);
 	}
 	World->UpdateChunksOverlappingBox(FVoxelBox(LocalPosition + FIntVector(1, 1, 1) * -(Size + 1), LocalPosition + FIntVector(1, 1, 1) * (Size + 1)), bAsync);
 }
@@ -491,6 +496,22 @@ void FindModifiedPositionsForRaycasts(AVoxelWorld* World, const FVector StartPos
 	}
 }
 
+// Smallest box containing the positions
+FVoxelBox GetBounds(const std::deque<TTuple<FIntVector, float>>& PositionsAndDistances)
+{
+	check(!PositionsAndDistances.empty());
+
+	const FIntVector First = PositionsAndDistances.front().Get<0>();
+	FVoxelBox Bounds(First, First);
+	for (auto Tuple : PositionsAndDistances)
+	{
+		const FIntVector Point = Tuple.Get<0>();
+		Bounds.Min = FIntVector(FMath::Min(Bounds.Min.X, Point.X), FMath::Min(Bounds.Min.Y, Point.Y), FMath::Min(Bounds.Min.Z, Point.Z));
+		Bounds.Max = FIntVector(FMath::Max(Bounds.Max.X, Point.X), FMath::Max(Bounds.Max.Y, Point.Y), FMath::Max(Bounds.Max.Z, Point.Z));
+	}
+	return Bounds;
+}
+
 void UVoxelTools::SetValueProjection(AVoxelWorld* World, const FVector StartPosition, const FVector Direction, const float Radius, const float Strength, const bool bAdd,
 	const float MaxDistance, const float Precision, const bool bAsync, const bool bShowRaycasts, const bool bShowHitPoints, const bool bShowModifiedVoxels, const float MinValue, const float MaxValue)
 {
@@ -505,23 +526,31 @@ void UVoxelTools::SetValueProjection(AVoxelWorld* World, const FVector StartPosi
 	std::deque<TTuple<FIntVector, float>> ModifiedPositionsAndDistances;
 	FindModifiedPositionsForRaycasts(World, StartPosition, Direction, Radius, MaxDistance, Precision, bShowRaycasts, bShowHitPoints, bShowModifiedVoxels, ModifiedPositionsAndDistances);
 
-	for (auto Tuple : ModifiedPositionsAndDistances)
+	if (ModifiedPositionsAndDistances.empty())
 	{
-		const FIntVector Point = Tuple.Get<0>();
-		const float Distance = Tuple.Get<1>();
-		if (World->IsInWorld(Point))
+		return;
+	}
+
+	FVoxelData* Data = World->GetData();
+
+	// Lock all the modified voxels at once
+	const FVoxelBox Bounds = GetBounds(ModifiedPositionsAndDistances);
+	Data->BeginSet(Bounds);
+	{
+		FVoxelAccessor Accessor(Data);
+		for (auto Tuple : ModifiedPositionsAndDistances)
 		{
-			if (bAdd)
-			{
-				World->SetValue(Point, FMath::Clamp(World->GetValue(Point) - Strength, MinValue, MaxValue));
-			}
-			else
-			{
-				World->SetValue(Point, FMath::Clamp(World->GetValue(Point) + Strength, MinValue, MaxValue));
-			}
-			World->UpdateChunksAtPosition(Point, bAsync);
+			const FIntVector Point = Tuple.Get<0>();
+			const float OldValue = Accessor.GetValue(Point.X, Point.Y, Point.Z);
+			Accessor.SetValue(Point.X, Point.Y, Point.Z, FMath::Clamp(bAdd ? OldValue - Strength : OldValue + Strength, MinValue, MaxValue));
 		}
 	}
+	Data->EndSet(Bounds);
+
+	for (auto Tuple : ModifiedPositionsAndDistances)
+	{
+		World->UpdateChunksAtPosition(Tuple.Get<0>(), bAsync);
+	}
 }
 
 void UVoxelTools::SetMaterialProjection(AVoxelWorld * World, const FVector StartPosition, const FVector Direction, const float Radius, const uint8 MaterialIndex, const bool bUseLayer1,
@@ -540,12 +569,23 @@ void UVoxelTools::SetMaterialProjection(AVoxelWorld * World, const FVector Start
 	std::deque<TTuple<FIntVector, float>> ModifiedPositionsAndDistances;
 	FindModifiedPositionsForRaycasts(World, StartPosition, Direction, Radius + FadeDistance + 2 * VoxelDiagonalLength, MaxDistance, Precision, bShowRaycasts, bShowHitPoints, bShowModifiedVoxels, ModifiedPositionsAndDistances);
 
+	if (ModifiedPositionsAndDistances.empty())
+	{
+		return;
+	}
+
+	FVoxelData* Data = World->GetData();
+
+	// Lock all the modified voxels at once
+	const FVoxelBox Bounds = GetBounds(ModifiedPositionsAndDistances);
+	Data->BeginSet(Bounds);
+	FVoxelAccessor Accessor(Data);
 	for (auto Tuple : ModifiedPositionsAndDistances)
 	{
 		const FIntVector Point = Tuple.Get<0>();
 		const float Distance = Tuple.Get<1>();
 
-		FVoxelMaterial Material = World->GetMaterial(Point);
+		FVoxelMaterial Material = Accessor.GetMaterial(Point.X, Point.Y, Point.Z);
 
 		if (Distance < Radius + FadeDistance + VoxelDiagonalLength)
 		{
@@ -572,23 +612,21 @@ void UVoxelTools::SetMaterialProjection(AVoxelWorld * World, const FVector Start
 				Material.Index2 = MaterialIndex;
 			}
 
-			if (World->IsInWorld(Point))
-			{
-				// Apply changes
-				World->SetMaterial(Point, Material);
-				World->UpdateChunksAtPosition(Point, bAsync);
-			}
+			// Apply changes
+			Accessor.SetMaterial(Point.X, Point.Y, Point.Z, Material);
 		}
 		else if ((bUseLayer1 ? Material.Index1 : Material.Index2) != MaterialIndex)
 		{
 			Material.Alpha = bUseLayer1 ? 255 : 0;
-			if (World->IsInWorld(Point))
-			{
-				World->SetMaterial(Point, Material);
-				World->UpdateChunksAtPosition(Point, bAsync);
-			}
+			Accessor.SetMaterial(Point.X, Point.Y, Point.Z, Material);
 		}
 	}
+	Data->EndSet(Bounds);
+
+	for (auto Tuple : ModifiedPositionsAndDistances)
+	{
+		World->UpdateChunksAtPosition(Tuple.Get<0>(), bAsync);
+	}
 }
 
 void UVoxelTools::SmoothValue(AVoxelWorld * World, FVector StartPosition, FVector Direction, float Radius, float Speed, float MaxDistance,
@@ -692,14 +730,42 @@ void UVoxelTools::SmoothValue(AVoxelWorld * World, FVector StartPosition, FVecto
 		}
 	}
 
+	if (ModifiedPositions.Num() == 0)
+	{
+		return;
+	}
+
+	FVoxelData* Data = World->GetData();
+
 	// Update values
-	for (int i = 0; i < ModifiedPositions.Num(); i++)
+	FVoxelBox Bounds(ModifiedPositions[0], ModifiedPositions[0]);
+	for (auto Point : ModifiedPositions)
+	{
+		Bounds.Min = FIntVector(FMath::Min(Bounds.Min.X, Point.X), FMath::Min(Bounds.Min.Y, Point.Y), FMath::Min(Bounds.Min.Z, Point.Z));
+		Bounds.Max = FIntVector(FMath::Max(Bounds.Max.X, Point.X), FMath::Max(Bounds.Max.Y, Point.Y), FMath::Max(Bounds.Max.Z, Point.Z));
+	}
+	Data->BeginSet(Bounds);
 	{
-		FIntVector Point = ModifiedPositions[i];
-		float Distance = DistancesToTool[i];
-		float Delta = Speed * (MeanDistance - Distance);
-		World->SetValue(Point, FMath::Clamp(Delta + World->GetValue(Point), MinValue, MaxValue));
-		World->UpdateChunksAtPosition(Point, bAsync);
+		FVoxelAccessor Accessor(Data);
+		for (int i = 0; i < ModifiedPositions.Num(); i++)
+		{
+			FIntVector Point = ModifiedPositions[i];
+			if (Data->IsInWorld(Point.X, Point.Y, Point.Z))
+			{
+				float Distance = DistancesToTool[i];
+				float Delta = Speed * (MeanDistance - Distance);
+				Accessor.SetValue(Point.X, Point.Y, Point.Z, FMath::Clamp(Delta + Accessor.GetValue(Point.X, Point.Y, Point.Z), MinValue, MaxValue));
+			}
+		}
+	}
+	Data->EndSet(Bounds);
+
+	for (auto Point : ModifiedPositions)
+	{
+		if (World->IsInWorld(Point))
+		{
+			World->UpdateChunksAtPosition(Point, bAsync);
+		}
 	}
 }
 
@@ -3,6 +3,7 @@
 #include "VoxelWorld.h"
 #include "VoxelPrivate.h"
 #include "VoxelData.h"
+#include "VoxelAccessor.h"
 #include "VoxelRender.h"
 #include "Components/CapsuleComponent.h"
 #include "FlatWorldGenerator.h"
@@ -23,6 +24,9 @@ AVoxelWorld::AVoxelWorld()
 	, Seed(100)
 	, MeshThreadCount(4)
 	, FoliageThreadCount(4)
+	, EditedVoxelsMemoryBudget(0)
+	, EditedVoxelsCompressionDelay(30)
+	, SaveCompression(EVoxelSaveCompression::Zlib)
 	, Render(nullptr)
 	, Data(nullptr)
 	, InstancedWorldGenerator(nullptr)
@@ -35,6 +39,7 @@ AVoxelWorld::AVoxelWorld()
 	, RayMaxDistance(5)
 	, RayCount(25)
 	, TimeSinceSync(0)
+	, TimeSinceColdLeafsUpdate(0)
 {
 	PrimaryActorTick.bCanEverTick = true;
 
@@ -79,6 +84,13 @@ void AVoxelWorld::Tick(float DeltaTime)
 	if (IsCreated())
 	{
 		Render->Tick(DeltaTime);
+
+		TimeSinceColdLeafsUpdate += DeltaTime;
+		if (TimeSinceColdLeafsUpdate > 1)
+		{
+			TimeSinceColdLeafsUpdate = 0;
+			Data->UpdateColdLeafs();
+		}
 	}
 }
 
@@ -119,9 +131,9 @@ float AVoxelWorld::GetValue(const FIntVector& Position) const
 		FVoxelMaterial Material;
 		float Value;
 
-		Data->BeginGet();
-		Data->GetValueAndMaterial(Position.X, Position.Y, Position.Z, Value, Material);
-		Data->EndGet();
+		Data->BeginGet(FVoxelBox(Position, Position));
+		FVoxelAccessor(Data).GetValueAndMaterial(Position.X, Position.Y, Position.Z, Value, Material);
+		Data->EndGet(FVoxelBox(Position, Position));
 
 		return Value;
 	}
@@ -139,9 +151,9 @@ FVoxelMaterial AVoxelWorld::GetMaterial(const FIntVector& Position) const
 		FVoxelMaterial Material;
 		float Value;
 
-		Data->BeginGet();
-		Data->GetValueAndMaterial(Position.X, Position.Y, Position.Z, Value, Material);
-		Data->EndGet();
+		Data->BeginGet(FVoxelBox(Position, Position));
+		FVoxelAccessor(Data).GetValueAndMaterial(Position.X, Position.Y, Position.Z, Value, Material);
+		Data->EndGet(FVoxelBox(Position, Position));
 
 		return Material;
 	}
@@ -156,9 +168,9 @@ void AVoxelWorld::SetValue(const FIntVector& Position, float Value)
 {
 	if (IsInWorld(Position))
 	{
-		Data->BeginSet();
-		Data->SetValue(Position.X, Position.Y, Position.Z, Value);
-		Data->EndSet();
+		Data->BeginSet(FVoxelBox(Position, Position));
+		FVoxelAccessor(Data).SetValue(Position.X, Position.Y, Position.Z, Value);
+		Data->EndSet(FVoxelBox(Position, Position));
 	}
 	else
 	{
@@ -170,9 +182,9 @@ void AVoxelWorld::SetMaterial(const FIntVector& Position, const FVoxelMaterial&
 {
 	if (IsInWorld(Position))
 	{
-		Data->BeginSet();
-		Data->SetMaterial(Position.X, Position.Y, Position.Z, Material);
-		Data->EndSet();
+		Data->BeginSet(FVoxelBox(Position, Position));
+		FVoxelAccessor(Data).SetMaterial(Position.X, Position.Y, Position.Z, Material);
+		Data->EndSet(FVoxelBox(Position, Position));
 	}
 	else
 	{
@@ -182,23 +194,39 @@ void AVoxelWorld::SetMaterial(const FIntVector& Position, const FVoxelMaterial&
 
 void AVoxelWorld::GetSave(FVoxelWorldSave& OutSave) const
 {
-	Data->GetSave(OutSave);
+	Data->GetSave(OutSave, SaveCompression);
+}
+
+void AVoxelWorld::GetDeltaSave(FVoxelWorldSave& OutSave) const
+{
+	Data->GetDeltaSave(OutSave, SaveCompression);
+}
+
+bool AVoxelWorld::CompactDeltaSaves(const FVoxelWorldSave& Base, const TArray<FVoxelWorldSave>& Deltas, FVoxelWorldSave& OutSave)
+{
+	return FVoxelWorldSave::CompactDeltas(Base, Deltas, OutSave);
 }
 
 void AVoxelWorld::LoadFromSave(const FVoxelWorldSave& Save, bool bReset)
 {
-	if (Save.Depth == Depth)
+	if (Save.bIsDelta && bReset)
+	{
+		UE_LOG(LogVoxel, Error, TEXT("LoadFromSave: Delta saves must be loaded with bReset = false, after the saves they follow"));
+	}
+	else if (Save.Depth == Depth)
 	{
 		std::deque<FIntVector> ModifiedPositions;
-		Data->LoadFromSaveAndGetModifiedPositions(Save, ModifiedPositions, bReset);
-		for (auto Position : ModifiedPositions)
+		if (Data->LoadFromSaveAndGetModifiedPositions(Save, ModifiedPositions, bReset))
 		{
-			if (IsInWorld(Position))
+			for (auto Position : ModifiedPositions)
 			{
-				UpdateChunksAtPosition(Position, true);
+				if (IsInWorld(Position))
+				{
+					UpdateChunksAtPosition(Position, true);
+				}
 			}
+			Render->ApplyUpdates();
 		}
-		Render->ApplyUpdates();
 	}
 	else
 	{
@@ -206,6 +234,26 @@ void AVoxelWorld::LoadFromSave(const FVoxelWorldSave& Save, bool bReset)
 	}
 }
 
+void AVoxelWorld::LogLeafCompressionReport() const
+{
+	FVoxelLeafCompressionReport Report;
+	Data->GetLeafCompressionReport(Report);
+
+	if (Report.LeafCount == 0)
+	{
+		UE_LOG(LogVoxel, Log, TEXT("Leaf compression: no edited leafs"));
+		return;
+	}
+
+	UE_LOG(LogVoxel, Log, TEXT("Leaf compression: %d leafs, %llu KB -> %llu KB (ratio %.2f). Decompression: %.1fus average, %.1fus max"),
+		Report.LeafCount,
+		Report.UncompressedSize / 1024,
+		Report.CompressedSize / 1024,
+		(double)Report.UncompressedSize / Report.CompressedSize,
+		Report.DecompressionTime / Report.LeafCount * 1e6,
+		Report.MaxDecompressionTime * 1e6);
+}
+
 AVoxelWorldEditorInterface* AVoxelWorld::GetVoxelWorldEditor() const
 {
 	return VoxelWorldEditor;
@@ -379,7 +427,7 @@ void AVoxelWorld::CreateWorld()
 	InstancedWorldGenerator->SetVoxelWorld(this);
 
 	// Create Data
-	Data = new FVoxelData(Depth, InstancedWorldGenerator);
+	Data = new FVoxelData(Depth, InstancedWorldGenerator, (uint64)EditedVoxelsMemoryBudget * 1024 * 1024, EditedVoxelsCompressionDelay);
 #if DO_CHECK
 	Data->TestWorldGenerator();
 #endif
@@ -512,49 +560,38 @@ bool AVoxelWorld::GetIntersection(const FIntVector& Start, const FIntVector& End
 	FIntVector RealStart(FMath::Min(Start.X, End.X), FMath::Min(Start.Y, End.Y), FMath::Min(Start.Z, End.Z));
 	FIntVector RealEnd(FMath::Max(Start.X, End.X), FMath::Max(Start.Y, End.Y), FMath::Max(Start.Z, End.Z));
 
+	// Read the whole segment at once
+	const FIntVector Size = RealEnd - RealStart + FIntVector(1, 1, 1);
+	TArray<FVoxelValue> Values;
+	Values.SetNumUninitialized(Size.X * Size.Y * Size.Z);
+	Data->BeginGet(FVoxelBox(RealStart, RealEnd));
+	Data->GetValuesAndMaterials(Values.GetData(), nullptr, RealStart, FIntVector::ZeroValue, 1, Size, Size);
+	Data->EndGet(FVoxelBox(RealStart, RealEnd));
+
 	bool bFound = false;
-	Data->BeginGet();
-	float OldValue = Data->GetValue(RealStart.X, RealStart.Y, RealStart.Z);
+	float OldValue = FVoxelValuePolicy::ToFloat(Values[0]);
 	FIntVector OldPosition = RealStart;
-	for (int X = RealStart.X; X <= RealEnd.X; X++)
+	for (int Index = 0; Index < Values.Num(); Index++)
 	{
-		for (int Y = RealStart.Y; Y <= RealEnd.Y; Y++)
-		{
-			for (int Z = RealStart.Z; Z <= RealEnd.Z; Z++)
-			{
-				float Value = Data->GetValue(X, Y, Z);
-				FIntVector Position(X, Y, Z);
-
-				if ((OldValue > 0 && Value > 0) || (OldValue <= 0 && Value <= 0))
-				{
-					check(OldValue - Value != 0);
-					const float t = OldValue / (OldValue - Value);
-
-					FVector Q = t * static_cast<FVector>(Position) + (1 - t) * static_cast<FVector>(OldPosition);
-					OutGlobalPosition = LocalToGlobal(Q);
-					OutVoxelPosition = Position;
-					bFound = true;
-				}
-
-				OldValue = Value;
-				OldPosition = Position;
+		// Only one axis changes
+		const FIntVector Position = RealStart + FIntVector(Size.X > 1 ? Index : 0, Size.Y > 1 ? Index : 0, Size.Z > 1 ? Index : 0);
+		const float Value = FVoxelValuePolicy::ToFloat(Values[Index]);
 
-				if (bFound)
-				{
-					break;
-				}
-			}
-			if (bFound)
-			{
-				break;
-			}
-		}
-		if (bFound)
+		if ((OldValue > 0 && Value > 0) || (OldValue <= 0 && Value <= 0))
 		{
+			check(OldValue - Value != 0);
+			const float t = OldValue / (OldValue - Value);
+
+			FVector Q = t * static_cast<FVector>(Position) + (1 - t) * static_cast<FVector>(OldPosition);
+			OutGlobalPosition = LocalToGlobal(Q);
+			OutVoxelPosition = Position;
+			bFound = true;
 			break;
 		}
+
+		OldValue = Value;
+		OldPosition = Position;
 	}
-	Data->EndGet();
 
 	return bFound;
 }
@@ -565,12 +602,14 @@ FVector AVoxelWorld::GetNormal(const FIntVector& Position) const
 	int Y = Position.Y;
 	int Z = Position.Z;
 
-	Data->BeginGet();
+	const FVoxelBox Bounds(Position - FIntVector(1, 1, 1), Position + FIntVector(1, 1, 1));
+	Data->BeginGet(Bounds);
+	FVoxelAccessor Accessor(Data);
 	FVector Gradient;
-	Gradient.X = Data->GetValue(X + 1, Y, Z) - Data->GetValue(X - 1, Y, Z);
-	Gradient.Y = Data->GetValue(X, Y + 1, Z) - Data->GetValue(X, Y - 1, Z);
-	Gradient.Z = Data->GetValue(X, Y, Z + 1) - Data->GetValue(X, Y, Z - 1);
-	Data->EndGet();
+	Gradient.X = Accessor.GetValue(X + 1, Y, Z) - Accessor.GetValue(X - 1, Y, Z);
+	Gradient.Y = Accessor.GetValue(X, Y + 1, Z) - Accessor.GetValue(X, Y - 1, Z);
+	Gradient.Z = Accessor.GetValue(X, Y, Z + 1) - Accessor.GetValue(X, Y, Z - 1);
+	Data->EndGet(Bounds);
 
 	return Gradient.GetSafeNormal();
 }
@@ -73,6 +73,33 @@ void UFlatWorldGenerator::GetValuesAndMaterials(float Values[], FVoxelMaterial M
 	}
 }
 
+bool UFlatWorldGenerator::GetValueRange(const FVoxelBox& Box, const int Step, float& OutMin, float& OutMax) const
+{
+	// Z of the lowest and of the highest voxels read
+	const int MinZ = FMath::CeilToInt(Box.Min.Z / (float)Step) * Step;
+	const int MaxZ = FMath::FloorToInt(Box.Max.Z / (float)Step) * Step;
+
+	const float Empty = HardnessMultiplier;
+	const float Full = -HardnessMultiplier;
+
+	if (MinZ >= TerrainHeight)
+	{
+		OutMin = Empty;
+		OutMax = Empty;
+	}
+	else if (MaxZ < TerrainHeight)
+	{
+		OutMin = Full;
+		OutMax = Full;
+	}
+	else
+	{
+		OutMin = FMath::Min(Empty, Full);
+		OutMax = FMath::Max(Empty, Full);
+	}
+	return true;
+}
+
 void UFlatWorldGenerator::SetVoxelWorld(AVoxelWorld* VoxelWorld)
 {
 	TerrainLayers.Sort([](const FFlatWorldLayer& Left, const FFlatWorldLayer& Right) { return Left.Start < Right.Start; });
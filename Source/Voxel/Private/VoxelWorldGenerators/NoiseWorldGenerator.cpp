@@ -98,6 +98,28 @@ void UNoiseWorldGenerator::GetValuesAndMaterials(float Values[], FVoxelMaterial
 	}
 }
 
+bool UNoiseWorldGenerator::GetValueRange(const FVoxelBox& Box, const int Step, float& OutMin, float& OutMax) const
+{
+	if (10 <= Box.Min.Z)
+	{
+		// Density is lerped to 2: values are 1, up to float rounding
+		OutMin = 1 - KINDA_SMALL_NUMBER;
+		OutMax = 1;
+		return true;
+	}
+	else if (Box.Max.Z < -100)
+	{
+		// Noise is too small to compensate Z: density is clamped to -2
+		OutMin = -1;
+		OutMax = -1;
+		return true;
+	}
+	else
+	{
+		return false;
+	}
+}
+
 void UNoiseWorldGenerator::SetVoxelWorld(AVoxelWorld* VoxelWorld)
 {
 	Noise.SetGradientPerturbAmp(45);
@@ -47,6 +47,28 @@ void USphereWorldGenerator::GetValuesAndMaterials(float Values[], FVoxelMaterial
 	}
 }
 
+bool USphereWorldGenerator::GetValueRange(const FVoxelBox& Box, const int Step, float& OutMin, float& OutMax) const
+{
+	// Closest and farthest voxels of the box to the center
+	const FIntVector Closest(
+		FMath::Clamp(0, Box.Min.X, Box.Max.X),
+		FMath::Clamp(0, Box.Min.Y, Box.Max.Y),
+		FMath::Clamp(0, Box.Min.Z, Box.Max.Z));
+	const FIntVector Farthest(
+		FMath::Max(FMath::Abs(Box.Min.X), FMath::Abs(Box.Max.X)),
+		FMath::Max(FMath::Abs(Box.Min.Y), FMath::Abs(Box.Max.Y)),
+		FMath::Max(FMath::Abs(Box.Min.Z), FMath::Abs(Box.Max.Z)));
+
+	// Values are monotonic with the distance to the center
+	const float Multiplier = HardnessMultiplier * (InverseOutsideInside ? -1 : 1);
+	const float ClosestValue = FMath::Clamp(FVector(Closest).Size() - LocalRadius, -2.f, 2.f) / 2 * Multiplier;
+	const float FarthestValue = FMath::Clamp(FVector(Farthest).Size() - LocalRadius, -2.f, 2.f) / 2 * Multiplier;
+
+	OutMin = FMath::Min(ClosestValue, FarthestValue);
+	OutMax = FMath::Max(ClosestValue, FarthestValue);
+	return true;
+}
+
 void USphereWorldGenerator::SetVoxelWorld(AVoxelWorld* VoxelWorld)
 {
 	LocalRadius = Radius / VoxelWorld->GetVoxelSize();
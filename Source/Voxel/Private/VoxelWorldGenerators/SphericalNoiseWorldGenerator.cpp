@@ -144,6 +144,40 @@ void USphericalNoiseWorldGenerator::SetVoxelWorld(AVoxelWorld* VoxelWorld)
 	Noise.SetFrequency(0.02);
 };
 
+bool USphericalNoiseWorldGenerator::GetValueRange(const FVoxelBox& Box, const int Step, float& OutMin, float& OutMax) const
+{
+	// Closest and farthest voxels of the box to the center
+	const FIntVector Closest(
+		FMath::Clamp(0, Box.Min.X, Box.Max.X),
+		FMath::Clamp(0, Box.Min.Y, Box.Max.Y),
+		FMath::Clamp(0, Box.Min.Z, Box.Max.Z));
+	const FIntVector Farthest(
+		FMath::Max(FMath::Abs(Box.Min.X), FMath::Abs(Box.Max.X)),
+		FMath::Max(FMath::Abs(Box.Min.Y), FMath::Abs(Box.Max.Y)),
+		FMath::Max(FMath::Abs(Box.Min.Z), FMath::Abs(Box.Max.Z)));
+
+	const float MinHeight = FVector(Closest).Size() - Radius;
+	const float MaxHeight = FVector(Farthest).Size() - Radius;
+
+	float Value;
+	if (MaxHeight < -100)
+	{
+		Value = -1;
+	}
+	else if (10000 < MinHeight)
+	{
+		Value = 1;
+	}
+	else
+	{
+		return false;
+	}
+
+	OutMin = Value * (InverseInsideOutside ? -1 : 1);
+	OutMax = OutMin;
+	return true;
+}
+
 FVector USphericalNoiseWorldGenerator::GetUpVector(int X, int Y, int Z) const
 {
 	return FVector(X, Y, Z).GetSafeNormal();